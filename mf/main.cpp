@@ -1,10 +1,225 @@
 #include "mf-util.hpp"
 #include "mf-enum.h"
+#include "mf-bench.h"
 #include "mf-capture.h"
+#include "mf-manager.h"
+#include "mf-source.h"
+#include "mf-test.h"
+#include <cstring>
+#include <memory>
+
+static void PrintCaptureMetrics(const char *name, const CCaptureMetrics &metrics)
+{
+	CaptureMetricsSnapshot snapshot;
+	metrics.GetSnapshot(snapshot);
+
+	printf("%s capture: samples %llu, dropped %llu, gap frames %llu, stream ticks %llu, read errors %llu \n", name, (unsigned long long)snapshot.samples,
+	       (unsigned long long)snapshot.dropped, (unsigned long long)snapshot.gapFrames, (unsigned long long)snapshot.streamTicks, (unsigned long long)snapshot.readErrors);
+
+	const char *names[] = {"callback", "interval", "lock"};
+	const HistogramSnapshot *histograms[] = {&snapshot.callback, &snapshot.interval, &snapshot.lock};
+	for (int i = 0; i < 3; ++i) {
+		const HistogramSnapshot &h = *histograms[i];
+		if (!h.count)
+			continue;
+		printf("\t%-8s us: p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f, mean %.1f \n", names[i], h.GetPercentile(50) / 1000.0, h.GetPercentile(99) / 1000.0,
+		       h.GetPercentile(99.9) / 1000.0, h.max / 1000.0, h.GetMean() / 1000.0);
+	}
+
+	if (snapshot.deviceLosses) {
+		printf("\tdevice lost %llu times, recovered %llu, outage ms: mean %.1f, max %.1f \n", (unsigned long long)snapshot.deviceLosses,
+		       (unsigned long long)snapshot.outage.count, snapshot.outage.GetMean() / 1e6, snapshot.outage.max / 1e6);
+	}
+}
+
+static void PrintSyncStats(const AVSyncStats &stats)
+{
+	printf("sync: audio drift against video %.1fppm \n", stats.driftPpm);
+	const char *names[] = {"video", "audio"};
+	const StreamSyncStats *streams[] = {&stats.video, &stats.audio};
+	for (int i = 0; i < 2; ++i) {
+		printf("%s: samples %llu, gaps %llu, drift %.1fppm, latency %.3fms \n", names[i], (unsigned long long)streams[i]->samples, (unsigned long long)streams[i]->gaps,
+		       streams[i]->driftPpm, double(streams[i]->latency) / 10000.0);
+	}
+}
+
+// every audio device is dumped in this format, whatever it delivers
+static MediaFormat GetCanonicalAudioFormat()
+{
+	MediaFormat format;
+	format.video = false;
+	format.subtype = MEDIA_SUBTYPE_FLOAT;
+	format.channels = 2;
+	format.sampleRate = 48000;
+	format.bitsPerSample = 32;
+	return format;
+}
+
+static void PrintWriterStats(const char *name, const AsyncWriterStats &stats)
+{
+	printf("%s writer: frames %llu, bytes %llu in %llu writes, dropped %llu, max depth %u \n", name, (unsigned long long)stats.frames, (unsigned long long)stats.bytes,
+	       (unsigned long long)stats.writes, (unsigned long long)stats.dropped, stats.maxDepth);
+}
+
+static void PrintManagerStats(const CCaptureManager &manager)
+{
+	for (uint32_t i = 0; i < manager.GetSessionCount(); ++i) {
+		CCaptureSession *session = manager.GetSession(i);
+		const CaptureSessionStats stats = session->GetStats();
+		const char *type = session->GetSource()->GetFormat().video ? "video" : "audio";
+		if (!stats.started) {
+			printf("\n%s (%s): failed to start \n", session->GetName().c_str(), type);
+			continue;
+		}
+
+		printf("\n%s (%s, %s): frames %llu, bytes %llu, dropped %llu, max depth %u, queued mean %.2fms, max %.2fms \n", session->GetName().c_str(), type,
+		       GetBackpressurePolicyString(session->GetBackpressure().policy), (unsigned long long)stats.frames, (unsigned long long)stats.bytes,
+		       (unsigned long long)stats.dropped, stats.maxDepth, stats.queue.GetMeanLatencyNs() / 1e6, stats.queue.maxLatencyNs / 1e6);
+		if (stats.dropped || stats.queue.blocked) {
+			printf("queue: dropped");
+			for (int r = 0; r < FRAME_DROP_REASONS; ++r)
+				printf(" %s %llu,", GetFrameDropReasonString((FrameDropReason)r), (unsigned long long)stats.queue.dropped[r]);
+			printf(" blocked %llu for %.1fms \n", (unsigned long long)stats.queue.blocked, stats.queue.blockedNs / 1e6);
+		}
+		if (session->GetSource()->GetCaptureMetrics())
+			PrintCaptureMetrics(type, *session->GetSource()->GetCaptureMetrics());
+		PrintWriterStats(type, session->GetPipeline().GetWriterStats());
+
+		const JpegDecoderStats jpeg = session->GetPipeline().GetJpegStats();
+		if (jpeg.frames || jpeg.errors) {
+			printf("mjpeg: frames %llu, errors %llu, split on restart markers %llu, late %llu, mean %.2fms, max %.2fms \n", (unsigned long long)jpeg.frames,
+			       (unsigned long long)jpeg.errors, (unsigned long long)jpeg.segmented, (unsigned long long)jpeg.late, jpeg.frames ? jpeg.totalNs / 1e6 / jpeg.frames : 0.0,
+			       jpeg.maxNs / 1e6);
+		}
+
+		const LosslessCodecStats lossless = session->GetPipeline().GetLosslessStats();
+		if (lossless.frames || lossless.errors) {
+			printf("lossless: frames %llu, errors %llu, ratio %.2f, mean %.2fms, max %.2fms \n", (unsigned long long)lossless.frames, (unsigned long long)lossless.errors,
+			       lossless.encodedBytes ? double(lossless.rawBytes) / lossless.encodedBytes : 0.0, lossless.frames ? lossless.totalNs / 1e6 / lossless.frames : 0.0,
+			       lossless.maxNs / 1e6);
+		}
+
+		const AudioPacketizerStats packets = session->GetPipeline().GetPacketizerStats();
+		if (packets.packets || packets.overruns) {
+			printf("packets: %llu, underruns %llu (%llu frames), overruns %llu (%llu frames), resyncs %llu \n", (unsigned long long)packets.packets,
+			       (unsigned long long)packets.underruns, (unsigned long long)packets.underrunFrames, (unsigned long long)packets.overruns,
+			       (unsigned long long)packets.overrunFrames, (unsigned long long)packets.resyncs);
+		}
+
+		const ChangeDetectorStats change = session->GetPipeline().GetChangeStats();
+		if (change.frames)
+			printf("unchanged: %llu of %llu frames, refreshed %llu \n", (unsigned long long)change.unchanged, (unsigned long long)change.frames, (unsigned long long)change.refreshed);
+	}
+
+	for (uint32_t i = 0; i < manager.GetSyncCount(); ++i)
+		PrintSyncStats(manager.GetSync(i)->GetStats());
+
+	const CaptureManagerStats stats = manager.GetStats();
+	printf("\n%u sessions (%u failed) on %u threads: %.1f frames/s, %.1f MB/s, dropped %llu, load %.2f, tasks %llu (stolen %llu) \n", stats.sessions, stats.failed, stats.threads,
+	       stats.framesPerSecond, stats.bytesPerSecond / 1e6, (unsigned long long)stats.dropped, stats.load, (unsigned long long)stats.tasks, (unsigned long long)stats.stolen);
+}
+
+// the dumps rather wait a little for a worker than lose frames
+static CaptureManagerOptions GetRecordingOptions()
+{
+	CaptureManagerOptions options;
+	options.backpressure.policy = BACKPRESSURE_BLOCK;
+	options.backpressure.blockTimeoutMs = 20;
+	return options;
+}
+
+// takes over the reference of `capture`
+static std::shared_ptr<IFrameSource> ToSharedSource(ComPtr<CMFCapture> &capture)
+{
+	return std::shared_ptr<IFrameSource>(capture.Detach(), [](IFrameSource *source) { static_cast<CMFCapture *>(source)->Release(); });
+}
+
+// "lossless" anywhere after the command: the NV12 video dumps are compressed as MFLZ, replay decodes them again
+static bool HasOption(int argc, char **argv, const char *option)
+{
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], option) == 0)
+			return true;
+	}
+	return false;
+}
+
+// drive the pipeline without any device: "mf.exe synthetic" or "mf.exe replay" (reads video.mfc / audio.mfc, or else input.nv12 / input.pcm).
+// "mf.exe faults" is synthetic with a camera which gets lost every 5 seconds
+static int RunStandIn(bool replay, bool faults, bool lossless)
+{
+	MediaFormat videoFormat;
+	videoFormat.video = true;
+	videoFormat.subtype = MEDIA_SUBTYPE_NV12;
+	videoFormat.width = DEST_VIDEO_WIDTH;
+	videoFormat.height = DEST_VIDEO_HEIGHT;
+	videoFormat.fpsNum = UINT32(DEST_VIDEO_FPS);
+	videoFormat.fpsDen = 1;
+
+	MediaFormat audioFormat;
+	audioFormat.video = false;
+	audioFormat.subtype = MEDIA_SUBTYPE_PCM;
+	audioFormat.channels = 2;
+	audioFormat.sampleRate = 44100; // goes through the resampler
+	audioFormat.bitsPerSample = 16;
+
+	std::shared_ptr<IFrameSource> vSource;
+	std::shared_ptr<IFrameSource> aSource;
+	if (replay) {
+		auto video = std::make_shared<CContainerReplaySource>("video.mfc", true, true);
+		auto audio = std::make_shared<CContainerReplaySource>("audio.mfc", true, false);
+		if (video->IsValid() && audio->IsValid()) {
+			vSource = video;
+			aSource = audio;
+		} else {
+			// the headerless dumps of older builds, in the formats they were captured in
+			printf("video.mfc / audio.mfc are missing or empty, replaying input.nv12 / input.pcm \n");
+			audioFormat.sampleRate = 48000;
+			vSource = std::make_shared<CFileReplaySource>(videoFormat, "input.nv12", true, true);
+			aSource = std::make_shared<CFileReplaySource>(audioFormat, "input.pcm", true, false);
+		}
+	} else {
+		vSource = std::make_shared<CSyntheticSource>(videoFormat, true);
+		aSource = std::make_shared<CSyntheticSource>(audioFormat, true);
+	}
+
+	if (faults) {
+		FaultInjectionOptions options;
+		options.lossEvery = uint64_t(5 * DEST_VIDEO_FPS);
+		vSource = std::make_shared<CFaultInjectionSource>(vSource, options);
+	}
+
+	// replay reads the dumps, so it must not write them
+	CCaptureManager manager(GetRecordingOptions());
+	manager.AddSessionPair("stand-in", vSource, aSource, replay ? nullptr : "video.mfc", replay ? nullptr : "audio.mfc");
+	if (!replay) {
+		manager.GetSession(0)->GetPipeline().SetLosslessDump(lossless);
+		manager.GetSession(1)->GetPipeline().SetAudioFormat(GetCanonicalAudioFormat());
+		manager.GetSession(1)->GetPipeline().SetAudioPackets(AudioPacketizerOptions());
+	}
+
+	// a preview of the same camera only ever wants the newest frame
+	BackpressureOptions preview;
+	preview.policy = BACKPRESSURE_KEEP_LATEST;
+	manager.AddSession("stand-in preview", vSource)->SetBackpressure(preview);
+
+	manager.Start();
+	Sleep(10000);
+	manager.Stop();
+	PrintManagerStats(manager);
+	return 0;
+}
 
 //---------------------------------------------------------------------------------------------
-int main()
+int main(int argc, char **argv)
 {
+	if (argc > 1 && (strcmp(argv[1], "synthetic") == 0 || strcmp(argv[1], "replay") == 0 || strcmp(argv[1], "faults") == 0))
+		return RunStandIn(strcmp(argv[1], "replay") == 0, strcmp(argv[1], "faults") == 0, HasOption(argc, argv, "lossless"));
+	if (argc > 1 && strcmp(argv[1], "bench") == 0)
+		return RunBenchmarks(argc - 2, argv + 2);
+	if (argc > 1 && strcmp(argv[1], "test") == 0)
+		return RunTests(argc - 2, argv + 2);
+
 	HRESULT hr = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
 	if (FAILED(hr))
 		return -1;
@@ -18,45 +233,64 @@ int main()
 	CreateMediaSource(true, L"Logitech BRIO", L"\\\\?\\usb#vid_046d&pid_085e&mi_00#9&1aa60e46&0&0000#{65e8773d-8f56-11d0-a3b9-00a0c9223196}\\global");
 	CreateMediaSource(true, L"Logitech BRIO", L"\\\\?\\usb#vid_046d&pid_085e&mi_00#9&1aa60e46&0&0000#{e5323777-f976-4f5b-9b55-b94699c46e44}\\global");
 
-	auto videoDevices = EnumDevices(true);
-	auto audioDevices = EnumDevices(false);
-
-	ComPtr<CMFCapture> vCapture;
-	ComPtr<CMFCapture> aCapture;
+	// capabilities of known devices come from the cache, only new or changed devices are activated
+	CCapabilityCache capCache;
+	capCache.Load("capabilities.bin");
+	auto videoDevices = EnumDevices(true, &capCache);
+	auto audioDevices = EnumDevices(false, &capCache);
+	capCache.Save("capabilities.bin");
 
+	std::vector<std::shared_ptr<IFrameSource>> videoSources;
+	std::vector<std::shared_ptr<IFrameSource>> audioSources;
 	for (const auto &dev : videoDevices) {
 		if (dev.name.find(L"Logitech") == std::wstring::npos)
 			continue;
 
-		vCapture = CMFCapture::CreateInstance(true, dev.name.c_str(), dev.path.c_str());
-		if (vCapture) {
-			if (vCapture->StartCapture()) {
-				printf("succeeded to capture video \n");
-			}
-		}
+		ComPtr<CMFCapture> capture = CMFCapture::CreateInstance(true, dev.name.c_str(), dev.path.c_str());
+		if (capture)
+			videoSources.push_back(ToSharedSource(capture));
 	}
 
 	for (const auto &dev : audioDevices) {
 		if (dev.name.find(L"Logitech") == std::wstring::npos)
 			continue;
 
-		aCapture = CMFCapture::CreateInstance(false, dev.name.c_str(), dev.path.c_str());
-		if (aCapture) {
-			if (aCapture->StartCapture()) {
-				printf("succeeded to capture audio \n");
-			}
-		}
+		ComPtr<CMFCapture> capture = CMFCapture::CreateInstance(false, dev.name.c_str(), dev.path.c_str());
+		if (capture)
+			audioSources.push_back(ToSharedSource(capture));
 	}
 
-	Sleep(10000);
-	if (vCapture) {
-		vCapture->StopCapture();
-		vCapture = nullptr;
-	}
-	if (aCapture) {
-		aCapture->StopCapture();
-		aCapture = nullptr;
-	}
+	{
+		// every device gets its own session and dump, the n-th camera is paired with the n-th microphone
+		CCaptureManager manager(GetRecordingOptions());
+		const size_t count = (std::max)(videoSources.size(), audioSources.size());
+		for (size_t i = 0; i < count; ++i) {
+			const std::string name = "device " + std::to_string(i);
+			const std::string videoPath = "video-" + std::to_string(i) + ".mfc";
+			const std::string audioPath = "audio-" + std::to_string(i) + ".mfc";
+			if (i < videoSources.size() && i < audioSources.size())
+				manager.AddSessionPair(name.c_str(), videoSources[i], audioSources[i], videoPath.c_str(), audioPath.c_str());
+			else if (i < videoSources.size())
+				manager.AddSession(name.c_str(), videoSources[i], videoPath.c_str());
+			else
+				manager.AddSession(name.c_str(), audioSources[i], audioPath.c_str());
+		}
+		videoSources.clear();
+		audioSources.clear();
+
+		// the audio settings are only used by audio sessions, dumped in 20ms packets
+		const bool lossless = HasOption(argc, argv, "lossless");
+		for (uint32_t i = 0; i < manager.GetSessionCount(); ++i) {
+			manager.GetSession(i)->GetPipeline().SetAudioFormat(GetCanonicalAudioFormat());
+			manager.GetSession(i)->GetPipeline().SetAudioPackets(AudioPacketizerOptions());
+			manager.GetSession(i)->GetPipeline().SetLosslessDump(lossless);
+		}
+
+		printf("started %u of %u sessions \n", manager.Start(), manager.GetSessionCount());
+		Sleep(10000);
+		manager.Stop();
+		PrintManagerStats(manager);
+	} // the captures are released before MFShutdown
 
 	MFShutdown();
 	CoUninitialize();
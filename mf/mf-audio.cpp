@@ -0,0 +1,583 @@
+#include "mf-audio.h"
+#include <algorithm>
+#include <assert.h>
+#include <cmath>
+#include <cstring>
+
+#define AUDIO_KAISER_BETA 8.0
+#define AUDIO_PI 3.14159265358979323846
+
+//---------------------------------------------------------------------------------------------
+// scalar reference, `i` is the first sample to convert so that the simd kernels can finish their tail here
+
+static void S16ToFloatTail_C(const uint8_t *src, float *dst, uint32_t i, uint32_t count)
+{
+	const int16_t *s = (const int16_t *)src;
+	for (; i < count; ++i)
+		dst[i] = float(s[i]) * (1.0f / 32768.0f);
+}
+
+static void S24ToFloatTail_C(const uint8_t *src, float *dst, uint32_t i, uint32_t count)
+{
+	for (; i < count; ++i) {
+		const uint8_t *p = src + i * 3;
+		int32_t v = int32_t(uint32_t(p[0]) << 8 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 24) >> 8;
+		dst[i] = float(v) * (1.0f / 8388608.0f);
+	}
+}
+
+static void S32ToFloatTail_C(const uint8_t *src, float *dst, uint32_t i, uint32_t count)
+{
+	const int32_t *s = (const int32_t *)src;
+	for (; i < count; ++i)
+		dst[i] = float(s[i]) * (1.0f / 2147483648.0f);
+}
+
+// clamp before converting, so that out of range samples saturate the same way as in the simd kernels
+static void FloatToS16Tail_C(const float *src, uint8_t *dst, uint32_t i, uint32_t count)
+{
+	int16_t *d = (int16_t *)dst;
+	for (; i < count; ++i) {
+		float v = (std::min)((std::max)(src[i] * 32768.0f, -32768.0f), 32767.0f);
+		d[i] = (int16_t)std::lrintf(v);
+	}
+}
+
+static void FloatToS32Tail_C(const float *src, uint8_t *dst, uint32_t i, uint32_t count)
+{
+	int32_t *d = (int32_t *)dst;
+	for (; i < count; ++i) {
+		float v = (std::min)((std::max)(src[i] * 2147483648.0f, -2147483648.0f), 2147483520.0f); // largest float below 2^31
+		d[i] = (int32_t)std::lrintf(v);
+	}
+}
+
+static void S16ToFloat_C(const uint8_t *src, float *dst, uint32_t count)
+{
+	S16ToFloatTail_C(src, dst, 0, count);
+}
+
+static void S24ToFloat_C(const uint8_t *src, float *dst, uint32_t count)
+{
+	S24ToFloatTail_C(src, dst, 0, count);
+}
+
+static void S32ToFloat_C(const uint8_t *src, float *dst, uint32_t count)
+{
+	S32ToFloatTail_C(src, dst, 0, count);
+}
+
+static void F32ToFloat_C(const uint8_t *src, float *dst, uint32_t count)
+{
+	memcpy(dst, src, count * sizeof(float));
+}
+
+static void FloatToS16_C(const float *src, uint8_t *dst, uint32_t count)
+{
+	FloatToS16Tail_C(src, dst, 0, count);
+}
+
+static void FloatToS32_C(const float *src, uint8_t *dst, uint32_t count)
+{
+	FloatToS32Tail_C(src, dst, 0, count);
+}
+
+static void FloatToF32_C(const float *src, uint8_t *dst, uint32_t count)
+{
+	memcpy(dst, src, count * sizeof(float));
+}
+
+static float DotProduct_C(const float *a, const float *b, uint32_t count)
+{
+	float sum = 0.0f;
+	for (uint32_t i = 0; i < count; ++i)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+#if MF_ARCH_X86
+//---------------------------------------------------------------------------------------------
+MF_TARGET_SSE2 static void S16ToFloat_SSE2(const uint8_t *src, float *dst, uint32_t count)
+{
+	const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+	uint32_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m128i s = _mm_loadu_si128((const __m128i *)(src + i * 2));
+		// sign extend by putting the samples into the high half and shifting back
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+		_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+	}
+	S16ToFloatTail_C(src, dst, i, count);
+}
+
+MF_TARGET_SSE2 static void S32ToFloat_SSE2(const uint8_t *src, float *dst, uint32_t count)
+{
+	const __m128 scale = _mm_set1_ps(1.0f / 2147483648.0f);
+	uint32_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i s = _mm_loadu_si128((const __m128i *)(src + i * 4));
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(s), scale));
+	}
+	S32ToFloatTail_C(src, dst, i, count);
+}
+
+MF_TARGET_SSE2 static void FloatToS16_SSE2(const float *src, uint8_t *dst, uint32_t count)
+{
+	const __m128 scale = _mm_set1_ps(32768.0f);
+	const __m128 low = _mm_set1_ps(-32768.0f);
+	const __m128 high = _mm_set1_ps(32767.0f);
+	uint32_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i), scale), low), high);
+		__m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i + 4), scale), low), high);
+		__m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+		_mm_storeu_si128((__m128i *)(dst + i * 2), packed);
+	}
+	FloatToS16Tail_C(src, dst, i, count);
+}
+
+MF_TARGET_SSE2 static void FloatToS32_SSE2(const float *src, uint8_t *dst, uint32_t count)
+{
+	const __m128 scale = _mm_set1_ps(2147483648.0f);
+	const __m128 low = _mm_set1_ps(-2147483648.0f);
+	const __m128 high = _mm_set1_ps(2147483520.0f);
+	uint32_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i), scale), low), high);
+		_mm_storeu_si128((__m128i *)(dst + i * 4), _mm_cvtps_epi32(a));
+	}
+	FloatToS32Tail_C(src, dst, i, count);
+}
+
+MF_TARGET_SSE2 static float DotProduct_SSE2(const float *a, const float *b, uint32_t count)
+{
+	__m128 sum0 = _mm_setzero_ps();
+	__m128 sum1 = _mm_setzero_ps();
+	uint32_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+		sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+	}
+
+	__m128 sum = _mm_add_ps(sum0, sum1);
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+	float result = _mm_cvtss_f32(sum);
+
+	for (; i < count; ++i)
+		result += a[i] * b[i];
+	return result;
+}
+
+//---------------------------------------------------------------------------------------------
+MF_TARGET_AVX2 static void S16ToFloat_AVX2(const uint8_t *src, float *dst, uint32_t count)
+{
+	const __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+	uint32_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(src + i * 2)));
+		__m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(src + i * 2 + 16)));
+		_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), scale));
+		_mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), scale));
+	}
+	S16ToFloatTail_C(src, dst, i, count);
+}
+
+// 4 samples of 3 bytes per lane, moved into the top 3 bytes of each int32 and shifted back with sign
+MF_TARGET_AVX2 static void S24ToFloat_AVX2(const uint8_t *src, float *dst, uint32_t count)
+{
+	const __m256i shuffle = _mm256_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+	const __m256 scale = _mm256_set1_ps(1.0f / 8388608.0f);
+	uint32_t i = 0;
+	// the second load reads 4 bytes beyond the 8 samples
+	for (; i + 10 <= count; i += 8) {
+		__m128i lo = _mm_loadu_si128((const __m128i *)(src + i * 3));
+		__m128i hi = _mm_loadu_si128((const __m128i *)(src + i * 3 + 12));
+		__m256i s = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+		s = _mm256_srai_epi32(_mm256_shuffle_epi8(s, shuffle), 8);
+		_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(s), scale));
+	}
+	S24ToFloatTail_C(src, dst, i, count);
+}
+
+MF_TARGET_AVX2 static void S32ToFloat_AVX2(const uint8_t *src, float *dst, uint32_t count)
+{
+	const __m256 scale = _mm256_set1_ps(1.0f / 2147483648.0f);
+	uint32_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i s = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+		_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(s), scale));
+	}
+	S32ToFloatTail_C(src, dst, i, count);
+}
+
+MF_TARGET_AVX2 static void FloatToS16_AVX2(const float *src, uint8_t *dst, uint32_t count)
+{
+	const __m256 scale = _mm256_set1_ps(32768.0f);
+	const __m256 low = _mm256_set1_ps(-32768.0f);
+	const __m256 high = _mm256_set1_ps(32767.0f);
+	uint32_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src + i), scale), low), high);
+		__m256 b = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src + i + 8), scale), low), high);
+		// packs works per lane, fix the order of the 64-bit quarters afterwards
+		__m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b));
+		packed = _mm256_permute4x64_epi64(packed, 0xD8);
+		_mm256_storeu_si256((__m256i *)(dst + i * 2), packed);
+	}
+	FloatToS16Tail_C(src, dst, i, count);
+}
+
+MF_TARGET_AVX2 static void FloatToS32_AVX2(const float *src, uint8_t *dst, uint32_t count)
+{
+	const __m256 scale = _mm256_set1_ps(2147483648.0f);
+	const __m256 low = _mm256_set1_ps(-2147483648.0f);
+	const __m256 high = _mm256_set1_ps(2147483520.0f);
+	uint32_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src + i), scale), low), high);
+		_mm256_storeu_si256((__m256i *)(dst + i * 4), _mm256_cvtps_epi32(a));
+	}
+	FloatToS32Tail_C(src, dst, i, count);
+}
+
+MF_TARGET_AVX2 static float DotProduct_AVX2(const float *a, const float *b, uint32_t count)
+{
+	__m256 sum0 = _mm256_setzero_ps();
+	__m256 sum1 = _mm256_setzero_ps();
+	uint32_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+		sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8)));
+	}
+
+	__m256 sum8 = _mm256_add_ps(sum0, sum1);
+	__m128 sum = _mm_add_ps(_mm256_castps256_ps128(sum8), _mm256_extractf128_ps(sum8, 1));
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+	float result = _mm_cvtss_f32(sum);
+
+	for (; i < count; ++i)
+		result += a[i] * b[i];
+	return result;
+}
+#endif
+
+//---------------------------------------------------------------------------------------------
+static uint32_t GetGcd(uint32_t a, uint32_t b)
+{
+	while (b) {
+		uint32_t t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+// modified bessel function of the first kind, order 0, for the kaiser window
+static double BesselI0(double x)
+{
+	double sum = 1.0;
+	double term = 1.0;
+	for (int k = 1; k < 50; ++k) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+		if (term < sum * 1e-12)
+			break;
+	}
+	return sum;
+}
+
+static bool IsSupportedInput(const MediaFormat &format)
+{
+	if (format.subtype == MEDIA_SUBTYPE_FLOAT)
+		return format.bitsPerSample == 32;
+	return format.subtype == MEDIA_SUBTYPE_PCM && (format.bitsPerSample == 16 || format.bitsPerSample == 24 || format.bitsPerSample == 32);
+}
+
+static bool IsSupportedOutput(const MediaFormat &format)
+{
+	if (format.subtype == MEDIA_SUBTYPE_FLOAT)
+		return format.bitsPerSample == 32;
+	return format.subtype == MEDIA_SUBTYPE_PCM && (format.bitsPerSample == 16 || format.bitsPerSample == 32);
+}
+
+bool CAudioConverter::Init(const MediaFormat &input, const MediaFormat &output, SimdLevel level)
+{
+	if (input.video || output.video || !IsSupportedInput(input) || !IsSupportedOutput(output) || !input.channels || !output.channels || !input.sampleRate || !output.sampleRate) {
+		assert(false);
+		return false;
+	}
+
+	const uint32_t gcd = GetGcd(input.sampleRate, output.sampleRate);
+	if (output.sampleRate / gcd > AUDIO_MAX_PHASES)
+		return false;
+
+	if (level > GetCpuSimdLevel())
+		level = GetCpuSimdLevel();
+
+	m_input = input;
+	m_output = output;
+	m_inFrameBytes = input.channels * input.bitsPerSample / 8;
+	m_outFrameBytes = output.channels * output.bitsPerSample / 8;
+	m_up = output.sampleRate / gcd;
+	m_down = input.sampleRate / gcd;
+	m_bPassthrough = input.subtype == output.subtype && input.bitsPerSample == output.bitsPerSample && input.channels == output.channels && m_up == m_down;
+
+#if MF_ARCH_X86
+	const bool avx2 = level >= SIMD_AVX2;
+	const bool sse2 = level >= SIMD_SSE2;
+#else
+	const bool avx2 = false;
+	const bool sse2 = false;
+#endif
+
+	if (input.subtype == MEDIA_SUBTYPE_FLOAT) {
+		m_toFloat = F32ToFloat_C;
+	} else if (input.bitsPerSample == 16) {
+		m_toFloat = S16ToFloat_C;
+#if MF_ARCH_X86
+		if (sse2)
+			m_toFloat = avx2 ? S16ToFloat_AVX2 : S16ToFloat_SSE2;
+#endif
+	} else if (input.bitsPerSample == 24) {
+		m_toFloat = S24ToFloat_C; // sse2 has no byte shuffle
+#if MF_ARCH_X86
+		if (avx2)
+			m_toFloat = S24ToFloat_AVX2;
+#endif
+	} else {
+		m_toFloat = S32ToFloat_C;
+#if MF_ARCH_X86
+		if (sse2)
+			m_toFloat = avx2 ? S32ToFloat_AVX2 : S32ToFloat_SSE2;
+#endif
+	}
+
+	if (output.subtype == MEDIA_SUBTYPE_FLOAT) {
+		m_fromFloat = FloatToF32_C;
+	} else if (output.bitsPerSample == 16) {
+		m_fromFloat = FloatToS16_C;
+#if MF_ARCH_X86
+		if (sse2)
+			m_fromFloat = avx2 ? FloatToS16_AVX2 : FloatToS16_SSE2;
+#endif
+	} else {
+		m_fromFloat = FloatToS32_C;
+#if MF_ARCH_X86
+		if (sse2)
+			m_fromFloat = avx2 ? FloatToS32_AVX2 : FloatToS32_SSE2;
+#endif
+	}
+
+	m_dot = DotProduct_C;
+#if MF_ARCH_X86
+	if (sse2)
+		m_dot = avx2 ? DotProduct_AVX2 : DotProduct_SSE2;
+#endif
+
+	(void)avx2;
+	(void)sse2;
+
+	InitMatrix();
+	InitFilter();
+	Reset();
+	return true;
+}
+
+void CAudioConverter::InitMatrix()
+{
+	const uint32_t in = m_input.channels;
+	const uint32_t out = m_output.channels;
+	m_matrix.clear();
+	if (in == out)
+		return;
+
+	m_matrix.assign(out * in, 0.0f);
+	float *m = m_matrix.data();
+
+	if (out == 1) {
+		// average of everything
+		for (uint32_t i = 0; i < in; ++i)
+			m[i] = 1.0f / float(in);
+	} else if (in == 1) {
+		// mono goes to the front left and right
+		m[0 * in] = 1.0f;
+		m[1 * in] = 1.0f;
+	} else if (in == 6 && out == 2) {
+		// 5.1 (FL FR FC LFE BL BR) -> stereo, ITU-R BS.775 without lfe, scaled to avoid clipping
+		const float c = 0.7071f;
+		const float norm = 1.0f / (1.0f + c + c);
+		m[0 * in + 0] = norm;
+		m[0 * in + 2] = c * norm;
+		m[0 * in + 4] = c * norm;
+		m[1 * in + 1] = norm;
+		m[1 * in + 2] = c * norm;
+		m[1 * in + 5] = c * norm;
+	} else {
+		// keep the channels both layouts have, drop or silence the rest
+		for (uint32_t o = 0; o < out && o < in; ++o)
+			m[o * in + o] = 1.0f;
+	}
+}
+
+void CAudioConverter::InitFilter()
+{
+	m_filter.clear();
+	if (m_up == m_down)
+		return;
+
+	// windowed sinc, the cutoff is below the nyquist frequency of the lower of both rates
+	const double cutoff = (std::min)(1.0, double(m_up) / double(m_down)) * 0.95;
+	const double half = AUDIO_FILTER_TAPS / 2;
+	const double window = BesselI0(AUDIO_KAISER_BETA);
+
+	m_filter.resize(size_t(m_up) * AUDIO_FILTER_TAPS);
+	for (uint32_t p = 0; p < m_up; ++p) {
+		float *coef = m_filter.data() + size_t(p) * AUDIO_FILTER_TAPS;
+		double sum = 0.0;
+		for (uint32_t k = 0; k < AUDIO_FILTER_TAPS; ++k) {
+			// tap k multiplies input frame (position - half + 1 + k), t is its distance to the output position
+			const double t = double(k) - half + 1.0 - double(p) / double(m_up);
+			const double x = t / half;
+			double value = 0.0;
+			if (x > -1.0 && x < 1.0) {
+				const double sinc = t == 0.0 ? 1.0 : std::sin(AUDIO_PI * cutoff * t) / (AUDIO_PI * cutoff * t);
+				value = cutoff * sinc * BesselI0(AUDIO_KAISER_BETA * std::sqrt(1.0 - x * x)) / window;
+			}
+			coef[k] = (float)value;
+			sum += value;
+		}
+
+		// unity gain at dc for every phase
+		for (uint32_t k = 0; k < AUDIO_FILTER_TAPS; ++k)
+			coef[k] = float(coef[k] / sum);
+	}
+}
+
+void CAudioConverter::Reset()
+{
+	// silence before the first frame, so that the first output frame is at input frame 0
+	const uint32_t pad = AUDIO_FILTER_TAPS / 2 - 1;
+	m_history.assign(m_output.channels, std::vector<float>(pad, 0.0f));
+	m_historyBase = -(int64_t)pad;
+	m_inputFrames = 0;
+	m_position = 0;
+	m_phase = 0;
+	m_timestampOffset = 0;
+}
+
+uint32_t CAudioConverter::GetMaxOutputSize(uint32_t size) const
+{
+	if (!m_inFrameBytes)
+		return 0;
+
+	// frames still waiting in the resampler can come out in this call as well
+	const uint64_t frames = size / m_inFrameBytes + AUDIO_FILTER_TAPS;
+	return (uint32_t)((frames * m_up + m_down - 1) / m_down + 1) * m_outFrameBytes;
+}
+
+void CAudioConverter::Mix(const float *src, float *dst, uint32_t frames) const
+{
+	const uint32_t in = m_input.channels;
+	const uint32_t out = m_output.channels;
+	const float *m = m_matrix.data();
+
+	for (uint32_t f = 0; f < frames; ++f) {
+		const float *s = src + f * in;
+		float *d = dst + f * out;
+		for (uint32_t o = 0; o < out; ++o) {
+			float sum = 0.0f;
+			for (uint32_t i = 0; i < in; ++i)
+				sum += m[o * in + i] * s[i];
+			d[o] = sum;
+		}
+	}
+}
+
+uint32_t CAudioConverter::Resample(const float *src, uint32_t frames, float *dst, uint32_t capacity)
+{
+	const uint32_t channels = m_output.channels;
+	const int64_t chunkStart = m_inputFrames;
+
+	for (uint32_t c = 0; c < channels; ++c) {
+		std::vector<float> &history = m_history[c];
+		const size_t offset = history.size();
+		history.resize(offset + frames);
+		for (uint32_t f = 0; f < frames; ++f)
+			history[offset + f] = src[f * channels + c];
+	}
+	m_inputFrames += frames;
+
+	// output n needs input frames [position - half + 1, position + half]
+	const int64_t half = AUDIO_FILTER_TAPS / 2;
+	const int64_t available = m_historyBase + (int64_t)m_history[0].size();
+
+	m_timestampOffset = (int64_t)(((double)(m_position - chunkStart) + double(m_phase) / double(m_up)) * 10000000.0 / double(m_input.sampleRate));
+
+	uint32_t count = 0;
+	while (count < capacity && m_position + half < available) {
+		const size_t start = size_t(m_position - half + 1 - m_historyBase);
+		const float *coef = m_filter.data() + size_t(m_phase) * AUDIO_FILTER_TAPS;
+		for (uint32_t c = 0; c < channels; ++c)
+			dst[count * channels + c] = m_dot(m_history[c].data() + start, coef, AUDIO_FILTER_TAPS);
+		++count;
+
+		m_phase += m_down;
+		m_position += m_phase / m_up;
+		m_phase %= m_up;
+	}
+
+	// keep only what the next output frame still needs
+	const int64_t keep = m_position - half + 1;
+	if (keep > m_historyBase) {
+		const size_t drop = (size_t)(std::min)(keep - m_historyBase, (int64_t)m_history[0].size());
+		for (auto &history : m_history)
+			history.erase(history.begin(), history.begin() + drop);
+		m_historyBase += drop;
+	}
+
+	return count;
+}
+
+uint32_t CAudioConverter::Convert(const uint8_t *src, uint32_t size, uint8_t *dst, uint32_t capacity)
+{
+	if (!m_toFloat) {
+		assert(false);
+		return 0;
+	}
+
+	const uint32_t frames = size / m_inFrameBytes;
+	if (m_bPassthrough) {
+		uint32_t bytes = (std::min)(frames * m_inFrameBytes, capacity);
+		memcpy(dst, src, bytes);
+		m_timestampOffset = 0;
+		return bytes;
+	}
+
+	m_float.resize(size_t(frames) * m_input.channels);
+	m_toFloat(src, m_float.data(), frames * m_input.channels);
+
+	const float *mixed = m_float.data();
+	if (!m_matrix.empty()) {
+		m_mixed.resize(size_t(frames) * m_output.channels);
+		Mix(m_float.data(), m_mixed.data(), frames);
+		mixed = m_mixed.data();
+	}
+
+	const float *result = mixed;
+	uint32_t outFrames = frames;
+	if (m_up != m_down) {
+		m_resampled.resize(size_t(GetMaxOutputSize(size) / m_outFrameBytes) * m_output.channels);
+		outFrames = Resample(mixed, frames, m_resampled.data(), (uint32_t)(m_resampled.size() / m_output.channels));
+		result = m_resampled.data();
+	} else {
+		m_timestampOffset = 0;
+	}
+
+	outFrames = (std::min)(outFrames, capacity / m_outFrameBytes);
+	m_fromFloat(result, dst, outFrames * m_output.channels);
+	return outFrames * m_outFrameBytes;
+}
@@ -0,0 +1,74 @@
+﻿#pragma once
+#include "mf-cpu.h"
+#include "mf-sample.h"
+#include <vector>
+
+#define AUDIO_MAX_PHASES 1024 // output rate / gcd of both rates
+#define AUDIO_FILTER_TAPS 32  // per phase
+
+// normalizes the interleaved pcm of any device (int16/int24/int32/float, any rate and channel count)
+// into one output format: sample conversion -> channel mix -> polyphase resampler -> output samples.
+// the sample conversions and the filter have simd kernels, they match the scalar code within float rounding.
+class CAudioConverter {
+public:
+	// input: PCM 16/24/32 bit or FLOAT 32 bit. output: PCM 16/32 bit or FLOAT 32 bit.
+	// fails for rates whose ratio needs more than AUDIO_MAX_PHASES filter phases.
+	bool Init(const MediaFormat &input, const MediaFormat &output, SimdLevel level = GetSimdLevel());
+	// drops the filter history, e.g. after a discontinuity
+	void Reset();
+
+	bool IsPassthrough() const { return m_bPassthrough; }
+	const MediaFormat &GetInputFormat() const { return m_input; }
+	const MediaFormat &GetOutputFormat() const { return m_output; }
+
+	// upper bound of what Convert writes for `size` input bytes
+	uint32_t GetMaxOutputSize(uint32_t size) const;
+
+	// converts whole input frames, returns the output bytes written to `dst`
+	uint32_t Convert(const uint8_t *src, uint32_t size, uint8_t *dst, uint32_t capacity);
+
+	// time of the first output frame of the last Convert relative to the first input frame of it, in 100ns.
+	// usually negative: the resampler needs a few input frames ahead of each output frame.
+	int64_t GetTimestampOffset() const { return m_timestampOffset; }
+
+	typedef void (*ToFloatFunc)(const uint8_t *src, float *dst, uint32_t count);
+	typedef void (*FromFloatFunc)(const float *src, uint8_t *dst, uint32_t count);
+	typedef float (*DotProductFunc)(const float *a, const float *b, uint32_t count);
+
+private:
+	void InitMatrix();
+	void InitFilter();
+	void Mix(const float *src, float *dst, uint32_t frames) const;
+	uint32_t Resample(const float *src, uint32_t frames, float *dst, uint32_t capacity);
+
+private:
+	MediaFormat m_input;
+	MediaFormat m_output;
+	bool m_bPassthrough = false;
+	uint32_t m_inFrameBytes = 0;
+	uint32_t m_outFrameBytes = 0;
+
+	ToFloatFunc m_toFloat = nullptr;
+	FromFloatFunc m_fromFloat = nullptr;
+	DotProductFunc m_dot = nullptr;
+
+	// channel mix, out x in, empty if the channel count does not change
+	std::vector<float> m_matrix;
+
+	// resampler: output frame n is at input position n * m_down / m_up
+	uint32_t m_up = 1;
+	uint32_t m_down = 1;
+	std::vector<float> m_filter; // m_up phases of AUDIO_FILTER_TAPS coefficients
+	std::vector<std::vector<float>> m_history; // per channel, starts at input frame m_historyBase
+	int64_t m_historyBase = 0;
+	int64_t m_inputFrames = 0; // input frames pushed since Reset
+	int64_t m_position = 0;    // input frame of the next output frame
+	uint32_t m_phase = 0;      // and its fraction, in 1/m_up
+
+	int64_t m_timestampOffset = 0;
+
+	// scratch, interleaved
+	std::vector<float> m_float;
+	std::vector<float> m_mixed;
+	std::vector<float> m_resampled;
+};
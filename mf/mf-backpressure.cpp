@@ -0,0 +1,217 @@
+#include "mf-backpressure.h"
+#include "mf-portable.hpp"
+#include <algorithm>
+#include <assert.h>
+#include <chrono>
+
+const char *GetBackpressurePolicyString(BackpressurePolicy policy)
+{
+	switch (policy) {
+	case BACKPRESSURE_BLOCK:
+		return "block";
+	case BACKPRESSURE_DROP_OLDEST:
+		return "drop oldest";
+	case BACKPRESSURE_KEEP_LATEST:
+		return "keep latest";
+	case BACKPRESSURE_RATE_LIMIT:
+		return "rate limit";
+	}
+	return "unknown";
+}
+
+const char *GetFrameDropReasonString(FrameDropReason reason)
+{
+	switch (reason) {
+	case FRAME_DROP_FULL:
+		return "full";
+	case FRAME_DROP_REPLACED:
+		return "replaced";
+	case FRAME_DROP_RATE:
+		return "rate";
+	default:
+		return "unknown";
+	}
+}
+
+CBackpressureQueue::CBackpressureQueue()
+{
+	for (uint32_t i = 0; i < FRAME_DROP_REASONS; ++i)
+		m_dropped[i] = 0;
+	Init(BackpressureOptions());
+}
+
+CBackpressureQueue::~CBackpressureQueue()
+{
+	for (uint32_t i = 0; i <= m_mask; ++i) {
+		CMediaFrame *frame = m_slots[i].exchange(nullptr);
+		if (frame)
+			frame->Release();
+	}
+}
+
+bool CBackpressureQueue::Init(const BackpressureOptions &options)
+{
+	if (GetSize() || !options.capacity || (options.policy == BACKPRESSURE_RATE_LIMIT && !(options.maxFramesPerSecond > 0.0))) {
+		assert(false);
+		return false;
+	}
+
+	m_options = options;
+	m_capacity = options.policy == BACKPRESSURE_KEEP_LATEST ? 1 : options.capacity;
+
+	uint32_t size = 2;
+	while (size < m_capacity * 2)
+		size *= 2;
+	m_slots.reset(new std::atomic<CMediaFrame *>[size]);
+	m_pushTimes.reset(new std::atomic<int64_t>[size]);
+	for (uint32_t i = 0; i < size; ++i) {
+		m_slots[i] = nullptr;
+		m_pushTimes[i] = 0;
+	}
+	m_mask = size - 1;
+	m_head = 0;
+	m_tail = 0;
+
+	// timestamps are in 100ns
+	m_interval = options.policy == BACKPRESSURE_RATE_LIMIT ? int64_t(1e7 / options.maxFramesPerSecond) : 0;
+	m_bRateStarted = false;
+	return true;
+}
+
+bool CBackpressureQueue::Push(CMediaFrame *frame)
+{
+	if (m_interval && !IsWithinRate(frame->GetTimestamp())) {
+		Drop(nullptr, FRAME_DROP_RATE);
+		return false;
+	}
+
+	const uint32_t tail = m_tail.load(std::memory_order_relaxed);
+	if (tail - m_head.load(std::memory_order_acquire) >= m_capacity) {
+		if (m_options.policy == BACKPRESSURE_DROP_OLDEST || m_options.policy == BACKPRESSURE_KEEP_LATEST) {
+			// the consumer may be taking the same frame right now, one of us gets it
+			Drop(m_slots[(tail - m_capacity) & m_mask].exchange(nullptr, std::memory_order_acq_rel), FRAME_DROP_REPLACED);
+		} else if (!WaitForRoom(tail)) {
+			Drop(nullptr, FRAME_DROP_FULL);
+			return false;
+		}
+	}
+
+	frame->AddRef();
+	m_pushTimes[tail & m_mask].store(GetMonotonicTimeNs(), std::memory_order_relaxed);
+	m_slots[tail & m_mask].store(frame, std::memory_order_release);
+	m_tail.store(tail + 1, std::memory_order_release);
+	m_pushed.store(m_pushed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+	uint32_t depth = GetSize();
+	uint32_t maxDepth = m_maxDepth.load(std::memory_order_relaxed);
+	while (depth > maxDepth && !m_maxDepth.compare_exchange_weak(maxDepth, depth))
+		;
+	return true;
+}
+
+bool CBackpressureQueue::TryPop(CMediaFrame *&frame)
+{
+	uint32_t head = m_head.load(std::memory_order_relaxed);
+	bool popped = false;
+
+	for (;;) {
+		const uint32_t tail = m_tail.load(std::memory_order_acquire);
+		if (head == tail)
+			break;
+
+		// the frames before were taken back by the producer
+		if (tail - head > m_capacity)
+			head = tail - m_capacity;
+
+		frame = m_slots[head & m_mask].exchange(nullptr, std::memory_order_acq_rel);
+		const int64_t pushTime = m_pushTimes[head & m_mask].load(std::memory_order_relaxed);
+		const uint32_t index = head++;
+		if (!frame)
+			continue;
+
+		// once the producer got a whole ring ahead, the slot may hold a newer frame than `index`, which would come out
+		// of order. it is rare enough to simply drop, the frame at `index` itself was out of the queue anyway
+		if (m_tail.load(std::memory_order_acquire) - index > m_mask) {
+			Drop(frame, FRAME_DROP_REPLACED);
+			continue;
+		}
+
+		// single writer, no need for read-modify-write
+		const int64_t latency = GetMonotonicTimeNs() - pushTime;
+		m_popped.store(m_popped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		m_latencyNs.store(m_latencyNs.load(std::memory_order_relaxed) + latency, std::memory_order_relaxed);
+		if (latency > m_maxLatencyNs.load(std::memory_order_relaxed))
+			m_maxLatencyNs.store(latency, std::memory_order_relaxed);
+
+		popped = true;
+		break;
+	}
+
+	m_head.store(head, std::memory_order_release);
+	m_room.Notify();
+	return popped;
+}
+
+uint32_t CBackpressureQueue::GetSize() const
+{
+	const uint32_t size = m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+	return (std::min)(size, m_capacity);
+}
+
+bool CBackpressureQueue::IsWithinRate(int64_t timestamp)
+{
+	// the first frame, or the source started over
+	if (!m_bRateStarted || timestamp < m_lastTimestamp) {
+		m_bRateStarted = true;
+		m_nextTimestamp = timestamp;
+	}
+	m_lastTimestamp = timestamp;
+
+	// a quarter of the interval absorbs the jitter of the timestamps
+	if (timestamp < m_nextTimestamp - m_interval / 4)
+		return false;
+
+	// steps by whole intervals, so e.g. 30 fps limited to 20 passes two of three frames, but does not catch up after a gap
+	m_nextTimestamp = (std::max)(m_nextTimestamp + m_interval, timestamp);
+	return true;
+}
+
+bool CBackpressureQueue::WaitForRoom(uint32_t tail)
+{
+	if (!m_options.blockTimeoutMs)
+		return false;
+
+	const int64_t begin = GetMonotonicTimeNs();
+	const bool room = m_room.WaitFor([&]() { return tail - m_head.load(std::memory_order_acquire) < m_capacity; }, m_options.blockTimeoutMs);
+
+	m_blocked.store(m_blocked.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	m_blockedNs.store(m_blockedNs.load(std::memory_order_relaxed) + GetMonotonicTimeNs() - begin, std::memory_order_relaxed);
+	return room;
+}
+
+void CBackpressureQueue::Drop(CMediaFrame *frame, FrameDropReason reason)
+{
+	if (!frame && reason == FRAME_DROP_REPLACED)
+		return; // the consumer was faster
+
+	if (frame)
+		frame->Release();
+	// REPLACED is counted on both sides
+	m_dropped[reason].fetch_add(1, std::memory_order_relaxed);
+}
+
+BackpressureStats CBackpressureQueue::GetStats() const
+{
+	BackpressureStats stats;
+	stats.pushed = m_pushed;
+	for (uint32_t i = 0; i < FRAME_DROP_REASONS; ++i)
+		stats.dropped[i] = m_dropped[i];
+	stats.blocked = m_blocked;
+	stats.blockedNs = m_blockedNs;
+	stats.depth = GetSize();
+	stats.maxDepth = m_maxDepth;
+	stats.popped = m_popped;
+	stats.latencyNs = m_latencyNs;
+	stats.maxLatencyNs = m_maxLatencyNs;
+	return stats;
+}
@@ -0,0 +1,106 @@
+﻿#pragma once
+#include "mf-frame.h"
+#include "mf-spsc-queue.hpp"
+#include "mf-wake.hpp"
+#include <atomic>
+#include <memory>
+
+// what happens to a frame which arrives while the queue is full
+enum BackpressurePolicy {
+	BACKPRESSURE_BLOCK,       // the source waits up to blockTimeoutMs for room, then the new frame is dropped. 0: dropped right away
+	BACKPRESSURE_DROP_OLDEST, // the oldest queued frame makes room, e.g. for analysis which wants recent frames but no gaps in bursts
+	BACKPRESSURE_KEEP_LATEST, // only the newest frame waits, for previews
+	BACKPRESSURE_RATE_LIMIT,  // frames above maxFramesPerSecond are dropped on arrival, the rest are queued as for BLOCK
+};
+
+enum FrameDropReason {
+	FRAME_DROP_FULL,     // no room, or none within blockTimeoutMs
+	FRAME_DROP_REPLACED, // made room for a newer frame
+	FRAME_DROP_RATE,     // above maxFramesPerSecond
+	FRAME_DROP_REASONS,
+};
+
+const char *GetBackpressurePolicyString(BackpressurePolicy policy);
+const char *GetFrameDropReasonString(FrameDropReason reason);
+
+struct BackpressureOptions {
+	BackpressurePolicy policy = BACKPRESSURE_BLOCK;
+	uint32_t capacity = 8;           // frames waiting for the consumer, KEEP_LATEST always uses 1
+	uint32_t blockTimeoutMs = 0;     // BLOCK and RATE_LIMIT
+	double maxFramesPerSecond = 0.0; // RATE_LIMIT, by the timestamps of the frames
+};
+
+struct BackpressureStats {
+	uint64_t pushed = 0;
+	uint64_t dropped[FRAME_DROP_REASONS] = {};
+	uint64_t blocked = 0;  // frames the source waited for room for
+	int64_t blockedNs = 0; // in total
+	uint32_t depth = 0;
+	uint32_t maxDepth = 0;
+	uint64_t popped = 0;
+	int64_t latencyNs = 0; // push -> pop of the popped frames, in total
+	int64_t maxLatencyNs = 0;
+
+	uint64_t GetDropped() const { return dropped[FRAME_DROP_FULL] + dropped[FRAME_DROP_REPLACED] + dropped[FRAME_DROP_RATE]; }
+	double GetMeanLatencyNs() const { return popped ? double(latencyNs) / popped : 0.0; }
+};
+
+// bounded queue of frames between exactly one producer, the source, and one consumer, which applies one of the
+// policies above when the consumer falls behind. each slot is an atomic pointer, so that the producer can take the
+// oldest frame back from under the consumer without a lock: whoever exchanges it first owns it. the ring has twice
+// the capacity, so a slot is only reused long after its frame left the queue.
+class CBackpressureQueue {
+public:
+	CBackpressureQueue();
+	~CBackpressureQueue();
+
+	// only while the queue is empty and neither side runs
+	bool Init(const BackpressureOptions &options);
+	const BackpressureOptions &GetOptions() const { return m_options; }
+
+	// producer only. the queue takes its own reference, false when the frame was dropped
+	bool Push(CMediaFrame *frame);
+	// consumer only. the frame holds one reference for the caller
+	bool TryPop(CMediaFrame *&frame);
+
+	// approximate when called from a third thread
+	uint32_t GetSize() const;
+	BackpressureStats GetStats() const;
+
+private:
+	bool IsWithinRate(int64_t timestamp);
+	bool WaitForRoom(uint32_t tail);
+	void Drop(CMediaFrame *frame, FrameDropReason reason);
+
+private:
+	BackpressureOptions m_options;
+	uint32_t m_capacity = 0;
+	std::unique_ptr<std::atomic<CMediaFrame *>[]> m_slots;
+	std::unique_ptr<std::atomic<int64_t>[]> m_pushTimes; // of the frame in the same slot
+	uint32_t m_mask = 0;
+
+	// the source may only wait for the consumer under BLOCK and RATE_LIMIT
+	CWakeEvent m_room;
+
+	char m_pad0[MF_CACHE_LINE];
+	std::atomic<uint32_t> m_head{0}; // written by the consumer
+
+	char m_pad1[MF_CACHE_LINE];
+	std::atomic<uint32_t> m_tail{0}; // written by the producer
+	int64_t m_interval = 0;          // RATE_LIMIT, in timestamp units
+	int64_t m_nextTimestamp = 0;
+	int64_t m_lastTimestamp = 0;
+	bool m_bRateStarted = false;
+
+	char m_pad2[MF_CACHE_LINE];
+	std::atomic<uint64_t> m_pushed{0};
+	std::atomic<uint64_t> m_dropped[FRAME_DROP_REASONS];
+	std::atomic<uint64_t> m_blocked{0};
+	std::atomic<int64_t> m_blockedNs{0};
+	std::atomic<uint32_t> m_maxDepth{0};
+
+	char m_pad3[MF_CACHE_LINE];
+	std::atomic<uint64_t> m_popped{0}; // written by the consumer
+	std::atomic<int64_t> m_latencyNs{0};
+	std::atomic<int64_t> m_maxLatencyNs{0};
+};
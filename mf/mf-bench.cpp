@@ -0,0 +1,950 @@
+#include "mf-bench.h"
+#include "mf-audio.h"
+#include "mf-capcache.h"
+#include "mf-change.h"
+#include "mf-container.h"
+#include "mf-convert.h"
+#include "mf-format.h"
+#include "mf-frame.h"
+#include "mf-jpeg.h"
+#include "mf-lossless.h"
+#include "mf-manager.h"
+#include "mf-metrics.h"
+#include "mf-portable.hpp"
+#include "mf-publish.h"
+#include "mf-scale.h"
+#include "mf-source.h"
+#include "mf-tiling.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+#define BENCH_MIN_TIME_NS 50000000 // each measurement runs at least 50ms
+
+static double GetElapsedMs(int64_t begin)
+{
+	return double(GetMonotonicTime100ns() - begin) / 10000.0;
+}
+
+// the resolutions the devices in "mf enum video.txt" offer, plus 4K
+static const struct {
+	uint32_t width;
+	uint32_t height;
+} g_resolutions[] = {{160, 120}, {320, 240}, {640, 360}, {640, 480}, {1280, 720}, {1920, 1080}, {3840, 2160}};
+
+// calls `func` until BENCH_MIN_TIME_NS passed, returns ns per call
+template<class Func> static double MeasureNs(Func func)
+{
+	func(); // warm up caches and pools
+
+	uint64_t iterations = 0;
+	const int64_t begin = GetMonotonicTimeNs();
+	int64_t elapsed = 0;
+	do {
+		func();
+		++iterations;
+		elapsed = GetMonotonicTimeNs() - begin;
+	} while (elapsed < BENCH_MIN_TIME_NS);
+	return double(elapsed) / double(iterations);
+}
+
+static void PrintFrameResult(const char *label, uint32_t width, uint32_t height, uint64_t bytes, double ns)
+{
+	printf("\t%-22s %4ux%-4u %12.0f ns/frame %10.1f MB/s \n", label, width, height, ns, double(bytes) * 1000.0 / ns);
+}
+
+// a frame as the device hands it out: `stride` bytes per row, negative for bottom-up rgb.
+// returns the plane count; `memory` owns the bytes
+static uint32_t CreateDeviceFrame(const MediaFormat &format, int32_t stride, std::vector<uint8_t> &memory, MediaPlane *planes)
+{
+	const uint32_t absStride = (uint32_t)(stride < 0 ? -stride : stride);
+	memory.resize(GetFormatFrameSize(*FindFormatTraits(format.subtype), absStride, format.height));
+	for (size_t i = 0; i < memory.size(); ++i)
+		memory[i] = (uint8_t)(i * 7 + (i >> 12));
+
+	// scan line 0 is the last row in memory for bottom-up frames, as VideoBufferLock returns it
+	const uint8_t *first = stride < 0 ? memory.data() + size_t(absStride) * (format.height - 1) : memory.data();
+	return DescribeVideoPlanes(format, first, stride, planes);
+}
+
+//---------------------------------------------------------------------------------------------
+// stand-in for MFEnumDeviceSources: what EnumDevices sees without activation, plus what activation would report
+struct StandInDevice {
+	DeviceCapabilities info;
+	uint32_t activationMs = 0; // ActivateObject + walking the media types
+};
+
+static std::vector<StandInDevice> CreateStandInDevices()
+{
+	static const struct {
+		uint32_t width;
+		uint32_t height;
+	} resolutions[] = {{160, 120}, {320, 240}, {640, 360}, {640, 480}, {1280, 720}, {1920, 1080}, {2560, 1440}, {3840, 2160}, {4096, 2160}};
+	static const uint32_t subtypes[] = {MEDIA_SUBTYPE_YUY2, MEDIA_FOURCC('M', 'J', 'P', 'G'), MEDIA_SUBTYPE_NV12};
+	static const uint32_t rates[] = {30, 60};
+
+	std::vector<StandInDevice> devices;
+	for (uint32_t d = 0; d < 4; ++d) {
+		StandInDevice device;
+		device.info.video = true;
+		device.info.name = L"Stand-in Camera " + std::to_wstring(d);
+		device.info.path = L"\\\\?\\usb#vid_046d&pid_085e&mi_00#" + std::to_wstring(d) + L"#{e5323777-f976-4f5b-9b55-b94699c46e44}\\global";
+		device.info.fingerprint = HashBytes(device.info.path.data(), device.info.path.size() * sizeof(wchar_t));
+		device.activationMs = 150; // a BRIO takes several hundred ms, be conservative
+
+		uint32_t index = 0;
+		for (auto subtype : subtypes) {
+			for (const auto &res : resolutions) {
+				for (auto rate : rates) {
+					DeviceCapability cap;
+					cap.format.subtype = subtype;
+					cap.format.width = res.width;
+					cap.format.height = res.height;
+					cap.format.fpsNum = rate;
+					cap.format.fpsDen = 1;
+					cap.index = index++;
+					device.info.caps.push_back(cap);
+				}
+			}
+		}
+		devices.push_back(device);
+	}
+
+	for (uint32_t d = 0; d < 2; ++d) {
+		StandInDevice device;
+		device.info.video = false;
+		device.info.name = L"Stand-in Microphone " + std::to_wstring(d);
+		device.info.path = L"\\\\?\\SWD#MMDEVAPI#{0.0.1.00000000}." + std::to_wstring(d);
+		device.info.fingerprint = HashBytes(device.info.path.data(), device.info.path.size() * sizeof(wchar_t));
+		device.activationMs = 60;
+
+		DeviceCapability cap;
+		cap.format.video = false;
+		cap.format.subtype = MEDIA_SUBTYPE_PCM;
+		cap.format.channels = 2;
+		cap.format.sampleRate = 48000;
+		cap.format.bitsPerSample = 16;
+		device.info.caps.push_back(cap);
+		devices.push_back(device);
+	}
+
+	return devices;
+}
+
+// EnumDevices with a cache: returns how many devices had to be activated
+static uint32_t EnumStandInDevices(const std::vector<StandInDevice> &devices, CCapabilityCache &cache, std::vector<std::vector<DeviceCapability>> &result)
+{
+	uint32_t activations = 0;
+	result.clear();
+	for (const auto &device : devices) {
+		const DeviceCapabilities *cached = cache.Find(device.info.path, device.info.fingerprint);
+		if (cached) {
+			result.push_back(cached->caps);
+			continue;
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(device.activationMs));
+		++activations;
+		result.push_back(device.info.caps);
+		cache.Update(device.info);
+	}
+	return activations;
+}
+
+static void BenchCapabilityCache()
+{
+	const char *path = "capabilities-bench.bin";
+	remove(path);
+
+	std::vector<StandInDevice> devices = CreateStandInDevices();
+	std::vector<std::vector<DeviceCapability>> cold, warm;
+
+	// cold: empty cache, every device is activated, then the cache is saved for the next start
+	int64_t begin = GetMonotonicTime100ns();
+	CCapabilityCache coldCache;
+	coldCache.Load(path);
+	uint32_t coldActivations = EnumStandInDevices(devices, coldCache, cold);
+	coldCache.Save(path);
+	double coldMs = GetElapsedMs(begin);
+
+	// warm: load from disk, no activation
+	const int warmRuns = 20;
+	uint32_t warmActivations = 0;
+	begin = GetMonotonicTime100ns();
+	for (int i = 0; i < warmRuns; ++i) {
+		CCapabilityCache warmCache;
+		warmCache.Load(path);
+		warmActivations += EnumStandInDevices(devices, warmCache, warm);
+		warmCache.Save(path); // nothing changed: no write
+	}
+	double warmMs = GetElapsedMs(begin) / warmRuns;
+
+	// one device got a new driver: only that one is activated again
+	devices[0].info.fingerprint ^= 1;
+	begin = GetMonotonicTime100ns();
+	CCapabilityCache changedCache;
+	changedCache.Load(path);
+	uint32_t changedActivations = EnumStandInDevices(devices, changedCache, warm);
+	changedCache.Save(path);
+	double changedMs = GetElapsedMs(begin);
+
+	size_t capCount = 0;
+	for (const auto &caps : cold)
+		capCount += caps.size();
+
+	printf("capcache: %u devices, %u capabilities \n", (uint32_t)devices.size(), (uint32_t)capCount);
+	printf("\tcold:    %9.3f ms, %u activations \n", coldMs, coldActivations);
+	printf("\twarm:    %9.3f ms, %u activations (avg of %d runs, %.0fx faster) \n", warmMs, warmActivations, warmRuns, warmMs > 0 ? coldMs / warmMs : 0.0);
+	printf("\tchanged: %9.3f ms, %u activations \n", changedMs, changedActivations);
+
+	remove(path);
+}
+
+//---------------------------------------------------------------------------------------------
+// 10ms packets of a 44.1k int16 stereo microphone, normalized to 48k float stereo
+static void BenchAudioConverter()
+{
+	MediaFormat input;
+	input.video = false;
+	input.subtype = MEDIA_SUBTYPE_PCM;
+	input.channels = 2;
+	input.sampleRate = 44100;
+	input.bitsPerSample = 16;
+
+	MediaFormat output = input;
+	output.subtype = MEDIA_SUBTYPE_FLOAT;
+	output.sampleRate = 48000;
+	output.bitsPerSample = 32;
+
+	const uint32_t frames = input.sampleRate / 100;
+	std::vector<int16_t> packet(frames * input.channels);
+	for (uint32_t i = 0; i < frames; ++i) {
+		int16_t value = (int16_t)(16000.0 * sin(2.0 * 3.14159265358979 * 1000.0 * i / input.sampleRate));
+		packet[i * 2] = value;
+		packet[i * 2 + 1] = value;
+	}
+
+	const int packets = 2000; // 20s of audio
+	printf("audio: %u Hz %u bit %u ch -> %u Hz float %u ch, %d packets of %u frames \n", input.sampleRate, input.bitsPerSample, input.channels, output.sampleRate,
+	       output.channels, packets, frames);
+
+	for (int level = SIMD_SCALAR; level <= (int)GetCpuSimdLevel(); ++level) {
+		CAudioConverter converter;
+		if (!converter.Init(input, output, (SimdLevel)level)) {
+			printf("\tinit failed \n");
+			return;
+		}
+
+		const uint32_t size = (uint32_t)(packet.size() * sizeof(int16_t));
+		std::vector<uint8_t> buffer(converter.GetMaxOutputSize(size));
+		uint64_t outBytes = 0;
+
+		int64_t begin = GetMonotonicTime100ns();
+		for (int i = 0; i < packets; ++i)
+			outBytes += converter.Convert((const uint8_t *)packet.data(), size, buffer.data(), (uint32_t)buffer.size());
+		double ms = GetElapsedMs(begin);
+
+		const double inFrames = double(frames) * packets;
+		printf("\t%-6s %8.3f ms, %6.2f ns/frame, %8.1f MB/s in, %.0fx realtime, %llu bytes out \n", GetSimdLevelString((SimdLevel)level), ms, ms * 1e6 / inFrames,
+		       double(size) * packets / (ms * 1000.0), inFrames / input.sampleRate * 1000.0 / ms, (unsigned long long)outBytes);
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+// OnVideoData without zero copy: the locked device buffer is copied into a pooled frame, rows are packed to the default stride
+static void BenchFrameCopy()
+{
+	static const struct {
+		const char *label;
+		uint32_t subtype;
+		uint32_t padding;  // bytes added to each row, as drivers align the pitch
+		bool bottomUp;     // negative stride, see GetDefaultStride
+	} layouts[] = {
+		{"nv12 tight", MEDIA_SUBTYPE_NV12, 0, false},
+		{"nv12 pitch +64", MEDIA_SUBTYPE_NV12, 64, false},
+		{"yuy2 tight", MEDIA_SUBTYPE_YUY2, 0, false},
+		{"rgb32 bottom-up", MEDIA_SUBTYPE_RGB32, 0, true},
+	};
+
+	CRefPtr<CFramePool> pool = CFramePool::Create(4);
+	printf("copy: device buffer -> pooled frame \n");
+	for (const auto &layout : layouts) {
+		for (const auto &res : g_resolutions) {
+			MediaFormat format;
+			format.subtype = layout.subtype;
+			format.width = res.width;
+			format.height = res.height;
+
+			int32_t stride = GetVideoDefaultStride(format) + (int32_t)layout.padding;
+			if (layout.bottomUp)
+				stride = -stride;
+
+			std::vector<uint8_t> memory;
+			MediaSample sample;
+			sample.format = &format;
+			sample.planeCount = CreateDeviceFrame(format, stride, memory, sample.planes);
+
+			double ns = MeasureNs([&]() { pool->CopySample(sample); });
+			PrintFrameResult(layout.label, res.width, res.height, GetVideoFrameSize(format), ns);
+		}
+	}
+}
+
+// CVideoConverter for every native type we convert, at every simd level the cpu has
+static void BenchConvert()
+{
+	static const struct {
+		const char *name;
+		uint32_t subtype;
+	} subtypes[] = {
+		{"yuy2", MEDIA_SUBTYPE_YUY2}, {"uyvy", MEDIA_SUBTYPE_UYVY}, {"i420", MEDIA_SUBTYPE_I420}, {"rgb32", MEDIA_SUBTYPE_RGB32}, {"rgb24", MEDIA_SUBTYPE_RGB24},
+		{"p010", MEDIA_SUBTYPE_P010}, {"y210", MEDIA_SUBTYPE_Y210}, {"v210", MEDIA_SUBTYPE_V210},
+	};
+
+	printf("convert: -> nv12, MB/s of the source \n");
+	for (const auto &type : subtypes) {
+		for (const auto &res : g_resolutions) {
+			MediaFormat format;
+			format.subtype = type.subtype;
+			format.width = res.width;
+			format.height = res.height;
+
+			std::vector<uint8_t> memory;
+			MediaPlane planes[MEDIA_MAX_PLANES];
+			CreateDeviceFrame(format, GetVideoDefaultStride(format), memory, planes);
+			std::vector<uint8_t> nv12(res.width * res.height * 3 / 2);
+
+			for (int level = SIMD_SCALAR; level <= (int)GetCpuSimdLevel(); ++level) {
+				CVideoConverter converter;
+				if (!converter.Init(type.subtype, (SimdLevel)level))
+					continue;
+
+				uint8_t *dstY = nv12.data();
+				uint8_t *dstUV = dstY + res.width * res.height;
+				double ns = MeasureNs([&]() { converter.Convert(planes, res.width, res.height, dstY, (int32_t)res.width, dstUV, (int32_t)res.width); });
+
+				char label[32];
+				snprintf(label, sizeof(label), "%s %s", type.name, GetSimdLevelString((SimdLevel)level));
+				PrintFrameResult(label, res.width, res.height, GetVideoFrameSize(format), ns);
+			}
+		}
+	}
+
+	// 10 bit devices kept at 10 bit
+	printf("convert: -> p010, MB/s of the source \n");
+	for (const auto &type : subtypes) {
+		if (type.subtype != MEDIA_SUBTYPE_Y210 && type.subtype != MEDIA_SUBTYPE_V210)
+			continue;
+
+		for (const auto &res : g_resolutions) {
+			MediaFormat format;
+			format.subtype = type.subtype;
+			format.width = res.width;
+			format.height = res.height;
+
+			std::vector<uint8_t> memory;
+			MediaPlane planes[MEDIA_MAX_PLANES];
+			CreateDeviceFrame(format, GetVideoDefaultStride(format), memory, planes);
+			std::vector<uint8_t> p010(res.width * res.height * 3);
+
+			for (int level = SIMD_SCALAR; level <= (int)GetCpuSimdLevel(); ++level) {
+				CDepthConverter converter;
+				if (!converter.Init(type.subtype, MEDIA_SUBTYPE_P010, (SimdLevel)level))
+					continue;
+
+				uint8_t *dstY = p010.data();
+				uint8_t *dstUV = dstY + res.width * res.height * 2;
+				double ns = MeasureNs([&]() { converter.Convert(planes, res.width, res.height, dstY, (int32_t)res.width * 2, dstUV, (int32_t)res.width * 2); });
+
+				char label[32];
+				snprintf(label, sizeof(label), "%s %s", type.name, GetSimdLevelString((SimdLevel)level));
+				PrintFrameResult(label, res.width, res.height, GetVideoFrameSize(format), ns);
+			}
+		}
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+// simulcast renditions of one nv12 frame: all in one pass vs. each one scaled from the source on its own
+static void BenchScale()
+{
+	static const struct {
+		uint32_t width;
+		uint32_t height;
+		uint32_t count;
+		ScaleRendition renditions[3];
+	} sets[] = {
+		{1280, 720, 3, {{1280, 720}, {640, 360}, {320, 180}}},
+		{1920, 1080, 3, {{1280, 720}, {640, 360}, {320, 180}}},
+		{1920, 1080, 3, {{960, 540}, {480, 270}, {240, 134}}},
+		{3840, 2160, 3, {{1920, 1080}, {960, 540}, {480, 270}}},
+	};
+
+	printf("scale: nv12 -> renditions, MB/s of the source \n");
+	for (const auto &set : sets) {
+		MediaFormat format;
+		format.video = true;
+		format.subtype = MEDIA_SUBTYPE_NV12;
+		format.width = set.width;
+		format.height = set.height;
+
+		std::vector<uint8_t> memory;
+		MediaPlane planes[MEDIA_MAX_PLANES];
+		CreateDeviceFrame(format, GetVideoDefaultStride(format), memory, planes);
+
+		std::vector<std::vector<uint8_t>> outputs(set.count);
+		uint8_t *dst[SCALE_MAX_RENDITIONS] = {};
+		for (uint32_t i = 0; i < set.count; ++i) {
+			outputs[i].resize(set.renditions[i].width * set.renditions[i].height * 3 / 2);
+			dst[i] = outputs[i].data();
+		}
+
+		printf("\t%ux%u ->", set.width, set.height);
+		for (uint32_t i = 0; i < set.count; ++i)
+			printf(" %ux%u", set.renditions[i].width, set.renditions[i].height);
+		printf(" \n");
+
+		for (int level = SIMD_SCALAR; level <= (int)GetCpuSimdLevel(); ++level) {
+			CVideoScaler pyramid;
+			CVideoScaler single[3];
+			pyramid.Init(set.width, set.height, set.renditions, set.count, (SimdLevel)level);
+			for (uint32_t i = 0; i < set.count; ++i)
+				single[i].Init(set.width, set.height, &set.renditions[i], 1, (SimdLevel)level);
+
+			double ns = MeasureNs([&]() { pyramid.Scale(planes, dst); });
+			char label[32];
+			snprintf(label, sizeof(label), "one pass %s", GetSimdLevelString((SimdLevel)level));
+			PrintFrameResult(label, set.width, set.height, GetVideoFrameSize(format), ns);
+
+			ns = MeasureNs([&]() {
+				for (uint32_t i = 0; i < set.count; ++i)
+					single[i].Scale(planes, &dst[i]);
+			});
+			snprintf(label, sizeof(label), "separate %s", GetSimdLevelString((SimdLevel)level));
+			PrintFrameResult(label, set.width, set.height, GetVideoFrameSize(format), ns);
+		}
+	}
+}
+
+// a stage which does nothing, what is left is the fork/join of a frame
+class CEmptyStage : public ITileStage {
+public:
+	void RunRows(uint32_t /*rowBegin*/, uint32_t /*rowEnd*/, uint32_t /*worker*/) override {}
+};
+
+// CTileExecutor at 4k for 1, 2, 4, ... threads. efficiency: speedup / threads
+static void BenchTiling()
+{
+	MediaFormat nv12;
+	nv12.video = true;
+	nv12.subtype = MEDIA_SUBTYPE_NV12;
+	nv12.width = 3840;
+	nv12.height = 2160;
+
+	MediaFormat yuy2 = nv12;
+	yuy2.subtype = MEDIA_SUBTYPE_YUY2;
+
+	// as a driver hands out 4k nv12, with an aligned pitch
+	std::vector<uint8_t> nv12Memory;
+	MediaSample nv12Sample;
+	nv12Sample.format = &nv12;
+	nv12Sample.planeCount = CreateDeviceFrame(nv12, GetVideoDefaultStride(nv12) + 64, nv12Memory, nv12Sample.planes);
+
+	std::vector<uint8_t> yuy2Memory;
+	MediaPlane yuy2Planes[MEDIA_MAX_PLANES];
+	CreateDeviceFrame(yuy2, GetVideoDefaultStride(yuy2), yuy2Memory, yuy2Planes);
+
+	CVideoConverter converter;
+	converter.Init(MEDIA_SUBTYPE_YUY2);
+	std::vector<uint8_t> output(GetVideoFrameSize(nv12));
+	const int32_t stride = GetVideoDefaultStride(nv12);
+
+	const ScaleRendition renditions[] = {{1920, 1080}, {1280, 720}, {640, 360}};
+	std::vector<std::vector<uint8_t>> scaled(3);
+	uint8_t *dst[SCALE_MAX_RENDITIONS] = {};
+	for (uint32_t i = 0; i < 3; ++i) {
+		scaled[i].resize(renditions[i].width * renditions[i].height * 3 / 2);
+		dst[i] = scaled[i].data();
+	}
+	CVideoScaler scaler;
+	scaler.Init(nv12.width, nv12.height, renditions, 3);
+
+	std::vector<uint32_t> counts;
+	const uint32_t cpus = (std::max)(std::thread::hardware_concurrency(), 1u);
+	for (uint32_t threads = 1; threads < cpus; threads *= 2)
+		counts.push_back(threads);
+	counts.push_back(cpus);
+
+	CRefPtr<CFramePool> pool = CFramePool::Create(4);
+	printf("tiling: %ux%u in bands, %u cpus \n", nv12.width, nv12.height, cpus);
+
+	double base[4] = {};
+	for (uint32_t threads : counts) {
+		TileExecutorOptions options;
+		options.threads = threads;
+		CTileExecutor tiles;
+		tiles.Start(options);
+		scaler.SetExecutor(&tiles);
+
+		CEmptyStage empty;
+		const double ns[4] = {
+			MeasureNs([&]() { tiles.CopySample(pool.Get(), nv12Sample); }),
+			MeasureNs([&]() { tiles.Convert(converter, yuy2Planes, yuy2, output.data(), stride, output.data() + stride * nv12.height, stride); }),
+			MeasureNs([&]() { scaler.Scale(nv12Sample.planes, dst); }),
+			MeasureNs([&]() { tiles.Run(&empty, nv12); }),
+		};
+		static const char *labels[4] = {"copy nv12 pitch +64", "convert yuy2", "scale 3 renditions", "fork/join"};
+
+		for (uint32_t i = 0; i < 4; ++i) {
+			if (threads == 1)
+				base[i] = ns[i];
+			const double speedup = base[i] / ns[i];
+			printf("\t%-22s %2u threads %12.0f ns/frame %6.2fx, efficiency %3.0f%% \n", labels[i], threads, ns[i], speedup, speedup * 100.0 / threads);
+		}
+		printf("\t%-22s %u rows per band \n", "", tiles.GetBandRows(nv12));
+		scaler.SetExecutor(nullptr);
+	}
+}
+
+// a consumer which reads a byte of every row, `sleepMs` stands in for an encoder which falls behind
+class CReadingSubscriber : public IFrameSubscriber {
+public:
+	void SetSleep(uint32_t sleepMs) { m_sleepMs = sleepMs; }
+
+	void OnFrame(const CMediaFrame *frame) override
+	{
+		const MediaSample &sample = frame->GetSample();
+		uint32_t rowBytes[MEDIA_MAX_PLANES];
+		uint32_t rows[MEDIA_MAX_PLANES];
+		const uint32_t planes = GetVideoPlaneRows(frame->GetFormat(), rowBytes, rows);
+		for (uint32_t i = 0; i < planes && i < sample.planeCount; ++i) {
+			for (uint32_t y = 0; y < rows[i]; ++y)
+				m_checksum += sample.planes[i].data[(ptrdiff_t)y * sample.planes[i].stride];
+		}
+		if (m_sleepMs)
+			std::this_thread::sleep_for(std::chrono::milliseconds(m_sleepMs));
+	}
+
+private:
+	uint32_t m_sleepMs = 0;
+	uint32_t m_checksum = 0;
+};
+
+// one 1080p nv12 frame for four consumers: a copy for each of them against one copy which CFramePublisher shares
+static void BenchFanOut()
+{
+	MediaFormat format;
+	format.video = true;
+	format.subtype = MEDIA_SUBTYPE_NV12;
+	format.width = 1920;
+	format.height = 1080;
+
+	std::vector<uint8_t> memory;
+	MediaSample sample;
+	sample.format = &format;
+	sample.planeCount = CreateDeviceFrame(format, GetVideoDefaultStride(format), memory, sample.planes);
+
+	static const struct {
+		const char *name;
+		BackpressurePolicy policy;
+		uint32_t capacity;
+		uint32_t blockTimeoutMs;
+		uint32_t sleepMs;
+	} subscribers[] = {
+		{"recorder", BACKPRESSURE_BLOCK, 8, 50, 0},
+		{"preview", BACKPRESSURE_KEEP_LATEST, 1, 0, 0},
+		{"analytics", BACKPRESSURE_DROP_OLDEST, 2, 0, 0},
+		{"encoder", BACKPRESSURE_BLOCK, 4, 100, 40},
+	};
+
+	CReadingSubscriber sinks[4];
+	CFramePublisher publisher;
+	for (uint32_t i = 0; i < 4; ++i) {
+		sinks[i].SetSleep(subscribers[i].sleepMs);
+		BackpressureOptions options;
+		options.policy = subscribers[i].policy;
+		options.capacity = subscribers[i].capacity;
+		options.blockTimeoutMs = subscribers[i].blockTimeoutMs;
+		publisher.Subscribe(subscribers[i].name, &sinks[i], options);
+	}
+
+	printf("fanout: nv12 %ux%u to %u consumers, source thread per frame \n", format.width, format.height, publisher.GetSubscriberCount());
+
+	CRefPtr<CFramePool> copies = CFramePool::Create(4);
+	double ns = MeasureNs([&]() {
+		for (uint32_t i = 0; i < 4; ++i)
+			copies->CopySample(sample);
+	});
+	PrintFrameResult("copy per consumer", format.width, format.height, GetVideoFrameSize(format) * 4, ns);
+
+	// the source copies once, the queues share the frame
+	CRefPtr<CFramePool> pool = CFramePool::Create(publisher.GetFramesInFlight() + 1);
+	publisher.Start();
+	uint64_t exhausted = 0;
+	ns = MeasureNs([&]() {
+		FramePtr frame = pool->CopySample(sample);
+		if (frame)
+			publisher.OnMediaFrame(frame.Get());
+		else
+			++exhausted;
+	});
+	PrintFrameResult("publish", format.width, format.height, GetVideoFrameSize(format), ns);
+
+	// at 60 fps for a second, the slow encoder waits and drops on threads of its own, the source never waits
+	auto next = std::chrono::steady_clock::now();
+	int64_t maxPublishNs = 0;
+	for (uint32_t tick = 0; tick < 60; ++tick) {
+		FramePtr frame = pool->CopySample(sample);
+		const int64_t begin = GetMonotonicTimeNs();
+		if (frame)
+			publisher.OnMediaFrame(frame.Get());
+		else
+			++exhausted;
+		maxPublishNs = (std::max)(maxPublishNs, GetMonotonicTimeNs() - begin);
+		next += std::chrono::microseconds(16667);
+		std::this_thread::sleep_until(next);
+	}
+	publisher.Stop();
+
+	printf("\tpublished %llu, pool exhausted %llu, longest publish %.3fms \n", (unsigned long long)publisher.GetPublished(), (unsigned long long)exhausted,
+	       maxPublishNs / 1e6);
+	for (uint32_t i = 0; i < publisher.GetSubscriberCount(); ++i) {
+		const SubscriberStats stats = publisher.GetSubscriberStats(i);
+		printf("\t%-10s %-12s delivered %6llu, dropped %6llu, blocked %4llu, max depth %u, mean %.2fms \n", publisher.GetSubscriberName(i).c_str(),
+		       GetBackpressurePolicyString(subscribers[i].policy), (unsigned long long)stats.delivered, (unsigned long long)stats.queue.GetDropped(),
+		       (unsigned long long)stats.queue.blocked, stats.queue.maxDepth, stats.delivered ? stats.totalNs / 1e6 / stats.delivered : 0.0);
+	}
+}
+
+// CChangeDetector on a frame equal to the reference, the worst case since every block is compared
+static void BenchChange()
+{
+	printf("change: nv12 luma against the last changed frame \n");
+	for (const auto &res : g_resolutions) {
+		MediaFormat format;
+		format.subtype = MEDIA_SUBTYPE_NV12;
+		format.width = res.width;
+		format.height = res.height;
+
+		std::vector<uint8_t> memory;
+		MediaSample sample;
+		sample.format = &format;
+		sample.planeCount = CreateDeviceFrame(format, GetVideoDefaultStride(format), memory, sample.planes);
+
+		for (int level = SIMD_SCALAR; level <= (int)GetCpuSimdLevel(); ++level) {
+			CChangeDetector detector;
+			detector.Init(ChangeDetectorOptions(), (SimdLevel)level);
+			detector.IsChanged(sample);
+
+			double ns = MeasureNs([&]() { detector.IsChanged(sample); });
+			PrintFrameResult(GetSimdLevelString((SimdLevel)level), res.width, res.height, res.width * res.height, ns);
+		}
+	}
+}
+
+// CLosslessCodec on one thread. the device pattern of CreateDeviceFrame would compress to nothing, so the frame is
+// a smooth image with +-2 of noise, roughly what a webcam gives in good light
+static void BenchLossless()
+{
+	printf("lossless: nv12 -> mflz -> nv12, MB/s of the raw frame \n");
+	for (const auto &res : g_resolutions) {
+		MediaFormat format;
+		format.subtype = MEDIA_SUBTYPE_NV12;
+		format.width = res.width;
+		format.height = res.height;
+
+		std::vector<uint8_t> memory(GetVideoFrameSize(format));
+		uint32_t noise = 1;
+		for (uint32_t y = 0; y < res.height * 3 / 2; ++y) {
+			for (uint32_t x = 0; x < res.width; ++x) {
+				noise = noise * 1664525 + 1013904223;
+				memory[(size_t)y * res.width + x] = uint8_t(128 + 60 * sin(x * 0.02) * cos(y * 0.03) + int((noise >> 24) % 5) - 2);
+			}
+		}
+
+		MediaPlane planes[MEDIA_MAX_PLANES];
+		DescribeVideoPlanes(format, memory.data(), GetVideoDefaultStride(format), planes);
+		std::vector<uint8_t> encoded(CLosslessCodec::GetMaxEncodedSize(res.width, res.height));
+		std::vector<uint8_t> decoded(memory.size());
+
+		for (int level = SIMD_SCALAR; level <= (int)GetCpuSimdLevel(); ++level) {
+			CLosslessCodec codec;
+			codec.Start(1, (SimdLevel)level);
+
+			uint32_t size = 0;
+			double ns = MeasureNs([&]() { size = codec.Encode(planes, res.width, res.height, encoded.data(), (uint32_t)encoded.size()); });
+			char label[32];
+			snprintf(label, sizeof(label), "encode %s", GetSimdLevelString((SimdLevel)level));
+			PrintFrameResult(label, res.width, res.height, memory.size(), ns);
+
+			ns = MeasureNs([&]() {
+				codec.Decode(encoded.data(), size, res.width, res.height, decoded.data(), (int32_t)res.width, decoded.data() + (size_t)res.width * res.height, (int32_t)res.width);
+			});
+			snprintf(label, sizeof(label), "decode %s", GetSimdLevelString((SimdLevel)level));
+			PrintFrameResult(label, res.width, res.height, memory.size(), ns);
+
+			const bool same = memcmp(decoded.data(), memory.data(), memory.size()) == 0;
+			printf("\t%-22s ratio %.2f%s \n", "", size ? double(memory.size()) / size : 0.0, same ? "" : ", DECODED FRAME DIFFERS");
+		}
+	}
+}
+
+// raw dump as the pipeline writes it: the capture thread only enqueues, the time includes Close, i.e. the data is on disk.
+// returns ns per frame, `enqueueNs` is what the capture thread spent per frame
+static double MeasureWrite(CFramePool *pool, const MediaFormat &format, uint32_t size, uint64_t frames, double &enqueueNs)
+{
+	const char *path = "bench-write.mfc";
+
+	FramePtr frame = pool->Acquire(size);
+	if (!frame)
+		return 0.0;
+	memset(frame->GetBuffer(), 0x80, size);
+	frame->SetSample(format, 0, 0, size);
+
+	CContainerWriter writer;
+	int64_t enqueueTotal = 0;
+	const int64_t begin = GetMonotonicTimeNs();
+	if (!writer.Open(path, format))
+		return 0.0;
+	for (uint64_t i = 0; i < frames; ++i) {
+		// the same frame over and over, only the disk is measured. a full queue is waited out, the
+		// capture thread would drop the frame instead, so only the accepted Write counts for it
+		for (;;) {
+			const int64_t enqueue = GetMonotonicTimeNs();
+			if (writer.Write(frame.Get())) {
+				enqueueTotal += GetMonotonicTimeNs() - enqueue;
+				break;
+			}
+			std::this_thread::yield();
+		}
+	}
+	writer.Close();
+	const double ns = double(GetMonotonicTimeNs() - begin) / double(frames);
+
+	remove(path);
+	enqueueNs = double(enqueueTotal) / double(frames);
+	return ns;
+}
+
+static void BenchWrite()
+{
+	const uint64_t target = 256ull * 1024 * 1024; // bytes per measurement
+
+	CRefPtr<CFramePool> pool = CFramePool::Create(1);
+	printf("write: frames -> container, %llu MB each \n", (unsigned long long)(target >> 20));
+	for (const auto &res : g_resolutions) {
+		MediaFormat format;
+		format.subtype = MEDIA_SUBTYPE_NV12;
+		format.width = res.width;
+		format.height = res.height;
+
+		const uint32_t size = GetVideoFrameSize(format);
+		double enqueueNs = 0.0;
+		double ns = MeasureWrite(pool.Get(), format, size, (std::max)(target / size, (uint64_t)16), enqueueNs);
+		PrintFrameResult("nv12", res.width, res.height, size, ns);
+		printf("\t%-22s %9s %12.0f ns/frame on the capture thread \n", "", "", enqueueNs);
+	}
+
+	// 10ms packets of 48k int16 stereo
+	MediaFormat audio;
+	audio.video = false;
+	audio.subtype = MEDIA_SUBTYPE_PCM;
+	audio.channels = 2;
+	audio.sampleRate = 48000;
+	audio.bitsPerSample = 16;
+
+	const uint32_t size = audio.sampleRate / 100 * audio.channels * audio.bitsPerSample / 8;
+	double enqueueNs = 0.0;
+	double ns = MeasureWrite(pool.Get(), audio, size, 100000, enqueueNs);
+	printf("\t%-22s %9s %12.0f ns/packet %10.1f MB/s, %.0f ns/packet on the capture thread \n", "pcm 10ms", "", ns, double(size) * 1000.0 / ns, enqueueNs);
+}
+
+//---------------------------------------------------------------------------------------------
+// recorded MJPG frames (a container of MJPG records, e.g. a camera's frames or a jpeg sequence) -> NV12 on 1..n threads
+static void BenchMjpegFrames(const char *source, const std::vector<std::vector<uint8_t>> &frames, uint32_t width, uint32_t height, double frameMs)
+{
+	std::vector<uint8_t> output(width * height * 3 / 2);
+	uint8_t *dstY = output.data();
+	uint8_t *dstUV = dstY + width * height;
+	uint64_t bytes = 0;
+	for (const std::vector<uint8_t> &frame : frames)
+		bytes += frame.size();
+
+	printf("mjpeg: %u frames of %s -> nv12, %.1fms per frame \n", (uint32_t)frames.size(), source, frameMs);
+	// powers of two up to the cpu count, and the cpu count
+	std::vector<uint32_t> counts;
+	const uint32_t cpus = (std::max)(std::thread::hardware_concurrency(), 1u);
+	for (uint32_t threads = 1; threads < cpus; threads *= 2)
+		counts.push_back(threads);
+	counts.push_back(cpus);
+
+	for (uint32_t threads : counts) {
+		CJpegDecoder decoder;
+		decoder.Start(threads);
+		const double ns = MeasureNs([&]() {
+			for (const std::vector<uint8_t> &frame : frames)
+				decoder.Decode(frame.data(), (uint32_t)frame.size(), width, height, dstY, width, dstUV, width);
+		}) / frames.size();
+
+		const JpegDecoderStats stats = decoder.GetStats();
+		char label[32];
+		snprintf(label, sizeof(label), "%u threads", threads);
+		PrintFrameResult(label, width, height, bytes / frames.size(), ns);
+		printf("\t%-22s %9s errors %llu, split on restart markers %llu of %llu, max %.2fms \n", "", "", (unsigned long long)stats.errors, (unsigned long long)stats.segmented,
+		       (unsigned long long)stats.frames, stats.maxNs / 1e6);
+	}
+}
+
+// a recording in mjpeg.mfc if there is one, else 4:2:2 frames of a moving pattern with camera like noise, once as one
+// entropy coded segment and once with a restart marker per mcu row
+static void BenchMjpeg()
+{
+	const char *path = "mjpeg.mfc";
+	CContainerReader reader;
+	if (reader.Open(path) && reader.GetFormat().subtype == MEDIA_SUBTYPE_MJPG && reader.GetFrameCount()) {
+		const MediaFormat &format = reader.GetFormat();
+		std::vector<std::vector<uint8_t>> frames;
+		for (uint32_t i = 0; i < (std::min)(reader.GetFrameCount(), (uint64_t)300); ++i) {
+			MediaSample sample;
+			if (reader.GetFrame(i, sample))
+				frames.emplace_back(sample.planes[0].data, sample.planes[0].data + sample.planes[0].size);
+		}
+		BenchMjpegFrames(path, frames, format.width, format.height, format.fpsNum ? 1000.0 * format.fpsDen / format.fpsNum : 0.0);
+		return;
+	}
+
+	const uint32_t width = 1280, height = 720, count = 30;
+	std::vector<uint8_t> y(width * height), u(width / 2 * height), v(width / 2 * height);
+	const MediaPlane planes[3] = {{y.data(), (int32_t)width, 0}, {u.data(), (int32_t)width / 2, 0}, {v.data(), (int32_t)width / 2, 0}};
+	for (uint32_t restartInterval : {0u, width / 16}) {
+		JpegEncodeOptions options;
+		options.restartInterval = restartInterval;
+		std::vector<std::vector<uint8_t>> frames(count);
+		uint32_t noise = 12345;
+		for (uint32_t i = 0; i < count; ++i) {
+			for (uint32_t row = 0; row < height; ++row) {
+				for (uint32_t col = 0; col < width; ++col) {
+					noise = noise * 1664525 + 1013904223;
+					y[row * width + col] = uint8_t((col + i * 8) / 5 + ((row + i * 4) / 40 % 2) * 48 + (noise >> 29));
+				}
+				for (uint32_t col = 0; col < width / 2; ++col) {
+					u[row * width / 2 + col] = uint8_t(96 + (col + i * 4) % 64);
+					v[row * width / 2 + col] = uint8_t(160 - row % 64);
+				}
+			}
+			EncodeJpeg(planes, width, height, options, frames[i]);
+		}
+		BenchMjpegFrames(restartInterval ? "generated 4:2:2, restart per mcu row" : "generated 4:2:2", frames, width, height, 1000.0 / 30);
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+// cost of one Record on the capture thread, and of a snapshot on the polling thread
+static void BenchHistogram()
+{
+	std::unique_ptr<CHistogram> histogram(new CHistogram());
+
+	const uint32_t count = 10000000;
+	uint64_t value = 12345;
+	int64_t begin = GetMonotonicTimeNs();
+	for (uint32_t i = 0; i < count; ++i) {
+		value = value * 6364136223846793005ULL + 1442695040888963407ULL;
+		histogram->Record((value >> 40) & 0xFFFFF); // up to 1ms in ns
+	}
+	double recordNs = double(GetMonotonicTimeNs() - begin) / count;
+
+	const int snapshots = 1000;
+	HistogramSnapshot snapshot;
+	begin = GetMonotonicTimeNs();
+	for (int i = 0; i < snapshots; ++i)
+		histogram->GetSnapshot(snapshot);
+	double snapshotUs = double(GetMonotonicTimeNs() - begin) / snapshots / 1000.0;
+
+	printf("histogram: %u buckets, %u records \n", (uint32_t)HISTOGRAM_BUCKETS, count);
+	printf("\trecord:   %6.2f ns \n", recordNs);
+	printf("\tsnapshot: %6.2f us, p50 %llu p99 %llu max %llu \n", snapshotUs, (unsigned long long)snapshot.GetPercentile(50), (unsigned long long)snapshot.GetPercentile(99),
+	       (unsigned long long)snapshot.max);
+}
+
+//---------------------------------------------------------------------------------------------
+// 720p30 yuy2 cameras converted to nv12 on the shared pool, no dumps. streams per core: sessions / busy workers
+static void BenchSessions()
+{
+	MediaFormat format;
+	format.video = true;
+	format.subtype = MEDIA_SUBTYPE_YUY2;
+	format.width = 1280;
+	format.height = 720;
+	format.fpsNum = 30;
+	format.fpsDen = 1;
+
+	printf("sessions: yuy2 %ux%u@%u -> nv12, %u cpus \n", format.width, format.height, format.fpsNum, std::thread::hardware_concurrency());
+	const uint32_t counts[] = {1, 2, 4, 8, 16};
+	for (uint32_t count : counts) {
+		CCaptureManager manager;
+		for (uint32_t i = 0; i < count; ++i)
+			manager.AddSession("synthetic", std::make_shared<CSyntheticSource>(format, true));
+
+		manager.Start();
+		std::this_thread::sleep_for(std::chrono::seconds(2));
+		manager.Stop();
+
+		const CaptureManagerStats stats = manager.GetStats();
+		printf("\t%2u sessions: %7.1f frames/s, dropped %5llu, load %5.2f, streams per core %6.1f \n", count, stats.framesPerSecond, (unsigned long long)stats.dropped,
+		       stats.load, stats.load > 0.0 ? count / stats.load : 0.0);
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+int RunBenchmarks(int argc, char **argv)
+{
+	static const struct {
+		const char *name;
+		void (*func)();
+	} benchmarks[] = {
+		{"copy", BenchFrameCopy},
+		{"convert", BenchConvert},
+		{"scale", BenchScale},
+		{"tiling", BenchTiling},
+		{"fanout", BenchFanOut},
+		{"change", BenchChange},
+		{"write", BenchWrite},
+		{"lossless", BenchLossless},
+		{"capcache", BenchCapabilityCache},
+		{"mjpeg", BenchMjpeg},
+		{"audio", BenchAudioConverter},
+		{"histogram", BenchHistogram},
+		{"sessions", BenchSessions},
+	};
+
+	int count = 0;
+	for (const auto &bench : benchmarks) {
+		bool selected = argc <= 0;
+		for (int i = 0; i < argc && !selected; ++i)
+			selected = strcmp(argv[i], bench.name) == 0;
+
+		if (selected) {
+			bench.func();
+			++count;
+		}
+	}
+
+	if (!count) {
+		printf("unknown benchmark, available:");
+		for (const auto &bench : benchmarks)
+			printf(" %s", bench.name);
+		printf("\n");
+		return 1;
+	}
+	return 0;
+}
+
+#ifdef MF_BENCH_STANDALONE
+int main(int argc, char **argv)
+{
+	return RunBenchmarks(argc - 1, argv + 1);
+}
+#endif
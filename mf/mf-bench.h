@@ -0,0 +1,7 @@
+﻿#pragma once
+// benchmarks of the portable parts of the capture pipeline, reported as ns/frame and MB/s.
+// windows: "mf.exe bench [name...]". linux, everything but main.cpp, mf-capture.cpp and mf-enum.cpp:
+//   g++ -std=c++14 -O2 -DMF_BENCH_STANDALONE $(ls mf-*.cpp | grep -v -e mf-capture -e mf-enum) -o mf-bench -pthread
+// without names every benchmark runs.
+
+int RunBenchmarks(int argc, char **argv);
@@ -0,0 +1,267 @@
+#include "mf-capcache.h"
+#include "mf-portable.hpp"
+#include <cstdio>
+#include <cstring>
+
+#define CAPCACHE_MAGIC MEDIA_FOURCC('M', 'F', 'C', 'C')
+#define CAPCACHE_VERSION 1
+#define CAPCACHE_CAP_FIELDS 15
+
+uint64_t HashBytes(const void *data, size_t size, uint64_t hash)
+{
+	const uint8_t *p = (const uint8_t *)data;
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= p[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// little endian, strings as utf-16 code units
+class CCacheWriter {
+public:
+	void U32(uint32_t v) { Bytes(&v, sizeof(v)); }
+	void U64(uint64_t v) { Bytes(&v, sizeof(v)); }
+	void String(const std::wstring &str)
+	{
+		U32((uint32_t)str.size());
+		for (wchar_t c : str) {
+			uint16_t unit = (uint16_t)c;
+			Bytes(&unit, sizeof(unit));
+		}
+	}
+	void Bytes(const void *data, size_t size) { m_buffer.insert(m_buffer.end(), (const uint8_t *)data, (const uint8_t *)data + size); }
+
+	std::vector<uint8_t> m_buffer;
+};
+
+class CCacheReader {
+public:
+	CCacheReader(const std::vector<uint8_t> &buffer) : m_buffer(buffer) {}
+
+	bool U32(uint32_t &v) { return Bytes(&v, sizeof(v)); }
+	bool U64(uint64_t &v) { return Bytes(&v, sizeof(v)); }
+	bool String(std::wstring &str)
+	{
+		uint32_t length = 0;
+		if (!U32(length) || length > GetRemaining() / sizeof(uint16_t))
+			return false;
+
+		str.resize(length);
+		for (uint32_t i = 0; i < length; ++i) {
+			uint16_t unit = 0;
+			Bytes(&unit, sizeof(unit));
+			str[i] = (wchar_t)unit;
+		}
+		return true;
+	}
+	bool Bytes(void *data, size_t size)
+	{
+		if (size > GetRemaining())
+			return false;
+		memcpy(data, m_buffer.data() + m_offset, size);
+		m_offset += size;
+		return true;
+	}
+	size_t GetRemaining() const { return m_buffer.size() - m_offset; }
+
+private:
+	const std::vector<uint8_t> &m_buffer;
+	size_t m_offset = 0;
+};
+
+//---------------------------------------------------------------------------------------------
+bool CCapabilityCache::Load(const char *path)
+{
+	Clear();
+
+	FILE *fp = OpenFile(path, "rb");
+	if (!fp)
+		return false;
+
+	std::vector<uint8_t> buffer;
+	uint8_t chunk[16 * 1024];
+	size_t read = 0;
+	while ((read = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+		buffer.insert(buffer.end(), chunk, chunk + read);
+	fclose(fp);
+
+	CCacheReader reader(buffer);
+	uint32_t magic = 0, version = 0, count = 0;
+	if (!reader.U32(magic) || !reader.U32(version) || !reader.U32(count) || magic != CAPCACHE_MAGIC || version != CAPCACHE_VERSION)
+		return false;
+
+	for (uint32_t i = 0; i < count; ++i) {
+		DeviceCapabilities device;
+		uint32_t video = 0, capCount = 0;
+		// a count the rest of the file cannot hold is a broken file, not an allocation
+		if (!reader.U32(video) || !reader.U64(device.fingerprint) || !reader.String(device.name) || !reader.String(device.path) || !reader.U32(capCount) ||
+		    capCount > reader.GetRemaining() / (CAPCACHE_CAP_FIELDS * sizeof(uint32_t))) {
+			Clear();
+			return false;
+		}
+		device.video = !!video;
+
+		device.caps.resize(capCount);
+		for (auto &cap : device.caps) {
+			uint32_t fields[CAPCACHE_CAP_FIELDS];
+			if (!reader.Bytes(fields, sizeof(fields))) {
+				Clear();
+				return false;
+			}
+
+			cap.format.video = !!fields[0];
+			cap.format.subtype = fields[1];
+			cap.format.width = fields[2];
+			cap.format.height = fields[3];
+			cap.format.fpsNum = fields[4];
+			cap.format.fpsDen = fields[5];
+			cap.format.channels = fields[6];
+			cap.format.sampleRate = fields[7];
+			cap.format.bitsPerSample = fields[8];
+			cap.stream = fields[9];
+			cap.index = fields[10];
+			cap.fpsMinNum = fields[11];
+			cap.fpsMinDen = fields[12];
+			cap.fpsMaxNum = fields[13];
+			cap.fpsMaxDen = fields[14];
+		}
+
+		std::wstring key = device.path;
+		m_devices[key] = std::move(device);
+	}
+
+	m_bDirty = false;
+	return true;
+}
+
+bool CCapabilityCache::Save(const char *path)
+{
+	if (!m_bDirty)
+		return true;
+
+	CCacheWriter writer;
+	writer.U32(CAPCACHE_MAGIC);
+	writer.U32(CAPCACHE_VERSION);
+	writer.U32((uint32_t)m_devices.size());
+
+	for (const auto &item : m_devices) {
+		const DeviceCapabilities &device = item.second;
+		writer.U32(device.video ? 1 : 0);
+		writer.U64(device.fingerprint);
+		writer.String(device.name);
+		writer.String(device.path);
+		writer.U32((uint32_t)device.caps.size());
+
+		for (const auto &cap : device.caps) {
+			const uint32_t fields[CAPCACHE_CAP_FIELDS] = {cap.format.video ? 1u : 0u,
+								      cap.format.subtype,
+								      cap.format.width,
+								      cap.format.height,
+								      cap.format.fpsNum,
+								      cap.format.fpsDen,
+								      cap.format.channels,
+								      cap.format.sampleRate,
+								      cap.format.bitsPerSample,
+								      cap.stream,
+								      cap.index,
+								      cap.fpsMinNum,
+								      cap.fpsMinDen,
+								      cap.fpsMaxNum,
+								      cap.fpsMaxDen};
+			writer.Bytes(fields, sizeof(fields));
+		}
+	}
+
+	// write a temporary file first, a crash while saving must not leave a half written cache
+	std::string temp = std::string(path) + ".tmp";
+	FILE *fp = OpenFile(temp.c_str(), "wb");
+	if (!fp)
+		return false;
+
+	bool ok = fwrite(writer.m_buffer.data(), 1, writer.m_buffer.size(), fp) == writer.m_buffer.size();
+	ok = (fclose(fp) == 0) && ok;
+	if (!ok) {
+		remove(temp.c_str());
+		return false;
+	}
+
+	remove(path); // rename does not replace an existing file on windows
+	if (rename(temp.c_str(), path) != 0)
+		return false;
+
+	m_bDirty = false;
+	return true;
+}
+
+const DeviceCapabilities *CCapabilityCache::Find(const std::wstring &path, uint64_t fingerprint) const
+{
+	auto iter = m_devices.find(path);
+	if (iter == m_devices.end() || iter->second.fingerprint != fingerprint)
+		return nullptr;
+	return &iter->second;
+}
+
+void CCapabilityCache::Update(const DeviceCapabilities &device)
+{
+	m_devices[device.path] = device;
+	m_bDirty = true;
+}
+
+void CCapabilityCache::Clear()
+{
+	m_bDirty = !m_devices.empty();
+	m_devices.clear();
+}
+
+//---------------------------------------------------------------------------------------------
+static std::string GetSubtypeString(const MediaFormat &format)
+{
+	if (!format.video) {
+		switch (format.subtype) {
+		case MEDIA_SUBTYPE_PCM:
+			return "PCM";
+		case MEDIA_SUBTYPE_FLOAT:
+			return "Float";
+		case 0x1610:
+			return "AAC";
+		case 0x55:
+			return "MP3";
+		default:
+			return std::to_string(format.subtype);
+		}
+	}
+
+	switch (format.subtype) {
+	case MEDIA_SUBTYPE_RGB24:
+		return "RGB24";
+	case MEDIA_SUBTYPE_ARGB32:
+		return "ARGB32";
+	case MEDIA_SUBTYPE_RGB32:
+		return "RGB32";
+	default:
+		break;
+	}
+
+	// fourcc
+	std::string str;
+	for (int i = 0; i < 4; ++i) {
+		char c = (char)((format.subtype >> (i * 8)) & 0xFF);
+		str += (c >= 0x20 && c < 0x7F) ? c : '?';
+	}
+	return str;
+}
+
+std::string GetCapabilityString(const DeviceCapability &cap)
+{
+	const MediaFormat &format = cap.format;
+	char text[256];
+	if (format.video) {
+		snprintf(text, sizeof(text), "stream[%u] mediaType[%u] >> %ux%u, Format=%s  fps:%u/%u (%.2ffps)", cap.stream + 1, cap.index + 1, format.width, format.height,
+			 GetSubtypeString(format).c_str(), format.fpsNum, format.fpsDen, format.fpsDen ? double(format.fpsNum) / double(format.fpsDen) : 0.0);
+	} else {
+		snprintf(text, sizeof(text), "stream[%u] mediaType[%u] >> chn=%u, Format=%s %uHZ %ubit", cap.stream + 1, cap.index + 1, format.channels, GetSubtypeString(format).c_str(),
+			 format.sampleRate, format.bitsPerSample);
+	}
+	return text;
+}
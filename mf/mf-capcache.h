@@ -0,0 +1,55 @@
+﻿#pragma once
+#include "mf-sample.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// one IMFMediaType of a device, as EnumCapability reports it.
+// the subtype is the Data1 of the GUID, like MediaFormat (all capture subtypes share the MFVideoFormat_Base tail).
+struct DeviceCapability {
+	MediaFormat format;
+	uint32_t stream = 0; // stream descriptor index
+	uint32_t index = 0;  // media type index, for IMFMediaTypeHandler::GetMediaTypeByIndex
+
+	// video devices may describe a frame rate range instead of a fixed rate, 0 if they do not
+	uint32_t fpsMinNum = 0;
+	uint32_t fpsMinDen = 0;
+	uint32_t fpsMaxNum = 0;
+	uint32_t fpsMaxDen = 0;
+};
+
+struct DeviceCapabilities {
+	bool video = true;
+	std::wstring name;
+	std::wstring path; // symbolic link, the key of the cache
+	uint64_t fingerprint = 0;
+	std::vector<DeviceCapability> caps;
+};
+
+// 64-bit FNV-1a, for fingerprints
+uint64_t HashBytes(const void *data, size_t size, uint64_t hash = 14695981039346656037ULL);
+
+// capabilities of the devices seen before, so that warm starts do not need to activate every device.
+// an entry is only used if the fingerprint still matches (computed from what is known without activation,
+// e.g. the attributes of the IMFActivate), otherwise the device is enumerated again and the entry replaced.
+class CCapabilityCache {
+public:
+	// a missing or broken file is an empty cache
+	bool Load(const char *path);
+	// only writes if something changed since Load
+	bool Save(const char *path);
+
+	const DeviceCapabilities *Find(const std::wstring &path, uint64_t fingerprint) const;
+	void Update(const DeviceCapabilities &device);
+	void Clear();
+
+	size_t GetCount() const { return m_devices.size(); }
+	bool IsDirty() const { return m_bDirty; }
+
+private:
+	std::unordered_map<std::wstring, DeviceCapabilities> m_devices;
+	bool m_bDirty = false;
+};
+
+// one line per capability, in the format of the enum log
+std::string GetCapabilityString(const DeviceCapability &cap);
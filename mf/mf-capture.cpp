@@ -1,18 +1,24 @@
 #include "mf-capture.h"
 #include "mf-util.hpp"
-#include <cmath>
+#include "mf-enum.h"
+#include <algorithm>
 #include <cstdio>
 #include <shlwapi.h> // for using QITAB
 
 #pragma comment(lib, "shlwapi.lib")
 
+// the pending ReadSample is cancelled by a flush, OnFlush normally comes right away
+#define CAPTURE_FLUSH_TIMEOUT_MS 500
+// MF_E_VIDEO_RECORDING_DEVICE_INVALIDATED
+#define CAPTURE_DEVICE_LOST ((HRESULT)0xc00d3ea2)
+
 ComPtr<CMFCapture> CMFCapture::CreateInstance(bool video, const WCHAR *name, const WCHAR *path)
 {
 	auto source = CreateMediaSource(video, name, path);
 	if (!source)
 		return nullptr;
 
-	CMFCapture *ins = new (std::nothrow) CMFCapture(source, video);
+	CMFCapture *ins = new (std::nothrow) CMFCapture(source, video, name, path);
 	if (!ins)
 		return nullptr;
 
@@ -21,28 +27,57 @@ ComPtr<CMFCapture> CMFCapture::CreateInstance(bool video, const WCHAR *name, con
 	return obj;
 }
 
-CMFCapture::CMFCapture(ComPtr<IMFMediaSource> source, bool video)
-	: m_pSource(source), m_bIsVideo(video), m_dwReaderStream(video ? (DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM : (DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM)
+CMFCapture::CMFCapture(ComPtr<IMFMediaSource> source, bool video, const WCHAR *name, const WCHAR *path)
+	: m_pSource(source), m_bIsVideo(video), m_dwReaderStream(video ? (DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM : (DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM),
+	  m_name(name ? name : L""), m_path(path), m_recovery(this, &m_metrics)
 {
+	m_request.video = video;
+	if (video) {
+		m_request.targetSubtype = DEST_VIDEO_SUBTYPE.Data1;
+		m_request.width = DEST_VIDEO_WIDTH;
+		m_request.height = DEST_VIDEO_HEIGHT;
+		m_request.fps = DEST_VIDEO_FPS;
+	}
+	m_hFlushed = CreateEvent(NULL, FALSE, FALSE, NULL);
 }
 
 CMFCapture::~CMFCapture()
 {
 	StopCapture();
+
+	// the reader leaves the source running on release, see StartCapture
+	if (m_pSource)
+		m_pSource->Shutdown();
+	if (m_hFlushed)
+		CloseHandle(m_hFlushed);
 }
 
-bool CMFCapture::StartCapture()
+bool CMFCapture::StartCapture(IMediaSink *sink)
 {
-	CAutoLockCS lock(m_lock);
-
-	if (m_pReader || !m_pSource) {
+	if (!m_pSource || !sink || !m_state.BeginStart()) {
 		assert(false);
 		return false;
 	}
 
+	m_recovery.Enable();
+	const bool started = OpenReader(sink, false);
+	if (!started) {
+		m_recovery.Disable();
+		m_pReader = nullptr;
+	}
+	m_state.EndStart(started);
+	return started;
+}
+
+bool CMFCapture::OpenReader(IMediaSink *sink, bool cachedType)
+{
+	m_pSink = sink;
+	if (sink->WantsFrames() && !m_pPool)
+		m_pPool = CFramePool::Create();
+
 	// Create an attribute store to hold initialization settings.
 	ComPtr<IMFAttributes> pAttributes = nullptr;
-	HRESULT hr = MFCreateAttributes(&pAttributes, 2);
+	HRESULT hr = MFCreateAttributes(&pAttributes, 3);
 	if (FAILED(hr)) {
 		assert(false);
 		return false;
@@ -54,6 +89,13 @@ bool CMFCapture::StartCapture()
 		return false;
 	}
 
+	// the source outlives the reader, so that Stop/Start does not have to create it again
+	hr = pAttributes->SetUINT32(MF_SOURCE_READER_DISCONNECT_MEDIASOURCE_ON_SHUTDOWN, TRUE);
+	if (FAILED(hr)) {
+		assert(false);
+		return false;
+	}
+
 	// Set the callback pointer.
 	hr = pAttributes->SetUnknown(MF_SOURCE_READER_ASYNC_CALLBACK, this);
 	if (FAILED(hr)) {
@@ -67,7 +109,8 @@ bool CMFCapture::StartCapture()
 		return false;
 	}
 
-	if (!SelectMediaType()) {
+	// after a device loss the same device comes back, the native types only have to be walked if its type moved
+	if (!(cachedType && SetCachedMediaType()) && !SelectMediaType()) {
 		assert(false);
 		return false;
 	}
@@ -75,11 +118,7 @@ bool CMFCapture::StartCapture()
 	// Ask for the first sample. 豸ռã˴CMFCapture::OnReadSample һλصʱHRESULT
 	hr = m_pReader->ReadSample(m_dwReaderStream, 0, NULL, NULL, NULL, NULL);
 	if (FAILED(hr)) {
-		// NOTE: The source reader shuts down the media source
-		// by default, but we might not have gotten that far.
-		m_pSource->Shutdown();
-
-		StopCapture();
+		m_metrics.AddReadError();
 		return false;
 	}
 
@@ -88,10 +127,39 @@ bool CMFCapture::StartCapture()
 
 void CMFCapture::StopCapture()
 {
-	CAutoLockCS lock(m_lock);
+	// a recovery in progress finishes or gives up first, then there is either a running reader to stop or none
+	m_recovery.Disable();
 
-	if (m_pReader)
-		m_pReader = nullptr;
+	// nothing new gets into OnReadSample from here on
+	if (!m_state.BeginStop())
+		return;
+
+	// the frames already in flight are delivered, none of them requests another one
+	m_state.WaitDrained();
+
+	// cancels the one ReadSample still pending, so that no late sample of this reader arrives after a restart
+	ResetEvent(m_hFlushed);
+	if (SUCCEEDED(m_pReader->Flush(m_dwReaderStream)))
+		WaitForSingleObject(m_hFlushed, CAPTURE_FLUSH_TIMEOUT_MS);
+
+	m_pReader = nullptr;
+	m_state.EndStop();
+}
+
+void CMFCapture::NotifyException(HRESULT hr)
+{
+	// the recovery waits for this callback to return before it releases the reader
+	if (hr == CAPTURE_DEVICE_LOST)
+		m_recovery.OnDeviceLost();
+}
+
+void CMFCapture::CloseDevice()
+{
+	if (m_state.BeginStop()) {
+		m_state.WaitDrained();
+		m_pReader = nullptr; // nothing to flush, the device is gone
+		m_state.EndStop();
+	}
 
 	if (m_pSource) {
 		m_pSource->Shutdown();
@@ -99,6 +167,23 @@ void CMFCapture::StopCapture()
 	}
 }
 
+bool CMFCapture::ReopenDevice()
+{
+	if (!m_pSource)
+		m_pSource = CreateMediaSource(m_bIsVideo, m_name.empty() ? nullptr : m_name.c_str(), m_path.c_str());
+	if (!m_pSource || !m_state.BeginStart())
+		return false;
+
+	const bool started = OpenReader(m_pSink, true);
+	if (!started) {
+		m_pReader = nullptr;
+		m_pSource->Shutdown();
+		m_pSource = nullptr;
+	}
+	m_state.EndStart(started);
+	return started;
+}
+
 ULONG CMFCapture::AddRef()
 {
 	return InterlockedIncrement(&m_nRefCount);
@@ -123,166 +208,271 @@ HRESULT CMFCapture::QueryInterface(REFIID riid, void **ppv)
 	return QISearch(this, qit, riid, ppv);
 }
 
+HRESULT CMFCapture::OnFlush(DWORD)
+{
+	SetEvent(m_hFlushed);
+	return S_OK;
+}
+
 // Called when the IMFMediaSource::ReadSample method completes.
-HRESULT CMFCapture::OnReadSample(HRESULT hrStatus, DWORD /* dwStreamIndex */, DWORD /* dwStreamFlags */, LONGLONG /* llTimestamp */, IMFSample *pSample /*Can be NULL*/)
+HRESULT CMFCapture::OnReadSample(HRESULT hrStatus, DWORD /* dwStreamIndex */, DWORD dwStreamFlags, LONGLONG llTimestamp, IMFSample *pSample /*Can be NULL*/)
 {
+	// includes the wait for the lock
+	const int64_t begin = GetMonotonicTimeNs();
+
+	// stopping or stopped: the sample is dropped and no further one is requested
+	CCaptureCallbackScope scope(m_state);
+	if (!scope.IsEntered())
+		return S_OK;
+
 	CAutoLockCS lock(m_lock);
 
 	HRESULT hr = S_OK;
 	if (FAILED(hrStatus)) {
 		hr = hrStatus;
+		m_metrics.AddReadError();
 	}
 
-	if (SUCCEEDED(hr)) {
-		if (pSample) { // it may be NULL
-			// Get the video frame buffer from the sample.
-			ComPtr<IMFMediaBuffer> pBuffer = NULL;
-			hr = pSample->GetBufferByIndex(0, &pBuffer);
-
-			// read the frame.
-			if (SUCCEEDED(hr)) {
-				OnData(pBuffer);
-			}
-		}
+	// Get the video frame buffer from the sample.
+	ComPtr<IMFMediaBuffer> pBuffer = NULL;
+	if (SUCCEEDED(hr) && pSample) { // it may be NULL
+		hr = pSample->GetBufferByIndex(0, &pBuffer);
 	}
 
-	// Request the next frame.
-	if (SUCCEEDED(hr)) {
+	// Request the next frame before handing this one on, so that the device never waits for the consumer.
+	// Callbacks are serialized by m_lock, the sink still gets the samples in order.
+	if (SUCCEEDED(hr) && m_state.IsRunning()) {
 		hr = m_pReader->ReadSample(m_dwReaderStream, 0,
 					   NULL, // actual
 					   NULL, // flags
 					   NULL, // timestamp
 					   NULL  // sample
 		);
+		if (FAILED(hr))
+			m_metrics.AddReadError();
+	}
+
+	// read the frame. with a CCaptureSession as sink this is only a copy into the pool and an enqueue.
+	if (pBuffer) {
+		m_metrics.RecordSample(begin);
+		OnData(pBuffer, llTimestamp, dwStreamFlags);
+	} else if (SUCCEEDED(hrStatus) && (dwStreamFlags & MF_SOURCE_READERF_STREAMTICK)) {
+		// gap in the stream, let the pipeline know about it
+		m_metrics.AddStreamTick();
+		MediaSample tick;
+		tick.format = &m_format;
+		tick.timestamp = llTimestamp;
+		tick.flags = GetSampleFlags(dwStreamFlags);
+		DeliverSample(m_pSink, m_pPool.Get(), tick);
 	}
 
 	if (FAILED(hr)) {
 		NotifyException(hr);
 	}
 
+	m_metrics.RecordCallback(GetMonotonicTimeNs() - begin);
 	return hr;
 }
 
 bool CMFCapture::SelectMediaType()
 {
-	bool found = false;
-
-	DWORD index = 0;
-	while (!found) {
+	// one walk over the native types, then the negotiator picks by cost
+	std::vector<DeviceCapability> caps;
+	for (DWORD index = 0;; ++index) {
 		ComPtr<IMFMediaType> pNativeType = nullptr;
 		HRESULT hr = m_pReader->GetNativeMediaType(m_dwReaderStream, index, &pNativeType);
 		if (FAILED(hr))
 			break;
 
-		found = m_bIsVideo ? TestVideoMediaType(pNativeType) : TestAudioMediaType(pNativeType);
-		++index;
+		DeviceCapability cap;
+		if (GetDeviceCapability(pNativeType.Get(), m_bIsVideo, cap)) {
+			cap.index = index;
+			caps.push_back(cap);
+		}
 	}
 
-	assert(found);
-	return found;
+	CMediaNegotiator negotiator;
+	negotiator.SetCapabilities(caps);
+
+	NegotiationResult result;
+	if (!negotiator.Negotiate(m_request, result) || !SetMediaType(result)) {
+		assert(false);
+		return false;
+	}
+
+	m_negotiated = result;
+	m_bNegotiated = true;
+	return true;
 }
 
-bool CMFCapture::TestVideoMediaType(ComPtr<IMFMediaType> pNativeType)
+bool CMFCapture::SetCachedMediaType()
 {
-	GUID subtype = {0};
-	if (SUCCEEDED(pNativeType->GetGUID(MF_MT_SUBTYPE, &subtype)) && IsEqualGUID(subtype, DEST_VIDEO_SUBTYPE)) {
-		UINT32 width = 0, height = 0;
-		if (SUCCEEDED(MFGetAttributeSize(pNativeType.Get(), MF_MT_FRAME_SIZE, &width, &height)) && width == DEST_VIDEO_WIDTH && height == DEST_VIDEO_HEIGHT) {
-			UINT32 frNum = 0, frDen = 0;
-			if (SUCCEEDED(MFGetAttributeRatio(pNativeType.Get(), MF_MT_FRAME_RATE, &frNum, &frDen))) {
-				if (frDen != 0 && std::abs(double(frNum) / double(frDen) - DEST_VIDEO_FPS) < 0.1) {
-					auto hr = m_pReader->SetCurrentMediaType(m_dwReaderStream, nullptr, pNativeType.Get());
-					assert(SUCCEEDED(hr));
-					if (SUCCEEDED(hr)) {
-						GetDefaultStride(pNativeType.Get(), &m_yStride);
-						assert(m_yStride > 0);
-						return true;
-					}
-				}
-			}
-		}
-	}
+	if (!m_bNegotiated)
+		return false;
+
+	ComPtr<IMFMediaType> pNativeType = nullptr;
+	DeviceCapability cap;
+	if (FAILED(m_pReader->GetNativeMediaType(m_dwReaderStream, m_negotiated.cap.index, &pNativeType)) || !GetDeviceCapability(pNativeType.Get(), m_bIsVideo, cap))
+		return false;
+
+	const MediaFormat &format = m_negotiated.cap.format;
+	if (cap.format.subtype != format.subtype || cap.format.width != format.width || cap.format.height != format.height || cap.format.channels != format.channels ||
+	    cap.format.sampleRate != format.sampleRate)
+		return false;
 
-	return false;
+	return SetMediaType(m_negotiated);
 }
 
-bool CMFCapture::TestAudioMediaType(ComPtr<IMFMediaType> pNativeType)
+bool CMFCapture::SetMediaType(const NegotiationResult &result)
 {
-	GUID subtype = {0};
-	if (SUCCEEDED(pNativeType->GetGUID(MF_MT_SUBTYPE, &subtype))) {
-		if (IsEqualGUID(subtype, MFAudioFormat_PCM) || IsEqualGUID(subtype, MFAudioFormat_Float)) {
-			auto hr = m_pReader->SetCurrentMediaType(m_dwReaderStream, nullptr, pNativeType.Get());
-			assert(SUCCEEDED(hr));
-			if (SUCCEEDED(hr)) {
-				if (FAILED(pNativeType->GetUINT32(MF_MT_AUDIO_NUM_CHANNELS, &m_dwChannels)) || FAILED(pNativeType->GetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, &m_dwSampleRate)) ||
-				    FAILED(pNativeType->GetUINT32(MF_MT_AUDIO_BITS_PER_SAMPLE, &m_dwBitsPerSample)) || m_dwChannels == 0 || m_dwSampleRate == 0 || m_dwBitsPerSample == 0) {
-					return false;
-				}
-
-				return true;
-			}
+	ComPtr<IMFMediaType> pNativeType = nullptr;
+	HRESULT hr = m_pReader->GetNativeMediaType(m_dwReaderStream, result.cap.index, &pNativeType);
+	if (FAILED(hr)) {
+		assert(false);
+		return false;
+	}
+
+	// a frame rate inside of MF_MT_FRAME_RATE_RANGE_MIN/MAX is chosen by setting MF_MT_FRAME_RATE
+	if (result.fpsFromRange)
+		MFSetAttributeRatio(pNativeType.Get(), MF_MT_FRAME_RATE, result.cap.format.fpsNum, result.cap.format.fpsDen);
+
+	hr = m_pReader->SetCurrentMediaType(m_dwReaderStream, nullptr, pNativeType.Get());
+	assert(SUCCEEDED(hr));
+	if (FAILED(hr))
+		return false;
+
+	if (m_bIsVideo && !IsCompressedVideo(result.cap.format.subtype)) {
+		// MF_MT_DEFAULT_STRIDE, or the stride of the format table
+		if (FAILED(GetDefaultStride(pNativeType.Get(), &m_yStride)))
+			m_yStride = 0;
+		assert(m_yStride != 0); // negative for bottom-up rgb
+		m_describePlanes = GetDescribePlanesFunc(result.cap.format.subtype);
+
+		if (CTileExecutor::IsWorthTiling(result.cap.format) && !m_tiles.IsStarted()) {
+			TileExecutorOptions options;
+			options.threads = (std::min)(std::thread::hardware_concurrency(), (uint32_t)TILING_MAX_THREADS);
+			m_tiles.Start(options);
 		}
 	}
 
-	return false;
+	m_format = result.cap.format;
+	if (m_bIsVideo && m_format.fpsNum)
+		m_metrics.SetNominalInterval((int64_t)m_format.fpsDen * 1000000000 / m_format.fpsNum);
+	return true;
+}
+
+uint32_t CMFCapture::GetSampleFlags(DWORD dwStreamFlags)
+{
+	uint32_t flags = 0;
+	if (dwStreamFlags & MF_SOURCE_READERF_ERROR)
+		flags |= MEDIA_SAMPLE_FLAG_ERROR;
+	if (dwStreamFlags & MF_SOURCE_READERF_ENDOFSTREAM)
+		flags |= MEDIA_SAMPLE_FLAG_END_OF_STREAM;
+	if (dwStreamFlags & MF_SOURCE_READERF_CURRENTMEDIATYPECHANGED)
+		flags |= MEDIA_SAMPLE_FLAG_TYPE_CHANGED;
+	if (dwStreamFlags & MF_SOURCE_READERF_STREAMTICK)
+		flags |= MEDIA_SAMPLE_FLAG_STREAM_TICK | MEDIA_SAMPLE_FLAG_DISCONTINUITY;
+	return flags;
 }
 
-void CMFCapture::OnData(ComPtr<IMFMediaBuffer> pBuffer)
+void CMFCapture::OnData(ComPtr<IMFMediaBuffer> pBuffer, LONGLONG llTimestamp, DWORD dwStreamFlags)
 {
-	if (m_bIsVideo)
-		OnVideoData(pBuffer);
+	MediaSample sample;
+	sample.format = &m_format;
+	sample.timestamp = llTimestamp;
+	sample.flags = GetSampleFlags(dwStreamFlags) | m_recovery.OnSample();
+
+	if (m_bIsVideo && !IsCompressedVideo(m_format.subtype))
+		OnVideoData(pBuffer, sample);
 	else
-		OnAudioData(pBuffer);
+		OnBitstreamData(pBuffer, sample);
 }
 
-void CMFCapture::OnVideoData(ComPtr<IMFMediaBuffer> pBuffer)
+void CMFCapture::OnVideoData(ComPtr<IMFMediaBuffer> pBuffer, MediaSample &sample)
 {
+	if (m_bZeroCopy && m_pSink->WantsFrames()) {
+		OnVideoDataZeroCopy(pBuffer, sample);
+		return;
+	}
+
 	VideoBufferLock helper(pBuffer);
 
 	BYTE *pData = NULL;
 	LONG lStride = 0;
-	if (FAILED(helper.LockBuffer(m_yStride, DEST_VIDEO_HEIGHT, &pData, &lStride))) {
+	const int64_t lockBegin = GetMonotonicTimeNs();
+	if (FAILED(helper.LockBuffer(m_yStride, m_format.height, &pData, &lStride))) {
 		assert(false);
 		return;
 	}
+	m_metrics.RecordLock(GetMonotonicTimeNs() - lockBegin);
 
-	{
-		// for test
-		assert(lStride == DEST_VIDEO_WIDTH); // test NV12
-		printf("V");
+	// the pipeline converts to NV12 if the device delivers anything else
+	sample.planeCount = m_describePlanes(m_format, pData, lStride, sample.planes);
+	assert(sample.planeCount > 0);
 
-		FILE *fp = NULL;
-		fopen_s(&fp, "input.nv12", "wb+");
-		if (fp) {
-			fwrite(pData, 1, DEST_VIDEO_WIDTH * DEST_VIDEO_HEIGHT * 3 / 2, fp);
-			fclose(fp);
-		}
-	}
+	CTileExecutor *tiles = m_tiles.IsStarted() && CTileExecutor::IsWorthTiling(m_format) ? &m_tiles : nullptr;
+	if (!DeliverSample(m_pSink, m_pPool.Get(), sample, tiles))
+		m_metrics.AddDropped();
 
 	helper.UnlockBuffer();
 }
 
-void CMFCapture::OnAudioData(ComPtr<IMFMediaBuffer> pBuffer)
+void CMFCapture::OnVideoDataZeroCopy(ComPtr<IMFMediaBuffer> pBuffer, MediaSample &sample)
+{
+	// the buffer stays locked until the last reference of the frame is released
+	VideoBufferLock *helper = new (std::nothrow) VideoBufferLock(pBuffer);
+	if (!helper) {
+		m_metrics.AddDropped();
+		return;
+	}
+
+	BYTE *pData = NULL;
+	LONG lStride = 0;
+	const int64_t lockBegin = GetMonotonicTimeNs();
+	if (FAILED(helper->LockBuffer(m_yStride, m_format.height, &pData, &lStride))) {
+		assert(false);
+		delete helper;
+		return;
+	}
+	m_metrics.RecordLock(GetMonotonicTimeNs() - lockBegin);
+
+	sample.planeCount = m_describePlanes(m_format, pData, lStride, sample.planes);
+	assert(sample.planeCount > 0);
+
+	FramePtr frame = CMediaFrame::Wrap(sample, [helper]() { delete helper; });
+	if (frame)
+		m_pSink->OnMediaFrame(frame.Get());
+	else
+		m_metrics.AddDropped();
+}
+
+// audio and compressed video: the bytes of the buffer as they are
+void CMFCapture::OnBitstreamData(ComPtr<IMFMediaBuffer> pBuffer, MediaSample &sample)
 {
 	BYTE *pData = nullptr;
 	DWORD cbMaxLength = 0, cbCurrentLength = 0;
+	const int64_t lockBegin = GetMonotonicTimeNs();
 	if (FAILED(pBuffer->Lock(&pData, &cbMaxLength, &cbCurrentLength))) {
 		assert(false);
 		return;
 	}
-
-	{
-		// for test
-		printf("A");
-		static FILE *fp = NULL;
-		if (!fp)
-			fopen_s(&fp, "input.pcm", "wb+");
-
-		if (fp) {
-			fwrite(pData, 1, cbCurrentLength, fp);
-			fflush(fp);
-		}
+	m_metrics.RecordLock(GetMonotonicTimeNs() - lockBegin);
+
+	sample.planes[0].data = pData;
+	sample.planes[0].size = cbCurrentLength;
+	sample.planeCount = 1;
+
+	if (m_bZeroCopy && m_pSink->WantsFrames()) {
+		FramePtr frame = CMediaFrame::Wrap(sample, [pBuffer]() { pBuffer->Unlock(); });
+		if (frame)
+			m_pSink->OnMediaFrame(frame.Get());
+		else
+			m_metrics.AddDropped();
+		return;
 	}
 
+	if (!DeliverSample(m_pSink, m_pPool.Get(), sample))
+		m_metrics.AddDropped();
+
 	pBuffer->Unlock();
 }
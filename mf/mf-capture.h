@@ -1,5 +1,13 @@
 ﻿#pragma once
 #include "mf-util.hpp"
+#include "mf-format.h"
+#include "mf-frame.h"
+#include "mf-metrics.h"
+#include "mf-negotiate.h"
+#include "mf-recovery.h"
+#include "mf-state.h"
+#include "mf-tiling.h"
+#include <string>
 
 // for test
 #define DEST_VIDEO_SUBTYPE MFVideoFormat_NV12
@@ -7,16 +15,41 @@
 #define DEST_VIDEO_HEIGHT 720
 #define DEST_VIDEO_FPS 30.0
 
-class CMFCapture : public IMFSourceReaderCallback {
+// one stream of one device through an async source reader. Start and Stop may be called from any thread and
+// repeated on the same object: Stop only drains the callbacks already in flight (see CCaptureStateMachine),
+// releases the reader and keeps the media source for the next Start.
+// a lost device (e.g. a usb glitch) is opened again by its symbolic link in the type negotiated before, see CDeviceRecovery.
+class CMFCapture : public IMFSourceReaderCallback, public IFrameSource, private IRecoverableDevice {
 protected:
-	CMFCapture(ComPtr<IMFMediaSource> source, bool video);
+	CMFCapture(ComPtr<IMFMediaSource> source, bool video, const WCHAR *name, const WCHAR *path);
 	virtual ~CMFCapture();
 
 public:
 	static ComPtr<CMFCapture> CreateInstance(bool video, const WCHAR *name, const WCHAR *path);
 
-	bool StartCapture();
-	void StopCapture();
+	// IFrameSource methods
+	bool StartCapture(IMediaSink *sink) override;
+	void StopCapture() override;
+	const MediaFormat &GetFormat() const override { return m_format; }
+
+	// what StartCapture negotiates for, the default is DEST_VIDEO_* for video and any pcm/float for audio
+	void SetMediaRequest(const MediaRequest &request) { m_request = request; }
+
+	// for sinks which want frames: hand out the locked device buffer instead of a pooled copy.
+	// the source reader only has a few buffers, so the sink must release such frames quickly.
+	void SetZeroCopy(bool enable) { m_bZeroCopy = enable; }
+	uint64_t GetDroppedCount() const { return m_metrics.GetDroppedCount(); }
+
+	// how often and how long after a device loss StartCapture is tried again
+	void SetRecoveryOptions(const DeviceRecoveryOptions &options) { m_recovery.SetOptions(options); }
+
+	// callback timing, arrival intervals, error counters and outages, can be polled while capturing
+	const CCaptureMetrics &GetMetrics() const { return m_metrics; }
+	const CCaptureMetrics *GetCaptureMetrics() const override { return &m_metrics; }
+
+	CaptureState GetState() const { return m_state.GetState(); }
+	// starts, stops and how long the stops took
+	CaptureStateStats GetStateStats() const { return m_state.GetStats(); }
 
 	// IUnknown methods
 	STDMETHODIMP QueryInterface(REFIID iid, void **ppv);
@@ -25,34 +58,56 @@ public:
 	// IMFSourceReaderCallback methods
 	STDMETHODIMP OnReadSample(HRESULT hrStatus, DWORD dwStreamIndex, DWORD dwStreamFlags, LONGLONG llTimestamp, IMFSample *pSample);
 	STDMETHODIMP OnEvent(DWORD, IMFMediaEvent *) { return S_OK; }
-	STDMETHODIMP OnFlush(DWORD) { return S_OK; }
+	STDMETHODIMP OnFlush(DWORD);
 
 private:
+	// cachedType: the type negotiated before, if the device still has it
+	bool OpenReader(IMediaSink *sink, bool cachedType);
 	bool SelectMediaType();
-	bool TestVideoMediaType(ComPtr<IMFMediaType> pNativeType);
-	bool TestAudioMediaType(ComPtr<IMFMediaType> pNativeType);
+	// m_negotiated again, false if the device no longer has it at the same index
+	bool SetCachedMediaType();
+	bool SetMediaType(const NegotiationResult &result);
+
+	void OnData(ComPtr<IMFMediaBuffer> pBuffer, LONGLONG llTimestamp, DWORD dwStreamFlags);
+	void OnVideoData(ComPtr<IMFMediaBuffer> pBuffer, MediaSample &sample);
+	void OnVideoDataZeroCopy(ComPtr<IMFMediaBuffer> pBuffer, MediaSample &sample);
+	void OnBitstreamData(ComPtr<IMFMediaBuffer> pBuffer, MediaSample &sample);
+	static uint32_t GetSampleFlags(DWORD dwStreamFlags);
 
-	void OnData(ComPtr<IMFMediaBuffer> pBuffer);
-	void OnVideoData(ComPtr<IMFMediaBuffer> pBuffer);
-	void OnAudioData(ComPtr<IMFMediaBuffer> pBuffer);
+	void NotifyException(HRESULT hr);
 
-	void NotifyException(HRESULT /*hr*/) {} // hr = 0xc00d3ea2: device lost
+	// IRecoverableDevice, on the thread of the recovery
+	void CloseDevice() override;
+	bool ReopenDevice() override;
 
 private:
 	long m_nRefCount = 1; // Reference count.
 
 	const bool m_bIsVideo;
 	const DWORD m_dwReaderStream;
+	const std::wstring m_name;
+	const std::wstring m_path; // symbolic link, to open the device again
 
+	CCaptureStateMachine m_state;
+	HANDLE m_hFlushed = NULL; // set by OnFlush
+	// only serializes the callbacks: the next sample is requested before this one is delivered
 	CWinSection m_lock;
 	ComPtr<IMFMediaSource> m_pSource = nullptr;
 	ComPtr<IMFSourceReader> m_pReader = nullptr;
+	IMediaSink *m_pSink = nullptr;
+	CRefPtr<CFramePool> m_pPool;
+	bool m_bZeroCopy = false;
+	CCaptureMetrics m_metrics;
+	CDeviceRecovery m_recovery;
+
+	// negotiated media type
+	MediaRequest m_request;
+	NegotiationResult m_negotiated;
+	bool m_bNegotiated = false;
+	MediaFormat m_format;
 
 	// video
 	LONG m_yStride = 0;
-
-	// audio
-	UINT32 m_dwChannels = 0;
-	UINT32 m_dwSampleRate = 0;
-	UINT32 m_dwBitsPerSample = 0;
+	DescribePlanesFunc m_describePlanes = DescribeVideoPlanes; // picked for the subtype in SetMediaType
+	CTileExecutor m_tiles; // copies 4k frames out of the locked buffer, started by SetMediaType
 };
@@ -0,0 +1,175 @@
+#include "mf-change.h"
+#include <algorithm>
+#include <assert.h>
+#include <cstdlib>
+#include <cstring>
+
+static void SadRowTail_C(const uint8_t *a, const uint8_t *b, uint32_t *sums, uint32_t i, uint32_t count)
+{
+	for (; i < count; ++i) {
+		uint32_t sum = 0;
+		for (uint32_t x = 0; x < CHANGE_COLUMN_WIDTH; ++x)
+			sum += (uint32_t)abs(a[i * CHANGE_COLUMN_WIDTH + x] - b[i * CHANGE_COLUMN_WIDTH + x]);
+		sums[i] += sum;
+	}
+}
+
+static void SadRow_C(const uint8_t *a, const uint8_t *b, uint32_t *sums, uint32_t count)
+{
+	SadRowTail_C(a, b, sums, 0, count);
+}
+
+#if MF_ARCH_X86
+//---------------------------------------------------------------------------------------------
+// psadbw sums 8 bytes into the low word of each qword, the sums of neighbouring columns are interleaved into dwords
+
+MF_TARGET_SSE2 static void SadRow_SSE2(const uint8_t *a, const uint8_t *b, uint32_t *sums, uint32_t count)
+{
+	uint32_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i s0 = _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(a + i * 16)), _mm_loadu_si128((const __m128i *)(b + i * 16)));
+		__m128i s1 = _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(a + i * 16 + 16)), _mm_loadu_si128((const __m128i *)(b + i * 16 + 16)));
+		__m128i s2 = _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(a + i * 16 + 32)), _mm_loadu_si128((const __m128i *)(b + i * 16 + 32)));
+		__m128i s3 = _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(a + i * 16 + 48)), _mm_loadu_si128((const __m128i *)(b + i * 16 + 48)));
+
+		// [lo0 lo1 hi0 hi1], [lo2 lo3 hi2 hi3]
+		const __m128i s01 = _mm_or_si128(s0, _mm_slli_epi64(s1, 32));
+		const __m128i s23 = _mm_or_si128(s2, _mm_slli_epi64(s3, 32));
+		const __m128i sum = _mm_add_epi32(_mm_unpacklo_epi64(s01, s23), _mm_unpackhi_epi64(s01, s23));
+
+		__m128i *dst = (__m128i *)(sums + i);
+		_mm_storeu_si128(dst, _mm_add_epi32(_mm_loadu_si128(dst), sum));
+	}
+
+	SadRowTail_C(a, b, sums, i, count);
+}
+
+MF_TARGET_AVX2 static void SadRow_AVX2(const uint8_t *a, const uint8_t *b, uint32_t *sums, uint32_t count)
+{
+	// the lanes hold the even and the odd columns
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	uint32_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i s0 = _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(a + i * 16)), _mm256_loadu_si256((const __m256i *)(b + i * 16)));
+		__m256i s1 = _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(a + i * 16 + 32)), _mm256_loadu_si256((const __m256i *)(b + i * 16 + 32)));
+		__m256i s2 = _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(a + i * 16 + 64)), _mm256_loadu_si256((const __m256i *)(b + i * 16 + 64)));
+		__m256i s3 = _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(a + i * 16 + 96)), _mm256_loadu_si256((const __m256i *)(b + i * 16 + 96)));
+
+		const __m256i s01 = _mm256_or_si256(s0, _mm256_slli_epi64(s1, 32));
+		const __m256i s23 = _mm256_or_si256(s2, _mm256_slli_epi64(s3, 32));
+		const __m256i sum = _mm256_add_epi32(_mm256_unpacklo_epi64(s01, s23), _mm256_unpackhi_epi64(s01, s23));
+
+		__m256i *dst = (__m256i *)(sums + i);
+		_mm256_storeu_si256(dst, _mm256_add_epi32(_mm256_loadu_si256(dst), _mm256_permutevar8x32_epi32(sum, order)));
+	}
+
+	SadRow_SSE2(a + i * 16, b + i * 16, sums + i, count - i);
+}
+#endif
+
+//---------------------------------------------------------------------------------------------
+bool CChangeDetector::Init(const ChangeDetectorOptions &options, SimdLevel level)
+{
+	m_sadRow = nullptr;
+	if (!options.blockSize || options.blockSize % CHANGE_COLUMN_WIDTH || !options.minChangedBlocks) {
+		assert(false);
+		return false;
+	}
+
+	if (level > GetCpuSimdLevel())
+		level = GetCpuSimdLevel();
+
+	m_options = options;
+	m_width = 0;
+	m_height = 0;
+	m_unchanged = 0;
+
+#if MF_ARCH_X86
+	const bool avx2 = level >= SIMD_AVX2;
+	const bool sse2 = level >= SIMD_SSE2;
+#else
+	const bool avx2 = false;
+	const bool sse2 = false;
+#endif
+
+	m_sadRow = SadRow_C;
+#if MF_ARCH_X86
+	if (sse2)
+		m_sadRow = avx2 ? SadRow_AVX2 : SadRow_SSE2;
+#endif
+
+	(void)avx2;
+	(void)sse2;
+	return true;
+}
+
+bool CChangeDetector::IsChanged(const MediaSample &sample)
+{
+	if (!m_sadRow) {
+		assert(false);
+		return true;
+	}
+
+	++m_stats.frames;
+
+	const MediaFormat &format = *sample.format;
+	if (format.subtype != MEDIA_SUBTYPE_NV12 || !sample.planeCount)
+		return true;
+
+	bool changed = true;
+	if (m_width == format.width && m_height == format.height && !(sample.flags & MEDIA_SAMPLE_FLAG_DISCONTINUITY))
+		changed = Compare(sample.planes[0]);
+
+	if (!changed) {
+		++m_stats.unchanged;
+		if (!m_options.maxUnchanged || ++m_unchanged <= m_options.maxUnchanged)
+			return false;
+		++m_stats.refreshed;
+	}
+
+	// the next frames are compared with this one
+	m_unchanged = 0;
+	m_width = format.width;
+	m_height = format.height;
+	m_reference.resize((size_t)m_width * m_height);
+	for (uint32_t y = 0; y < m_height; ++y)
+		memcpy(m_reference.data() + (size_t)y * m_width, sample.planes[0].data + (ptrdiff_t)y * sample.planes[0].stride, m_width);
+	return true;
+}
+
+bool CChangeDetector::Compare(const MediaPlane &luma)
+{
+	const uint32_t blockSize = m_options.blockSize;
+	const uint32_t columns = m_width / CHANGE_COLUMN_WIDTH;
+	const uint32_t tail = m_width % CHANGE_COLUMN_WIDTH;
+	const uint32_t columnsPerBlock = blockSize / CHANGE_COLUMN_WIDTH;
+	m_columns.resize(columns + 1);
+
+	uint32_t changedBlocks = 0;
+	for (uint32_t top = 0; top < m_height; top += blockSize) {
+		const uint32_t rows = (std::min)(blockSize, m_height - top);
+		std::fill(m_columns.begin(), m_columns.end(), 0);
+
+		for (uint32_t y = top; y < top + rows; ++y) {
+			const uint8_t *a = luma.data + (ptrdiff_t)y * luma.stride;
+			const uint8_t *b = m_reference.data() + (size_t)y * m_width;
+			m_sadRow(a, b, m_columns.data(), columns);
+
+			// the columns right of the last whole one
+			for (uint32_t x = columns * CHANGE_COLUMN_WIDTH; x < m_width; ++x)
+				m_columns[columns] += (uint32_t)abs(a[x] - b[x]);
+		}
+
+		for (uint32_t left = 0; left < columns + (tail ? 1 : 0); left += columnsPerBlock) {
+			const uint32_t end = (std::min)(left + columnsPerBlock, columns + (tail ? 1 : 0));
+			uint64_t sad = 0;
+			for (uint32_t i = left; i < end; ++i)
+				sad += m_columns[i];
+
+			const uint32_t width = (std::min)(end * CHANGE_COLUMN_WIDTH, m_width) - left * CHANGE_COLUMN_WIDTH;
+			if (sad > (uint64_t)m_options.threshold * width * rows && ++changedBlocks >= m_options.minChangedBlocks)
+				return true;
+		}
+	}
+	return false;
+}
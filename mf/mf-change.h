@@ -0,0 +1,59 @@
+﻿#pragma once
+#include "mf-cpu.h"
+#include "mf-sample.h"
+#include <vector>
+
+// luma columns summed by one entry of a SadRowFunc
+#define CHANGE_COLUMN_WIDTH 16
+
+struct ChangeDetectorOptions {
+	uint32_t blockSize = 32;       // luma pixels, square, a multiple of CHANGE_COLUMN_WIDTH
+	uint32_t threshold = 2;        // a block changed when its mean absolute difference per pixel is above this
+	uint32_t minChangedBlocks = 1; // a frame changed when at least this many blocks did
+	uint32_t maxUnchanged = 0;     // after this many unchanged frames in a row the next one counts as changed, 0: never
+	bool drop = false;             // unchanged frames are dropped, else passed on with MEDIA_SAMPLE_FLAG_UNCHANGED
+};
+
+struct ChangeDetectorStats {
+	uint64_t frames = 0;
+	uint64_t unchanged = 0;
+	uint64_t refreshed = 0; // unchanged, but passed on because of maxUnchanged
+};
+
+// sums[i] += sum of absolute differences of the CHANGE_COLUMN_WIDTH bytes at i * CHANGE_COLUMN_WIDTH, for `count` columns
+typedef void (*SadRowFunc)(const uint8_t *a, const uint8_t *b, uint32_t *sums, uint32_t count);
+
+// finds NV12 frames whose luma matches the last changed frame, e.g. of virtual cameras or static scenes, so they are
+// not copied, written and encoded again. the luma is compared in blocks, so a small change in one place is not lost
+// in the noise of the whole frame. comparing against the last changed frame, not the previous one, also catches
+// slow fades. the frame is changed as soon as enough blocks are found, the rest is not compared.
+class CChangeDetector {
+public:
+	bool Init(const ChangeDetectorOptions &options, SimdLevel level = GetSimdLevel());
+	bool IsInitialized() const { return m_sadRow != nullptr; }
+	const ChangeDetectorOptions &GetOptions() const { return m_options; }
+
+	// true for the first frame, after a discontinuity or a change of size, and for anything but NV12
+	bool IsChanged(const MediaSample &sample);
+
+	// the next frame counts as changed
+	void Reset() { m_width = 0; }
+
+	ChangeDetectorStats GetStats() const { return m_stats; }
+
+private:
+	bool Compare(const MediaPlane &luma);
+
+private:
+	ChangeDetectorOptions m_options;
+	SadRowFunc m_sadRow = nullptr;
+
+	// luma of the last changed frame, tight
+	uint32_t m_width = 0;
+	uint32_t m_height = 0;
+	std::vector<uint8_t> m_reference;
+	std::vector<uint32_t> m_columns; // sums of the current row of blocks
+
+	uint32_t m_unchanged = 0; // in a row
+	ChangeDetectorStats m_stats;
+};
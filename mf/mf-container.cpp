@@ -0,0 +1,321 @@
+#include "mf-container.h"
+#include <algorithm>
+#include <assert.h>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define CONTAINER_ALIGNMENT 8
+#define CONTAINER_INDEX_CHUNK (1024 * 1024)
+
+static bool IsSameFormat(const MediaFormat &a, const MediaFormat &b)
+{
+	if (a.video != b.video || a.subtype != b.subtype)
+		return false;
+
+	if (a.video)
+		return a.width == b.width && a.height == b.height;
+
+	return a.channels == b.channels && a.sampleRate == b.sampleRate && a.bitsPerSample == b.bitsPerSample;
+}
+
+static uint32_t GetPadding(uint64_t offset)
+{
+	return uint32_t((CONTAINER_ALIGNMENT - offset % CONTAINER_ALIGNMENT) % CONTAINER_ALIGNMENT);
+}
+
+//---------------------------------------------------------------------------------------------
+bool CContainerWriter::Open(const char *path, const MediaFormat &format, const AsyncWriterOptions &options)
+{
+	if (!m_writer.Open(path, options))
+		return false;
+
+	m_format = format;
+	// the writer puts the planes in Y,U,V order
+	if (m_format.subtype == MEDIA_SUBTYPE_YV12)
+		m_format.subtype = MEDIA_SUBTYPE_I420;
+
+	m_index.clear();
+	m_index.reserve(1024);
+
+	ContainerFileHeader header = {};
+	header.magic = CONTAINER_FILE_MAGIC;
+	header.version = CONTAINER_VERSION;
+	header.headerSize = sizeof(header);
+	header.video = m_format.video ? 1 : 0;
+	header.subtype = m_format.subtype;
+	header.width = m_format.width;
+	header.height = m_format.height;
+	header.fpsNum = m_format.fpsNum;
+	header.fpsDen = m_format.fpsDen;
+	header.channels = m_format.channels;
+	header.sampleRate = m_format.sampleRate;
+	header.bitsPerSample = m_format.bitsPerSample;
+	m_writer.WriteBytes(&header, sizeof(header), true);
+	return true;
+}
+
+bool CContainerWriter::Write(CMediaFrame *frame)
+{
+	if (!IsOpen() || !frame->GetSample().planeCount)
+		return false;
+
+	MediaFormat format = frame->GetFormat();
+	if (format.subtype == MEDIA_SUBTYPE_YV12)
+		format.subtype = MEDIA_SUBTYPE_I420;
+	if (!IsSameFormat(format, m_format))
+		return false;
+
+	const uint64_t offset = m_writer.GetLogicalSize();
+	const uint32_t padding = GetPadding(offset);
+
+	ContainerRecordHeader header = {};
+	header.magic = CONTAINER_RECORD_MAGIC;
+	header.size = CAsyncFileWriter::GetFramePayloadSize(frame);
+	header.timestamp = frame->GetTimestamp();
+	header.flags = frame->GetFlags();
+	header.index = m_index.size();
+
+	uint8_t prefix[CONTAINER_ALIGNMENT + sizeof(header)] = {};
+	memcpy(prefix + padding, &header, sizeof(header));
+	if (!m_writer.Write(frame, prefix, padding + sizeof(header)))
+		return false;
+
+	ContainerIndexEntry entry;
+	entry.offset = offset + padding + sizeof(header);
+	entry.timestamp = header.timestamp;
+	entry.size = header.size;
+	entry.flags = header.flags;
+	m_index.push_back(entry);
+	return true;
+}
+
+void CContainerWriter::Close()
+{
+	if (!IsOpen())
+		return;
+
+	static const uint8_t zeros[CONTAINER_ALIGNMENT] = {};
+	const uint32_t padding = GetPadding(m_writer.GetLogicalSize());
+	if (padding)
+		m_writer.WriteBytes(zeros, padding, true);
+
+	ContainerTrailer trailer = {};
+	trailer.magic = CONTAINER_INDEX_MAGIC;
+	trailer.version = CONTAINER_VERSION;
+	trailer.indexOffset = m_writer.GetLogicalSize();
+	trailer.count = m_index.size();
+
+	const uint8_t *index = (const uint8_t *)m_index.data();
+	uint64_t remaining = m_index.size() * sizeof(ContainerIndexEntry);
+	while (remaining) {
+		uint32_t size = (uint32_t)(std::min)(remaining, (uint64_t)CONTAINER_INDEX_CHUNK);
+		m_writer.WriteBytes(index, size, true);
+		index += size;
+		remaining -= size;
+	}
+
+	m_writer.WriteBytes(&trailer, sizeof(trailer), true);
+	m_writer.Close();
+	m_index.clear();
+}
+
+//---------------------------------------------------------------------------------------------
+bool CContainerReader::Open(const char *path)
+{
+	Close();
+
+#ifdef _WIN32
+	HANDLE hFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+	m_hFile = hFile;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(hFile, &size) || size.QuadPart < (LONGLONG)sizeof(ContainerFileHeader)) {
+		Close();
+		return false;
+	}
+
+	m_hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!m_hMapping) {
+		Close();
+		return false;
+	}
+
+	m_pData = (const uint8_t *)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+	m_size = (uint64_t)size.QuadPart;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ContainerFileHeader)) {
+		close(fd);
+		return false;
+	}
+
+	void *p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd); // the mapping keeps the file
+	if (p == MAP_FAILED)
+		return false;
+
+	m_pData = (const uint8_t *)p;
+	m_size = (uint64_t)st.st_size;
+#endif
+
+	if (!m_pData) {
+		Close();
+		return false;
+	}
+
+	ContainerFileHeader header;
+	memcpy(&header, m_pData, sizeof(header));
+	if (header.magic != CONTAINER_FILE_MAGIC || header.version != CONTAINER_VERSION || header.headerSize < sizeof(header)) {
+		Close();
+		return false;
+	}
+
+	m_format.video = !!header.video;
+	m_format.subtype = header.subtype;
+	m_format.width = header.width;
+	m_format.height = header.height;
+	m_format.fpsNum = header.fpsNum;
+	m_format.fpsDen = header.fpsDen;
+	m_format.channels = header.channels;
+	m_format.sampleRate = header.sampleRate;
+	m_format.bitsPerSample = header.bitsPerSample;
+
+	if (!ReadIndex() && !RecoverIndex()) {
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void CContainerReader::Close()
+{
+#ifdef _WIN32
+	if (m_pData)
+		UnmapViewOfFile(m_pData);
+	if (m_hMapping)
+		CloseHandle((HANDLE)m_hMapping);
+	if (m_hFile)
+		CloseHandle((HANDLE)m_hFile);
+	m_hMapping = nullptr;
+	m_hFile = nullptr;
+#else
+	if (m_pData)
+		munmap((void *)m_pData, (size_t)m_size);
+#endif
+
+	m_pData = nullptr;
+	m_size = 0;
+	m_pIndex = nullptr;
+	m_count = 0;
+	m_recovered.clear();
+	m_format = MediaFormat();
+}
+
+bool CContainerReader::ReadIndex()
+{
+	if (m_size < sizeof(ContainerFileHeader) + sizeof(ContainerTrailer))
+		return false;
+
+	ContainerTrailer trailer;
+	memcpy(&trailer, m_pData + m_size - sizeof(trailer), sizeof(trailer));
+	if (trailer.magic != CONTAINER_INDEX_MAGIC || trailer.version != CONTAINER_VERSION)
+		return false;
+
+	const uint64_t indexEnd = m_size - sizeof(trailer);
+	if (trailer.indexOffset % CONTAINER_ALIGNMENT || trailer.indexOffset > indexEnd || trailer.count > (indexEnd - trailer.indexOffset) / sizeof(ContainerIndexEntry))
+		return false;
+
+	m_pIndex = (const ContainerIndexEntry *)(m_pData + trailer.indexOffset);
+	m_count = trailer.count;
+	return true;
+}
+
+bool CContainerReader::RecoverIndex()
+{
+	uint64_t offset = sizeof(ContainerFileHeader);
+	for (;;) {
+		offset += GetPadding(offset);
+		if (offset + sizeof(ContainerRecordHeader) > m_size)
+			break;
+
+		ContainerRecordHeader header;
+		memcpy(&header, m_pData + offset, sizeof(header));
+		if (header.magic != CONTAINER_RECORD_MAGIC || header.index != m_recovered.size())
+			break;
+
+		const uint64_t payload = offset + sizeof(header);
+		if (header.size > m_size - payload)
+			break; // cut off in the middle of the payload
+
+		ContainerIndexEntry entry;
+		entry.offset = payload;
+		entry.timestamp = header.timestamp;
+		entry.size = header.size;
+		entry.flags = header.flags;
+		m_recovered.push_back(entry);
+
+		offset = payload + header.size;
+	}
+
+	if (m_recovered.empty())
+		return false;
+
+	m_pIndex = m_recovered.data();
+	m_count = m_recovered.size();
+	return true;
+}
+
+bool CContainerReader::GetFrame(uint64_t index, MediaSample &sample) const
+{
+	const ContainerIndexEntry *entry = GetIndexEntry(index);
+	if (!entry || entry->offset > m_size || entry->size > m_size - entry->offset)
+		return false;
+
+	const uint8_t *data = m_pData + entry->offset;
+
+	sample = MediaSample();
+	sample.format = &m_format;
+	sample.timestamp = entry->timestamp;
+	sample.flags = entry->flags;
+
+	if (!m_format.video || IsCompressedVideo(m_format.subtype)) {
+		sample.planes[0].data = data;
+		sample.planes[0].size = entry->size;
+		sample.planeCount = 1;
+		return true;
+	}
+
+	if (entry->size < GetVideoFrameSize(m_format))
+		return false;
+
+	sample.planeCount = DescribeVideoPlanes(m_format, data, GetVideoDefaultStride(m_format), sample.planes);
+	return sample.planeCount != 0;
+}
+
+uint64_t CContainerReader::FindFrame(int64_t timestamp) const
+{
+	uint64_t begin = 0;
+	uint64_t end = m_count;
+	while (begin < end) {
+		uint64_t middle = begin + (end - begin) / 2;
+		if (m_pIndex[middle].timestamp <= timestamp)
+			begin = middle + 1;
+		else
+			end = middle;
+	}
+	return begin ? begin - 1 : 0;
+}
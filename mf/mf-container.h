@@ -0,0 +1,127 @@
+﻿#pragma once
+#include "mf-writer.h"
+#include <vector>
+
+// capture container, one stream per file, little endian:
+//   ContainerFileHeader
+//   records: 0-7 bytes of padding, ContainerRecordHeader, payload (tight rows per plane for video)
+//   ContainerIndexEntry[count] at an 8 byte aligned offset
+//   ContainerTrailer, always the last 32 bytes of the file
+// without a trailer (the capture was killed) the reader rebuilds the index by walking the records.
+#define CONTAINER_FILE_MAGIC MEDIA_FOURCC('M', 'F', 'C', 'F')
+#define CONTAINER_RECORD_MAGIC MEDIA_FOURCC('M', 'F', 'C', 'R')
+#define CONTAINER_INDEX_MAGIC MEDIA_FOURCC('M', 'F', 'C', 'I')
+#define CONTAINER_VERSION 1
+
+struct ContainerFileHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t headerSize;
+
+	// MediaFormat
+	uint32_t video;
+	uint32_t subtype;
+	uint32_t width;
+	uint32_t height;
+	uint32_t fpsNum;
+	uint32_t fpsDen;
+	uint32_t channels;
+	uint32_t sampleRate;
+	uint32_t bitsPerSample;
+
+	uint32_t reserved[4];
+};
+
+struct ContainerRecordHeader {
+	uint32_t magic;
+	uint32_t size; // payload bytes
+	int64_t timestamp;
+	uint32_t flags; // MediaSampleFlags
+	uint32_t reserved;
+	uint64_t index;
+};
+
+struct ContainerIndexEntry {
+	uint64_t offset; // of the payload
+	int64_t timestamp;
+	uint32_t size;
+	uint32_t flags;
+};
+
+struct ContainerTrailer {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t indexOffset;
+	uint64_t count;
+	uint64_t reserved;
+};
+
+static_assert(sizeof(ContainerFileHeader) == 64, "file layout");
+static_assert(sizeof(ContainerRecordHeader) == 32, "file layout");
+static_assert(sizeof(ContainerIndexEntry) == 24, "file layout");
+static_assert(sizeof(ContainerTrailer) == 32, "file layout");
+
+// writes one stream through CAsyncFileWriter, so it is as cheap for the calling thread as a raw dump.
+// Write must always be called from the same thread.
+class CContainerWriter {
+public:
+	CContainerWriter() {}
+	~CContainerWriter() { Close(); }
+
+	bool Open(const char *path, const MediaFormat &format, const AsyncWriterOptions &options = AsyncWriterOptions());
+	// appends the index and the trailer, then closes the file
+	void Close();
+	bool IsOpen() const { return m_writer.IsOpen(); }
+
+	// returns false if the frame was dropped, or if its format is not the one of the file
+	bool Write(CMediaFrame *frame);
+
+	uint64_t GetFrameCount() const { return m_index.size(); }
+	AsyncWriterStats GetStats() const { return m_writer.GetStats(); }
+
+private:
+	CAsyncFileWriter m_writer;
+	MediaFormat m_format;
+	std::vector<ContainerIndexEntry> m_index;
+};
+
+// random access to the frames of a container through a read-only mapping of the whole file
+class CContainerReader {
+public:
+	CContainerReader() {}
+	~CContainerReader() { Close(); }
+
+	bool Open(const char *path);
+	void Close();
+
+	const MediaFormat &GetFormat() const { return m_format; }
+	uint64_t GetFrameCount() const { return m_count; }
+
+	// true if the file had no index and it was rebuilt by walking the records
+	bool IsRecovered() const { return !m_recovered.empty(); }
+
+	// the planes point into the mapping and stay valid until Close
+	bool GetFrame(uint64_t index, MediaSample &sample) const;
+	const ContainerIndexEntry *GetIndexEntry(uint64_t index) const { return index < m_count ? m_pIndex + index : nullptr; }
+
+	// last frame with a timestamp <= `timestamp` (binary search, timestamps are increasing), 0 if there is none
+	uint64_t FindFrame(int64_t timestamp) const;
+
+private:
+	bool ReadIndex();
+	bool RecoverIndex();
+
+private:
+	MediaFormat m_format;
+	const uint8_t *m_pData = nullptr;
+	uint64_t m_size = 0;
+
+	const ContainerIndexEntry *m_pIndex = nullptr; // in the mapping, or m_recovered
+	uint64_t m_count = 0;
+	std::vector<ContainerIndexEntry> m_recovered;
+
+#ifdef _WIN32
+	void *m_hFile = nullptr;
+	void *m_hMapping = nullptr;
+#endif
+};
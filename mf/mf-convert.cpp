@@ -0,0 +1,487 @@
+#include "mf-convert.h"
+#include "mf-format.h"
+#include <assert.h>
+#include <cstddef>
+#include <cstring>
+
+//---------------------------------------------------------------------------------------------
+// scalar reference, `x` is the first pixel to convert so that the simd kernels can finish their tail here
+
+static inline uint8_t RGBToY(int r, int g, int b)
+{
+	return uint8_t((66 * r + 129 * g + 25 * b + 128 + (16 << 8)) >> 8);
+}
+
+// the offset keeps the sum positive, so that a logical shift gives the same result as an arithmetic one
+static inline uint8_t RGBToU(int r, int g, int b)
+{
+	return uint8_t((-38 * r - 74 * g + 112 * b + 128 + (128 << 8)) >> 8);
+}
+
+static inline uint8_t RGBToV(int r, int g, int b)
+{
+	return uint8_t((112 * r - 94 * g - 18 * b + 128 + (128 << 8)) >> 8);
+}
+
+// kernels are instantiated per subtype, the component offsets come from the format table
+template<uint32_t Subtype> static void PackedYUVToNV12RowTail_C(const uint8_t *src0, const uint8_t *src1, uint8_t *dstY0, uint8_t *dstY1, uint8_t *dstUV, uint32_t x, uint32_t width)
+{
+	const uint32_t yOffset = TFormatTraits<Subtype>::lumaOffset;
+	const uint32_t cOffset = TFormatTraits<Subtype>::chromaOffset;
+	for (; x < width; x += 2) {
+		const uint8_t *a = src0 + x * 2;
+		const uint8_t *b = src1 + x * 2;
+		dstY0[x] = a[yOffset];
+		dstY0[x + 1] = a[yOffset + 2];
+		dstY1[x] = b[yOffset];
+		dstY1[x + 1] = b[yOffset + 2];
+		dstUV[x] = uint8_t((a[cOffset] + b[cOffset] + 1) >> 1);
+		dstUV[x + 1] = uint8_t((a[cOffset + 2] + b[cOffset + 2] + 1) >> 1);
+	}
+}
+
+// memory order of MFVideoFormat_RGB32/ARGB32/RGB24 is B, G, R (, A)
+template<uint32_t Subtype> static void RGBToNV12RowTail_C(const uint8_t *src0, const uint8_t *src1, uint8_t *dstY0, uint8_t *dstY1, uint8_t *dstUV, uint32_t x, uint32_t width)
+{
+	const uint32_t BPP = TFormatTraits<Subtype>::bytesPerPixel;
+	for (; x < width; x += 2) {
+		const uint8_t *a = src0 + x * BPP;
+		const uint8_t *b = src1 + x * BPP;
+		dstY0[x] = RGBToY(a[2], a[1], a[0]);
+		dstY0[x + 1] = RGBToY(a[BPP + 2], a[BPP + 1], a[BPP]);
+		dstY1[x] = RGBToY(b[2], b[1], b[0]);
+		dstY1[x + 1] = RGBToY(b[BPP + 2], b[BPP + 1], b[BPP]);
+
+		int blue = (a[0] + a[BPP] + b[0] + b[BPP] + 2) >> 2;
+		int green = (a[1] + a[BPP + 1] + b[1] + b[BPP + 1] + 2) >> 2;
+		int red = (a[2] + a[BPP + 2] + b[2] + b[BPP + 2] + 2) >> 2;
+		dstUV[x] = RGBToU(red, green, blue);
+		dstUV[x + 1] = RGBToV(red, green, blue);
+	}
+}
+
+static void InterleaveUVRowTail_C(const uint8_t *srcU, const uint8_t *srcV, uint8_t *dstUV, uint32_t i, uint32_t count)
+{
+	for (; i < count; ++i) {
+		dstUV[i * 2] = srcU[i];
+		dstUV[i * 2 + 1] = srcV[i];
+	}
+}
+
+template<uint32_t Subtype> static void PackedYUVToNV12Row_C(const uint8_t *src0, const uint8_t *src1, uint8_t *dstY0, uint8_t *dstY1, uint8_t *dstUV, uint32_t width)
+{
+	PackedYUVToNV12RowTail_C<Subtype>(src0, src1, dstY0, dstY1, dstUV, 0, width);
+}
+
+template<uint32_t Subtype> static void RGBToNV12Row_C(const uint8_t *src0, const uint8_t *src1, uint8_t *dstY0, uint8_t *dstY1, uint8_t *dstUV, uint32_t width)
+{
+	RGBToNV12RowTail_C<Subtype>(src0, src1, dstY0, dstY1, dstUV, 0, width);
+}
+
+static void InterleaveUVRow_C(const uint8_t *srcU, const uint8_t *srcV, uint8_t *dstUV, uint32_t count)
+{
+	InterleaveUVRowTail_C(srcU, srcV, dstUV, 0, count);
+}
+
+// rgb24 simd kernels expand a chunk of pixels to rgb32 and reuse the rgb32 kernel
+#define RGB24_CHUNK_PIXELS 64
+
+static void ExpandRGB24ToRGB32(const uint8_t *src, uint8_t *dst, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; ++i) {
+		dst[i * 4] = src[i * 3];
+		dst[i * 4 + 1] = src[i * 3 + 1];
+		dst[i * 4 + 2] = src[i * 3 + 2];
+		dst[i * 4 + 3] = 0xff;
+	}
+}
+
+template<PackedToNV12RowFunc RGB32Row> static void RGB24ToNV12Row_Chunked(const uint8_t *src0, const uint8_t *src1, uint8_t *dstY0, uint8_t *dstY1, uint8_t *dstUV, uint32_t width)
+{
+	uint8_t tmp0[RGB24_CHUNK_PIXELS * 4];
+	uint8_t tmp1[RGB24_CHUNK_PIXELS * 4];
+	for (uint32_t x = 0; x < width; x += RGB24_CHUNK_PIXELS) {
+		uint32_t count = width - x < RGB24_CHUNK_PIXELS ? width - x : RGB24_CHUNK_PIXELS;
+		ExpandRGB24ToRGB32(src0 + x * 3, tmp0, count);
+		ExpandRGB24ToRGB32(src1 + x * 3, tmp1, count);
+		RGB32Row(tmp0, tmp1, dstY0 + x, dstY1 + x, dstUV + x, count);
+	}
+}
+
+#if MF_ARCH_X86
+//---------------------------------------------------------------------------------------------
+// sse2
+
+template<uint32_t Subtype> MF_TARGET_SSE2 static void PackedYUVToNV12Row_SSE2(const uint8_t *src0, const uint8_t *src1, uint8_t *dstY0, uint8_t *dstY1, uint8_t *dstUV, uint32_t width)
+{
+	const __m128i mask = _mm_set1_epi16(0x00ff);
+	uint32_t x = 0;
+	for (; x + 16 <= width; x += 16) {
+		__m128i a0 = _mm_loadu_si128((const __m128i *)(src0 + x * 2));
+		__m128i a1 = _mm_loadu_si128((const __m128i *)(src0 + x * 2 + 16));
+		__m128i b0 = _mm_loadu_si128((const __m128i *)(src1 + x * 2));
+		__m128i b1 = _mm_loadu_si128((const __m128i *)(src1 + x * 2 + 16));
+
+		__m128i ya, yb, ca, cb;
+		if (TFormatTraits<Subtype>::lumaOffset) {
+			ya = _mm_packus_epi16(_mm_srli_epi16(a0, 8), _mm_srli_epi16(a1, 8));
+			yb = _mm_packus_epi16(_mm_srli_epi16(b0, 8), _mm_srli_epi16(b1, 8));
+			ca = _mm_packus_epi16(_mm_and_si128(a0, mask), _mm_and_si128(a1, mask));
+			cb = _mm_packus_epi16(_mm_and_si128(b0, mask), _mm_and_si128(b1, mask));
+		} else {
+			ya = _mm_packus_epi16(_mm_and_si128(a0, mask), _mm_and_si128(a1, mask));
+			yb = _mm_packus_epi16(_mm_and_si128(b0, mask), _mm_and_si128(b1, mask));
+			ca = _mm_packus_epi16(_mm_srli_epi16(a0, 8), _mm_srli_epi16(a1, 8));
+			cb = _mm_packus_epi16(_mm_srli_epi16(b0, 8), _mm_srli_epi16(b1, 8));
+		}
+
+		_mm_storeu_si128((__m128i *)(dstY0 + x), ya);
+		_mm_storeu_si128((__m128i *)(dstY1 + x), yb);
+		_mm_storeu_si128((__m128i *)(dstUV + x), _mm_avg_epu8(ca, cb)); // (a + b + 1) >> 1
+	}
+
+	PackedYUVToNV12RowTail_C<Subtype>(src0, src1, dstY0, dstY1, dstUV, x, width);
+}
+
+// [a0 a1 b0 b1] [c0 c1 d0 d1] -> [a0+a1 b0+b1 c0+c1 d0+d1]
+MF_TARGET_SSE2 static inline __m128i HorizontalAddPairs_SSE2(__m128i m0, __m128i m1)
+{
+	__m128 f0 = _mm_castsi128_ps(m0);
+	__m128 f1 = _mm_castsi128_ps(m1);
+	__m128i even = _mm_castps_si128(_mm_shuffle_ps(f0, f1, _MM_SHUFFLE(2, 0, 2, 0)));
+	__m128i odd = _mm_castps_si128(_mm_shuffle_ps(f0, f1, _MM_SHUFFLE(3, 1, 3, 1)));
+	return _mm_add_epi32(even, odd);
+}
+
+// 4 bgra pixels -> 4 luma values as int32
+MF_TARGET_SSE2 static inline __m128i RGB32ToY4_SSE2(__m128i px, __m128i coef, __m128i bias)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(px, zero), coef);
+	__m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(px, zero), coef);
+	return _mm_srli_epi32(_mm_add_epi32(HorizontalAddPairs_SSE2(lo, hi), bias), 8);
+}
+
+// 4 bgra pixels of two rows -> the averaged b,g,r,a of the two 2x2 blocks as int16
+MF_TARGET_SSE2 static inline __m128i RGB32BlockAverage_SSE2(__m128i a, __m128i b)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+	__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+	lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+	hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+	return _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_set1_epi16(2)), 2);
+}
+
+MF_TARGET_SSE2 static void RGB32ToNV12Row_SSE2(const uint8_t *src0, const uint8_t *src1, uint8_t *dstY0, uint8_t *dstY1, uint8_t *dstUV, uint32_t width)
+{
+	const __m128i coefY = _mm_setr_epi16(25, 129, 66, 0, 25, 129, 66, 0);
+	const __m128i coefU = _mm_setr_epi16(112, -74, -38, 0, 112, -74, -38, 0);
+	const __m128i coefV = _mm_setr_epi16(-18, -94, 112, 0, -18, -94, 112, 0);
+	const __m128i biasY = _mm_set1_epi32(128 + (16 << 8));
+	const __m128i biasC = _mm_set1_epi32(128 + (128 << 8));
+
+	uint32_t x = 0;
+	for (; x + 16 <= width; x += 16) {
+		__m128i a[4], b[4], blocks[4];
+		for (int i = 0; i < 4; ++i) {
+			a[i] = _mm_loadu_si128((const __m128i *)(src0 + (x + i * 4) * 4));
+			b[i] = _mm_loadu_si128((const __m128i *)(src1 + (x + i * 4) * 4));
+			blocks[i] = RGB32BlockAverage_SSE2(a[i], b[i]);
+		}
+
+		__m128i ya = _mm_packs_epi32(RGB32ToY4_SSE2(a[0], coefY, biasY), RGB32ToY4_SSE2(a[1], coefY, biasY));
+		__m128i yb = _mm_packs_epi32(RGB32ToY4_SSE2(a[2], coefY, biasY), RGB32ToY4_SSE2(a[3], coefY, biasY));
+		_mm_storeu_si128((__m128i *)(dstY0 + x), _mm_packus_epi16(ya, yb));
+
+		ya = _mm_packs_epi32(RGB32ToY4_SSE2(b[0], coefY, biasY), RGB32ToY4_SSE2(b[1], coefY, biasY));
+		yb = _mm_packs_epi32(RGB32ToY4_SSE2(b[2], coefY, biasY), RGB32ToY4_SSE2(b[3], coefY, biasY));
+		_mm_storeu_si128((__m128i *)(dstY1 + x), _mm_packus_epi16(ya, yb));
+
+		// 8 blocks -> 8 U and 8 V
+		__m128i u0 = _mm_srli_epi32(_mm_add_epi32(HorizontalAddPairs_SSE2(_mm_madd_epi16(blocks[0], coefU), _mm_madd_epi16(blocks[1], coefU)), biasC), 8);
+		__m128i u1 = _mm_srli_epi32(_mm_add_epi32(HorizontalAddPairs_SSE2(_mm_madd_epi16(blocks[2], coefU), _mm_madd_epi16(blocks[3], coefU)), biasC), 8);
+		__m128i v0 = _mm_srli_epi32(_mm_add_epi32(HorizontalAddPairs_SSE2(_mm_madd_epi16(blocks[0], coefV), _mm_madd_epi16(blocks[1], coefV)), biasC), 8);
+		__m128i v1 = _mm_srli_epi32(_mm_add_epi32(HorizontalAddPairs_SSE2(_mm_madd_epi16(blocks[2], coefV), _mm_madd_epi16(blocks[3], coefV)), biasC), 8);
+		__m128i u = _mm_packs_epi32(u0, u1);
+		__m128i v = _mm_packs_epi32(v0, v1);
+		_mm_storeu_si128((__m128i *)(dstUV + x), _mm_or_si128(u, _mm_slli_epi16(v, 8)));
+	}
+
+	RGBToNV12RowTail_C<MEDIA_SUBTYPE_RGB32>(src0, src1, dstY0, dstY1, dstUV, x, width);
+}
+
+MF_TARGET_SSE2 static void InterleaveUVRow_SSE2(const uint8_t *srcU, const uint8_t *srcV, uint8_t *dstUV, uint32_t count)
+{
+	uint32_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m128i u = _mm_loadu_si128((const __m128i *)(srcU + i));
+		__m128i v = _mm_loadu_si128((const __m128i *)(srcV + i));
+		_mm_storeu_si128((__m128i *)(dstUV + i * 2), _mm_unpacklo_epi8(u, v));
+		_mm_storeu_si128((__m128i *)(dstUV + i * 2 + 16), _mm_unpackhi_epi8(u, v));
+	}
+
+	InterleaveUVRowTail_C(srcU, srcV, dstUV, i, count);
+}
+
+//---------------------------------------------------------------------------------------------
+// avx2, the 256bit pack/unpack instructions work per 128bit lane, the permutes restore the pixel order
+
+template<uint32_t Subtype> MF_TARGET_AVX2 static void PackedYUVToNV12Row_AVX2(const uint8_t *src0, const uint8_t *src1, uint8_t *dstY0, uint8_t *dstY1, uint8_t *dstUV, uint32_t width)
+{
+	const __m256i mask = _mm256_set1_epi16(0x00ff);
+	uint32_t x = 0;
+	for (; x + 32 <= width; x += 32) {
+		__m256i a0 = _mm256_loadu_si256((const __m256i *)(src0 + x * 2));
+		__m256i a1 = _mm256_loadu_si256((const __m256i *)(src0 + x * 2 + 32));
+		__m256i b0 = _mm256_loadu_si256((const __m256i *)(src1 + x * 2));
+		__m256i b1 = _mm256_loadu_si256((const __m256i *)(src1 + x * 2 + 32));
+
+		__m256i ya, yb, ca, cb;
+		if (TFormatTraits<Subtype>::lumaOffset) {
+			ya = _mm256_packus_epi16(_mm256_srli_epi16(a0, 8), _mm256_srli_epi16(a1, 8));
+			yb = _mm256_packus_epi16(_mm256_srli_epi16(b0, 8), _mm256_srli_epi16(b1, 8));
+			ca = _mm256_packus_epi16(_mm256_and_si256(a0, mask), _mm256_and_si256(a1, mask));
+			cb = _mm256_packus_epi16(_mm256_and_si256(b0, mask), _mm256_and_si256(b1, mask));
+		} else {
+			ya = _mm256_packus_epi16(_mm256_and_si256(a0, mask), _mm256_and_si256(a1, mask));
+			yb = _mm256_packus_epi16(_mm256_and_si256(b0, mask), _mm256_and_si256(b1, mask));
+			ca = _mm256_packus_epi16(_mm256_srli_epi16(a0, 8), _mm256_srli_epi16(a1, 8));
+			cb = _mm256_packus_epi16(_mm256_srli_epi16(b0, 8), _mm256_srli_epi16(b1, 8));
+		}
+
+		// [0-7 16-23 | 8-15 24-31] -> [0-15 | 16-31]
+		ya = _mm256_permute4x64_epi64(ya, _MM_SHUFFLE(3, 1, 2, 0));
+		yb = _mm256_permute4x64_epi64(yb, _MM_SHUFFLE(3, 1, 2, 0));
+		__m256i uv = _mm256_permute4x64_epi64(_mm256_avg_epu8(ca, cb), _MM_SHUFFLE(3, 1, 2, 0));
+
+		_mm256_storeu_si256((__m256i *)(dstY0 + x), ya);
+		_mm256_storeu_si256((__m256i *)(dstY1 + x), yb);
+		_mm256_storeu_si256((__m256i *)(dstUV + x), uv);
+	}
+
+	PackedYUVToNV12RowTail_C<Subtype>(src0, src1, dstY0, dstY1, dstUV, x, width);
+}
+
+MF_TARGET_AVX2 static inline __m256i HorizontalAddPairs_AVX2(__m256i m0, __m256i m1)
+{
+	__m256 f0 = _mm256_castsi256_ps(m0);
+	__m256 f1 = _mm256_castsi256_ps(m1);
+	__m256i even = _mm256_castps_si256(_mm256_shuffle_ps(f0, f1, _MM_SHUFFLE(2, 0, 2, 0)));
+	__m256i odd = _mm256_castps_si256(_mm256_shuffle_ps(f0, f1, _MM_SHUFFLE(3, 1, 3, 1)));
+	return _mm256_add_epi32(even, odd);
+}
+
+// 8 bgra pixels -> 8 luma values as int32, in pixel order
+MF_TARGET_AVX2 static inline __m256i RGB32ToY8_AVX2(__m256i px, __m256i coef, __m256i bias)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(px, zero), coef);
+	__m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(px, zero), coef);
+	return _mm256_srli_epi32(_mm256_add_epi32(HorizontalAddPairs_AVX2(lo, hi), bias), 8);
+}
+
+// 8 bgra pixels of two rows -> the averaged b,g,r,a of the four 2x2 blocks as int16, in block order
+MF_TARGET_AVX2 static inline __m256i RGB32BlockAverage_AVX2(__m256i a, __m256i b)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+	__m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+	lo = _mm256_add_epi16(lo, _mm256_srli_si256(lo, 8));
+	hi = _mm256_add_epi16(hi, _mm256_srli_si256(hi, 8));
+	return _mm256_srli_epi16(_mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi), _mm256_set1_epi16(2)), 2);
+}
+
+MF_TARGET_AVX2 static void RGB32ToNV12Row_AVX2(const uint8_t *src0, const uint8_t *src1, uint8_t *dstY0, uint8_t *dstY1, uint8_t *dstUV, uint32_t width)
+{
+	const __m256i coefY = _mm256_setr_epi16(25, 129, 66, 0, 25, 129, 66, 0, 25, 129, 66, 0, 25, 129, 66, 0);
+	const __m256i coefU = _mm256_setr_epi16(112, -74, -38, 0, 112, -74, -38, 0, 112, -74, -38, 0, 112, -74, -38, 0);
+	const __m256i coefV = _mm256_setr_epi16(-18, -94, 112, 0, -18, -94, 112, 0, -18, -94, 112, 0, -18, -94, 112, 0);
+	const __m256i biasY = _mm256_set1_epi32(128 + (16 << 8));
+	const __m256i biasC = _mm256_set1_epi32(128 + (128 << 8));
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+	uint32_t x = 0;
+	for (; x + 32 <= width; x += 32) {
+		__m256i a[4], b[4], blocks[4];
+		for (int i = 0; i < 4; ++i) {
+			a[i] = _mm256_loadu_si256((const __m256i *)(src0 + (x + i * 8) * 4));
+			b[i] = _mm256_loadu_si256((const __m256i *)(src1 + (x + i * 8) * 4));
+			blocks[i] = RGB32BlockAverage_AVX2(a[i], b[i]);
+		}
+
+		__m256i ya = _mm256_packs_epi32(RGB32ToY8_AVX2(a[0], coefY, biasY), RGB32ToY8_AVX2(a[1], coefY, biasY));
+		__m256i yb = _mm256_packs_epi32(RGB32ToY8_AVX2(a[2], coefY, biasY), RGB32ToY8_AVX2(a[3], coefY, biasY));
+		_mm256_storeu_si256((__m256i *)(dstY0 + x), _mm256_permutevar8x32_epi32(_mm256_packus_epi16(ya, yb), order));
+
+		ya = _mm256_packs_epi32(RGB32ToY8_AVX2(b[0], coefY, biasY), RGB32ToY8_AVX2(b[1], coefY, biasY));
+		yb = _mm256_packs_epi32(RGB32ToY8_AVX2(b[2], coefY, biasY), RGB32ToY8_AVX2(b[3], coefY, biasY));
+		_mm256_storeu_si256((__m256i *)(dstY1 + x), _mm256_permutevar8x32_epi32(_mm256_packus_epi16(ya, yb), order));
+
+		// 16 blocks, lanes hold blocks [0 1 4 5 | 2 3 6 7] after the horizontal add
+		__m256i u0 = _mm256_srli_epi32(_mm256_add_epi32(HorizontalAddPairs_AVX2(_mm256_madd_epi16(blocks[0], coefU), _mm256_madd_epi16(blocks[1], coefU)), biasC), 8);
+		__m256i u1 = _mm256_srli_epi32(_mm256_add_epi32(HorizontalAddPairs_AVX2(_mm256_madd_epi16(blocks[2], coefU), _mm256_madd_epi16(blocks[3], coefU)), biasC), 8);
+		__m256i v0 = _mm256_srli_epi32(_mm256_add_epi32(HorizontalAddPairs_AVX2(_mm256_madd_epi16(blocks[0], coefV), _mm256_madd_epi16(blocks[1], coefV)), biasC), 8);
+		__m256i v1 = _mm256_srli_epi32(_mm256_add_epi32(HorizontalAddPairs_AVX2(_mm256_madd_epi16(blocks[2], coefV), _mm256_madd_epi16(blocks[3], coefV)), biasC), 8);
+		__m256i u = _mm256_packs_epi32(u0, u1);
+		__m256i v = _mm256_packs_epi32(v0, v1);
+		__m256i uv = _mm256_or_si256(u, _mm256_slli_epi16(v, 8));
+		_mm256_storeu_si256((__m256i *)(dstUV + x), _mm256_permutevar8x32_epi32(uv, order));
+	}
+
+	RGBToNV12RowTail_C<MEDIA_SUBTYPE_RGB32>(src0, src1, dstY0, dstY1, dstUV, x, width);
+}
+
+MF_TARGET_AVX2 static void InterleaveUVRow_AVX2(const uint8_t *srcU, const uint8_t *srcV, uint8_t *dstUV, uint32_t count)
+{
+	uint32_t i = 0;
+	for (; i + 32 <= count; i += 32) {
+		__m256i u = _mm256_loadu_si256((const __m256i *)(srcU + i));
+		__m256i v = _mm256_loadu_si256((const __m256i *)(srcV + i));
+		__m256i lo = _mm256_unpacklo_epi8(u, v); // [0-7 | 16-23]
+		__m256i hi = _mm256_unpackhi_epi8(u, v); // [8-15 | 24-31]
+		_mm256_storeu_si256((__m256i *)(dstUV + i * 2), _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i *)(dstUV + i * 2 + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+
+	InterleaveUVRowTail_C(srcU, srcV, dstUV, i, count);
+}
+#endif
+
+//---------------------------------------------------------------------------------------------
+bool IsConvertibleToNV12(uint32_t subtype)
+{
+	switch (subtype) {
+	case MEDIA_SUBTYPE_NV12:
+	case MEDIA_SUBTYPE_I420:
+	case MEDIA_SUBTYPE_IYUV:
+	case MEDIA_SUBTYPE_YV12:
+	case MEDIA_SUBTYPE_YUY2:
+	case MEDIA_SUBTYPE_UYVY:
+	case MEDIA_SUBTYPE_RGB32:
+	case MEDIA_SUBTYPE_ARGB32:
+	case MEDIA_SUBTYPE_RGB24:
+		return true;
+	default:
+		return IsHighBitDepth(subtype);
+	}
+}
+
+bool CVideoConverter::Init(uint32_t subtype, SimdLevel level)
+{
+	if (!IsConvertibleToNV12(subtype))
+		return false;
+
+	if (level > GetCpuSimdLevel())
+		level = GetCpuSimdLevel();
+
+	m_subtype = subtype;
+	m_level = level;
+	m_packedRow = nullptr;
+	m_interleaveRow = nullptr;
+	m_depth = CDepthConverter();
+	if (IsHighBitDepth(subtype))
+		return m_depth.Init(subtype, MEDIA_SUBTYPE_NV12, level);
+
+#if MF_ARCH_X86
+	const bool avx2 = level >= SIMD_AVX2;
+	const bool sse2 = level >= SIMD_SSE2;
+#else
+	const bool avx2 = false;
+	const bool sse2 = false;
+#endif
+
+	switch (subtype) {
+	case MEDIA_SUBTYPE_YUY2:
+		m_packedRow = PackedYUVToNV12Row_C<MEDIA_SUBTYPE_YUY2>;
+#if MF_ARCH_X86
+		if (sse2)
+			m_packedRow = avx2 ? PackedYUVToNV12Row_AVX2<MEDIA_SUBTYPE_YUY2> : PackedYUVToNV12Row_SSE2<MEDIA_SUBTYPE_YUY2>;
+#endif
+		break;
+
+	case MEDIA_SUBTYPE_UYVY:
+		m_packedRow = PackedYUVToNV12Row_C<MEDIA_SUBTYPE_UYVY>;
+#if MF_ARCH_X86
+		if (sse2)
+			m_packedRow = avx2 ? PackedYUVToNV12Row_AVX2<MEDIA_SUBTYPE_UYVY> : PackedYUVToNV12Row_SSE2<MEDIA_SUBTYPE_UYVY>;
+#endif
+		break;
+
+	case MEDIA_SUBTYPE_RGB32:
+	case MEDIA_SUBTYPE_ARGB32:
+		m_packedRow = RGBToNV12Row_C<MEDIA_SUBTYPE_RGB32>;
+#if MF_ARCH_X86
+		if (sse2)
+			m_packedRow = avx2 ? RGB32ToNV12Row_AVX2 : RGB32ToNV12Row_SSE2;
+#endif
+		break;
+
+	case MEDIA_SUBTYPE_RGB24:
+		m_packedRow = RGBToNV12Row_C<MEDIA_SUBTYPE_RGB24>;
+#if MF_ARCH_X86
+		if (sse2)
+			m_packedRow = avx2 ? RGB24ToNV12Row_Chunked<RGB32ToNV12Row_AVX2> : RGB24ToNV12Row_Chunked<RGB32ToNV12Row_SSE2>;
+#endif
+		break;
+
+	case MEDIA_SUBTYPE_I420:
+	case MEDIA_SUBTYPE_IYUV:
+	case MEDIA_SUBTYPE_YV12:
+		m_interleaveRow = InterleaveUVRow_C;
+#if MF_ARCH_X86
+		if (sse2)
+			m_interleaveRow = avx2 ? InterleaveUVRow_AVX2 : InterleaveUVRow_SSE2;
+#endif
+		break;
+
+	default: // NV12 is a plain copy
+		break;
+	}
+
+	(void)avx2;
+	(void)sse2;
+	return true;
+}
+
+bool CVideoConverter::Convert(const MediaPlane *src, uint32_t width, uint32_t height, uint8_t *dstY, int32_t dstStrideY, uint8_t *dstUV, int32_t dstStrideUV, uint32_t rowBegin,
+			      uint32_t rowEnd) const
+{
+	if (!m_subtype || (width & 1) || (height & 1)) {
+		assert(false);
+		return false;
+	}
+
+	if (!rowEnd)
+		rowEnd = height;
+	if ((rowBegin & 1) || (rowEnd & 1) || rowBegin > rowEnd || rowEnd > height) {
+		assert(false);
+		return false;
+	}
+
+	if (m_depth.GetSubtype())
+		return m_depth.Convert(src, width, height, dstY, dstStrideY, dstUV, dstStrideUV, rowBegin, rowEnd);
+
+	if (m_packedRow) {
+		const ptrdiff_t stride = src[0].stride;
+		for (uint32_t y = rowBegin; y < rowEnd; y += 2) {
+			const uint8_t *src0 = src[0].data + (ptrdiff_t)y * stride;
+			uint8_t *y0 = dstY + (ptrdiff_t)y * dstStrideY;
+			m_packedRow(src0, src0 + stride, y0, y0 + dstStrideY, dstUV + (ptrdiff_t)(y / 2) * dstStrideUV, width);
+		}
+		return true;
+	}
+
+	for (uint32_t y = rowBegin; y < rowEnd; ++y)
+		memcpy(dstY + (ptrdiff_t)y * dstStrideY, src[0].data + (ptrdiff_t)y * src[0].stride, width);
+
+	for (uint32_t y = rowBegin / 2; y < rowEnd / 2; ++y) {
+		uint8_t *uv = dstUV + (ptrdiff_t)y * dstStrideUV;
+		if (m_interleaveRow)
+			m_interleaveRow(src[1].data + (ptrdiff_t)y * src[1].stride, src[2].data + (ptrdiff_t)y * src[2].stride, uv, width / 2);
+		else
+			memcpy(uv, src[1].data + (ptrdiff_t)y * src[1].stride, width);
+	}
+
+	return true;
+}
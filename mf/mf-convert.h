@@ -0,0 +1,35 @@
+﻿#pragma once
+#include "mf-cpu.h"
+#include "mf-depth.h"
+#include "mf-sample.h"
+
+// YUY2/UYVY/RGB32/ARGB32/RGB24/I420/YV12 -> NV12 conversion, so that any native type of the device can be captured
+// without the system converters of the source reader. the 10 and 16 bit types are dithered down by CDepthConverter.
+// rgb -> yuv uses BT.601 limited range, chroma of rgb and packed yuv is the average of each 2x2 block.
+// every simd kernel produces exactly the same bytes as the scalar one.
+
+bool IsConvertibleToNV12(uint32_t subtype);
+
+typedef void (*PackedToNV12RowFunc)(const uint8_t *src0, const uint8_t *src1, uint8_t *dstY0, uint8_t *dstY1, uint8_t *dstUV, uint32_t width);
+typedef void (*InterleaveUVRowFunc)(const uint8_t *srcU, const uint8_t *srcV, uint8_t *dstUV, uint32_t count);
+
+class CVideoConverter {
+public:
+	// kernels are picked once here for the given level, the default is what the cpu supports
+	bool Init(uint32_t subtype, SimdLevel level = GetSimdLevel());
+
+	uint32_t GetSubtype() const { return m_subtype; }
+	SimdLevel GetLevel() const { return m_level; }
+
+	// src planes as produced by DescribeVideoPlanes, width and height must be even.
+	// rows [rowBegin, rowEnd) of the frame are converted, rowBegin and rowEnd must be even, rowEnd = 0 means the whole frame.
+	bool Convert(const MediaPlane *src, uint32_t width, uint32_t height, uint8_t *dstY, int32_t dstStrideY, uint8_t *dstUV, int32_t dstStrideUV, uint32_t rowBegin = 0,
+		     uint32_t rowEnd = 0) const;
+
+private:
+	uint32_t m_subtype = 0;
+	SimdLevel m_level = SIMD_SCALAR;
+	PackedToNV12RowFunc m_packedRow = nullptr;
+	InterleaveUVRowFunc m_interleaveRow = nullptr;
+	CDepthConverter m_depth;
+};
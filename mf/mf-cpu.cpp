@@ -0,0 +1,99 @@
+#include "mf-cpu.h"
+#include <atomic>
+
+#if MF_ARCH_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+static void CpuId(int leaf, int subleaf, unsigned int regs[4])
+{
+#ifdef _MSC_VER
+	int info[4] = {0};
+	__cpuidex(info, leaf, subleaf);
+	for (int i = 0; i < 4; ++i)
+		regs[i] = (unsigned int)info[i];
+#else
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static uint64_t GetXCR0()
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	unsigned int eax = 0, edx = 0;
+	__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+static SimdLevel DetectSimdLevel()
+{
+	unsigned int regs[4] = {0};
+	CpuId(0, 0, regs);
+	const unsigned int maxLeaf = regs[0];
+
+	CpuId(1, 0, regs);
+	if (!(regs[3] & (1u << 26))) // sse2
+		return SIMD_SCALAR;
+
+	const bool osxsave = (regs[2] & (1u << 27)) != 0;
+	const bool avx = (regs[2] & (1u << 28)) != 0;
+	if (!osxsave || !avx || maxLeaf < 7)
+		return SIMD_SSE2;
+
+	// the os must save the ymm registers on context switch
+	if ((GetXCR0() & 0x6) != 0x6)
+		return SIMD_SSE2;
+
+	CpuId(7, 0, regs);
+	if (!(regs[1] & (1u << 5))) // avx2
+		return SIMD_SSE2;
+
+	return SIMD_AVX2;
+}
+#else
+static SimdLevel DetectSimdLevel()
+{
+	return SIMD_SCALAR;
+}
+#endif
+
+static std::atomic<int> g_simdLevel{-1};
+
+SimdLevel GetCpuSimdLevel()
+{
+	static const SimdLevel level = DetectSimdLevel();
+	return level;
+}
+
+SimdLevel GetSimdLevel()
+{
+	int level = g_simdLevel.load(std::memory_order_relaxed);
+	if (level < 0)
+		return GetCpuSimdLevel();
+	return (SimdLevel)level;
+}
+
+void SetSimdLevel(SimdLevel level)
+{
+	if (level > GetCpuSimdLevel())
+		level = GetCpuSimdLevel();
+	g_simdLevel = (int)level;
+}
+
+const char *GetSimdLevelString(SimdLevel level)
+{
+	switch (level) {
+	case SIMD_SSE2:
+		return "sse2";
+	case SIMD_AVX2:
+		return "avx2";
+	default:
+		return "scalar";
+	}
+}
@@ -0,0 +1,34 @@
+﻿#pragma once
+#include <cstdint>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define MF_ARCH_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#else
+#define MF_ARCH_X86 0
+#endif
+
+// msvc accepts intrinsics of any instruction set, gcc/clang need the function to be tagged
+#if MF_ARCH_X86 && !defined(_MSC_VER)
+#define MF_TARGET_SSE2 __attribute__((target("sse2")))
+#define MF_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define MF_TARGET_SSE2
+#define MF_TARGET_AVX2
+#endif
+
+enum SimdLevel {
+	SIMD_SCALAR = 0,
+	SIMD_SSE2,
+	SIMD_AVX2,
+};
+
+// best level supported by both the cpu and the os, detected once
+SimdLevel GetCpuSimdLevel();
+
+// level used by the kernels, defaults to GetCpuSimdLevel(); can be lowered for profiling/comparison
+SimdLevel GetSimdLevel();
+void SetSimdLevel(SimdLevel level);
+
+const char *GetSimdLevelString(SimdLevel level);
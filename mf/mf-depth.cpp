@@ -0,0 +1,435 @@
+#include "mf-depth.h"
+#include <assert.h>
+#include <cstddef>
+#include <cstring>
+
+// unpacked in chunks which stay in the l1 cache before they are dithered.
+// a multiple of the 6 pixels of a v210 group and of the 32 samples of the avx2 dither
+#define DEPTH_CHUNK_PIXELS 192
+// the 10 bits P010 keeps of a 16 bit sample
+#define DEPTH_P010_MASK 0xffc0
+
+// 8x8 bayer matrix in 1/256 of an 8 bit step, centered in each of the 64 levels
+static const uint16_t g_dither[8][8] = {
+	{2, 130, 34, 162, 10, 138, 42, 170},
+	{194, 66, 226, 98, 202, 74, 234, 106},
+	{50, 178, 18, 146, 58, 186, 26, 154},
+	{242, 114, 210, 82, 250, 122, 218, 90},
+	{14, 142, 46, 174, 6, 134, 38, 166},
+	{206, 78, 238, 110, 198, 70, 230, 102},
+	{62, 190, 30, 158, 54, 182, 22, 150},
+	{254, 126, 222, 94, 246, 118, 214, 86},
+};
+
+static void DitherRowTail_C(const uint16_t *src, uint8_t *dst, uint32_t i, uint32_t count, uint32_t row)
+{
+	const uint16_t *dither = g_dither[row & 7];
+	for (; i < count; ++i) {
+		uint32_t value = src[i] + dither[i & 7];
+		dst[i] = uint8_t((value > 65535 ? 65535 : value) >> 8);
+	}
+}
+
+static void MaskRowTail_C(const uint16_t *src, uint16_t *dst, uint32_t i, uint32_t count)
+{
+	for (; i < count; ++i)
+		dst[i] = uint16_t(src[i] & DEPTH_P010_MASK);
+}
+
+// the chroma is averaged at 10 bits, so the rounding does not set the bits P010 requires to be zero
+static void Y210ToP010RowTail_C(const uint8_t *src0, const uint8_t *src1, uint16_t *dstY0, uint16_t *dstY1, uint16_t *dstUV, uint32_t x, uint32_t width)
+{
+	const uint16_t *a = (const uint16_t *)src0;
+	const uint16_t *b = (const uint16_t *)src1;
+	for (; x < width; x += 2) {
+		dstY0[x] = uint16_t(a[x * 2] & DEPTH_P010_MASK);
+		dstY0[x + 1] = uint16_t(a[x * 2 + 2] & DEPTH_P010_MASK);
+		dstY1[x] = uint16_t(b[x * 2] & DEPTH_P010_MASK);
+		dstY1[x + 1] = uint16_t(b[x * 2 + 2] & DEPTH_P010_MASK);
+		dstUV[x] = uint16_t(((a[x * 2 + 1] >> 6) + (b[x * 2 + 1] >> 6) + 1) >> 1 << 6);
+		dstUV[x + 1] = uint16_t(((a[x * 2 + 3] >> 6) + (b[x * 2 + 3] >> 6) + 1) >> 1 << 6);
+	}
+}
+
+// 4 words of [Cb0 Y0 Cr0] [Y1 Cb1 Y2] [Cr1 Y3 Cb2] [Y4 Cr2 Y5], the first value in the low bits
+static void UnpackV210Group(const uint8_t *src, uint32_t *y, uint32_t *uv)
+{
+	uint32_t w[4];
+	memcpy(w, src, sizeof(w));
+	uv[0] = w[0] & 0x3ff;
+	y[0] = (w[0] >> 10) & 0x3ff;
+	uv[1] = (w[0] >> 20) & 0x3ff;
+	y[1] = w[1] & 0x3ff;
+	uv[2] = (w[1] >> 10) & 0x3ff;
+	y[2] = (w[1] >> 20) & 0x3ff;
+	uv[3] = w[2] & 0x3ff;
+	y[3] = (w[2] >> 10) & 0x3ff;
+	uv[4] = (w[2] >> 20) & 0x3ff;
+	y[4] = w[3] & 0x3ff;
+	uv[5] = (w[3] >> 10) & 0x3ff;
+	y[5] = (w[3] >> 20) & 0x3ff;
+}
+
+// x must be a multiple of 6
+static void V210ToP010RowTail_C(const uint8_t *src0, const uint8_t *src1, uint16_t *dstY0, uint16_t *dstY1, uint16_t *dstUV, uint32_t x, uint32_t width)
+{
+	for (; x < width; x += 6) {
+		uint32_t ya[6], yb[6], uva[6], uvb[6];
+		UnpackV210Group(src0 + x / 6 * 16, ya, uva);
+		UnpackV210Group(src1 + x / 6 * 16, yb, uvb);
+
+		const uint32_t count = width - x < 6 ? width - x : 6;
+		for (uint32_t i = 0; i < count; ++i) {
+			dstY0[x + i] = uint16_t(ya[i] << 6);
+			dstY1[x + i] = uint16_t(yb[i] << 6);
+			dstUV[x + i] = uint16_t(((uva[i] + uvb[i] + 1) >> 1) << 6);
+		}
+	}
+}
+
+static void DitherRow_C(const uint16_t *src, uint8_t *dst, uint32_t count, uint32_t row)
+{
+	DitherRowTail_C(src, dst, 0, count, row);
+}
+
+static void MaskRow_C(const uint16_t *src, uint16_t *dst, uint32_t count)
+{
+	MaskRowTail_C(src, dst, 0, count);
+}
+
+static void Y210ToP010Row_C(const uint8_t *src0, const uint8_t *src1, uint16_t *dstY0, uint16_t *dstY1, uint16_t *dstUV, uint32_t width)
+{
+	Y210ToP010RowTail_C(src0, src1, dstY0, dstY1, dstUV, 0, width);
+}
+
+static void V210ToP010Row_C(const uint8_t *src0, const uint8_t *src1, uint16_t *dstY0, uint16_t *dstY1, uint16_t *dstUV, uint32_t width)
+{
+	V210ToP010RowTail_C(src0, src1, dstY0, dstY1, dstUV, 0, width);
+}
+
+#if MF_ARCH_X86
+//---------------------------------------------------------------------------------------------
+// sse2
+
+MF_TARGET_SSE2 static void DitherRow_SSE2(const uint16_t *src, uint8_t *dst, uint32_t count, uint32_t row)
+{
+	const __m128i dither = _mm_loadu_si128((const __m128i *)g_dither[row & 7]);
+	uint32_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m128i a = _mm_adds_epu16(_mm_loadu_si128((const __m128i *)(src + i)), dither);
+		__m128i b = _mm_adds_epu16(_mm_loadu_si128((const __m128i *)(src + i + 8)), dither);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+	}
+
+	DitherRowTail_C(src, dst, i, count, row);
+}
+
+MF_TARGET_SSE2 static void MaskRow_SSE2(const uint16_t *src, uint16_t *dst, uint32_t count)
+{
+	const __m128i mask = _mm_set1_epi16((short)DEPTH_P010_MASK);
+	uint32_t i = 0;
+	for (; i + 8 <= count; i += 8)
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_and_si128(_mm_loadu_si128((const __m128i *)(src + i)), mask));
+
+	MaskRowTail_C(src, dst, i, count);
+}
+
+// [Y0 U0 Y1 V0 Y2 U1 Y3 V1] -> [Y0 Y1 Y2 Y3 U0 V0 U1 V1]
+MF_TARGET_SSE2 static inline __m128i SplitY210_SSE2(__m128i x)
+{
+	x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(3, 1, 2, 0));
+	x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(3, 1, 2, 0));
+	return _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+MF_TARGET_SSE2 static void Y210ToP010Row_SSE2(const uint8_t *src0, const uint8_t *src1, uint16_t *dstY0, uint16_t *dstY1, uint16_t *dstUV, uint32_t width)
+{
+	const __m128i mask = _mm_set1_epi16((short)DEPTH_P010_MASK);
+	uint32_t x = 0;
+	for (; x + 8 <= width; x += 8) {
+		__m128i a0 = SplitY210_SSE2(_mm_loadu_si128((const __m128i *)(src0 + x * 4)));
+		__m128i a1 = SplitY210_SSE2(_mm_loadu_si128((const __m128i *)(src0 + x * 4 + 16)));
+		__m128i b0 = SplitY210_SSE2(_mm_loadu_si128((const __m128i *)(src1 + x * 4)));
+		__m128i b1 = SplitY210_SSE2(_mm_loadu_si128((const __m128i *)(src1 + x * 4 + 16)));
+
+		_mm_storeu_si128((__m128i *)(dstY0 + x), _mm_and_si128(_mm_unpacklo_epi64(a0, a1), mask));
+		_mm_storeu_si128((__m128i *)(dstY1 + x), _mm_and_si128(_mm_unpacklo_epi64(b0, b1), mask));
+		const __m128i uv = _mm_avg_epu16(_mm_srli_epi16(_mm_unpackhi_epi64(a0, a1), 6), _mm_srli_epi16(_mm_unpackhi_epi64(b0, b1), 6));
+		_mm_storeu_si128((__m128i *)(dstUV + x), _mm_slli_epi16(uv, 6));
+	}
+
+	Y210ToP010RowTail_C(src0, src1, dstY0, dstY1, dstUV, x, width);
+}
+
+// one v210 group -> y: [Y0 .. Y5 U0 V0], uv: [U0 V0 U1 V1 U2 V2 0 0], 10 bit
+MF_TARGET_SSE2 static inline void UnpackV210_SSE2(__m128i w, __m128i &y, __m128i &uv)
+{
+	const __m128i mask = _mm_set1_epi32(0x3ff);
+	const __m128i lanes03 = _mm_setr_epi32(-1, 0, 0, -1);
+	const __m128i lanes02 = _mm_setr_epi32(-1, 0, -1, 0);
+	const __m128i lane1 = _mm_setr_epi32(0, -1, 0, 0);
+	const __m128i lane2 = _mm_setr_epi32(0, 0, -1, 0);
+
+	// the first, second and third value of each word
+	__m128i s0 = _mm_and_si128(w, mask);
+	__m128i s10 = _mm_and_si128(_mm_srli_epi32(w, 10), mask);
+	__m128i s20 = _mm_and_si128(_mm_srli_epi32(w, 20), mask);
+
+	// [Y0 Y1 Y2 Y3] = [s10.0 s0.1 s20.1 s10.2]
+	__m128i v0 = _mm_or_si128(_mm_and_si128(_mm_shuffle_epi32(s10, _MM_SHUFFLE(2, 2, 0, 0)), lanes03), _mm_and_si128(s0, lane1));
+	v0 = _mm_or_si128(v0, _mm_and_si128(_mm_shuffle_epi32(s20, _MM_SHUFFLE(1, 1, 1, 1)), lane2));
+	// [Y4 Y5 U0 V0] = [s0.3 s20.3 s0.0 s20.0]
+	__m128i v1 = _mm_or_si128(_mm_and_si128(_mm_shuffle_epi32(s0, _MM_SHUFFLE(0, 0, 3, 3)), lanes02), _mm_andnot_si128(lanes02, _mm_shuffle_epi32(s20, _MM_SHUFFLE(0, 0, 3, 3))));
+	// [U1 V1 U2 V2] = [s10.1 s0.2 s20.2 s10.3]
+	__m128i v2 = _mm_or_si128(_mm_and_si128(_mm_shuffle_epi32(s10, _MM_SHUFFLE(3, 3, 1, 1)), lanes03), _mm_and_si128(_mm_shuffle_epi32(s0, _MM_SHUFFLE(2, 2, 2, 2)), lane1));
+	v2 = _mm_or_si128(v2, _mm_and_si128(s20, lane2));
+
+	y = _mm_packs_epi32(v0, v1);
+	uv = _mm_srli_si128(_mm_packs_epi32(v1, v2), 4);
+}
+
+// x must be a multiple of 6
+MF_TARGET_SSE2 static void V210ToP010RowTail_SSE2(const uint8_t *src0, const uint8_t *src1, uint16_t *dstY0, uint16_t *dstY1, uint16_t *dstUV, uint32_t x, uint32_t width)
+{
+	// each group stores 8 samples of which 6 are valid, the next group overwrites the other two
+	for (; x + 8 <= width; x += 6) {
+		__m128i ya, yb, uva, uvb;
+		UnpackV210_SSE2(_mm_loadu_si128((const __m128i *)(src0 + x / 6 * 16)), ya, uva);
+		UnpackV210_SSE2(_mm_loadu_si128((const __m128i *)(src1 + x / 6 * 16)), yb, uvb);
+
+		_mm_storeu_si128((__m128i *)(dstY0 + x), _mm_slli_epi16(ya, 6));
+		_mm_storeu_si128((__m128i *)(dstY1 + x), _mm_slli_epi16(yb, 6));
+		_mm_storeu_si128((__m128i *)(dstUV + x), _mm_slli_epi16(_mm_avg_epu16(uva, uvb), 6));
+	}
+
+	V210ToP010RowTail_C(src0, src1, dstY0, dstY1, dstUV, x, width);
+}
+
+MF_TARGET_SSE2 static void V210ToP010Row_SSE2(const uint8_t *src0, const uint8_t *src1, uint16_t *dstY0, uint16_t *dstY1, uint16_t *dstUV, uint32_t width)
+{
+	V210ToP010RowTail_SSE2(src0, src1, dstY0, dstY1, dstUV, 0, width);
+}
+
+//---------------------------------------------------------------------------------------------
+// avx2, the same per 128 bit lane
+
+MF_TARGET_AVX2 static void DitherRow_AVX2(const uint16_t *src, uint8_t *dst, uint32_t count, uint32_t row)
+{
+	const __m256i dither = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)g_dither[row & 7]));
+	uint32_t i = 0;
+	for (; i + 32 <= count; i += 32) {
+		__m256i a = _mm256_adds_epu16(_mm256_loadu_si256((const __m256i *)(src + i)), dither);
+		__m256i b = _mm256_adds_epu16(_mm256_loadu_si256((const __m256i *)(src + i + 16)), dither);
+		__m256i packed = _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8));
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+
+	DitherRowTail_C(src, dst, i, count, row);
+}
+
+MF_TARGET_AVX2 static void MaskRow_AVX2(const uint16_t *src, uint16_t *dst, uint32_t count)
+{
+	const __m256i mask = _mm256_set1_epi16((short)DEPTH_P010_MASK);
+	uint32_t i = 0;
+	for (; i + 16 <= count; i += 16)
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(src + i)), mask));
+
+	MaskRowTail_C(src, dst, i, count);
+}
+
+MF_TARGET_AVX2 static inline __m256i SplitY210_AVX2(__m256i x)
+{
+	x = _mm256_shufflelo_epi16(x, _MM_SHUFFLE(3, 1, 2, 0));
+	x = _mm256_shufflehi_epi16(x, _MM_SHUFFLE(3, 1, 2, 0));
+	return _mm256_shuffle_epi32(x, _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+MF_TARGET_AVX2 static void Y210ToP010Row_AVX2(const uint8_t *src0, const uint8_t *src1, uint16_t *dstY0, uint16_t *dstY1, uint16_t *dstUV, uint32_t width)
+{
+	const __m256i mask = _mm256_set1_epi16((short)DEPTH_P010_MASK);
+	uint32_t x = 0;
+	for (; x + 16 <= width; x += 16) {
+		__m256i a0 = SplitY210_AVX2(_mm256_loadu_si256((const __m256i *)(src0 + x * 4)));
+		__m256i a1 = SplitY210_AVX2(_mm256_loadu_si256((const __m256i *)(src0 + x * 4 + 32)));
+		__m256i b0 = SplitY210_AVX2(_mm256_loadu_si256((const __m256i *)(src1 + x * 4)));
+		__m256i b1 = SplitY210_AVX2(_mm256_loadu_si256((const __m256i *)(src1 + x * 4 + 32)));
+
+		// unpack works per lane: [0-3 8-11 | 4-7 12-15] -> permute
+		__m256i ya = _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(a0, a1), _MM_SHUFFLE(3, 1, 2, 0));
+		__m256i yb = _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(b0, b1), _MM_SHUFFLE(3, 1, 2, 0));
+		__m256i uv = _mm256_avg_epu16(_mm256_srli_epi16(_mm256_unpackhi_epi64(a0, a1), 6), _mm256_srli_epi16(_mm256_unpackhi_epi64(b0, b1), 6));
+		_mm256_storeu_si256((__m256i *)(dstY0 + x), _mm256_and_si256(ya, mask));
+		_mm256_storeu_si256((__m256i *)(dstY1 + x), _mm256_and_si256(yb, mask));
+		_mm256_storeu_si256((__m256i *)(dstUV + x), _mm256_slli_epi16(_mm256_permute4x64_epi64(uv, _MM_SHUFFLE(3, 1, 2, 0)), 6));
+	}
+
+	Y210ToP010RowTail_C(src0, src1, dstY0, dstY1, dstUV, x, width);
+}
+
+// two v210 groups, one per lane
+MF_TARGET_AVX2 static inline void UnpackV210_AVX2(__m256i w, __m256i &y, __m256i &uv)
+{
+	const __m256i mask = _mm256_set1_epi32(0x3ff);
+	const __m256i lanes03 = _mm256_setr_epi32(-1, 0, 0, -1, -1, 0, 0, -1);
+	const __m256i lanes02 = _mm256_setr_epi32(-1, 0, -1, 0, -1, 0, -1, 0);
+	const __m256i lane1 = _mm256_setr_epi32(0, -1, 0, 0, 0, -1, 0, 0);
+	const __m256i lane2 = _mm256_setr_epi32(0, 0, -1, 0, 0, 0, -1, 0);
+
+	__m256i s0 = _mm256_and_si256(w, mask);
+	__m256i s10 = _mm256_and_si256(_mm256_srli_epi32(w, 10), mask);
+	__m256i s20 = _mm256_and_si256(_mm256_srli_epi32(w, 20), mask);
+
+	__m256i v0 = _mm256_or_si256(_mm256_and_si256(_mm256_shuffle_epi32(s10, _MM_SHUFFLE(2, 2, 0, 0)), lanes03), _mm256_and_si256(s0, lane1));
+	v0 = _mm256_or_si256(v0, _mm256_and_si256(_mm256_shuffle_epi32(s20, _MM_SHUFFLE(1, 1, 1, 1)), lane2));
+	__m256i v1 = _mm256_or_si256(_mm256_and_si256(_mm256_shuffle_epi32(s0, _MM_SHUFFLE(0, 0, 3, 3)), lanes02),
+				     _mm256_andnot_si256(lanes02, _mm256_shuffle_epi32(s20, _MM_SHUFFLE(0, 0, 3, 3))));
+	__m256i v2 = _mm256_or_si256(_mm256_and_si256(_mm256_shuffle_epi32(s10, _MM_SHUFFLE(3, 3, 1, 1)), lanes03),
+				     _mm256_and_si256(_mm256_shuffle_epi32(s0, _MM_SHUFFLE(2, 2, 2, 2)), lane1));
+	v2 = _mm256_or_si256(v2, _mm256_and_si256(s20, lane2));
+
+	y = _mm256_packs_epi32(v0, v1);
+	uv = _mm256_srli_si256(_mm256_packs_epi32(v1, v2), 4);
+}
+
+MF_TARGET_AVX2 static void V210ToP010Row_AVX2(const uint8_t *src0, const uint8_t *src1, uint16_t *dstY0, uint16_t *dstY1, uint16_t *dstUV, uint32_t width)
+{
+	uint32_t x = 0;
+	for (; x + 14 <= width; x += 12) {
+		__m256i ya, yb, uva, uvb;
+		UnpackV210_AVX2(_mm256_loadu_si256((const __m256i *)(src0 + x / 6 * 16)), ya, uva);
+		UnpackV210_AVX2(_mm256_loadu_si256((const __m256i *)(src1 + x / 6 * 16)), yb, uvb);
+		ya = _mm256_slli_epi16(ya, 6);
+		yb = _mm256_slli_epi16(yb, 6);
+		__m256i uv = _mm256_slli_epi16(_mm256_avg_epu16(uva, uvb), 6);
+
+		// 6 valid samples per lane, overlapping stores as in the sse2 version
+		_mm_storeu_si128((__m128i *)(dstY0 + x), _mm256_castsi256_si128(ya));
+		_mm_storeu_si128((__m128i *)(dstY0 + x + 6), _mm256_extracti128_si256(ya, 1));
+		_mm_storeu_si128((__m128i *)(dstY1 + x), _mm256_castsi256_si128(yb));
+		_mm_storeu_si128((__m128i *)(dstY1 + x + 6), _mm256_extracti128_si256(yb, 1));
+		_mm_storeu_si128((__m128i *)(dstUV + x), _mm256_castsi256_si128(uv));
+		_mm_storeu_si128((__m128i *)(dstUV + x + 6), _mm256_extracti128_si256(uv, 1));
+	}
+
+	V210ToP010RowTail_SSE2(src0, src1, dstY0, dstY1, dstUV, x, width);
+}
+#endif
+
+//---------------------------------------------------------------------------------------------
+bool IsHighBitDepth(uint32_t subtype)
+{
+	return GetVideoBitDepth(subtype) > 8;
+}
+
+bool CDepthConverter::Init(uint32_t subtype, uint32_t target, SimdLevel level)
+{
+	if (!IsHighBitDepth(subtype) || (target != MEDIA_SUBTYPE_P010 && target != MEDIA_SUBTYPE_NV12))
+		return false;
+
+	if (level > GetCpuSimdLevel())
+		level = GetCpuSimdLevel();
+
+	m_subtype = subtype;
+	m_target = target;
+	m_packedRow = nullptr;
+
+#if MF_ARCH_X86
+	const bool avx2 = level >= SIMD_AVX2;
+	const bool sse2 = level >= SIMD_SSE2;
+#else
+	const bool avx2 = false;
+	const bool sse2 = false;
+#endif
+
+	switch (subtype) {
+	case MEDIA_SUBTYPE_Y210:
+		m_packedRow = Y210ToP010Row_C;
+#if MF_ARCH_X86
+		if (sse2)
+			m_packedRow = avx2 ? Y210ToP010Row_AVX2 : Y210ToP010Row_SSE2;
+#endif
+		break;
+
+	case MEDIA_SUBTYPE_V210:
+		m_packedRow = V210ToP010Row_C;
+#if MF_ARCH_X86
+		if (sse2)
+			m_packedRow = avx2 ? V210ToP010Row_AVX2 : V210ToP010Row_SSE2;
+#endif
+		break;
+
+	default: // P010 / P016 are already planar
+		break;
+	}
+
+	m_ditherRow = DitherRow_C;
+#if MF_ARCH_X86
+	if (sse2)
+		m_ditherRow = avx2 ? DitherRow_AVX2 : DitherRow_SSE2;
+#endif
+
+	m_maskRow = MaskRow_C;
+#if MF_ARCH_X86
+	if (sse2)
+		m_maskRow = avx2 ? MaskRow_AVX2 : MaskRow_SSE2;
+#endif
+
+	(void)avx2;
+	(void)sse2;
+	return true;
+}
+
+bool CDepthConverter::Convert(const MediaPlane *src, uint32_t width, uint32_t height, uint8_t *dstY, int32_t dstStrideY, uint8_t *dstUV, int32_t dstStrideUV, uint32_t rowBegin,
+			      uint32_t rowEnd) const
+{
+	if (!m_subtype || (width & 1) || (height & 1)) {
+		assert(false);
+		return false;
+	}
+
+	if (!rowEnd)
+		rowEnd = height;
+	if ((rowBegin & 1) || (rowEnd & 1) || rowBegin > rowEnd || rowEnd > height) {
+		assert(false);
+		return false;
+	}
+
+	const bool dither = m_target == MEDIA_SUBTYPE_NV12;
+	for (uint32_t y = rowBegin; y < rowEnd; y += 2) {
+		const uint8_t *src0 = src[0].data + (ptrdiff_t)y * src[0].stride;
+		const uint8_t *src1 = src0 + src[0].stride;
+		uint8_t *y0 = dstY + (ptrdiff_t)y * dstStrideY;
+		uint8_t *y1 = y0 + dstStrideY;
+		uint8_t *uv = dstUV + (ptrdiff_t)(y / 2) * dstStrideUV;
+
+		if (m_packedRow && !dither) {
+			m_packedRow(src0, src1, (uint16_t *)y0, (uint16_t *)y1, (uint16_t *)uv, width);
+		} else if (m_packedRow) {
+			uint16_t tmpY0[DEPTH_CHUNK_PIXELS];
+			uint16_t tmpY1[DEPTH_CHUNK_PIXELS];
+			uint16_t tmpUV[DEPTH_CHUNK_PIXELS];
+			for (uint32_t x = 0; x < width; x += DEPTH_CHUNK_PIXELS) {
+				const uint32_t count = width - x < DEPTH_CHUNK_PIXELS ? width - x : DEPTH_CHUNK_PIXELS;
+				const uint32_t offset = m_subtype == MEDIA_SUBTYPE_V210 ? x / 6 * 16 : x * 4;
+				m_packedRow(src0 + offset, src1 + offset, tmpY0, tmpY1, tmpUV, count);
+				m_ditherRow(tmpY0, y0 + x, count, y);
+				m_ditherRow(tmpY1, y1 + x, count, y + 1);
+				m_ditherRow(tmpUV, uv + x, count, y / 2);
+			}
+		} else {
+			// P016 is truncated to P010
+			const uint8_t *srcUV = src[1].data + (ptrdiff_t)(y / 2) * src[1].stride;
+			if (dither) {
+				m_ditherRow((const uint16_t *)src0, y0, width, y);
+				m_ditherRow((const uint16_t *)src1, y1, width, y + 1);
+				m_ditherRow((const uint16_t *)srcUV, uv, width, y / 2);
+			} else {
+				m_maskRow((const uint16_t *)src0, (uint16_t *)y0, width);
+				m_maskRow((const uint16_t *)src1, (uint16_t *)y1, width);
+				m_maskRow((const uint16_t *)srcUV, (uint16_t *)uv, width);
+			}
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,37 @@
+﻿#pragma once
+#include "mf-cpu.h"
+#include "mf-sample.h"
+
+// high bit depth video: v210 / Y210 / P016 -> P010, and P010 / P016 / Y210 / v210 -> NV12 with an 8x8 ordered dither,
+// so 10 bit devices can be kept at 10 bit or go through the 8 bit pipeline without banding.
+// v210 and Y210 are 4:2:2, their chroma is the average of two rows like for YUY2.
+// every simd kernel produces exactly the same bytes as the scalar one.
+
+bool IsHighBitDepth(uint32_t subtype);
+
+// two rows of a 4:2:2 type -> two P010 rows and one chroma row
+typedef void (*PackedToP010RowFunc)(const uint8_t *src0, const uint8_t *src1, uint16_t *dstY0, uint16_t *dstY1, uint16_t *dstUV, uint32_t width);
+// 16 bit samples -> 8 bit, `row` picks the row of the dither matrix
+typedef void (*DitherRowFunc)(const uint16_t *src, uint8_t *dst, uint32_t count, uint32_t row);
+// 16 bit samples -> 10 bit in the high bits, P010 requires the low 6 bits to be zero
+typedef void (*MaskRowFunc)(const uint16_t *src, uint16_t *dst, uint32_t count);
+
+class CDepthConverter {
+public:
+	// subtype: any IsHighBitDepth type, target: MEDIA_SUBTYPE_P010 or MEDIA_SUBTYPE_NV12
+	bool Init(uint32_t subtype, uint32_t target, SimdLevel level = GetSimdLevel());
+
+	uint32_t GetSubtype() const { return m_subtype; }
+	uint32_t GetTarget() const { return m_target; }
+
+	// same as CVideoConverter::Convert, the strides are in bytes
+	bool Convert(const MediaPlane *src, uint32_t width, uint32_t height, uint8_t *dstY, int32_t dstStrideY, uint8_t *dstUV, int32_t dstStrideUV, uint32_t rowBegin = 0,
+		     uint32_t rowEnd = 0) const;
+
+private:
+	uint32_t m_subtype = 0;
+	uint32_t m_target = 0;
+	PackedToP010RowFunc m_packedRow = nullptr;
+	DitherRowFunc m_ditherRow = nullptr;
+	MaskRowFunc m_maskRow = nullptr;
+};
@@ -1,6 +1,6 @@
 #include "mf-enum.h"
 
-std::vector<MFDevice> EnumDevices(bool video)
+std::vector<MFDevice> EnumDevices(bool video, CCapabilityCache *cache)
 {
 	std::vector<MFDevice> devices;
 
@@ -20,6 +20,7 @@ std::vector<MFDevice> EnumDevices(bool video)
 		return devices;
 
 	for (UINT32 i = 0; i < count; ++i) {
+		MFDevice *pDevice = nullptr;
 		WCHAR *szFriendlyName = nullptr;
 		WCHAR *szSymbolicLink = nullptr;
 		WCHAR *szAudioEndpoint = nullptr;
@@ -41,6 +42,7 @@ std::vector<MFDevice> EnumDevices(bool video)
 				dev.name = szFriendlyName ? szFriendlyName : L"";
 				dev.path = szSymbolicLink ? szSymbolicLink : L"";
 				devices.push_back(dev);
+				pDevice = &devices.back();
 
 				if (video) {
 					wprintf(L"Video Device [%u/%u]\n%s \nSymbolicLink: %s\n\n", i + 1, count, szFriendlyName, szSymbolicLink);
@@ -51,10 +53,33 @@ std::vector<MFDevice> EnumDevices(bool video)
 			}
 		}
 
-		ComPtr<IMFMediaSource> pSource = NULL;
-		hr = ppDevices[i]->ActivateObject(__uuidof(IMFMediaSource), (void **)&pSource);
-		if (SUCCEEDED(hr)) {
-			EnumCapability(pSource, video);
+		const uint64_t fingerprint = pDevice && cache ? GetDeviceFingerprint(ppDevices[i]) : 0;
+		const DeviceCapabilities *cached = pDevice && cache ? cache->Find(pDevice->path, fingerprint) : nullptr;
+		if (cached) {
+			// warm start: no activation
+			pDevice->caps = cached->caps;
+			for (const auto &cap : cached->caps)
+				printf("\tcapability (cached) %s \n", GetCapabilityString(cap).c_str());
+		} else {
+			ComPtr<IMFMediaSource> pSource = NULL;
+			hr = ppDevices[i]->ActivateObject(__uuidof(IMFMediaSource), (void **)&pSource);
+			if (SUCCEEDED(hr)) {
+				std::vector<DeviceCapability> caps;
+				EnumCapability(pSource, video, &caps);
+
+				if (pDevice) {
+					pDevice->caps = caps;
+					if (cache) {
+						DeviceCapabilities entry;
+						entry.video = video;
+						entry.name = pDevice->name;
+						entry.path = pDevice->path;
+						entry.fingerprint = fingerprint;
+						entry.caps = caps;
+						cache->Update(entry);
+					}
+				}
+			}
 		}
 
 		printf("\n\n");
@@ -73,7 +98,7 @@ std::vector<MFDevice> EnumDevices(bool video)
 	return devices;
 }
 
-HRESULT EnumCapability(ComPtr<IMFMediaSource> pSource, bool video)
+HRESULT EnumCapability(ComPtr<IMFMediaSource> pSource, bool video, std::vector<DeviceCapability> *caps)
 {
 	if (!pSource)
 		return E_POINTER;
@@ -123,6 +148,13 @@ HRESULT EnumCapability(ComPtr<IMFMediaSource> pSource, bool video)
 			if (FAILED(hr) || majorType2 != destMajorType)
 				continue;
 
+			DeviceCapability cap;
+			if (caps && GetDeviceCapability(pType.Get(), video, cap)) {
+				cap.stream = i;
+				cap.index = j;
+				caps->push_back(cap);
+			}
+
 			if (video) {
 				// format
 				GUID subtype = {0};
@@ -209,81 +241,98 @@ HRESULT EnumCapability(ComPtr<IMFMediaSource> pSource, bool video)
 	return S_OK;
 }
 
-std::string GetVideoSubtypeString(const GUID &subtype)
+bool GetDeviceCapability(IMFMediaType *pType, bool video, DeviceCapability &cap)
 {
-#if 0
-	// https://learn.microsoft.com/en-us/windows/win32/medfound/video-subtype-guids
-	struct {
-		GUID guid;
-		const char *str;
-	} subtypeMap[] = {{MFVideoFormat_RGB32, "RGB32"},     {MFVideoFormat_ARGB32, "ARGB32"},   {MFVideoFormat_RGB24, "RGB24"}, {MFVideoFormat_RGB555, "RGB555"}, {MFVideoFormat_RGB565, "RGB565"},
-			  {MFVideoFormat_I420, "I420"},       {MFVideoFormat_IYUV, "IYUV"}, // 等同于 I420
-			  {MFVideoFormat_YV12, "YV12"},       {MFVideoFormat_NV12, "NV12"},       {MFVideoFormat_NV21, "NV21"},   {MFVideoFormat_YUY2, "YUY2"},     {MFVideoFormat_UYVY, "UYVY"},
-			  {MFVideoFormat_AYUV, "AYUV"},       {MFVideoFormat_P010, "P010"},       {MFVideoFormat_P016, "P016"},   {MFVideoFormat_P210, "P210"},     {MFVideoFormat_P216, "P216"},
-			  {MFVideoFormat_v210, "v210"},       {MFVideoFormat_v216, "v216"},       {MFVideoFormat_v410, "v410"},   {MFVideoFormat_Y210, "Y210"},     {MFVideoFormat_Y216, "Y216"},
-			  {MFVideoFormat_Y410, "Y410"},       {MFVideoFormat_Y416, "Y416"},       {MFVideoFormat_MJPG, "MJPG"},   {MFVideoFormat_H264, "H264"},     {MFVideoFormat_HEVC, "HEVC"},
-			  {MFVideoFormat_HEVC_ES, "HEVC_ES"}, {MFVideoFormat_MPEG2, "MPEG2"},     {MFVideoFormat_H263, "H263"},   {MFVideoFormat_MP43, "MP43"},     {MFVideoFormat_MP4S, "MP4S"},
-			  {MFVideoFormat_M4S2, "M4S2"},       {MFVideoFormat_MP4V, "MP4V"},       {MFVideoFormat_WMV1, "WMV1"},   {MFVideoFormat_WMV2, "WMV2"},     {MFVideoFormat_WMV3, "WMV3"},
-			  {MFVideoFormat_WVC1, "WVC1"},       {MFVideoFormat_MSS1, "MSS1"},       {MFVideoFormat_MSS2, "MSS2"},   {MFVideoFormat_MPG1, "MPG1"},     {MFVideoFormat_DVSL, "DVSL"},
-			  {MFVideoFormat_DVSD, "DVSD"},       {MFVideoFormat_DVHD, "DVHD"},       {MFVideoFormat_DV25, "DV25"},   {MFVideoFormat_DV50, "DV50"},     {MFVideoFormat_DVH1, "DVH1"},
-			  {MFVideoFormat_DVC, "DVC"},         {MFVideoFormat_H264_ES, "H264_ES"}, {MFVideoFormat_VP80, "VP80"},   {MFVideoFormat_VP90, "VP90"},     {MFVideoFormat_AV1, "AV1"},
-			  {MFVideoFormat_L8, "L8"},           {MFVideoFormat_L16, "L16"},         {MFVideoFormat_D16, "D16"}};
-#else
-	struct {
-		GUID guid;
-		const char *str;
-	} subtypeMap[] = {
-		{MFVideoFormat_RGB32, "RGB32"}, {MFVideoFormat_ARGB32, "ARGB32"}, {MFVideoFormat_RGB24, "RGB24"}, {MFVideoFormat_I420, "I420"}, {MFVideoFormat_IYUV, "IYUV"}, // 等同于 I420
-		{MFVideoFormat_YV12, "YV12"},   {MFVideoFormat_NV12, "NV12"},     {MFVideoFormat_NV21, "NV21"},   {MFVideoFormat_YUY2, "YUY2"}, {MFVideoFormat_UYVY, "UYVY"},
-		{MFVideoFormat_AYUV, "AYUV"},   {MFVideoFormat_P010, "P010"},     {MFVideoFormat_P016, "P016"},   {MFVideoFormat_P210, "P210"}, {MFVideoFormat_P216, "P216"},
-		{MFVideoFormat_v210, "v210"},   {MFVideoFormat_v216, "v216"},     {MFVideoFormat_v410, "v410"},   {MFVideoFormat_Y210, "Y210"}, {MFVideoFormat_Y216, "Y216"},
-		{MFVideoFormat_Y410, "Y410"},   {MFVideoFormat_Y416, "Y416"},     {MFVideoFormat_MJPG, "MJPG"},   {MFVideoFormat_H264, "H264"}, {MFVideoFormat_HEVC, "HEVC"},
-	};
-#endif
-
-	for (const auto &entry : subtypeMap) {
-		if (IsEqualGUID(subtype, entry.guid)) {
-			return entry.str;
-		}
+	// subtypes built from a FourCC / D3DFORMAT / WAVE_FORMAT tag share the tail of MFVideoFormat_Base, so Data1 identifies them
+	GUID subtype = {0};
+	if (FAILED(pType->GetGUID(MF_MT_SUBTYPE, &subtype)))
+		return false;
+	GUID base = subtype;
+	base.Data1 = 0;
+	if (!IsEqualGUID(base, MFVideoFormat_Base))
+		return false;
+
+	cap = DeviceCapability();
+	cap.format.video = video;
+	cap.format.subtype = subtype.Data1;
+
+	if (!video) {
+		return SUCCEEDED(pType->GetUINT32(MF_MT_AUDIO_NUM_CHANNELS, &cap.format.channels)) && SUCCEEDED(pType->GetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, &cap.format.sampleRate)) &&
+		       SUCCEEDED(pType->GetUINT32(MF_MT_AUDIO_BITS_PER_SAMPLE, &cap.format.bitsPerSample)) && cap.format.channels && cap.format.sampleRate && cap.format.bitsPerSample;
 	}
 
-	return "";
+	if (FAILED(MFGetAttributeSize(pType, MF_MT_FRAME_SIZE, &cap.format.width, &cap.format.height)) || !cap.format.width || !cap.format.height)
+		return false;
+	if (FAILED(MFGetAttributeRatio(pType, MF_MT_FRAME_RATE, &cap.format.fpsNum, &cap.format.fpsDen)) || !cap.format.fpsDen)
+		return false;
+
+	// optional
+	MFGetAttributeRatio(pType, MF_MT_FRAME_RATE_RANGE_MIN, &cap.fpsMinNum, &cap.fpsMinDen);
+	MFGetAttributeRatio(pType, MF_MT_FRAME_RATE_RANGE_MAX, &cap.fpsMaxNum, &cap.fpsMaxDen);
+	return true;
 }
 
-std::string GetAudioSubtypeString(const GUID &subtype)
+uint64_t GetDeviceFingerprint(IMFActivate *pActivate)
 {
-	struct {
-		GUID guid;
-		const char *str;
-	} subtypeMap[] = {
-		{MFAudioFormat_PCM, "PCM"},     // LRLRLR
-		{MFAudioFormat_Float, "Float"}, // LRLRLR
-		{MFAudioFormat_AAC, "AAC"},
-		{MFAudioFormat_MP3, "MP3"},
-#if 0
-		{MFAudioFormat_DTS, "DTS"},
-		{MFAudioFormat_Dolby_AC3, "Dolby_AC3"},
-		{MFAudioFormat_ADTS, "ADTS"},
-		{MFAudioFormat_MPEG, "MPEG"},
-		{MFAudioFormat_WMAudioV8, "WMAudioV8"},
-		{MFAudioFormat_WMAudioV9, "WMAudioV9"},
-		{MFAudioFormat_WMAudio_Lossless, "WMAudio_Lossless"},
-		{MFAudioFormat_WMASPDIF, "WMASPDIF"},
-		{MFAudioFormat_MSP1, "MSP1"},
-		{MFAudioFormat_FLAC, "FLAC"},
-		{MFAudioFormat_ALAC, "ALAC"},
-		{MFAudioFormat_AMR_NB, "AMR_NB"},
-		{MFAudioFormat_AMR_WB, "AMR_WB"},
-		{MFAudioFormat_DRM, "DRM"},
-		{MFAudioFormat_ADTS, "ADTS"},
-#endif
-	};
-
-	for (const auto &entry : subtypeMap) {
-		if (IsEqualGUID(subtype, entry.guid)) {
-			return entry.str;
+	uint64_t hash = HashBytes(nullptr, 0);
+
+	UINT32 count = 0;
+	if (FAILED(pActivate->GetCount(&count)))
+		return hash;
+
+	for (UINT32 i = 0; i < count; ++i) {
+		GUID key = {0};
+		PROPVARIANT var;
+		PropVariantInit(&var);
+		if (FAILED(pActivate->GetItemByIndex(i, &key, &var)))
+			continue;
+
+		hash = HashBytes(&key, sizeof(key), hash);
+		switch (var.vt) {
+		case VT_UI4:
+			hash = HashBytes(&var.ulVal, sizeof(var.ulVal), hash);
+			break;
+		case VT_UI8:
+			hash = HashBytes(&var.uhVal, sizeof(var.uhVal), hash);
+			break;
+		case VT_R8:
+			hash = HashBytes(&var.dblVal, sizeof(var.dblVal), hash);
+			break;
+		case VT_CLSID:
+			hash = HashBytes(var.puuid, sizeof(GUID), hash);
+			break;
+		case VT_LPWSTR:
+			hash = HashBytes(var.pwszVal, wcslen(var.pwszVal) * sizeof(WCHAR), hash);
+			break;
+		case VT_VECTOR | VT_UI1:
+			hash = HashBytes(var.caub.pElems, var.caub.cElems, hash);
+			break;
+		default:
+			break;
 		}
+
+		PropVariantClear(&var);
 	}
 
-	return "";
+	return hash;
+}
+
+// names come from the format table, see mf-format.h. subtypes outside of MFVideoFormat_Base (= MFAudioFormat_Base) have none
+static const MediaFormatTraits *FindSubtypeTraits(const GUID &subtype)
+{
+	GUID base = subtype;
+	base.Data1 = 0;
+	return IsEqualGUID(base, MFVideoFormat_Base) ? FindFormatTraits(subtype.Data1) : nullptr;
+}
+
+std::string GetVideoSubtypeString(const GUID &subtype)
+{
+	const MediaFormatTraits *traits = FindSubtypeTraits(subtype);
+	return traits && traits->video ? traits->name : "";
+}
+
+std::string GetAudioSubtypeString(const GUID &subtype)
+{
+	const MediaFormatTraits *traits = FindSubtypeTraits(subtype);
+	return traits && !traits->video ? traits->name : "";
 }
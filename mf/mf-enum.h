@@ -1,15 +1,25 @@
 ﻿#pragma once
 #include "mf-util.hpp"
+#include "mf-capcache.h"
 #include <string>
 #include <vector>
 
 struct MFDevice {
 	std::wstring name = L"";
 	std::wstring path = L"";
+	std::vector<DeviceCapability> caps;
 };
 
-std::vector<MFDevice> EnumDevices(bool video);
-HRESULT EnumCapability(ComPtr<IMFMediaSource> pSource, bool video);
+// with a cache, devices whose fingerprint did not change are answered from it without ActivateObject
+std::vector<MFDevice> EnumDevices(bool video, CCapabilityCache *cache = nullptr);
+HRESULT EnumCapability(ComPtr<IMFMediaSource> pSource, bool video, std::vector<DeviceCapability> *caps = nullptr);
+
+// capability record of a native media type, false for types the capture cannot use
+// (video subtypes outside of MFVideoFormat_Base, missing frame size / rate, audio without channels / rate / bits)
+bool GetDeviceCapability(IMFMediaType *pType, bool video, DeviceCapability &cap);
+
+// hash of the attributes of the IMFActivate, available without activating the device
+uint64_t GetDeviceFingerprint(IMFActivate *pActivate);
 
 std::string GetVideoSubtypeString(const GUID &subtype);
 std::string GetAudioSubtypeString(const GUID &subtype);
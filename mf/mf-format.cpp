@@ -0,0 +1,34 @@
+#include "mf-format.h"
+
+// odr-used by FindFormatTraits, c++14 still needs the definitions
+constexpr MediaFormatTraits CFormatRegistry::s_formats[];
+constexpr FormatHashTable CFormatHash::s_table;
+
+DescribePlanesFunc GetDescribePlanesFunc(uint32_t subtype)
+{
+	switch (subtype) {
+	case MEDIA_SUBTYPE_NV12:
+		return DescribeVideoPlanesOf<MEDIA_SUBTYPE_NV12>;
+	case MEDIA_SUBTYPE_I420:
+		return DescribeVideoPlanesOf<MEDIA_SUBTYPE_I420>;
+	case MEDIA_SUBTYPE_IYUV:
+		return DescribeVideoPlanesOf<MEDIA_SUBTYPE_IYUV>;
+	case MEDIA_SUBTYPE_YV12:
+		return DescribeVideoPlanesOf<MEDIA_SUBTYPE_YV12>;
+	case MEDIA_SUBTYPE_P010:
+		return DescribeVideoPlanesOf<MEDIA_SUBTYPE_P010>;
+	case MEDIA_SUBTYPE_P016:
+		return DescribeVideoPlanesOf<MEDIA_SUBTYPE_P016>;
+	case MEDIA_SUBTYPE_YUY2:
+	case MEDIA_SUBTYPE_UYVY:
+	case MEDIA_SUBTYPE_RGB24:
+	case MEDIA_SUBTYPE_RGB32:
+	case MEDIA_SUBTYPE_ARGB32:
+	case MEDIA_SUBTYPE_Y210:
+	case MEDIA_SUBTYPE_V210:
+		// one plane, the layout does not matter
+		return DescribeVideoPlanesOf<MEDIA_SUBTYPE_YUY2>;
+	default:
+		return DescribeVideoPlanes;
+	}
+}
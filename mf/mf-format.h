@@ -0,0 +1,233 @@
+﻿#pragma once
+// compile-time registry of the subtypes we know: layout, planes, chroma subsampling, bit depth and the stride / size formulas.
+// the lookup by subtype (the Data1 of the media foundation GUID) is a perfect hash into a table checked at compile time,
+// and TFormatTraits lets a kernel be instantiated for one format so the layout is folded away instead of looked up per frame.
+#include "mf-sample.h"
+
+enum FormatLayout : uint8_t {
+	FORMAT_LAYOUT_UNKNOWN = 0, // only the name is known, the pipeline does not handle it
+	FORMAT_LAYOUT_PACKED,      // one plane of interleaved components
+	FORMAT_LAYOUT_SEMI_PLANAR, // Y plane, then one plane of interleaved chroma
+	FORMAT_LAYOUT_PLANAR,      // Y, U, V planes
+	FORMAT_LAYOUT_BITSTREAM,   // compressed video, one plane of variable size
+	FORMAT_LAYOUT_AUDIO,       // interleaved samples
+};
+
+// WAVE_FORMAT_MPEGLAYER3 / WAVE_FORMAT_MPEG_HEAAC, only named
+#define MEDIA_SUBTYPE_MP3 0x0055
+#define MEDIA_SUBTYPE_AAC 0x1610
+
+struct MediaFormatTraits {
+	uint32_t subtype;
+	const char *name;
+	bool video;
+	FormatLayout layout;
+	uint8_t planes;
+	uint8_t chromaShiftX;     // log2 of the chroma subsampling, 1/1 for 4:2:0
+	uint8_t chromaShiftY;
+	uint8_t bitsPerComponent; // significant bits, 0 if it depends on the media type (pcm) or is not known
+	uint8_t groupPixels;      // the first plane stores `groupPixels` pixels in `groupBytes` bytes
+	uint8_t groupBytes;
+	uint8_t lumaOffset;       // packed 4:2:2: byte of the first Y in a group
+	bool swapUV;              // planar: V plane before U
+	bool bottomUp;            // rgb: bottom-up without MF_MT_DEFAULT_STRIDE, like a DIB
+};
+
+#define FORMAT_HASH_BITS 6
+#define FORMAT_HASH_MULTIPLIER 0x6a70344fu
+
+constexpr uint32_t GetFormatHash(uint32_t subtype)
+{
+	return (subtype * FORMAT_HASH_MULTIPLIER) >> (32 - FORMAT_HASH_BITS);
+}
+
+struct FormatHashTable {
+	uint8_t slots[1 << FORMAT_HASH_BITS]; // index + 1 into the format table, 0 if empty
+};
+
+class CFormatRegistry {
+public:
+	// clang-format off
+	static constexpr MediaFormatTraits s_formats[] = {
+		// subtype, name, video, layout, planes, chroma shift x / y, bits, group pixels / bytes, luma offset, swap uv, bottom-up
+		{MEDIA_SUBTYPE_RGB24,              "RGB24",  true,  FORMAT_LAYOUT_PACKED,      1, 0, 0, 8,  1,  3,   0, false, true},
+		{MEDIA_SUBTYPE_ARGB32,             "ARGB32", true,  FORMAT_LAYOUT_PACKED,      1, 0, 0, 8,  1,  4,   0, false, true},
+		{MEDIA_SUBTYPE_RGB32,              "RGB32",  true,  FORMAT_LAYOUT_PACKED,      1, 0, 0, 8,  1,  4,   0, false, true},
+		{MEDIA_SUBTYPE_NV12,               "NV12",   true,  FORMAT_LAYOUT_SEMI_PLANAR, 2, 1, 1, 8,  1,  1,   0, false, false},
+		{MEDIA_SUBTYPE_I420,               "I420",   true,  FORMAT_LAYOUT_PLANAR,      3, 1, 1, 8,  1,  1,   0, false, false},
+		{MEDIA_SUBTYPE_IYUV,               "IYUV",   true,  FORMAT_LAYOUT_PLANAR,      3, 1, 1, 8,  1,  1,   0, false, false}, // same as I420
+		{MEDIA_SUBTYPE_YV12,               "YV12",   true,  FORMAT_LAYOUT_PLANAR,      3, 1, 1, 8,  1,  1,   0, true,  false},
+		{MEDIA_SUBTYPE_YUY2,               "YUY2",   true,  FORMAT_LAYOUT_PACKED,      1, 1, 0, 8,  1,  2,   0, false, false},
+		{MEDIA_SUBTYPE_UYVY,               "UYVY",   true,  FORMAT_LAYOUT_PACKED,      1, 1, 0, 8,  1,  2,   1, false, false},
+		{MEDIA_SUBTYPE_P010,               "P010",   true,  FORMAT_LAYOUT_SEMI_PLANAR, 2, 1, 1, 10, 1,  2,   0, false, false},
+		{MEDIA_SUBTYPE_P016,               "P016",   true,  FORMAT_LAYOUT_SEMI_PLANAR, 2, 1, 1, 16, 1,  2,   0, false, false},
+		{MEDIA_SUBTYPE_Y210,               "Y210",   true,  FORMAT_LAYOUT_PACKED,      1, 1, 0, 10, 1,  4,   0, false, false},
+		{MEDIA_SUBTYPE_V210,               "v210",   true,  FORMAT_LAYOUT_PACKED,      1, 1, 0, 10, 48, 128, 0, false, false},
+		{MEDIA_SUBTYPE_MJPG,               "MJPG",   true,  FORMAT_LAYOUT_BITSTREAM,   1, 0, 0, 8,  0,  0,   0, false, false},
+		{MEDIA_SUBTYPE_MFLZ,               "MFLZ",   true,  FORMAT_LAYOUT_BITSTREAM,   1, 1, 1, 8,  0,  0,   0, false, false},
+		{MEDIA_FOURCC('N', 'V', '2', '1'), "NV21",   true,  FORMAT_LAYOUT_UNKNOWN,     0, 0, 0, 0,  0,  0,   0, false, false},
+		{MEDIA_FOURCC('A', 'Y', 'U', 'V'), "AYUV",   true,  FORMAT_LAYOUT_UNKNOWN,     0, 0, 0, 0,  0,  0,   0, false, false},
+		{MEDIA_FOURCC('P', '2', '1', '0'), "P210",   true,  FORMAT_LAYOUT_UNKNOWN,     0, 0, 0, 0,  0,  0,   0, false, false},
+		{MEDIA_FOURCC('P', '2', '1', '6'), "P216",   true,  FORMAT_LAYOUT_UNKNOWN,     0, 0, 0, 0,  0,  0,   0, false, false},
+		{MEDIA_FOURCC('v', '2', '1', '6'), "v216",   true,  FORMAT_LAYOUT_UNKNOWN,     0, 0, 0, 0,  0,  0,   0, false, false},
+		{MEDIA_FOURCC('v', '4', '1', '0'), "v410",   true,  FORMAT_LAYOUT_UNKNOWN,     0, 0, 0, 0,  0,  0,   0, false, false},
+		{MEDIA_FOURCC('Y', '2', '1', '6'), "Y216",   true,  FORMAT_LAYOUT_UNKNOWN,     0, 0, 0, 0,  0,  0,   0, false, false},
+		{MEDIA_FOURCC('Y', '4', '1', '0'), "Y410",   true,  FORMAT_LAYOUT_UNKNOWN,     0, 0, 0, 0,  0,  0,   0, false, false},
+		{MEDIA_FOURCC('Y', '4', '1', '6'), "Y416",   true,  FORMAT_LAYOUT_UNKNOWN,     0, 0, 0, 0,  0,  0,   0, false, false},
+		{MEDIA_FOURCC('H', '2', '6', '4'), "H264",   true,  FORMAT_LAYOUT_UNKNOWN,     0, 0, 0, 0,  0,  0,   0, false, false},
+		{MEDIA_FOURCC('H', 'E', 'V', 'C'), "HEVC",   true,  FORMAT_LAYOUT_UNKNOWN,     0, 0, 0, 0,  0,  0,   0, false, false},
+		{MEDIA_SUBTYPE_PCM,                "PCM",    false, FORMAT_LAYOUT_AUDIO,       1, 0, 0, 0,  0,  0,   0, false, false}, // LRLRLR
+		{MEDIA_SUBTYPE_FLOAT,              "Float",  false, FORMAT_LAYOUT_AUDIO,       1, 0, 0, 32, 0,  0,   0, false, false}, // LRLRLR
+		{MEDIA_SUBTYPE_MP3,                "MP3",    false, FORMAT_LAYOUT_UNKNOWN,     0, 0, 0, 0,  0,  0,   0, false, false},
+		{MEDIA_SUBTYPE_AAC,                "AAC",    false, FORMAT_LAYOUT_UNKNOWN,     0, 0, 0, 0,  0,  0,   0, false, false},
+	};
+	// clang-format on
+
+	static constexpr uint32_t s_count = sizeof(s_formats) / sizeof(s_formats[0]);
+};
+
+constexpr FormatHashTable BuildFormatHashTable()
+{
+	FormatHashTable table = {};
+	for (uint32_t i = 0; i < CFormatRegistry::s_count; ++i)
+		table.slots[GetFormatHash(CFormatRegistry::s_formats[i].subtype)] = uint8_t(i + 1);
+	return table;
+}
+
+constexpr bool IsPerfectFormatHash()
+{
+	for (uint32_t i = 0; i < CFormatRegistry::s_count; ++i) {
+		for (uint32_t j = i + 1; j < CFormatRegistry::s_count; ++j) {
+			if (GetFormatHash(CFormatRegistry::s_formats[i].subtype) == GetFormatHash(CFormatRegistry::s_formats[j].subtype))
+				return false;
+		}
+	}
+	return CFormatRegistry::s_count < 255;
+}
+
+static_assert(IsPerfectFormatHash(), "two subtypes share a slot, pick another FORMAT_HASH_MULTIPLIER");
+
+class CFormatHash {
+public:
+	static constexpr FormatHashTable s_table = BuildFormatHashTable();
+};
+
+#define FORMAT_NOT_FOUND 0xffffffffu
+
+// index into CFormatRegistry::s_formats, FORMAT_NOT_FOUND if the subtype is not in the table
+constexpr uint32_t FindFormatIndex(uint32_t subtype)
+{
+	const uint8_t slot = CFormatHash::s_table.slots[GetFormatHash(subtype)];
+	return slot && CFormatRegistry::s_formats[slot - 1].subtype == subtype ? slot - 1u : FORMAT_NOT_FOUND;
+}
+
+// null if the subtype is not in the table
+constexpr const MediaFormatTraits *FindFormatTraits(uint32_t subtype)
+{
+	const uint32_t index = FindFormatIndex(subtype);
+	return index != FORMAT_NOT_FOUND ? &CFormatRegistry::s_formats[index] : nullptr;
+}
+
+// uncompressed video with the planes described by the table
+constexpr bool IsRawVideoFormat(const MediaFormatTraits &traits)
+{
+	return traits.layout == FORMAT_LAYOUT_PACKED || traits.layout == FORMAT_LAYOUT_SEMI_PLANAR || traits.layout == FORMAT_LAYOUT_PLANAR;
+}
+
+// bytes per row of the first plane without padding, 0 if the format is not raw video
+constexpr uint32_t GetFormatStride(const MediaFormatTraits &traits, uint32_t width)
+{
+	return IsRawVideoFormat(traits) ? (width + traits.groupPixels - 1) / traits.groupPixels * traits.groupBytes : 0;
+}
+
+// the chroma rows of a semi-planar format hold both components, so they are as long as the luma rows
+constexpr int32_t GetFormatChromaStride(const MediaFormatTraits &traits, int32_t stride)
+{
+	return traits.layout == FORMAT_LAYOUT_PLANAR ? stride / (1 << traits.chromaShiftX) : stride;
+}
+
+constexpr uint32_t GetFormatChromaRows(const MediaFormatTraits &traits, uint32_t height)
+{
+	return height >> traits.chromaShiftY;
+}
+
+// bytes of a contiguous frame whose first plane has `stride` bytes per row
+constexpr uint32_t GetFormatFrameSize(const MediaFormatTraits &traits, uint32_t stride, uint32_t height)
+{
+	return IsRawVideoFormat(traits) ? stride * height + (traits.planes - 1) * (uint32_t)GetFormatChromaStride(traits, (int32_t)stride) * GetFormatChromaRows(traits, height) : 0;
+}
+
+// bytes per row and row count of each plane of a frame with the minimum stride, returns the plane count
+inline uint32_t GetFormatPlaneRows(const MediaFormatTraits &traits, uint32_t width, uint32_t height, uint32_t rowBytes[MEDIA_MAX_PLANES], uint32_t rows[MEDIA_MAX_PLANES])
+{
+	if (!IsRawVideoFormat(traits))
+		return 0;
+
+	// v210 keeps the padding of each row, so the rows can be read back with the default stride
+	rowBytes[0] = GetFormatStride(traits, width);
+	rows[0] = height;
+	for (uint32_t i = 1; i < traits.planes; ++i) {
+		rowBytes[i] = (uint32_t)GetFormatChromaStride(traits, (int32_t)rowBytes[0]);
+		rows[i] = GetFormatChromaRows(traits, height);
+	}
+	return traits.planes;
+}
+
+// see DescribeVideoPlanes
+inline uint32_t DescribeFormatPlanes(const MediaFormatTraits &traits, uint32_t height, const uint8_t *data, int32_t stride, MediaPlane *planes)
+{
+	if (!IsRawVideoFormat(traits))
+		return 0;
+
+	const uint32_t absStride = (uint32_t)(stride < 0 ? -stride : stride);
+	planes[0].data = data;
+	planes[0].stride = stride;
+	planes[0].size = absStride * height;
+	if (traits.planes == 1)
+		return 1;
+
+	const int32_t chromaStride = GetFormatChromaStride(traits, stride);
+	const uint32_t chromaRows = GetFormatChromaRows(traits, height);
+	const uint32_t chromaSize = (uint32_t)(chromaStride < 0 ? -chromaStride : chromaStride) * chromaRows;
+	const uint8_t *chroma = data + stride * (int32_t)height;
+	for (uint32_t i = 1; i < traits.planes; ++i) {
+		const uint32_t plane = traits.swapUV ? traits.planes - i : i;
+		planes[plane].data = chroma + chromaStride * (int32_t)chromaRows * (int32_t)(i - 1);
+		planes[plane].stride = chromaStride;
+		planes[plane].size = chromaSize;
+	}
+	return traits.planes;
+}
+
+// compile-time view of one format, for kernels instantiated per subtype
+template<uint32_t Subtype> struct TFormatTraits {
+	static_assert(FindFormatIndex(Subtype) != FORMAT_NOT_FOUND, "subtype is not in the format table");
+
+	static constexpr const MediaFormatTraits &Get() { return CFormatRegistry::s_formats[FindFormatIndex(Subtype)]; }
+
+	static constexpr uint32_t subtype = Subtype;
+	static constexpr FormatLayout layout = Get().layout;
+	static constexpr uint32_t planes = Get().planes;
+	static constexpr uint32_t chromaShiftX = Get().chromaShiftX;
+	static constexpr uint32_t chromaShiftY = Get().chromaShiftY;
+	static constexpr uint32_t bitsPerComponent = Get().bitsPerComponent;
+	static constexpr uint32_t bytesPerPixel = Get().groupPixels == 1 ? Get().groupBytes : 0; // 0 for v210
+	static constexpr uint32_t lumaOffset = Get().lumaOffset;
+	static constexpr uint32_t chromaOffset = 1 - Get().lumaOffset;
+	static constexpr bool swapUV = Get().swapUV;
+
+	static constexpr uint32_t GetStride(uint32_t width) { return GetFormatStride(Get(), width); }
+	static constexpr uint32_t GetFrameSize(uint32_t width, uint32_t height) { return GetFormatFrameSize(Get(), GetStride(width), height); }
+};
+
+// DescribeVideoPlanes for one format, the layout is folded in at compile time
+template<uint32_t Subtype> uint32_t DescribeVideoPlanesOf(const MediaFormat &format, const uint8_t *data, int32_t stride, MediaPlane *planes)
+{
+	return DescribeFormatPlanes(TFormatTraits<Subtype>::Get(), format.height, data, stride, planes);
+}
+
+typedef uint32_t (*DescribePlanesFunc)(const MediaFormat &format, const uint8_t *data, int32_t stride, MediaPlane *planes);
+
+// instantiation of DescribeVideoPlanesOf for the subtype, to be picked once per media type instead of per frame.
+// the generic DescribeVideoPlanes for formats without one
+DescribePlanesFunc GetDescribePlanesFunc(uint32_t subtype);
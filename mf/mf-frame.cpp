@@ -0,0 +1,355 @@
+#include "mf-frame.h"
+#include "mf-tiling.h"
+#include <assert.h>
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// page aligned memory straight from the os; large pages are only used if they can be had
+static uint8_t *AllocateBuffer(uint32_t size, bool hugePages, bool &usedHugePages)
+{
+	usedHugePages = false;
+
+#ifdef _WIN32
+	if (hugePages) {
+		SIZE_T largePage = GetLargePageMinimum();
+		if (largePage) {
+			SIZE_T rounded = (size + largePage - 1) / largePage * largePage;
+			void *p = VirtualAlloc(NULL, rounded, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE);
+			if (p) {
+				usedHugePages = true;
+				return (uint8_t *)p;
+			}
+		}
+	}
+
+	return (uint8_t *)VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+#ifdef MAP_HUGETLB
+	if (hugePages) {
+		size_t rounded = (size_t(size) + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+		void *p = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED) {
+			usedHugePages = true;
+			return (uint8_t *)p;
+		}
+	}
+#endif
+
+	void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return nullptr;
+
+#ifdef MADV_HUGEPAGE
+	// no reserved huge pages: transparent huge pages are the next best thing
+	if (hugePages)
+		madvise(p, size, MADV_HUGEPAGE);
+#endif
+	return (uint8_t *)p;
+#endif
+}
+
+static void FreeBuffer(uint8_t *p, uint32_t size, bool usedHugePages)
+{
+#ifdef _WIN32
+	(void)size;
+	(void)usedHugePages;
+	VirtualFree(p, 0, MEM_RELEASE);
+#else
+	size_t length = size;
+	if (usedHugePages)
+		length = (length + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+	munmap(p, length);
+#endif
+}
+
+//---------------------------------------------------------------------------------------------
+CRefPtr<CMediaFrame> CMediaFrame::Wrap(const MediaSample &sample, std::function<void()> release)
+{
+	CMediaFrame *frame = new (std::nothrow) CMediaFrame();
+	if (!frame) {
+		if (release)
+			release();
+		return FramePtr();
+	}
+
+	frame->m_format = *sample.format;
+	frame->m_sample = sample;
+	frame->m_sample.format = &frame->m_format;
+	frame->m_release = std::move(release);
+
+	FramePtr ptr;
+	ptr.Attach(frame); // keep the initial reference
+	return ptr;
+}
+
+CMediaFrame::~CMediaFrame()
+{
+	if (m_release)
+		m_release();
+
+	if (m_pBuffer)
+		FreeBuffer(m_pBuffer, m_capacity, m_bHugePages);
+}
+
+long CMediaFrame::Release() const
+{
+	long count = --m_nRefCount;
+	if (count == 0) {
+		if (m_pPool) {
+			CFramePool *pool = m_pPool;
+			pool->Recycle(const_cast<CMediaFrame *>(this)); // nobody sees it any more
+			pool->Release(); // may delete the pool and this frame with it
+		} else {
+			delete this;
+		}
+	}
+
+	// For thread safety, return a temporary variable.
+	return count;
+}
+
+void CMediaFrame::Reset()
+{
+	m_format = MediaFormat();
+	m_sample = MediaSample();
+}
+
+void CMediaFrame::SetSample(const MediaFormat &format, int64_t timestamp, uint32_t flags, uint32_t size)
+{
+	assert(m_pBuffer);
+
+	m_format = format;
+	m_sample = MediaSample();
+	m_sample.format = &m_format;
+	m_sample.timestamp = timestamp;
+	m_sample.flags = flags;
+
+	if (format.video && !IsCompressedVideo(format.subtype)) {
+		assert(GetVideoFrameSize(format) <= m_capacity);
+		m_sample.planeCount = DescribeVideoPlanes(m_format, m_pBuffer, GetVideoDefaultStride(m_format), m_sample.planes);
+	} else {
+		assert(size <= m_capacity);
+		m_sample.planes[0].data = m_pBuffer;
+		m_sample.planes[0].size = size;
+		m_sample.planeCount = 1;
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+CRefPtr<CFramePool> CFramePool::Create(uint32_t maxFramesPerBucket, bool hugePages)
+{
+	CFramePool *pool = new (std::nothrow) CFramePool(maxFramesPerBucket, hugePages);
+	CRefPtr<CFramePool> ptr;
+	ptr.Attach(pool);
+	return ptr;
+}
+
+CFramePool::CFramePool(uint32_t maxFramesPerBucket, bool hugePages) : m_maxFramesPerBucket(maxFramesPerBucket), m_bHugePages(hugePages) {}
+
+CFramePool::~CFramePool()
+{
+	// frames in flight hold a reference, so every frame is back here
+	for (auto &bucket : m_buckets) {
+		assert(bucket.freeFrames.size() == bucket.count);
+		for (auto frame : bucket.freeFrames)
+			delete frame;
+	}
+}
+
+long CFramePool::Release()
+{
+	long count = --m_nRefCount;
+	if (count == 0)
+		delete this;
+	return count;
+}
+
+uint32_t CFramePool::GetSizeClass(uint32_t size)
+{
+	// 2^k * {1.25, 1.5, 1.75, 2}
+	uint64_t power = 4096;
+	if (size <= power)
+		return (uint32_t)power;
+
+	while (power * 2 < size)
+		power *= 2;
+
+	uint64_t step = power / 4;
+	uint64_t sizeClass = power + step;
+	while (sizeClass < size)
+		sizeClass += step;
+	return (uint32_t)sizeClass;
+}
+
+CMediaFrame *CFramePool::AllocateFrame(uint32_t bucket, uint32_t sizeClass)
+{
+	CMediaFrame *frame = new (std::nothrow) CMediaFrame();
+	if (!frame)
+		return nullptr;
+
+	bool usedHugePages = false;
+	frame->m_pBuffer = AllocateBuffer(sizeClass, m_bHugePages, usedHugePages);
+	if (!frame->m_pBuffer) {
+		delete frame;
+		return nullptr;
+	}
+
+	// touch every page now, not on the capture thread
+	memset(frame->m_pBuffer, 0, sizeClass);
+
+	frame->m_pPool = this;
+	frame->m_bucket = bucket;
+	frame->m_capacity = sizeClass;
+	frame->m_bHugePages = usedHugePages;
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	++m_stats.allocated;
+	m_stats.bytes += sizeClass;
+	return frame;
+}
+
+FramePtr CFramePool::Acquire(uint32_t size)
+{
+	const uint32_t sizeClass = GetSizeClass(size);
+
+	CMediaFrame *frame = nullptr;
+	uint32_t index = 0;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+
+		while (index < m_buckets.size() && m_buckets[index].sizeClass != sizeClass)
+			++index;
+		if (index == m_buckets.size()) {
+			m_buckets.emplace_back();
+			m_buckets.back().sizeClass = sizeClass;
+		}
+
+		Bucket &bucket = m_buckets[index];
+		if (!bucket.freeFrames.empty()) {
+			frame = bucket.freeFrames.back();
+			bucket.freeFrames.pop_back();
+		} else if (bucket.count < m_maxFramesPerBucket) {
+			++bucket.count; // reserve the slot, allocate outside of the lock
+		} else {
+			++m_stats.exhausted;
+			return FramePtr();
+		}
+
+		++m_stats.acquired;
+		++m_stats.inFlight;
+	}
+
+	if (!frame) {
+		frame = AllocateFrame(index, sizeClass);
+		if (!frame) {
+			std::lock_guard<std::mutex> lock(m_lock);
+			--m_buckets[index].count;
+			--m_stats.inFlight;
+			return FramePtr();
+		}
+	}
+
+	frame->m_nRefCount = 1;
+	AddRef(); // released by the frame when it comes back
+
+	FramePtr ptr;
+	ptr.Attach(frame);
+	return ptr;
+}
+
+void CFramePool::Recycle(CMediaFrame *frame)
+{
+	frame->Reset();
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_buckets[frame->m_bucket].freeFrames.push_back(frame);
+	--m_stats.inFlight;
+}
+
+void CFramePool::Preallocate(uint32_t size, uint32_t count)
+{
+	std::vector<FramePtr> frames;
+	for (uint32_t i = 0; i < count; ++i) {
+		FramePtr frame = Acquire(size);
+		if (!frame)
+			break;
+		frames.push_back(frame);
+	}
+}
+
+FramePtr CFramePool::CopySample(const MediaSample &sample)
+{
+	const MediaFormat &format = *sample.format;
+	if (!sample.planeCount)
+		return CMediaFrame::Wrap(sample, nullptr); // stream tick, nothing to copy
+
+	// audio and compressed video are one plane of bytes
+	const bool raw = format.video && !IsCompressedVideo(format.subtype);
+	const uint32_t size = raw ? GetVideoFrameSize(format) : sample.planes[0].size;
+	if (raw && !size) {
+		assert(false);
+		return FramePtr();
+	}
+
+	FramePtr frame = Acquire(size);
+	if (!frame)
+		return frame;
+
+	frame->SetSample(format, sample.timestamp, sample.flags, size);
+
+	if (!raw) {
+		memcpy(frame->m_pBuffer, sample.planes[0].data, size);
+		return frame;
+	}
+
+	const MediaSample &dst = frame->m_sample;
+	assert(dst.planeCount == sample.planeCount);
+	for (uint32_t i = 0; i < dst.planeCount && i < sample.planeCount; ++i) {
+		const MediaPlane &from = sample.planes[i];
+		uint8_t *to = frame->m_pBuffer + (dst.planes[i].data - frame->m_pBuffer);
+		const uint32_t rowBytes = (uint32_t)dst.planes[i].stride;
+
+		if (from.stride == dst.planes[i].stride) {
+			memcpy(to, from.data, dst.planes[i].size);
+			continue;
+		}
+
+		// padded or bottom-up source
+		const uint32_t rows = dst.planes[i].size / rowBytes;
+		for (uint32_t y = 0; y < rows; ++y)
+			memcpy(to + y * rowBytes, from.data + (ptrdiff_t)y * from.stride, rowBytes);
+	}
+
+	return frame;
+}
+
+FramePoolStats CFramePool::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_stats;
+}
+
+//---------------------------------------------------------------------------------------------
+bool DeliverSample(IMediaSink *sink, CFramePool *pool, const MediaSample &sample, CTileExecutor *tiles)
+{
+	if (!sink->WantsFrames()) {
+		sink->OnMediaSample(sample);
+		return true;
+	}
+
+	assert(pool);
+	FramePtr frame = !pool ? FramePtr() : tiles ? tiles->CopySample(pool, sample) : pool->CopySample(sample);
+	if (!frame)
+		return false;
+
+	sink->OnMediaFrame(frame.Get());
+	return true;
+}
@@ -0,0 +1,134 @@
+﻿#pragma once
+#include "mf-portable.hpp"
+#include "mf-sample.h"
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+class CFramePool;
+
+// a captured sample which can outlive the capture callback.
+// the memory either comes from a CFramePool (and goes back to it with the last Release), or is owned by
+// someone else, e.g. a still locked IMFMediaBuffer, and a release callback is run with the last Release.
+class CMediaFrame {
+	friend class CFramePool;
+
+public:
+	// zero copy: the frame points into `sample`, `release` runs when the last reference is gone
+	static CRefPtr<CMediaFrame> Wrap(const MediaSample &sample, std::function<void()> release);
+
+	// also on a const frame: a reader may keep a frame alive, but not change it
+	long AddRef() const { return ++m_nRefCount; }
+	long Release() const;
+
+	const MediaFormat &GetFormat() const { return m_format; }
+	int64_t GetTimestamp() const { return m_sample.timestamp; }
+	uint32_t GetFlags() const { return m_sample.flags; }
+
+	// read-only view, valid as long as a reference is held
+	const MediaSample &GetSample() const { return m_sample; }
+
+	// writable memory of a pooled frame, null for wrapped frames
+	uint8_t *GetBuffer() { return m_pBuffer; }
+	uint32_t GetCapacity() const { return m_capacity; }
+
+	// for pooled frames filled by the caller (e.g. a conversion output), size is only used for audio
+	void SetSample(const MediaFormat &format, int64_t timestamp, uint32_t flags, uint32_t size = 0);
+
+	// corrects the timing of any frame, only while nobody else holds a reference yet (e.g. CAVSync)
+	void SetTiming(int64_t timestamp, uint32_t flags)
+	{
+		m_sample.timestamp = timestamp;
+		m_sample.flags = flags;
+	}
+
+private:
+	CMediaFrame() {}
+	~CMediaFrame();
+
+	void Reset();
+
+private:
+	mutable std::atomic<long> m_nRefCount{1};
+
+	MediaFormat m_format;
+	MediaSample m_sample;
+
+	// pooled memory
+	CFramePool *m_pPool = nullptr;
+	uint32_t m_bucket = 0;
+	uint8_t *m_pBuffer = nullptr;
+	uint32_t m_capacity = 0;
+	bool m_bHugePages = false;
+
+	// wrapped memory
+	std::function<void()> m_release;
+};
+
+typedef CRefPtr<CMediaFrame> FramePtr;
+
+struct FramePoolStats {
+	uint64_t acquired = 0;  // frames handed out
+	uint64_t allocated = 0; // frames whose memory had to be allocated, the rest were reused
+	uint64_t exhausted = 0; // Acquire failed because a bucket reached its capacity
+	uint64_t bytes = 0;     // memory currently owned by the pool
+	uint32_t inFlight = 0;  // frames currently referenced outside the pool
+};
+
+// fixed-capacity pool of page aligned frame buffers, bucketed by size class (at most 25% waste).
+// frames keep the pool alive while they are in flight, so consumers may release them after the capture is gone.
+class CFramePool {
+	friend class CMediaFrame;
+
+public:
+	// maxFramesPerBucket: how many frames of one size class may exist at once; Acquire fails beyond that.
+	// hugePages: back large buffers with 2MB pages when the os allows it (MEM_LARGE_PAGES needs SeLockMemoryPrivilege).
+	static CRefPtr<CFramePool> Create(uint32_t maxFramesPerBucket = 8, bool hugePages = false);
+
+	long AddRef() { return ++m_nRefCount; }
+	long Release();
+
+	// empty frame with at least `size` bytes, null if the bucket is exhausted
+	FramePtr Acquire(uint32_t size);
+
+	// one copy out of the (locked) device buffer into a pooled frame; bottom-up rgb is stored top-down
+	FramePtr CopySample(const MediaSample &sample);
+
+	// allocates and touches `count` buffers up front so that the capture thread never page faults
+	void Preallocate(uint32_t size, uint32_t count);
+
+	FramePoolStats GetStats() const;
+
+	static uint32_t GetSizeClass(uint32_t size);
+
+private:
+	CFramePool(uint32_t maxFramesPerBucket, bool hugePages);
+	~CFramePool();
+
+	void Recycle(CMediaFrame *frame);
+	CMediaFrame *AllocateFrame(uint32_t bucket, uint32_t sizeClass);
+
+	struct Bucket {
+		uint32_t sizeClass = 0;
+		uint32_t count = 0; // frames of this bucket, free or in flight
+		std::vector<CMediaFrame *> freeFrames;
+	};
+
+private:
+	std::atomic<long> m_nRefCount{1};
+
+	const uint32_t m_maxFramesPerBucket;
+	const bool m_bHugePages;
+
+	mutable std::mutex m_lock;
+	std::vector<Bucket> m_buckets;
+	FramePoolStats m_stats;
+};
+
+class CTileExecutor;
+
+// hands a sample to the sink: borrowed for plain sinks, as a pooled copy for sinks which want frames.
+// with `tiles` the copy is split into bands over its threads, see CTileExecutor::CopySample.
+// returns false if the frame was dropped because the pool is exhausted.
+bool DeliverSample(IMediaSink *sink, CFramePool *pool, const MediaSample &sample, CTileExecutor *tiles = nullptr);
@@ -0,0 +1,1147 @@
+#include "mf-jpeg.h"
+#include "mf-portable.hpp"
+#include <algorithm>
+#include <assert.h>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+// natural order index of each zigzag position, padded for runs past the end of a corrupt block
+static const uint8_t g_zigzag[64 + 16] = {
+	0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,  12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6,  7,  14, 21, 28, 35, 42, 49, 56, 57,
+	50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63,
+	63, 63, 63, 63, 63, 63,
+};
+
+// the tables of annex k.3, luminance and chrominance
+static const uint8_t g_dcCounts[2][16] = {
+	{0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0},
+	{0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0},
+};
+static const uint8_t g_dcSymbols[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+static const uint8_t g_acCounts[2][16] = {
+	{0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d},
+	{0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77},
+};
+static const uint8_t g_acSymbols[2][162] = {
+	{
+		0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+		0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+		0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+		0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+		0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+		0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+		0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa,
+	},
+	{
+		0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+		0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+		0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+		0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+		0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+		0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+		0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa,
+	},
+};
+
+// entropy coded data of one segment, msb first. a marker or the end of the segment reads as zeros
+struct JpegBits {
+	const uint8_t *p;
+	const uint8_t *end;
+	uint64_t bits;
+	uint32_t count;
+
+	JpegBits(const uint8_t *begin, const uint8_t *last) : p(begin), end(last), bits(0), count(0) {}
+
+	// at least 32 bits afterwards, enough for a code and its value
+	void Fill()
+	{
+		if (count >= 32)
+			return;
+
+		// four bytes at once while none of them is 0xff
+		if (end - p >= 4) {
+			const uint32_t word = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+			if (!((~word - 0x01010101u) & word & 0x80808080u)) {
+				bits |= uint64_t(word) << (32 - count);
+				count += 32;
+				p += 4;
+				return;
+			}
+		}
+
+		while (count <= 56) {
+			uint32_t byte = 0;
+			if (p < end) {
+				byte = *p++;
+				if (byte == 0xff) {
+					if (p < end && *p == 0) {
+						++p; // stuffed
+					} else {
+						p = end;
+						byte = 0;
+					}
+				}
+			}
+			bits |= uint64_t(byte) << (56 - count);
+			count += 8;
+		}
+	}
+
+	void Skip(uint32_t n)
+	{
+		bits <<= n;
+		count -= n;
+	}
+};
+
+static inline int DecodeSymbol(JpegBits &bits, const uint16_t *lookup, const int32_t *maxCode, const int32_t *offset, const uint8_t *symbols)
+{
+	bits.Fill();
+
+	const uint32_t entry = lookup[bits.bits >> (64 - JPEG_LOOKUP_BITS)];
+	if (entry) {
+		bits.Skip(entry >> 8);
+		return int(entry & 0xff);
+	}
+
+	for (uint32_t length = JPEG_LOOKUP_BITS + 1; length <= 16; ++length) {
+		const int32_t code = int32_t(bits.bits >> (64 - length));
+		if (code <= maxCode[length]) {
+			bits.Skip(length);
+			return symbols[offset[length] + code];
+		}
+	}
+	return -1;
+}
+
+// the value of `size` bits which follows a code
+static inline int32_t Receive(JpegBits &bits, uint32_t size)
+{
+	const int32_t value = int32_t(bits.bits >> (64 - size));
+	bits.Skip(size);
+	return value < (1 << (size - 1)) ? value - (1 << size) + 1 : value;
+}
+
+//---------------------------------------------------------------------------------------------
+// the accurate integer idct of the ijg library (jidctint.c), so the output matches libjpeg's default
+#define IDCT_CONST_BITS 13
+#define IDCT_PASS1_BITS 2
+
+#define FIX_0_298631336 2446
+#define FIX_0_390180644 3196
+#define FIX_0_541196100 4433
+#define FIX_0_765366865 6270
+#define FIX_0_899976223 7373
+#define FIX_1_175875602 9633
+#define FIX_1_501321110 12299
+#define FIX_1_847759065 15137
+#define FIX_1_961570560 16069
+#define FIX_2_053119869 16819
+#define FIX_2_562915447 20995
+#define FIX_3_072711026 25172
+
+static inline int32_t Descale(int32_t x, int n)
+{
+	return (x + (1 << (n - 1))) >> n;
+}
+
+static inline uint8_t ClampSample(int32_t x)
+{
+	return uint8_t(x < 0 ? 0 : x > 255 ? 255 : x);
+}
+
+// one dimension of the idct, `in` and `out` step by `inStep` / `outStep`
+template <int Shift, typename Out, typename Store>
+static inline void Idct1D(const int32_t *in, int inStep, Out *out, int outStep, Store store)
+{
+	int32_t z2 = in[2 * inStep];
+	int32_t z3 = in[6 * inStep];
+	int32_t z1 = (z2 + z3) * FIX_0_541196100;
+	int32_t tmp2 = z1 + z3 * -FIX_1_847759065;
+	int32_t tmp3 = z1 + z2 * FIX_0_765366865;
+
+	int32_t tmp0 = (in[0] + in[4 * inStep]) * (1 << IDCT_CONST_BITS);
+	int32_t tmp1 = (in[0] - in[4 * inStep]) * (1 << IDCT_CONST_BITS);
+
+	const int32_t tmp10 = tmp0 + tmp3;
+	const int32_t tmp13 = tmp0 - tmp3;
+	const int32_t tmp11 = tmp1 + tmp2;
+	const int32_t tmp12 = tmp1 - tmp2;
+
+	tmp0 = in[7 * inStep];
+	tmp1 = in[5 * inStep];
+	tmp2 = in[3 * inStep];
+	tmp3 = in[1 * inStep];
+
+	z1 = tmp0 + tmp3;
+	z2 = tmp1 + tmp2;
+	z3 = tmp0 + tmp2;
+	int32_t z4 = tmp1 + tmp3;
+	const int32_t z5 = (z3 + z4) * FIX_1_175875602;
+
+	tmp0 *= FIX_0_298631336;
+	tmp1 *= FIX_2_053119869;
+	tmp2 *= FIX_3_072711026;
+	tmp3 *= FIX_1_501321110;
+	z1 *= -FIX_0_899976223;
+	z2 *= -FIX_2_562915447;
+	z3 = z3 * -FIX_1_961570560 + z5;
+	z4 = z4 * -FIX_0_390180644 + z5;
+
+	tmp0 += z1 + z3;
+	tmp1 += z2 + z4;
+	tmp2 += z2 + z3;
+	tmp3 += z1 + z4;
+
+	out[0] = store(Descale(tmp10 + tmp3, Shift));
+	out[7 * outStep] = store(Descale(tmp10 - tmp3, Shift));
+	out[1 * outStep] = store(Descale(tmp11 + tmp2, Shift));
+	out[6 * outStep] = store(Descale(tmp11 - tmp2, Shift));
+	out[2 * outStep] = store(Descale(tmp12 + tmp1, Shift));
+	out[5 * outStep] = store(Descale(tmp12 - tmp1, Shift));
+	out[3 * outStep] = store(Descale(tmp13 + tmp0, Shift));
+	out[4 * outStep] = store(Descale(tmp13 - tmp0, Shift));
+}
+
+// a block without ac coefficients is flat, which is most blocks of a smooth image
+static inline bool IsFlatBlock(const int16_t *coefficients)
+{
+	uint64_t words[16];
+	memcpy(words, coefficients, sizeof(words));
+	uint64_t any = words[0] & ~uint64_t(0xffff);
+	for (int i = 1; i < 16; ++i)
+		any |= words[i];
+	return !any;
+}
+
+static void FillFlatBlock(int32_t dc, uint8_t *dst, ptrdiff_t stride)
+{
+	// what both passes compute for a lone dc value
+	const uint8_t value = ClampSample(Descale(dc * (1 << IDCT_PASS1_BITS), IDCT_PASS1_BITS + 3) + 128);
+	for (int y = 0; y < 8; ++y)
+		memset(dst + y * stride, value, 8);
+}
+
+static void IdctBlock_C(const int16_t *coefficients, const uint16_t *quant, uint8_t *dst, ptrdiff_t stride)
+{
+	if (IsFlatBlock(coefficients)) {
+		FillFlatBlock(coefficients[0] * quant[0], dst, stride);
+		return;
+	}
+
+	int32_t in[64];
+	for (int i = 0; i < 64; ++i)
+		in[i] = coefficients[i] * quant[i];
+
+	// columns, a column with only a dc value is flat
+	int32_t work[64];
+	for (int x = 0; x < 8; ++x) {
+		const int32_t *column = in + x;
+		if (!column[8] && !column[16] && !column[24] && !column[32] && !column[40] && !column[48] && !column[56]) {
+			const int32_t dc = column[0] * (1 << IDCT_PASS1_BITS);
+			for (int y = 0; y < 8; ++y)
+				work[y * 8 + x] = dc;
+			continue;
+		}
+		Idct1D<IDCT_CONST_BITS - IDCT_PASS1_BITS>(column, 8, work + x, 8, [](int32_t v) { return v; });
+	}
+
+	// rows, centered on 128
+	for (int y = 0; y < 8; ++y) {
+		const int32_t *row = work + y * 8;
+		uint8_t *out = dst + y * stride;
+		if (!row[1] && !row[2] && !row[3] && !row[4] && !row[5] && !row[6] && !row[7]) {
+			memset(out, ClampSample(Descale(row[0], IDCT_PASS1_BITS + 3) + 128), 8);
+			continue;
+		}
+		Idct1D<IDCT_CONST_BITS + IDCT_PASS1_BITS + 3>(row, 1, out, 1, [](int32_t v) { return ClampSample(v + 128); });
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+#if MF_ARCH_X86
+// sse2 has no 32 bit multiply, it keeps the scalar idct
+MF_TARGET_AVX2 static inline void Transpose8x8_AVX2(__m256i *r)
+{
+	const __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+	const __m256i t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+	const __m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]);
+	const __m256i t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+	const __m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]);
+	const __m256i t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+	const __m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]);
+	const __m256i t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+
+	const __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+	const __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+	const __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+	const __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+	const __m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+	const __m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+	const __m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+	const __m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+
+	r[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+	r[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+	r[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+	r[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+	r[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+	r[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+	r[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+	r[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+MF_TARGET_AVX2 static inline __m256i Multiply_AVX2(__m256i x, int32_t factor)
+{
+	return _mm256_mullo_epi32(x, _mm256_set1_epi32(factor));
+}
+
+// Idct1D on 8 columns at once, v[k] holds coefficient k of each column
+template <int Shift> MF_TARGET_AVX2 static inline void Idct1D_AVX2(__m256i *v)
+{
+	__m256i z1 = Multiply_AVX2(_mm256_add_epi32(v[2], v[6]), FIX_0_541196100);
+	__m256i tmp2 = _mm256_add_epi32(z1, Multiply_AVX2(v[6], -FIX_1_847759065));
+	__m256i tmp3 = _mm256_add_epi32(z1, Multiply_AVX2(v[2], FIX_0_765366865));
+
+	__m256i tmp0 = _mm256_slli_epi32(_mm256_add_epi32(v[0], v[4]), IDCT_CONST_BITS);
+	__m256i tmp1 = _mm256_slli_epi32(_mm256_sub_epi32(v[0], v[4]), IDCT_CONST_BITS);
+
+	const __m256i tmp10 = _mm256_add_epi32(tmp0, tmp3);
+	const __m256i tmp13 = _mm256_sub_epi32(tmp0, tmp3);
+	const __m256i tmp11 = _mm256_add_epi32(tmp1, tmp2);
+	const __m256i tmp12 = _mm256_sub_epi32(tmp1, tmp2);
+
+	tmp0 = v[7];
+	tmp1 = v[5];
+	tmp2 = v[3];
+	tmp3 = v[1];
+
+	z1 = _mm256_add_epi32(tmp0, tmp3);
+	__m256i z2 = _mm256_add_epi32(tmp1, tmp2);
+	__m256i z3 = _mm256_add_epi32(tmp0, tmp2);
+	__m256i z4 = _mm256_add_epi32(tmp1, tmp3);
+	const __m256i z5 = Multiply_AVX2(_mm256_add_epi32(z3, z4), FIX_1_175875602);
+
+	tmp0 = Multiply_AVX2(tmp0, FIX_0_298631336);
+	tmp1 = Multiply_AVX2(tmp1, FIX_2_053119869);
+	tmp2 = Multiply_AVX2(tmp2, FIX_3_072711026);
+	tmp3 = Multiply_AVX2(tmp3, FIX_1_501321110);
+	z1 = Multiply_AVX2(z1, -FIX_0_899976223);
+	z2 = Multiply_AVX2(z2, -FIX_2_562915447);
+	z3 = _mm256_add_epi32(Multiply_AVX2(z3, -FIX_1_961570560), z5);
+	z4 = _mm256_add_epi32(Multiply_AVX2(z4, -FIX_0_390180644), z5);
+
+	tmp0 = _mm256_add_epi32(tmp0, _mm256_add_epi32(z1, z3));
+	tmp1 = _mm256_add_epi32(tmp1, _mm256_add_epi32(z2, z4));
+	tmp2 = _mm256_add_epi32(tmp2, _mm256_add_epi32(z2, z3));
+	tmp3 = _mm256_add_epi32(tmp3, _mm256_add_epi32(z1, z4));
+
+	const __m256i round = _mm256_set1_epi32(1 << (Shift - 1));
+	v[0] = _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(tmp10, tmp3), round), Shift);
+	v[7] = _mm256_srai_epi32(_mm256_add_epi32(_mm256_sub_epi32(tmp10, tmp3), round), Shift);
+	v[1] = _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(tmp11, tmp2), round), Shift);
+	v[6] = _mm256_srai_epi32(_mm256_add_epi32(_mm256_sub_epi32(tmp11, tmp2), round), Shift);
+	v[2] = _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(tmp12, tmp1), round), Shift);
+	v[5] = _mm256_srai_epi32(_mm256_add_epi32(_mm256_sub_epi32(tmp12, tmp1), round), Shift);
+	v[3] = _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(tmp13, tmp0), round), Shift);
+	v[4] = _mm256_srai_epi32(_mm256_add_epi32(_mm256_sub_epi32(tmp13, tmp0), round), Shift);
+}
+
+// the shortcuts of the scalar version for flat columns and rows give the same values as the full transform
+MF_TARGET_AVX2 static void IdctBlock_AVX2(const int16_t *coefficients, const uint16_t *quant, uint8_t *dst, ptrdiff_t stride)
+{
+	if (IsFlatBlock(coefficients)) {
+		FillFlatBlock(coefficients[0] * quant[0], dst, stride);
+		return;
+	}
+
+	__m256i v[8];
+	for (int k = 0; k < 8; ++k) {
+		const __m256i c = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(coefficients + k * 8)));
+		const __m256i q = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(quant + k * 8)));
+		v[k] = _mm256_mullo_epi32(c, q);
+	}
+
+	Idct1D_AVX2<IDCT_CONST_BITS - IDCT_PASS1_BITS>(v);
+	Transpose8x8_AVX2(v);
+	Idct1D_AVX2<IDCT_CONST_BITS + IDCT_PASS1_BITS + 3>(v);
+	Transpose8x8_AVX2(v);
+
+	const __m128i center = _mm_set1_epi16(128);
+	for (int y = 0; y < 8; ++y) {
+		const __m128i words = _mm_adds_epi16(_mm_packs_epi32(_mm256_castsi256_si128(v[y]), _mm256_extracti128_si256(v[y], 1)), center);
+		_mm_storel_epi64((__m128i *)(dst + y * stride), _mm_packus_epi16(words, words));
+	}
+}
+#endif
+
+//---------------------------------------------------------------------------------------------
+CJpegDecoder::CJpegDecoder()
+{
+	for (int i = 0; i < 2; ++i) {
+		BuildTable(g_dcCounts[i], g_dcSymbols, m_defaultDc[i]);
+		BuildTable(g_acCounts[i], g_acSymbols[i], m_defaultAc[i]);
+	}
+}
+
+bool CJpegDecoder::Start(uint32_t threads, SimdLevel level)
+{
+	if (level > GetCpuSimdLevel())
+		level = GetCpuSimdLevel();
+
+	m_idct = IdctBlock_C;
+#if MF_ARCH_X86
+	if (level >= SIMD_AVX2)
+		m_idct = IdctBlock_AVX2;
+#else
+	(void)level;
+#endif
+
+	return m_threads.Start(threads);
+}
+
+bool CJpegDecoder::BuildTable(const uint8_t *counts, const uint8_t *symbols, HuffmanTable &table)
+{
+	memset(&table, 0, sizeof(table));
+
+	uint32_t total = 0;
+	for (int i = 0; i < 16; ++i)
+		total += counts[i];
+	if (total > 256)
+		return false;
+	memcpy(table.symbols, symbols, total);
+
+	// canonical codes: consecutive within a length, shifted left for the next length
+	int32_t code = 0;
+	uint32_t index = 0;
+	for (uint32_t length = 1; length <= 16; ++length) {
+		const uint32_t count = counts[length - 1];
+		table.offset[length] = (int32_t)index - code;
+		table.maxCode[length] = count ? code + (int32_t)count - 1 : -1;
+
+		for (uint32_t i = 0; i < count; ++i, ++index, ++code) {
+			if (code >= (1 << length))
+				return false; // more codes than fit in the length
+
+			if (length <= JPEG_LOOKUP_BITS) {
+				const uint32_t shift = JPEG_LOOKUP_BITS - length;
+				for (uint32_t j = 0; j < (1u << shift); ++j)
+					table.lookup[((uint32_t)code << shift) | j] = uint16_t((length << 8) | table.symbols[index]);
+			}
+		}
+		code <<= 1;
+	}
+
+	// a short ac code followed by a small value decodes in one lookup, that is most coefficients
+	for (uint32_t i = 0; i < (1u << JPEG_LOOKUP_BITS); ++i) {
+		const uint32_t entry = table.lookup[i];
+		const uint32_t length = entry >> 8;
+		const uint32_t run = (entry >> 4) & 15;
+		const uint32_t size = entry & 15;
+		if (!length || !size || length + size > JPEG_LOOKUP_BITS)
+			continue;
+
+		int32_t value = int32_t((i >> (JPEG_LOOKUP_BITS - length - size)) & ((1u << size) - 1));
+		if (value < (1 << (size - 1)))
+			value -= (1 << size) - 1;
+		if (value >= -128 && value <= 127)
+			table.coefficient[i] = int16_t(value * 256 + int32_t((run << 4) | (length + size)));
+	}
+
+	table.valid = true;
+	return true;
+}
+
+bool CJpegDecoder::Parse(const uint8_t *data, uint32_t size)
+{
+	const uint8_t *p = data;
+	const uint8_t *end = data + size;
+	if (size < 4 || p[0] != 0xff || p[1] != 0xd8)
+		return false;
+	p += 2;
+
+	m_dc[0] = m_defaultDc[0];
+	m_dc[1] = m_defaultDc[1];
+	m_ac[0] = m_defaultAc[0];
+	m_ac[1] = m_defaultAc[1];
+	m_dc[2].valid = m_dc[3].valid = m_ac[2].valid = m_ac[3].valid = false;
+	memset(m_quantValid, 0, sizeof(m_quantValid));
+	m_componentCount = 0;
+	m_restartInterval = 0;
+
+	for (;;) {
+		// markers may be preceded by fill bytes
+		while (end - p >= 2 && p[0] == 0xff && p[1] == 0xff)
+			++p;
+		if (end - p < 4 || p[0] != 0xff)
+			return false;
+
+		const uint8_t marker = p[1];
+		const uint32_t length = ((uint32_t)p[2] << 8) | p[3];
+		if (length < 2 || length > (uint32_t)(end - p) - 2)
+			return false;
+
+		const uint8_t *q = p + 4;
+		uint32_t n = length - 2;
+		switch (marker) {
+		case 0xc0: // baseline
+		case 0xc1: // extended, huffman
+			if (!ParseFrame(q, n))
+				return false;
+			break;
+
+		case 0xc4: // huffman tables
+			while (n >= 17) {
+				const uint32_t type = q[0] >> 4;
+				const uint32_t slot = q[0] & 15;
+				uint32_t total = 0;
+				for (int i = 1; i <= 16; ++i)
+					total += q[i];
+				if (type > 1 || slot > 3 || 17 + total > n || !BuildTable(q + 1, q + 17, type ? m_ac[slot] : m_dc[slot]))
+					return false;
+				q += 17 + total;
+				n -= 17 + total;
+			}
+			break;
+
+		case 0xdb: // quantization tables
+			while (n >= 65) {
+				const uint32_t wide = q[0] >> 4;
+				const uint32_t slot = q[0] & 15;
+				const uint32_t bytes = 1 + 64 * (wide + 1);
+				if (wide > 1 || slot > 3 || bytes > n)
+					return false;
+				for (int k = 0; k < 64; ++k)
+					m_quant[slot][g_zigzag[k]] = wide ? uint16_t((q[1 + k * 2] << 8) | q[2 + k * 2]) : q[1 + k];
+				m_quantValid[slot] = true;
+				q += bytes;
+				n -= bytes;
+			}
+			break;
+
+		case 0xdd: // restart interval
+			if (n < 2)
+				return false;
+			m_restartInterval = ((uint32_t)q[0] << 8) | q[1];
+			break;
+
+		case 0xda: // start of scan, the entropy coded data follows
+			if (!ParseScan(q, n))
+				return false;
+			FindSegments(p + 2 + length, end);
+			return true;
+
+		default:
+			// progressive, lossless and arithmetic coding are not used by webcams. app and com segments are skipped
+			if (marker >= 0xc2 && marker <= 0xcf)
+				return false;
+			break;
+		}
+
+		p += 2 + length;
+	}
+}
+
+bool CJpegDecoder::ParseFrame(const uint8_t *p, uint32_t length)
+{
+	if (length < 6 || p[0] != 8)
+		return false;
+
+	m_imageHeight = ((uint32_t)p[1] << 8) | p[2];
+	m_imageWidth = ((uint32_t)p[3] << 8) | p[4];
+	m_componentCount = p[5];
+	if (!m_imageWidth || !m_imageHeight || (m_componentCount != 1 && m_componentCount != 3) || length < 6 + m_componentCount * 3)
+		return false;
+
+	for (uint32_t i = 0; i < m_componentCount; ++i) {
+		Component &component = m_components[i];
+		component.id = p[6 + i * 3];
+		component.h = p[7 + i * 3] >> 4;
+		component.v = p[7 + i * 3] & 15;
+		component.quant = p[8 + i * 3];
+		if (component.quant > 3)
+			return false;
+	}
+
+	// a single component is not interleaved, its mcu is one block whatever its sampling factors
+	Component &luma = m_components[0];
+	if (m_componentCount == 1) {
+		luma.h = luma.v = 1;
+	} else {
+		if (luma.h < 1 || luma.h > 2 || luma.v < 1 || luma.v > 2)
+			return false;
+		for (uint32_t i = 1; i < m_componentCount; ++i) {
+			if (m_components[i].h != 1 || m_components[i].v != 1)
+				return false;
+		}
+	}
+
+	m_mcusX = (m_imageWidth + luma.h * 8 - 1) / (luma.h * 8);
+	m_mcusY = (m_imageHeight + luma.v * 8 - 1) / (luma.v * 8);
+	m_lumaBlocks = luma.h * luma.v;
+	m_blocks = m_lumaBlocks + m_componentCount - 1;
+	return true;
+}
+
+bool CJpegDecoder::ParseScan(const uint8_t *p, uint32_t length)
+{
+	// one scan with all components, interleaved
+	if (!m_componentCount || length < 1 || p[0] != m_componentCount || length < 4 + m_componentCount * 2)
+		return false;
+
+	for (uint32_t i = 0; i < m_componentCount; ++i) {
+		Component &component = m_components[i];
+		if (p[1 + i * 2] != component.id)
+			return false;
+		component.dc = p[2 + i * 2] >> 4;
+		component.ac = p[2 + i * 2] & 15;
+		if (component.dc > 3 || component.ac > 3 || !m_dc[component.dc].valid || !m_ac[component.ac].valid || !m_quantValid[component.quant])
+			return false;
+	}
+
+	// spectral selection and successive approximation of a sequential scan
+	const uint8_t *spectral = p + 1 + m_componentCount * 2;
+	return spectral[0] == 0 && spectral[1] == 63 && spectral[2] == 0;
+}
+
+void CJpegDecoder::FindSegments(const uint8_t *p, const uint8_t *end)
+{
+	m_segments.clear();
+
+	const uint8_t *begin = p;
+	for (;;) {
+		p = (const uint8_t *)memchr(p, 0xff, end - p);
+		if (!p || end - p < 2) {
+			p = end;
+			break;
+		}
+
+		const uint8_t marker = p[1];
+		if (marker == 0x00 || marker == 0xff) {
+			p += marker ? 1 : 2; // stuffed byte, or fill before a marker
+			continue;
+		}
+		if (marker < 0xd0 || marker > 0xd7)
+			break; // eoi
+
+		m_segments.push_back({begin, p});
+		p += 2;
+		begin = p;
+	}
+	m_segments.push_back({begin, p});
+}
+
+//---------------------------------------------------------------------------------------------
+bool CJpegDecoder::DecodeMcu(JpegBits &bits, int32_t *predictions, int16_t (*blocks)[64]) const
+{
+	memset(blocks, 0, sizeof(int16_t) * 64 * m_blocks);
+
+	for (uint32_t b = 0; b < m_blocks; ++b) {
+		const uint32_t c = b < m_lumaBlocks ? 0 : b - m_lumaBlocks + 1;
+		const HuffmanTable &dc = m_dc[m_components[c].dc];
+		const HuffmanTable &ac = m_ac[m_components[c].ac];
+		int16_t *block = blocks[b];
+
+		const int size = DecodeSymbol(bits, dc.lookup, dc.maxCode, dc.offset, dc.symbols);
+		if (size < 0 || size > 11)
+			return false;
+		predictions[c] += size ? Receive(bits, (uint32_t)size) : 0;
+		block[0] = (int16_t)predictions[c];
+
+		for (uint32_t k = 1; k < 64;) {
+			bits.Fill();
+			const int32_t fast = ac.coefficient[bits.bits >> (64 - JPEG_LOOKUP_BITS)];
+			if (fast) {
+				k += (fast >> 4) & 15;
+				bits.Skip(fast & 15);
+				block[g_zigzag[k]] = int16_t(fast >> 8);
+				++k;
+				continue;
+			}
+
+			const int symbol = DecodeSymbol(bits, ac.lookup, ac.maxCode, ac.offset, ac.symbols);
+			if (symbol < 0)
+				return false;
+
+			const uint32_t run = (uint32_t)symbol >> 4;
+			const uint32_t value = (uint32_t)symbol & 15;
+			if (!value) {
+				if (run != 15)
+					break; // end of block
+				k += 16;
+				continue;
+			}
+
+			k += run;
+			if (k > 63)
+				return false;
+			block[g_zigzag[k]] = (int16_t)Receive(bits, value);
+			++k;
+		}
+	}
+	return true;
+}
+
+void CJpegDecoder::OutputMcu(uint32_t mcu, const int16_t (*blocks)[64])
+{
+	const Component &luma = m_components[0];
+	const uint32_t mcuX = mcu % m_mcusX;
+	const uint32_t mcuY = mcu / m_mcusX;
+
+	// luma blocks, clipped at the right and bottom edge
+	uint8_t block[64];
+	for (uint32_t v = 0; v < luma.v; ++v) {
+		for (uint32_t h = 0; h < luma.h; ++h) {
+			const uint32_t x = (mcuX * luma.h + h) * 8;
+			const uint32_t y = (mcuY * luma.v + v) * 8;
+			if (x >= m_width || y >= m_height)
+				continue;
+
+			uint8_t *dst = m_pDstY + (ptrdiff_t)y * m_strideY + x;
+			const int16_t *coefficients = blocks[v * luma.h + h];
+			const uint32_t w = (std::min)(8u, m_width - x);
+			const uint32_t rows = (std::min)(8u, m_height - y);
+			if (w == 8 && rows == 8) {
+				m_idct(coefficients, m_quant[luma.quant], dst, m_strideY);
+				continue;
+			}
+
+			m_idct(coefficients, m_quant[luma.quant], block, 8);
+			for (uint32_t row = 0; row < rows; ++row)
+				memcpy(dst + (ptrdiff_t)row * m_strideY, block + row * 8, w);
+		}
+	}
+
+	// the chroma of the mcu in NV12, (4 * h) x (4 * v) pairs
+	const uint32_t x0 = mcuX * luma.h * 4;
+	const uint32_t y0 = mcuY * luma.v * 4;
+	if (x0 >= m_width / 2 || y0 >= m_height / 2)
+		return;
+	const uint32_t w = (std::min)(luma.h * 4, m_width / 2 - x0);
+	const uint32_t rows = (std::min)(luma.v * 4, m_height / 2 - y0);
+	uint8_t *dst = m_pDstUV + (ptrdiff_t)y0 * m_strideUV + x0 * 2;
+
+	if (m_componentCount == 1) {
+		for (uint32_t row = 0; row < rows; ++row)
+			memset(dst + (ptrdiff_t)row * m_strideUV, 128, w * 2);
+		return;
+	}
+
+	uint8_t cb[64];
+	uint8_t cr[64];
+	m_idct(blocks[m_lumaBlocks], m_quant[m_components[1].quant], cb, 8);
+	m_idct(blocks[m_lumaBlocks + 1], m_quant[m_components[2].quant], cr, 8);
+
+	// a chroma block covers the whole mcu, average it down to half the luma size
+	const uint32_t fx = 2 / luma.h;
+	const uint32_t fy = 2 / luma.v;
+	const uint32_t shift = (fx - 1) + (fy - 1);
+	const uint32_t round = (1u << shift) >> 1;
+	for (uint32_t row = 0; row < rows; ++row) {
+		uint8_t *out = dst + (ptrdiff_t)row * m_strideUV;
+		for (uint32_t x = 0; x < w; ++x) {
+			const uint32_t first = row * fy * 8 + x * fx;
+			uint32_t u = 0;
+			uint32_t v = 0;
+			for (uint32_t j = 0; j < fy; ++j) {
+				for (uint32_t i = 0; i < fx; ++i) {
+					u += cb[first + j * 8 + i];
+					v += cr[first + j * 8 + i];
+				}
+			}
+			out[x * 2] = uint8_t((u + round) >> shift);
+			out[x * 2 + 1] = uint8_t((v + round) >> shift);
+		}
+	}
+}
+
+bool CJpegDecoder::DecodeSegment(uint32_t segment)
+{
+	const uint32_t total = m_mcusX * m_mcusY;
+	const uint32_t begin = segment * m_restartInterval;
+	const uint32_t end = (std::min)(begin + m_restartInterval, total);
+
+	JpegBits bits(m_segments[segment].begin, m_segments[segment].end);
+	int32_t predictions[3] = {};
+	int16_t blocks[JPEG_MAX_BLOCKS][64];
+	for (uint32_t mcu = begin; mcu < end; ++mcu) {
+		if (!DecodeMcu(bits, predictions, blocks))
+			return false;
+		OutputMcu(mcu, blocks);
+	}
+	return true;
+}
+
+void CJpegDecoder::DecodeCoefficients()
+{
+	// also walks the segments of a frame which has fewer of them than threads
+	uint32_t segment = 0;
+	uint32_t left = m_restartInterval;
+	JpegBits bits(m_segments[0].begin, m_segments[0].end);
+	int32_t predictions[3] = {};
+
+	int16_t(*blocks)[64] = (int16_t(*)[64])m_coefficients.data();
+	for (uint32_t row = 0; row < m_mcusY; ++row) {
+		for (uint32_t x = 0; x < m_mcusX; ++x, blocks += m_blocks) {
+			if (m_restartInterval && !left) {
+				++segment;
+				bits = JpegBits(m_segments[segment].begin, m_segments[segment].end);
+				memset(predictions, 0, sizeof(predictions));
+				left = m_restartInterval;
+			}
+			--left;
+
+			if (!DecodeMcu(bits, predictions, blocks)) {
+				m_bFailed = true;
+				m_decodedRows.store(m_mcusY, std::memory_order_release);
+				return;
+			}
+		}
+		m_decodedRows.store(row + 1, std::memory_order_release);
+	}
+}
+
+void CJpegDecoder::OutputRows(uint32_t rowBegin, uint32_t rowEnd)
+{
+	for (uint32_t row = rowBegin; row < rowEnd; ++row) {
+		while (m_decodedRows.load(std::memory_order_acquire) <= row)
+			std::this_thread::yield();
+		if (m_bFailed)
+			return;
+
+		const int16_t(*blocks)[64] = (const int16_t(*)[64])m_coefficients.data() + (size_t)row * m_mcusX * m_blocks;
+		for (uint32_t x = 0; x < m_mcusX; ++x, blocks += m_blocks)
+			OutputMcu(row * m_mcusX + x, blocks);
+	}
+}
+
+void CJpegDecoder::RunPart(uint32_t part, uint32_t /*worker*/)
+{
+	if (m_bSegmented) {
+		const uint32_t count = (uint32_t)m_segments.size();
+		const uint32_t end = (part + 1) * count / m_parts;
+		for (uint32_t segment = part * count / m_parts; segment < end && !m_bFailed; ++segment) {
+			if (!DecodeSegment(segment))
+				m_bFailed = true;
+		}
+		return;
+	}
+
+	// part 0 takes the entropy decoding, it is always claimed first so the bands never wait on a part that did not start
+	if (!part) {
+		DecodeCoefficients();
+		return;
+	}
+
+	const uint32_t bands = m_parts - 1;
+	OutputRows((part - 1) * m_mcusY / bands, part * m_mcusY / bands);
+}
+
+bool CJpegDecoder::Decode(const uint8_t *data, uint32_t size, uint32_t width, uint32_t height, uint8_t *dstY, int32_t strideY, uint8_t *dstUV, int32_t strideUV)
+{
+	if (!IsStarted()) {
+		assert(false);
+		return false;
+	}
+
+	const int64_t begin = GetMonotonicTimeNs();
+
+	bool ok = Parse(data, size) && m_imageWidth == width && m_imageHeight == height;
+	if (ok) {
+		// a truncated frame has fewer segments, trailing garbage after the last one is ignored
+		const uint32_t total = m_mcusX * m_mcusY;
+		const uint32_t expected = m_restartInterval ? (total + m_restartInterval - 1) / m_restartInterval : 1;
+		ok = m_segments.size() >= expected;
+		m_segments.resize(expected);
+	}
+
+	if (ok) {
+		m_width = width;
+		m_height = height;
+		m_pDstY = dstY;
+		m_strideY = strideY;
+		m_pDstUV = dstUV;
+		m_strideUV = strideUV;
+		m_bFailed = false;
+
+		const uint32_t threads = m_threads.GetThreadCount();
+		m_bSegmented = m_segments.size() > 1 && m_segments.size() >= threads;
+		if (m_bSegmented) {
+			m_parts = (std::min)((uint32_t)m_segments.size(), threads * 4);
+		} else {
+			m_coefficients.resize((size_t)m_mcusX * m_mcusY * m_blocks * 64);
+			m_decodedRows = 0;
+			m_parts = 1 + (std::min)(m_mcusY, threads * 2);
+		}
+
+		m_threads.Run(this, m_parts);
+		ok = !m_bFailed;
+	}
+
+	if (!ok) {
+		++m_stats.errors;
+		return false;
+	}
+
+	const int64_t ns = GetMonotonicTimeNs() - begin;
+	++m_stats.frames;
+	m_stats.segmented += m_bSegmented ? 1 : 0;
+	m_stats.totalNs += ns;
+	m_stats.maxNs = (std::max)(m_stats.maxNs, ns);
+	if (m_intervalNs && ns > m_intervalNs)
+		++m_stats.late;
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+// the quantization tables of annex k.1, natural order
+static const uint8_t g_lumaQuant[64] = {
+	16, 11, 10, 16, 24,  40,  51,  61,  12, 12, 14, 19, 26,  58,  60,  55,  14, 13, 16, 24, 40,  57,  69,  56,  14, 17, 22, 29, 51,  87,  80,  62,
+	18, 22, 37, 56, 68,  109, 103, 77,  24, 35, 55, 64, 81,  104, 113, 92,  49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99,
+};
+static const uint8_t g_chromaQuant[64] = {
+	17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99, 24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+	99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+};
+
+struct JpegEncodeTable {
+	uint16_t code[256];
+	uint8_t length[256];
+};
+
+static void BuildEncodeTable(const uint8_t *counts, const uint8_t *symbols, JpegEncodeTable &table)
+{
+	memset(&table, 0, sizeof(table));
+	uint32_t code = 0;
+	uint32_t index = 0;
+	for (uint32_t length = 1; length <= 16; ++length, code <<= 1) {
+		for (uint32_t i = 0; i < counts[length - 1]; ++i, ++index, ++code) {
+			table.code[symbols[index]] = uint16_t(code);
+			table.length[symbols[index]] = uint8_t(length);
+		}
+	}
+}
+
+// msb first, 0xff is followed by a stuffed zero
+struct JpegBitWriter {
+	std::vector<uint8_t> &out;
+	uint32_t bits = 0;
+	uint32_t count = 0;
+
+	explicit JpegBitWriter(std::vector<uint8_t> &buffer) : out(buffer) {}
+
+	void Put(uint32_t value, uint32_t length)
+	{
+		bits = (bits << length) | (value & ((1u << length) - 1));
+		count += length;
+		while (count >= 8) {
+			const uint8_t byte = uint8_t(bits >> (count - 8));
+			out.push_back(byte);
+			if (byte == 0xff)
+				out.push_back(0);
+			count -= 8;
+		}
+	}
+
+	// pads with ones, before a marker
+	void Flush()
+	{
+		if (count)
+			Put(0x7f, 8 - count);
+		bits = 0;
+	}
+};
+
+static void PutMarker(std::vector<uint8_t> &out, uint8_t marker, uint32_t length)
+{
+	out.push_back(0xff);
+	out.push_back(marker);
+	if (length) {
+		out.push_back(uint8_t(length >> 8));
+		out.push_back(uint8_t(length));
+	}
+}
+
+// bits of the magnitude category, and the value as it is sent
+static uint32_t GetCategory(int32_t value, uint32_t &bits)
+{
+	const uint32_t magnitude = uint32_t(value < 0 ? -value : value);
+	uint32_t category = 0;
+	while ((1u << category) <= magnitude)
+		++category;
+	bits = uint32_t(value < 0 ? value - 1 : value);
+	return category;
+}
+
+struct JpegCosines {
+	double c[8][8];
+
+	JpegCosines()
+	{
+		for (int u = 0; u < 8; ++u) {
+			for (int i = 0; i < 8; ++i)
+				c[u][i] = (u ? 0.5 : 0.5 / sqrt(2.0)) * cos((2 * i + 1) * u * 3.14159265358979323846 / 16);
+		}
+	}
+
+	const double *operator[](int u) const { return c[u]; }
+};
+
+// 8x8 samples around (x, y) of the plane, edges repeated -> quantized coefficients in natural order
+static void ForwardDctBlock(const MediaPlane &plane, uint32_t planeWidth, uint32_t planeHeight, uint32_t x, uint32_t y, const uint16_t *quant, int32_t *coefficients)
+{
+	static const JpegCosines cosines;
+
+	double samples[8][8];
+	for (uint32_t i = 0; i < 8; ++i) {
+		const uint8_t *row = plane.data + (ptrdiff_t)(std::min)(y + i, planeHeight - 1) * plane.stride;
+		for (uint32_t j = 0; j < 8; ++j)
+			samples[i][j] = row[(std::min)(x + j, planeWidth - 1)] - 128.0;
+	}
+
+	double rows[8][8];
+	for (int i = 0; i < 8; ++i) {
+		for (int u = 0; u < 8; ++u) {
+			double sum = 0.0;
+			for (int j = 0; j < 8; ++j)
+				sum += cosines[u][j] * samples[i][j];
+			rows[i][u] = sum;
+		}
+	}
+
+	for (int v = 0; v < 8; ++v) {
+		for (int u = 0; u < 8; ++u) {
+			double sum = 0.0;
+			for (int i = 0; i < 8; ++i)
+				sum += cosines[v][i] * rows[i][u];
+			coefficients[v * 8 + u] = (int32_t)lround(sum / quant[v * 8 + u]);
+		}
+	}
+}
+
+static void EncodeBlock(JpegBitWriter &writer, const int32_t *coefficients, int32_t &prediction, const JpegEncodeTable &dc, const JpegEncodeTable &ac)
+{
+	uint32_t bits = 0;
+	uint32_t category = GetCategory(coefficients[0] - prediction, bits);
+	prediction = coefficients[0];
+	writer.Put(dc.code[category], dc.length[category]);
+	if (category)
+		writer.Put(bits, category);
+
+	uint32_t run = 0;
+	for (uint32_t k = 1; k < 64; ++k) {
+		const int32_t value = coefficients[g_zigzag[k]];
+		if (!value) {
+			++run;
+			continue;
+		}
+		for (; run >= 16; run -= 16)
+			writer.Put(ac.code[0xf0], ac.length[0xf0]);
+
+		category = GetCategory(value, bits);
+		const uint32_t symbol = (run << 4) | category;
+		writer.Put(ac.code[symbol], ac.length[symbol]);
+		writer.Put(bits, category);
+		run = 0;
+	}
+	if (run)
+		writer.Put(ac.code[0], ac.length[0]);
+}
+
+bool EncodeJpeg(const MediaPlane *planes, uint32_t width, uint32_t height, const JpegEncodeOptions &options, std::vector<uint8_t> &out)
+{
+	if (!width || !height || width > 65535 || height > 65535 || !options.quality || options.quality > 100 || options.restartInterval > 65535) {
+		assert(false);
+		return false;
+	}
+
+	// libjpeg's scaling of the tables
+	const uint32_t scale = options.quality < 50 ? 5000 / options.quality : 200 - options.quality * 2;
+	uint16_t quant[2][64];
+	for (int i = 0; i < 64; ++i) {
+		quant[0][i] = (uint16_t)(std::max)(1u, (std::min)(255u, (g_lumaQuant[i] * scale + 50) / 100));
+		quant[1][i] = (uint16_t)(std::max)(1u, (std::min)(255u, (g_chromaQuant[i] * scale + 50) / 100));
+	}
+
+	JpegEncodeTable dc[2], ac[2];
+	for (int i = 0; i < 2; ++i) {
+		BuildEncodeTable(g_dcCounts[i], g_dcSymbols, dc[i]);
+		BuildEncodeTable(g_acCounts[i], g_acSymbols[i], ac[i]);
+	}
+
+	const uint32_t v = options.chroma420 ? 2 : 1;
+	const uint32_t chromaWidth = (width + 1) / 2;
+	const uint32_t chromaHeight = options.chroma420 ? (height + 1) / 2 : height;
+
+	out.clear();
+	PutMarker(out, 0xd8, 0);
+
+	for (uint8_t i = 0; i < 2; ++i) {
+		PutMarker(out, 0xdb, 2 + 65);
+		out.push_back(i);
+		for (int k = 0; k < 64; ++k)
+			out.push_back(uint8_t(quant[i][g_zigzag[k]]));
+	}
+
+	PutMarker(out, 0xc0, 8 + 3 * 3);
+	const uint8_t frame[] = {8, uint8_t(height >> 8), uint8_t(height), uint8_t(width >> 8), uint8_t(width), 3, 1, uint8_t(0x20 | v), 0, 2, 0x11, 1, 3, 0x11, 1};
+	out.insert(out.end(), frame, frame + sizeof(frame));
+
+	if (options.huffmanTables) {
+		for (uint8_t i = 0; i < 2; ++i) {
+			const uint8_t *counts[2] = {g_dcCounts[i], g_acCounts[i]};
+			const uint8_t *symbols[2] = {g_dcSymbols, g_acSymbols[i]};
+			for (uint8_t type = 0; type < 2; ++type) {
+				uint32_t total = 0;
+				for (int k = 0; k < 16; ++k)
+					total += counts[type][k];
+				PutMarker(out, 0xc4, 2 + 1 + 16 + total);
+				out.push_back(uint8_t((type << 4) | i));
+				out.insert(out.end(), counts[type], counts[type] + 16);
+				out.insert(out.end(), symbols[type], symbols[type] + total);
+			}
+		}
+	}
+
+	if (options.restartInterval) {
+		PutMarker(out, 0xdd, 4);
+		out.push_back(uint8_t(options.restartInterval >> 8));
+		out.push_back(uint8_t(options.restartInterval));
+	}
+
+	PutMarker(out, 0xda, 6 + 2 * 3);
+	const uint8_t scan[] = {3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0};
+	out.insert(out.end(), scan, scan + sizeof(scan));
+
+	JpegBitWriter writer(out);
+	int32_t predictions[3] = {};
+	int32_t coefficients[64];
+	const uint32_t mcusX = (width + 15) / 16;
+	const uint32_t mcusY = (height + 8 * v - 1) / (8 * v);
+	for (uint32_t mcu = 0; mcu < mcusX * mcusY; ++mcu) {
+		if (options.restartInterval && mcu && mcu % options.restartInterval == 0) {
+			writer.Flush();
+			PutMarker(out, uint8_t(0xd0 + (mcu / options.restartInterval - 1) % 8), 0);
+			predictions[0] = predictions[1] = predictions[2] = 0;
+		}
+
+		const uint32_t mx = mcu % mcusX;
+		const uint32_t my = mcu / mcusX;
+		for (uint32_t by = 0; by < v; ++by) {
+			for (uint32_t bx = 0; bx < 2; ++bx) {
+				ForwardDctBlock(planes[0], width, height, mx * 16 + bx * 8, (my * v + by) * 8, quant[0], coefficients);
+				EncodeBlock(writer, coefficients, predictions[0], dc[0], ac[0]);
+			}
+		}
+		for (uint32_t c = 1; c < 3; ++c) {
+			ForwardDctBlock(planes[c], chromaWidth, chromaHeight, mx * 8, my * 8, quant[1], coefficients);
+			EncodeBlock(writer, coefficients, predictions[c], dc[1], ac[1]);
+		}
+	}
+
+	writer.Flush();
+	PutMarker(out, 0xd9, 0);
+	return true;
+}
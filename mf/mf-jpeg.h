@@ -0,0 +1,138 @@
+﻿#pragma once
+#include "mf-cpu.h"
+#include "mf-sample.h"
+#include "mf-threadpool.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define JPEG_LOOKUP_BITS 9
+#define JPEG_MAX_BLOCKS 6 // per mcu: 2x2 luma blocks and one of each chroma
+
+struct JpegBits;
+
+// dequantizes and transforms one block of coefficients in natural order into 8x8 samples
+typedef void (*IdctBlockFunc)(const int16_t *coefficients, const uint16_t *quant, uint8_t *dst, ptrdiff_t stride);
+
+struct JpegDecoderStats {
+	uint64_t frames = 0;    // decoded
+	uint64_t errors = 0;    // corrupt, truncated or unsupported
+	uint64_t segmented = 0; // of the decoded frames, split on their restart markers
+	uint64_t late = 0;      // took longer than the frame interval
+	int64_t totalNs = 0;
+	int64_t maxNs = 0;
+};
+
+struct JpegEncodeOptions {
+	uint32_t quality = 75;        // 1..100, scales the tables of annex k like libjpeg
+	bool chroma420 = false;       // else 4:2:2, as most uvc cameras send
+	uint32_t restartInterval = 0; // mcus between two restart markers, 0 for none
+	bool huffmanTables = false;   // mjpeg usually leaves the standard tables out
+};
+
+// minimal baseline encoder for MJPG fixtures: the tests and benchmarks generate the frames a camera would send with it,
+// so the decoder runs on linux without a recording. planes: y, u, v, the chroma in the resolution of the options.
+// the edges of partial mcus are repeated. a plain float dct, not meant to be fast.
+bool EncodeJpeg(const MediaPlane *planes, uint32_t width, uint32_t height, const JpegEncodeOptions &options, std::vector<uint8_t> &out);
+
+// baseline jpeg (8 bit, huffman) as sent by uvc webcams for MJPG -> NV12, on several threads.
+// a frame with restart markers is split on them and the segments are decoded in parallel. without markers the
+// entropy decoding is serial by nature, it runs on one thread while the others do the idct of the mcu rows it has
+// finished. frames without huffman tables use the tables of the standard, mjpeg usually leaves them out.
+// 4:2:0, 4:2:2, 4:4:0, 4:4:4 and grayscale, the chroma is averaged down to 4:2:0 like for YUY2.
+// the idct is the accurate integer one of libjpeg, its simd version produces exactly the same bytes.
+class CJpegDecoder : private IParallelJob {
+public:
+	CJpegDecoder();
+
+	// threads including the caller, 0 means one per cpu
+	bool Start(uint32_t threads = 0, SimdLevel level = GetSimdLevel());
+	void Stop() { m_threads.Stop(); }
+	bool IsStarted() const { return m_threads.IsStarted(); }
+
+	// decodes which take longer count as late, 0 to not count them
+	void SetFrameInterval(int64_t ns) { m_intervalNs = ns; }
+
+	// the image must be width x height. false if the frame is corrupt or not baseline, the output is then undefined
+	bool Decode(const uint8_t *data, uint32_t size, uint32_t width, uint32_t height, uint8_t *dstY, int32_t strideY, uint8_t *dstUV, int32_t strideUV);
+
+	// from the thread which decodes
+	JpegDecoderStats GetStats() const { return m_stats; }
+
+private:
+	struct HuffmanTable {
+		uint16_t lookup[1 << JPEG_LOOKUP_BITS]; // (length << 8) | symbol for the codes up to JPEG_LOOKUP_BITS, 0 for longer ones
+		int16_t coefficient[1 << JPEG_LOOKUP_BITS]; // ac codes whose value fits as well: (value << 8) | (run << 4) | bits, 0 otherwise
+		int32_t maxCode[17];                    // per length, -1 if there is no code of that length
+		int32_t offset[17];                     // index of the symbol minus the code, per length
+		uint8_t symbols[256];
+		bool valid;
+	};
+
+	struct Component {
+		uint32_t id;
+		uint32_t h; // sampling factors
+		uint32_t v;
+		uint32_t quant;
+		uint32_t dc; // huffman tables
+		uint32_t ac;
+	};
+
+	struct Segment {
+		const uint8_t *begin;
+		const uint8_t *end;
+	};
+
+	static bool BuildTable(const uint8_t *counts, const uint8_t *symbols, HuffmanTable &table);
+	bool Parse(const uint8_t *data, uint32_t size);
+	bool ParseFrame(const uint8_t *p, uint32_t length);
+	bool ParseScan(const uint8_t *p, uint32_t length);
+	void FindSegments(const uint8_t *p, const uint8_t *end);
+
+	void RunPart(uint32_t part, uint32_t worker) override;
+	bool DecodeMcu(JpegBits &bits, int32_t *predictions, int16_t (*blocks)[64]) const;
+	bool DecodeSegment(uint32_t segment);
+	void DecodeCoefficients();
+	void OutputRows(uint32_t rowBegin, uint32_t rowEnd);
+	void OutputMcu(uint32_t mcu, const int16_t (*blocks)[64]);
+
+private:
+	CParallelFor m_threads;
+	IdctBlockFunc m_idct = nullptr;
+	HuffmanTable m_defaultDc[2];
+	HuffmanTable m_defaultAc[2];
+	int64_t m_intervalNs = 0;
+	JpegDecoderStats m_stats;
+
+	// of the frame being decoded
+	HuffmanTable m_dc[4];
+	HuffmanTable m_ac[4];
+	uint16_t m_quant[4][64]; // natural order
+	bool m_quantValid[4];
+	Component m_components[3];
+	uint32_t m_componentCount = 0;
+	uint32_t m_imageWidth = 0;
+	uint32_t m_imageHeight = 0;
+	uint32_t m_restartInterval = 0; // mcus per segment, 0 if there are no markers
+	uint32_t m_mcusX = 0;
+	uint32_t m_mcusY = 0;
+	uint32_t m_lumaBlocks = 0; // per mcu, h * v of the first component
+	uint32_t m_blocks = 0;     // per mcu
+	std::vector<Segment> m_segments;
+
+	// output
+	uint32_t m_width = 0;
+	uint32_t m_height = 0;
+	uint8_t *m_pDstY = nullptr;
+	int32_t m_strideY = 0;
+	uint8_t *m_pDstUV = nullptr;
+	int32_t m_strideUV = 0;
+
+	// parts of a segmented frame, or of a frame whose coefficients are decoded by part 0 while the others do the idct
+	bool m_bSegmented = false;
+	uint32_t m_parts = 0;
+	std::vector<int16_t> m_coefficients;
+	std::atomic<uint32_t> m_decodedRows{0}; // mcu rows of m_coefficients which are complete
+	std::atomic<bool> m_bFailed{false};
+};
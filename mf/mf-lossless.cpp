@@ -0,0 +1,524 @@
+#include "mf-lossless.h"
+#include "mf-portable.hpp"
+#include <algorithm>
+#include <assert.h>
+#include <cstring>
+
+#define LOSSLESS_RAW_UNIT 0x80000000u
+
+struct LosslessFrameHeader {
+	uint32_t magic; // LOSSLESS_MAGIC
+	uint32_t width;
+	uint32_t height;
+	uint32_t units;
+};
+
+static inline uint8_t ZigZag(uint8_t x, uint8_t prediction)
+{
+	const int8_t r = int8_t(uint8_t(x - prediction));
+	return uint8_t((uint8_t(r) << 1) ^ (r >> 7));
+}
+
+static inline uint8_t UnZigZag(uint8_t z)
+{
+	return uint8_t((z >> 1) ^ (0u - (z & 1)));
+}
+
+static inline uint32_t GetGroupCount(uint32_t count)
+{
+	return (count + LOSSLESS_GROUP - 1) / LOSSLESS_GROUP;
+}
+
+// the nibbles with the number of planes of each group
+static inline uint32_t GetWidthBytes(uint32_t count)
+{
+	return (GetGroupCount(count) + 1) / 2;
+}
+
+// of a byte, without a branch
+static inline uint32_t GetBitLength(uint32_t x)
+{
+	return (x > 0) + (x > 1) + (x > 3) + (x > 7) + (x > 15) + (x > 31) + (x > 63) + (x > 127);
+}
+
+// returns the number of planes written to `data`
+static uint32_t EncodeGroup_C(const uint8_t *row, const uint8_t *up, uint8_t *data)
+{
+	uint8_t z[LOSSLESS_GROUP];
+	uint32_t any = 0;
+	for (uint32_t i = 0; i < LOSSLESS_GROUP; ++i) {
+		z[i] = ZigZag(row[i], up[i]);
+		any |= z[i];
+	}
+
+	const uint32_t width = GetBitLength(any);
+	for (uint32_t k = 0; k < width; ++k) {
+		uint32_t mask = 0;
+		for (uint32_t i = 0; i < LOSSLESS_GROUP; ++i)
+			mask |= ((z[i] >> k) & 1u) << i;
+		data[k * 2] = uint8_t(mask);
+		data[k * 2 + 1] = uint8_t(mask >> 8);
+	}
+	return width;
+}
+
+static void DecodeGroup_C(const uint8_t *data, uint32_t width, const uint8_t *up, uint8_t *row)
+{
+	uint8_t z[LOSSLESS_GROUP] = {};
+	for (uint32_t k = 0; k < width; ++k) {
+		const uint32_t mask = data[k * 2] | (data[k * 2 + 1] << 8);
+		for (uint32_t i = 0; i < LOSSLESS_GROUP; ++i)
+			z[i] |= uint8_t(((mask >> i) & 1u) << k);
+	}
+
+	for (uint32_t i = 0; i < LOSSLESS_GROUP; ++i)
+		row[i] = uint8_t(up[i] + UnZigZag(z[i]));
+}
+
+// the groups from `group` on, `data` is where the planes of `group` go. returns the end of the planes
+static uint8_t *EncodeRowTail_C(const uint8_t *row, const uint8_t *up, uint8_t *widths, uint8_t *data, uint32_t group, uint32_t count)
+{
+	const uint32_t groups = GetGroupCount(count);
+	for (; group < groups; ++group) {
+		const uint32_t x = group * LOSSLESS_GROUP;
+		uint32_t width = 0;
+		if (x + LOSSLESS_GROUP <= count) {
+			width = EncodeGroup_C(row + x, up + x, data);
+		} else {
+			// the last group is padded with residuals of 0
+			uint8_t paddedRow[LOSSLESS_GROUP] = {};
+			uint8_t paddedUp[LOSSLESS_GROUP] = {};
+			memcpy(paddedRow, row + x, count - x);
+			memcpy(paddedUp, up + x, count - x);
+			width = EncodeGroup_C(paddedRow, paddedUp, data);
+		}
+		widths[group / 2] |= uint8_t(width << (group & 1) * 4);
+		data += width * 2;
+	}
+	return data;
+}
+
+static void DecodeRowTail_C(const uint8_t *widths, const uint8_t *data, const uint8_t *up, uint8_t *row, uint32_t group, uint32_t count)
+{
+	const uint32_t groups = GetGroupCount(count);
+	for (; group < groups; ++group) {
+		const uint32_t x = group * LOSSLESS_GROUP;
+		const uint32_t width = (widths[group / 2] >> (group & 1) * 4) & 15;
+		if (x + LOSSLESS_GROUP <= count) {
+			DecodeGroup_C(data, width, up + x, row + x);
+		} else {
+			uint8_t paddedUp[LOSSLESS_GROUP] = {};
+			uint8_t paddedRow[LOSSLESS_GROUP];
+			memcpy(paddedUp, up + x, count - x);
+			DecodeGroup_C(data, width, paddedUp, paddedRow);
+			memcpy(row + x, paddedRow, count - x);
+		}
+		data += width * 2;
+	}
+}
+
+static uint32_t EncodeRow_C(const uint8_t *row, const uint8_t *up, uint8_t *dst, uint32_t count)
+{
+	const uint32_t widthBytes = GetWidthBytes(count);
+	memset(dst, 0, widthBytes);
+	return uint32_t(EncodeRowTail_C(row, up, dst, dst + widthBytes, 0, count) - dst);
+}
+
+static void DecodeRow_C(const uint8_t *src, const uint8_t *up, uint8_t *row, uint32_t count)
+{
+	DecodeRowTail_C(src, src + GetWidthBytes(count), up, row, 0, count);
+}
+
+#if MF_ARCH_X86
+//---------------------------------------------------------------------------------------------
+// sse2: movemask takes a bit plane of the group at once
+
+MF_TARGET_SSE2 static inline uint32_t EncodeGroup_SSE2(const uint8_t *row, const uint8_t *up, uint8_t *data)
+{
+	const __m128i r = _mm_sub_epi8(_mm_loadu_si128((const __m128i *)row), _mm_loadu_si128((const __m128i *)up));
+	const __m128i z = _mm_xor_si128(_mm_add_epi8(r, r), _mm_cmpgt_epi8(_mm_setzero_si128(), r));
+
+	// bit k of each byte moved to its top bit, the 16 bit shift does not carry into it from the low byte
+	const __m128i bias = _mm_set1_epi32(0x8000);
+	const __m128i low = _mm_setr_epi32(_mm_movemask_epi8(_mm_slli_epi16(z, 7)), _mm_movemask_epi8(_mm_slli_epi16(z, 6)), _mm_movemask_epi8(_mm_slli_epi16(z, 5)),
+					   _mm_movemask_epi8(_mm_slli_epi16(z, 4)));
+	const __m128i high = _mm_setr_epi32(_mm_movemask_epi8(_mm_slli_epi16(z, 3)), _mm_movemask_epi8(_mm_slli_epi16(z, 2)), _mm_movemask_epi8(_mm_slli_epi16(z, 1)),
+					    _mm_movemask_epi8(z));
+
+	// all eight planes are stored, the next group overwrites the unused ones. packs saturates signed, hence the bias
+	const __m128i planes = _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(low, bias), _mm_sub_epi32(high, bias)), _mm_set1_epi16(-0x8000));
+	_mm_storeu_si128((__m128i *)data, planes);
+
+	__m128i any = _mm_or_si128(z, _mm_srli_si128(z, 8));
+	any = _mm_or_si128(any, _mm_srli_si128(any, 4));
+	any = _mm_or_si128(any, _mm_srli_si128(any, 2));
+	any = _mm_or_si128(any, _mm_srli_si128(any, 1));
+	return GetBitLength((uint32_t)_mm_cvtsi128_si32(any) & 0xff);
+}
+
+MF_TARGET_SSE2 static inline void DecodeGroup_SSE2(const uint8_t *data, uint32_t width, const uint8_t *up, uint8_t *row)
+{
+	const __m128i bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+	const __m128i one = _mm_set1_epi8(1);
+
+	// from the top plane down, each one shifts the previous ones up
+	__m128i z = _mm_setzero_si128();
+	for (uint32_t k = width; k-- > 0;) {
+		// the low byte of the mask to the first 8 bytes, the high byte to the others
+		__m128i mask = _mm_cvtsi32_si128(data[k * 2] | (data[k * 2 + 1] << 8));
+		mask = _mm_unpacklo_epi8(mask, mask);
+		mask = _mm_unpacklo_epi16(mask, mask);
+		mask = _mm_unpacklo_epi32(mask, mask);
+		const __m128i set = _mm_cmpeq_epi8(_mm_and_si128(mask, bits), bits);
+		z = _mm_or_si128(_mm_add_epi8(z, z), _mm_and_si128(set, one));
+	}
+
+	const __m128i half = _mm_and_si128(_mm_srli_epi16(z, 1), _mm_set1_epi8(0x7f));
+	const __m128i sign = _mm_sub_epi8(_mm_setzero_si128(), _mm_and_si128(z, one));
+	const __m128i r = _mm_xor_si128(half, sign);
+	_mm_storeu_si128((__m128i *)row, _mm_add_epi8(_mm_loadu_si128((const __m128i *)up), r));
+}
+
+// the whole groups from `group` on, then the tail
+MF_TARGET_SSE2 static uint8_t *EncodeRowGroups_SSE2(const uint8_t *row, const uint8_t *up, uint8_t *widths, uint8_t *data, uint32_t group, uint32_t count)
+{
+	for (; (group + 1) * LOSSLESS_GROUP <= count; ++group) {
+		const uint32_t width = EncodeGroup_SSE2(row + group * LOSSLESS_GROUP, up + group * LOSSLESS_GROUP, data);
+		widths[group / 2] |= uint8_t(width << (group & 1) * 4);
+		data += width * 2;
+	}
+
+	return EncodeRowTail_C(row, up, widths, data, group, count);
+}
+
+MF_TARGET_SSE2 static void DecodeRowGroups_SSE2(const uint8_t *widths, const uint8_t *data, const uint8_t *up, uint8_t *row, uint32_t group, uint32_t count)
+{
+	for (; (group + 1) * LOSSLESS_GROUP <= count; ++group) {
+		const uint32_t width = (widths[group / 2] >> (group & 1) * 4) & 15;
+		DecodeGroup_SSE2(data, width, up + group * LOSSLESS_GROUP, row + group * LOSSLESS_GROUP);
+		data += width * 2;
+	}
+
+	DecodeRowTail_C(widths, data, up, row, group, count);
+}
+
+MF_TARGET_SSE2 static uint32_t EncodeRow_SSE2(const uint8_t *row, const uint8_t *up, uint8_t *dst, uint32_t count)
+{
+	const uint32_t widthBytes = GetWidthBytes(count);
+	memset(dst, 0, widthBytes);
+	return uint32_t(EncodeRowGroups_SSE2(row, up, dst, dst + widthBytes, 0, count) - dst);
+}
+
+MF_TARGET_SSE2 static void DecodeRow_SSE2(const uint8_t *src, const uint8_t *up, uint8_t *row, uint32_t count)
+{
+	DecodeRowGroups_SSE2(src, src + GetWidthBytes(count), up, row, 0, count);
+}
+
+//---------------------------------------------------------------------------------------------
+// avx2: two groups at once, which share a byte of widths
+
+MF_TARGET_AVX2 static uint32_t EncodeRow_AVX2(const uint8_t *row, const uint8_t *up, uint8_t *dst, uint32_t count)
+{
+	const uint32_t widthBytes = GetWidthBytes(count);
+	memset(dst, 0, widthBytes);
+
+	const __m256i mask = _mm256_set1_epi32(0xffff);
+	uint8_t *data = dst + widthBytes;
+	uint32_t group = 0;
+	for (; (group + 2) * LOSSLESS_GROUP <= count; group += 2) {
+		const __m256i r = _mm256_sub_epi8(_mm256_loadu_si256((const __m256i *)(row + group * LOSSLESS_GROUP)), _mm256_loadu_si256((const __m256i *)(up + group * LOSSLESS_GROUP)));
+		const __m256i z = _mm256_xor_si256(_mm256_add_epi8(r, r), _mm256_cmpgt_epi8(_mm256_setzero_si256(), r));
+
+		// plane k of both groups in dword k, the first group in the low word
+		const __m256i masks = _mm256_setr_epi32(_mm256_movemask_epi8(_mm256_slli_epi16(z, 7)), _mm256_movemask_epi8(_mm256_slli_epi16(z, 6)),
+							_mm256_movemask_epi8(_mm256_slli_epi16(z, 5)), _mm256_movemask_epi8(_mm256_slli_epi16(z, 4)),
+							_mm256_movemask_epi8(_mm256_slli_epi16(z, 3)), _mm256_movemask_epi8(_mm256_slli_epi16(z, 2)),
+							_mm256_movemask_epi8(_mm256_slli_epi16(z, 1)), _mm256_movemask_epi8(z));
+		const __m256i planes = _mm256_permute4x64_epi64(_mm256_packus_epi32(_mm256_and_si256(masks, mask), _mm256_srli_epi32(masks, 16)), _MM_SHUFFLE(3, 1, 2, 0));
+
+		const __m128i low = _mm256_castsi256_si128(z);
+		const __m128i high = _mm256_extracti128_si256(z, 1);
+		__m128i any = _mm_or_si128(_mm_unpacklo_epi64(low, high), _mm_unpackhi_epi64(low, high));
+		any = _mm_or_si128(any, _mm_srli_epi64(any, 32));
+		any = _mm_or_si128(any, _mm_srli_epi64(any, 16));
+		any = _mm_or_si128(any, _mm_srli_epi64(any, 8));
+		const uint32_t width0 = GetBitLength((uint32_t)_mm_cvtsi128_si32(any) & 0xff);
+		const uint32_t width1 = GetBitLength((uint32_t)_mm_extract_epi16(any, 4) & 0xff);
+
+		dst[group / 2] = uint8_t(width0 | (width1 << 4));
+		_mm_storeu_si128((__m128i *)data, _mm256_castsi256_si128(planes));
+		data += width0 * 2;
+		_mm_storeu_si128((__m128i *)data, _mm256_extracti128_si256(planes, 1));
+		data += width1 * 2;
+	}
+
+	return uint32_t(EncodeRowGroups_SSE2(row, up, dst, data, group, count) - dst);
+}
+
+MF_TARGET_AVX2 static void DecodeRow_AVX2(const uint8_t *src, const uint8_t *up, uint8_t *row, uint32_t count)
+{
+	const __m256i spread = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+	const __m256i bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+	const __m256i one = _mm256_set1_epi8(1);
+
+	const uint8_t *data = src + GetWidthBytes(count);
+	uint32_t group = 0;
+	for (; (group + 2) * LOSSLESS_GROUP <= count; group += 2) {
+		const uint32_t width0 = src[group / 2] & 15;
+		const uint32_t width1 = src[group / 2] >> 4;
+		const uint8_t *data1 = data + width0 * 2;
+
+		// the planes above the width of a group are empty
+		__m256i z = _mm256_setzero_si256();
+		for (uint32_t k = (std::max)(width0, width1); k-- > 0;) {
+			const uint32_t mask0 = k < width0 ? data[k * 2] | (data[k * 2 + 1] << 8) : 0;
+			const uint32_t mask1 = k < width1 ? data1[k * 2] | (data1[k * 2 + 1] << 8) : 0;
+			const __m256i mask = _mm256_shuffle_epi8(_mm256_set1_epi32(int(mask0 | (mask1 << 16))), spread);
+			const __m256i set = _mm256_cmpeq_epi8(_mm256_and_si256(mask, bits), bits);
+			z = _mm256_or_si256(_mm256_add_epi8(z, z), _mm256_and_si256(set, one));
+		}
+
+		const __m256i half = _mm256_and_si256(_mm256_srli_epi16(z, 1), _mm256_set1_epi8(0x7f));
+		const __m256i sign = _mm256_sub_epi8(_mm256_setzero_si256(), _mm256_and_si256(z, one));
+		const __m256i r = _mm256_xor_si256(half, sign);
+		_mm256_storeu_si256((__m256i *)(row + group * LOSSLESS_GROUP), _mm256_add_epi8(_mm256_loadu_si256((const __m256i *)(up + group * LOSSLESS_GROUP)), r));
+		data = data1 + width1 * 2;
+	}
+
+	DecodeRowGroups_SSE2(src, data, up, row, group, count);
+}
+#endif
+
+//---------------------------------------------------------------------------------------------
+bool CLosslessCodec::Start(uint32_t threads, SimdLevel level)
+{
+	if (level > GetCpuSimdLevel())
+		level = GetCpuSimdLevel();
+
+#if MF_ARCH_X86
+	const bool avx2 = level >= SIMD_AVX2;
+	const bool sse2 = level >= SIMD_SSE2;
+#else
+	const bool avx2 = false;
+	const bool sse2 = false;
+#endif
+
+	m_encodeRow = EncodeRow_C;
+	m_decodeRow = DecodeRow_C;
+#if MF_ARCH_X86
+	if (sse2) {
+		m_encodeRow = avx2 ? EncodeRow_AVX2 : EncodeRow_SSE2;
+		m_decodeRow = avx2 ? DecodeRow_AVX2 : DecodeRow_SSE2;
+	}
+#endif
+
+	(void)avx2;
+	(void)sse2;
+	return m_threads.Start(threads);
+}
+
+uint32_t CLosslessCodec::GetMaxUnitSize(uint32_t width)
+{
+	// every group with all eight planes
+	return LOSSLESS_BAND_ROWS * (GetWidthBytes(width) + GetGroupCount(width) * LOSSLESS_GROUP);
+}
+
+uint32_t CLosslessCodec::GetMaxEncodedSize(uint32_t width, uint32_t height)
+{
+	const uint32_t units = (height + LOSSLESS_BAND_ROWS - 1) / LOSSLESS_BAND_ROWS * 2;
+	return sizeof(LosslessFrameHeader) + units * (sizeof(uint32_t) + GetMaxUnitSize(width));
+}
+
+void CLosslessCodec::SetupUnits(uint32_t width, uint32_t height)
+{
+	const uint32_t bands = (height + LOSSLESS_BAND_ROWS - 1) / LOSSLESS_BAND_ROWS;
+	m_width = width;
+	m_units.resize(bands * 2);
+	for (uint32_t band = 0; band < bands; ++band) {
+		Unit &luma = m_units[band * 2];
+		luma.rows = (std::min)((uint32_t)LOSSLESS_BAND_ROWS, height - band * LOSSLESS_BAND_ROWS);
+		luma.step = 1;
+
+		Unit &chroma = m_units[band * 2 + 1];
+		chroma.rows = (luma.rows + 1) / 2;
+		chroma.step = 2;
+	}
+}
+
+void CLosslessCodec::EncodeUnit(Unit &unit, uint8_t *scratch)
+{
+	uint8_t *dst = m_pOutput + unit.offset;
+	const uint32_t raw = unit.rows * m_width;
+
+	// the first row is predicted from the left
+	memset(scratch, 0, unit.step);
+	memcpy(scratch + unit.step, unit.src, m_width - unit.step);
+
+	uint32_t size = 0;
+	const uint8_t *up = scratch;
+	for (uint32_t y = 0; y < unit.rows && size < raw; ++y) {
+		const uint8_t *row = unit.src + (ptrdiff_t)y * unit.srcStride;
+		size += m_encodeRow(row, up, dst + size, m_width);
+		up = row;
+	}
+
+	if (size < raw) {
+		unit.size = size;
+		return;
+	}
+
+	for (uint32_t y = 0; y < unit.rows; ++y)
+		memcpy(dst + y * m_width, unit.src + (ptrdiff_t)y * unit.srcStride, m_width);
+	unit.size = raw | LOSSLESS_RAW_UNIT;
+}
+
+bool CLosslessCodec::DecodeUnit(const Unit &unit)
+{
+	const uint8_t *src = m_pData + unit.offset;
+	const uint8_t *end = src + (unit.size & ~LOSSLESS_RAW_UNIT);
+
+	if (unit.size & LOSSLESS_RAW_UNIT) {
+		for (uint32_t y = 0; y < unit.rows; ++y)
+			memcpy(unit.dst + (ptrdiff_t)y * unit.dstStride, src + y * m_width, m_width);
+		return true;
+	}
+
+	const uint32_t groups = GetGroupCount(m_width);
+	const uint32_t widthBytes = GetWidthBytes(m_width);
+	const uint8_t *up = m_scratch.data(); // zeros, the first row is predicted from the left
+	for (uint32_t y = 0; y < unit.rows; ++y) {
+		if ((size_t)(end - src) < widthBytes)
+			return false;
+
+		// the planes of the row must be there before the kernel reads them
+		uint32_t planes = 0;
+		for (uint32_t i = 0; i < widthBytes; ++i) {
+			const uint32_t low = src[i] & 15;
+			const uint32_t high = src[i] >> 4;
+			if (low > 8 || high > 8)
+				return false;
+			planes += low + high;
+		}
+		if (((groups & 1) && (src[widthBytes - 1] >> 4)) || (size_t)(end - src - widthBytes) < planes * 2)
+			return false;
+
+		uint8_t *row = unit.dst + (ptrdiff_t)y * unit.dstStride;
+		m_decodeRow(src, up, row, m_width);
+		if (!y) {
+			for (uint32_t x = unit.step; x < m_width; ++x)
+				row[x] = uint8_t(row[x] + row[x - unit.step]);
+		}
+
+		src += widthBytes + planes * 2;
+		up = row;
+	}
+	return src == end;
+}
+
+void CLosslessCodec::RunPart(uint32_t part, uint32_t worker)
+{
+	if (m_bEncoding) {
+		EncodeUnit(m_units[part], m_scratch.data() + (size_t)worker * m_width);
+		return;
+	}
+
+	if (!m_bFailed && !DecodeUnit(m_units[part]))
+		m_bFailed = true;
+}
+
+uint32_t CLosslessCodec::Encode(const MediaPlane *src, uint32_t width, uint32_t height, uint8_t *dst, uint32_t capacity)
+{
+	if (!IsStarted() || !width || !height || (width & 1) || (height & 1) || capacity < GetMaxEncodedSize(width, height)) {
+		assert(false);
+		++m_stats.errors;
+		return 0;
+	}
+
+	const int64_t begin = GetMonotonicTimeNs();
+
+	SetupUnits(width, height);
+	const uint32_t count = (uint32_t)m_units.size();
+	const uint32_t first = sizeof(LosslessFrameHeader) + count * sizeof(uint32_t);
+	const uint32_t slot = GetMaxUnitSize(width);
+
+	// each unit is coded into a slot of its worst case size, then they are moved together
+	for (uint32_t i = 0; i < count; ++i) {
+		Unit &unit = m_units[i];
+		const MediaPlane &plane = src[i & 1];
+		unit.src = plane.data + (ptrdiff_t)(i / 2) * (LOSSLESS_BAND_ROWS >> (i & 1)) * plane.stride;
+		unit.srcStride = plane.stride;
+		unit.offset = first + i * slot;
+	}
+
+	m_bEncoding = true;
+	m_pOutput = dst;
+	m_scratch.resize((size_t)m_threads.GetThreadCount() * width);
+	m_threads.Run(this, count);
+
+	uint32_t size = first;
+	for (uint32_t i = 0; i < count; ++i) {
+		const Unit &unit = m_units[i];
+		const uint32_t bytes = unit.size & ~LOSSLESS_RAW_UNIT;
+		memmove(dst + size, dst + unit.offset, bytes);
+		memcpy(dst + sizeof(LosslessFrameHeader) + i * sizeof(uint32_t), &unit.size, sizeof(uint32_t));
+		size += bytes;
+	}
+
+	LosslessFrameHeader header;
+	header.magic = LOSSLESS_MAGIC;
+	header.width = width;
+	header.height = height;
+	header.units = count;
+	memcpy(dst, &header, sizeof(header));
+
+	const int64_t ns = GetMonotonicTimeNs() - begin;
+	++m_stats.frames;
+	m_stats.rawBytes += (uint64_t)width * height * 3 / 2;
+	m_stats.encodedBytes += size;
+	m_stats.totalNs += ns;
+	m_stats.maxNs = (std::max)(m_stats.maxNs, ns);
+	return size;
+}
+
+bool CLosslessCodec::Decode(const uint8_t *data, uint32_t size, uint32_t width, uint32_t height, uint8_t *dstY, int32_t strideY, uint8_t *dstUV, int32_t strideUV)
+{
+	if (!IsStarted()) {
+		assert(false);
+		return false;
+	}
+
+	LosslessFrameHeader header = {};
+	if (size >= sizeof(header))
+		memcpy(&header, data, sizeof(header));
+
+	SetupUnits(width, height);
+	const uint32_t count = (uint32_t)m_units.size();
+	bool ok = header.magic == LOSSLESS_MAGIC && header.width == width && header.height == height && header.units == count &&
+		  size - sizeof(header) >= count * sizeof(uint32_t);
+
+	uint64_t offset = sizeof(header) + count * sizeof(uint32_t);
+	for (uint32_t i = 0; i < count && ok; ++i) {
+		Unit &unit = m_units[i];
+		memcpy(&unit.size, data + sizeof(header) + i * sizeof(uint32_t), sizeof(uint32_t));
+		unit.offset = (uint32_t)offset;
+		unit.dst = (i & 1) ? dstUV + (ptrdiff_t)(i / 2) * (LOSSLESS_BAND_ROWS / 2) * strideUV : dstY + (ptrdiff_t)(i / 2) * LOSSLESS_BAND_ROWS * strideY;
+		unit.dstStride = (i & 1) ? strideUV : strideY;
+
+		const uint32_t bytes = unit.size & ~LOSSLESS_RAW_UNIT;
+		offset += bytes;
+		ok = offset <= size && (!(unit.size & LOSSLESS_RAW_UNIT) || bytes == unit.rows * width);
+	}
+
+	if (ok) {
+		m_bEncoding = false;
+		m_pData = data;
+		m_bFailed = false;
+		m_scratch.assign(width, 0);
+		m_threads.Run(this, count);
+		ok = !m_bFailed;
+	}
+
+	if (!ok)
+		++m_stats.errors;
+	return ok;
+}
@@ -0,0 +1,88 @@
+﻿#pragma once
+#include "mf-cpu.h"
+#include "mf-sample.h"
+#include "mf-threadpool.h"
+#include <atomic>
+#include <vector>
+
+#define LOSSLESS_MAGIC MEDIA_FOURCC('M', 'F', 'L', '1')
+#define LOSSLESS_BAND_ROWS 16 // luma rows per band, each band is coded on its own
+#define LOSSLESS_GROUP 16     // residuals which share a bit width
+
+// one row: prediction residuals in groups of LOSSLESS_GROUP, see CLosslessCodec. returns the bytes written
+typedef uint32_t (*LosslessEncodeRowFunc)(const uint8_t *row, const uint8_t *up, uint8_t *dst, uint32_t count);
+// the inverse, `src` has been checked to hold the whole row
+typedef void (*LosslessDecodeRowFunc)(const uint8_t *src, const uint8_t *up, uint8_t *row, uint32_t count);
+
+struct LosslessCodecStats {
+	uint64_t frames = 0;       // encoded
+	uint64_t errors = 0;       // frames which failed to encode or decode
+	uint64_t rawBytes = 0;     // of the encoded frames
+	uint64_t encodedBytes = 0;
+	int64_t totalNs = 0;       // encoding
+	int64_t maxNs = 0;
+};
+
+// lossless NV12 for the raw dump (MEDIA_SUBTYPE_MFLZ), and the decoder to replay it.
+// each sample is predicted from the one above it (from the one on its left in the first row of a band), the residuals
+// are zigzag mapped and stored as bit planes of LOSSLESS_GROUP samples, with as many planes as the largest residual
+// of the group needs. the luma and the chroma of every band of LOSSLESS_BAND_ROWS rows are independent units which
+// are coded in parallel, a unit which would grow is stored raw. camera noise costs a few planes, flat areas none.
+// the simd kernels produce exactly the same bytes as the scalar ones.
+//
+// frame: LosslessFrameHeader, uint32_t size of each unit (LOSSLESS_RAW_UNIT set if stored raw), the units in order:
+// luma of band 0, chroma of band 0, luma of band 1, ...
+// row: one nibble per group with its number of planes, low nibble first, padded to a byte, then the planes of each
+// group from bit 0 up as little endian uint16_t, bit i of plane k is bit k of residual i.
+class CLosslessCodec : private IParallelJob {
+public:
+	// threads including the caller, 0 means one per cpu
+	bool Start(uint32_t threads = 0, SimdLevel level = GetSimdLevel());
+	void Stop() { m_threads.Stop(); }
+	bool IsStarted() const { return m_threads.IsStarted(); }
+
+	// capacity Encode needs for a frame of this size
+	static uint32_t GetMaxEncodedSize(uint32_t width, uint32_t height);
+
+	// src planes as produced by DescribeVideoPlanes for NV12, even width and height. returns the size written to dst, 0 on failure
+	uint32_t Encode(const MediaPlane *src, uint32_t width, uint32_t height, uint8_t *dst, uint32_t capacity);
+
+	// the frame must be width x height. false if it is corrupt, the output is then undefined
+	bool Decode(const uint8_t *data, uint32_t size, uint32_t width, uint32_t height, uint8_t *dstY, int32_t strideY, uint8_t *dstUV, int32_t strideUV);
+
+	// from the thread which encodes
+	LosslessCodecStats GetStats() const { return m_stats; }
+
+private:
+	struct Unit {
+		const uint8_t *src; // first row
+		ptrdiff_t srcStride;
+		uint8_t *dst;
+		ptrdiff_t dstStride;
+		uint32_t rows;
+		uint32_t step; // distance of the left neighbour, 2 for the interleaved chroma
+		uint32_t offset; // of the coded unit in the frame
+		uint32_t size;
+	};
+
+	void SetupUnits(uint32_t width, uint32_t height);
+	static uint32_t GetMaxUnitSize(uint32_t width);
+	void RunPart(uint32_t part, uint32_t worker) override;
+	void EncodeUnit(Unit &unit, uint8_t *scratch);
+	bool DecodeUnit(const Unit &unit);
+
+private:
+	CParallelFor m_threads;
+	LosslessEncodeRowFunc m_encodeRow = nullptr;
+	LosslessDecodeRowFunc m_decodeRow = nullptr;
+	LosslessCodecStats m_stats;
+
+	// of the frame being coded
+	bool m_bEncoding = false;
+	uint32_t m_width = 0;
+	std::vector<Unit> m_units;
+	const uint8_t *m_pData = nullptr; // frame being decoded
+	uint8_t *m_pOutput = nullptr;     // frame being encoded
+	std::vector<uint8_t> m_scratch;   // per worker: the shifted first row of a unit, and a row of zeros
+	std::atomic<bool> m_bFailed{false};
+};
@@ -0,0 +1,272 @@
+#include "mf-manager.h"
+#include "mf-portable.hpp"
+#include <algorithm>
+#include <assert.h>
+
+// frames one task processes before the session goes to the back of the queue, so that one busy camera
+// does not keep a worker from the others
+#define SESSION_BATCH 4
+// how long Stop lets the sessions drain with every worker still there, the pool runs whatever is left when it stops
+#define MANAGER_DRAIN_MS 2000
+
+CCaptureSession::CCaptureSession(const char *name, std::shared_ptr<IFrameSource> source, const char *dumpPath, const BackpressureOptions &backpressure,
+				 CWorkStealingPool *pool, uint32_t home, CWakeEvent *idle)
+    : m_name(name), m_source(std::move(source)), m_pInput(this), m_pipeline(dumpPath != nullptr), m_pPool(pool), m_home(home), m_pIdle(idle)
+{
+	m_queue.Init(backpressure);
+	if (dumpPath)
+		m_pipeline.SetDumpPath(dumpPath);
+}
+
+CCaptureSession::~CCaptureSession() {}
+
+void CCaptureSession::OnMediaSample(const MediaSample & /*sample*/)
+{
+	// WantsFrames() is true, sources must use OnMediaFrame
+	assert(false);
+}
+
+void CCaptureSession::OnMediaFrame(CMediaFrame *frame)
+{
+	// may wait for a worker, depending on the policy
+	if (m_queue.Push(frame))
+		Schedule();
+}
+
+void CCaptureSession::Schedule()
+{
+	// only one task per session at a time, the queue has a single consumer
+	if (!m_bScheduled.exchange(true))
+		m_pPool->Submit(this, m_home);
+}
+
+void CCaptureSession::Run()
+{
+	for (uint32_t i = 0; i < SESSION_BATCH; ++i) {
+		CMediaFrame *frame = nullptr;
+		if (!m_queue.TryPop(frame))
+			break;
+
+		const MediaSample &sample = frame->GetSample();
+		uint64_t bytes = 0;
+		for (uint32_t p = 0; p < sample.planeCount; ++p)
+			bytes += sample.planes[p].size;
+
+		m_pipeline.OnMediaFrame(frame);
+		frame->Release();
+
+		m_bytes.store(m_bytes.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+		m_frames.store(m_frames.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	// either the source sees the flag cleared and schedules, or we see its frame here
+	m_bScheduled = false;
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (m_queue.GetSize())
+		Schedule();
+	else
+		m_pIdle->Notify();
+}
+
+CaptureSessionStats CCaptureSession::GetStats() const
+{
+	CaptureSessionStats stats;
+	stats.frames = m_frames;
+	stats.bytes = m_bytes;
+	stats.queue = m_queue.GetStats();
+	stats.dropped = stats.queue.GetDropped();
+	stats.maxDepth = stats.queue.maxDepth;
+	stats.started = m_bStarted;
+	return stats;
+}
+
+void CCaptureSession::OnFrame(const CMediaFrame *frame)
+{
+	// the memory stays shared and read-only, the timing becomes ours
+	frame->AddRef();
+	FramePtr own = CMediaFrame::Wrap(frame->GetSample(), [frame]() { frame->Release(); });
+	if (own)
+		m_pInput->OnMediaFrame(own.Get());
+}
+
+//---------------------------------------------------------------------------------------------
+// the policy of a session applies in its own queue, the publisher in front of it only hands the frames over.
+// without a blockTimeoutMs it never waits: a blocking session waits on the thread of its subscription instead
+static BackpressureOptions GetHandoffOptions(const BackpressureOptions &options)
+{
+	BackpressureOptions handoff;
+	handoff.policy = options.policy == BACKPRESSURE_RATE_LIMIT ? BACKPRESSURE_BLOCK : options.policy;
+	handoff.capacity = options.capacity;
+	return handoff;
+}
+
+//---------------------------------------------------------------------------------------------
+CCaptureManager::CCaptureManager(const CaptureManagerOptions &options) : m_options(options)
+{
+	m_threads = options.threads ? options.threads : (std::max)(std::thread::hardware_concurrency(), 1u);
+}
+
+CCaptureManager::~CCaptureManager()
+{
+	Stop();
+}
+
+CCaptureSession *CCaptureManager::AddSession(const char *name, std::shared_ptr<IFrameSource> source, const char *dumpPath)
+{
+	if (!source || m_startTime) {
+		assert(false);
+		return nullptr;
+	}
+
+	// spread the sessions over the workers, stealing evens out the rest
+	const uint32_t home = (uint32_t)m_sessions.size() % m_threads;
+	m_sessions.emplace_back(new CCaptureSession(name, std::move(source), dumpPath, m_options.backpressure, &m_pool, home, &m_idle));
+	return m_sessions.back().get();
+}
+
+bool CCaptureManager::AddSessionPair(const char *name, std::shared_ptr<IFrameSource> video, std::shared_ptr<IFrameSource> audio, const char *videoPath,
+				     const char *audioPath)
+{
+	CCaptureSession *videoSession = AddSession(name, std::move(video), videoPath);
+	CCaptureSession *audioSession = AddSession(name, std::move(audio), audioPath);
+	if (!videoSession || !audioSession)
+		return false;
+
+	CAVSync *sync = new CAVSync(videoSession, audioSession);
+	m_syncs.emplace_back(sync);
+	videoSession->SetInput(sync->GetVideoInput());
+	audioSession->SetInput(sync->GetAudioInput());
+	return true;
+}
+
+uint32_t CCaptureManager::Start()
+{
+	if (m_startTime) {
+		assert(false);
+		return 0;
+	}
+
+	if (!m_pool.Start(m_threads, m_options.pinThreads))
+		return 0;
+
+	m_startTime = GetMonotonicTimeNs();
+
+	for (size_t i = 0; i < m_sessions.size(); ++i) {
+		if (!IsFirstOfSource(i))
+			continue;
+
+		IFrameSource *source = m_sessions[i]->GetSource();
+		CFramePublisher *publisher = nullptr;
+		for (size_t j = i + 1; j < m_sessions.size(); ++j) {
+			if (m_sessions[j]->GetSource() != source)
+				continue;
+			if (!publisher) {
+				m_publishers.emplace_back(new CFramePublisher());
+				publisher = m_publishers.back().get();
+				publisher->Subscribe(m_sessions[i]->GetName().c_str(), m_sessions[i].get(), GetHandoffOptions(m_sessions[i]->GetBackpressure()));
+			}
+			publisher->Subscribe(m_sessions[j]->GetName().c_str(), m_sessions[j].get(), GetHandoffOptions(m_sessions[j]->GetBackpressure()));
+		}
+
+		bool ok = false;
+		if (publisher) {
+			ok = publisher->Start() && source->StartCapture(publisher);
+			if (!ok)
+				publisher->Stop();
+		} else {
+			ok = source->StartCapture(m_sessions[i]->GetInput());
+		}
+		for (size_t j = i; j < m_sessions.size(); ++j) {
+			if (m_sessions[j]->GetSource() == source)
+				m_sessions[j]->m_bStarted = ok;
+		}
+	}
+
+	// the ones which failed show up in their stats
+	uint32_t started = 0;
+	for (const auto &session : m_sessions) {
+		if (session->IsStarted())
+			++started;
+	}
+	return started;
+}
+
+void CCaptureManager::Stop()
+{
+	if (!m_startTime || m_stopTime)
+		return;
+
+	for (size_t i = 0; i < m_sessions.size(); ++i) {
+		if (m_sessions[i]->IsStarted() && IsFirstOfSource(i))
+			m_sessions[i]->GetSource()->StopCapture();
+	}
+
+	// the sources are quiet now, the publishers hand on what they still hold and the workers finish what is queued
+	for (auto &publisher : m_publishers)
+		publisher->Stop();
+	m_idle.WaitFor(
+		[this]() {
+			for (const auto &session : m_sessions) {
+				if (!session->IsIdle())
+					return false;
+			}
+			return true;
+		},
+		MANAGER_DRAIN_MS);
+
+	m_pool.Stop();
+	m_stopTime = GetMonotonicTimeNs();
+}
+
+CaptureManagerStats CCaptureManager::GetStats() const
+{
+	CaptureManagerStats stats;
+	stats.threads = m_threads;
+
+	for (size_t i = 0; i < m_sessions.size(); ++i) {
+		if (!m_sessions[i]->IsStarted()) {
+			if (m_startTime)
+				++stats.failed;
+			continue;
+		}
+
+		const CaptureSessionStats session = m_sessions[i]->GetStats();
+		++stats.sessions;
+		stats.frames += session.frames;
+		stats.bytes += session.bytes;
+		stats.dropped += session.dropped;
+
+		const CCaptureMetrics *metrics = m_sessions[i]->GetSource()->GetCaptureMetrics();
+		if (metrics && IsFirstOfSource(i))
+			stats.dropped += metrics->GetDroppedCount();
+	}
+
+	for (const auto &publisher : m_publishers) {
+		for (uint32_t i = 0; i < publisher->GetSubscriberCount(); ++i)
+			stats.dropped += publisher->GetSubscriberStats(i).queue.GetDropped();
+	}
+
+	if (m_startTime) {
+		const int64_t end = m_stopTime ? m_stopTime : GetMonotonicTimeNs();
+		stats.seconds = double(end - m_startTime) / 1e9;
+	}
+
+	const WorkPoolStats pool = m_pool.GetStats();
+	stats.tasks = pool.executed;
+	stats.stolen = pool.stolen;
+	if (stats.seconds > 0.0) {
+		stats.framesPerSecond = double(stats.frames) / stats.seconds;
+		stats.bytesPerSecond = double(stats.bytes) / stats.seconds;
+		stats.load = double(pool.busyNs) / 1e9 / stats.seconds;
+	}
+	return stats;
+}
+
+bool CCaptureManager::IsFirstOfSource(size_t index) const
+{
+	for (size_t i = 0; i < index; ++i) {
+		if (m_sessions[i]->GetSource() == m_sessions[index]->GetSource())
+			return false;
+	}
+	return true;
+}
@@ -0,0 +1,145 @@
+﻿#pragma once
+#include "mf-backpressure.h"
+#include "mf-metrics.h"
+#include "mf-pipeline.h"
+#include "mf-publish.h"
+#include "mf-sync.h"
+#include "mf-threadpool.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+struct CaptureSessionStats {
+	uint64_t frames = 0;   // processed by the pipeline
+	uint64_t bytes = 0;    // payload of those
+	uint64_t dropped = 0;  // by the session queue, all reasons
+	uint32_t maxDepth = 0; // of the session queue
+	bool started = false;  // the source started with the last CCaptureManager::Start
+	BackpressureStats queue;
+};
+
+// one stream of one device: the source delivers into the session on its own thread, the frames wait in a
+// single producer queue and the pipeline runs as a task of the shared pool. at most one worker runs a session
+// at a time, so its pipeline still sees the frames one by one and in order. what happens when the pipeline falls
+// behind is up to the backpressure policy of the session, e.g. a preview keeps the latest frame, a recording blocks.
+class CCaptureSession : public IMediaSink, public IFrameSubscriber, private IPoolTask {
+	friend class CCaptureManager;
+
+public:
+	// dumpPath: null for no dump. home: the worker which gets the tasks of this session first
+	// idle: notified whenever the session runs out of frames
+	CCaptureSession(const char *name, std::shared_ptr<IFrameSource> source, const char *dumpPath, const BackpressureOptions &backpressure, CWorkStealingPool *pool,
+			uint32_t home, CWakeEvent *idle);
+	virtual ~CCaptureSession();
+
+	const std::string &GetName() const { return m_name; }
+	IFrameSource *GetSource() const { return m_source.get(); }
+	// configure before the manager starts, e.g. SetAudioFormat
+	CMediaPipeline &GetPipeline() { return m_pipeline; }
+	bool SetBackpressure(const BackpressureOptions &options) { return m_queue.Init(options); }
+	const BackpressureOptions &GetBackpressure() const { return m_queue.GetOptions(); }
+
+	// where the source delivers, the session itself or a CAVSync in front of it
+	IMediaSink *GetInput() const { return m_pInput; }
+	void SetInput(IMediaSink *input) { m_pInput = input; }
+
+	// IMediaSink, called by the source
+	void OnMediaSample(const MediaSample &sample) override;
+	bool WantsFrames() const override { return true; }
+	void OnMediaFrame(CMediaFrame *frame) override;
+
+	// IFrameSubscriber, when the source is shared with other sessions: the input gets a frame of its own around the
+	// shared memory, so that a CAVSync in front of this session can retime it
+	void OnFrame(const CMediaFrame *frame) override;
+
+	// nothing queued and no task pending
+	bool IsIdle() const { return !m_bScheduled.load() && m_queue.GetSize() == 0; }
+	bool IsStarted() const { return m_bStarted; }
+	CaptureSessionStats GetStats() const;
+
+private:
+	void Schedule();
+	void Run() override;
+
+private:
+	const std::string m_name;
+	std::shared_ptr<IFrameSource> m_source;
+	IMediaSink *m_pInput;
+	CMediaPipeline m_pipeline;
+
+	CBackpressureQueue m_queue;
+	CWorkStealingPool *const m_pPool;
+	const uint32_t m_home;
+	CWakeEvent *const m_pIdle;
+	std::atomic<bool> m_bScheduled{false}; // a task is queued or running
+	std::atomic<bool> m_bStarted{false};   // set by the manager
+
+	std::atomic<uint64_t> m_frames{0};
+	std::atomic<uint64_t> m_bytes{0};
+};
+
+struct CaptureManagerOptions {
+	uint32_t threads = 0;             // workers of the pool, 0: one per cpu
+	bool pinThreads = false;          // worker i runs on cpu i only
+	BackpressureOptions backpressure; // of every session, CCaptureSession::SetBackpressure changes one
+};
+
+struct CaptureManagerStats {
+	uint32_t sessions = 0; // started
+	uint32_t failed = 0;   // whose source did not start
+	uint32_t threads = 0;
+	uint64_t frames = 0;
+	uint64_t bytes = 0;
+	uint64_t dropped = 0; // session queues plus what the sources and the publishers of shared sources dropped
+	double seconds = 0.0; // since Start
+	double framesPerSecond = 0.0;
+	double bytesPerSecond = 0.0;
+	double load = 0.0;    // busy workers on average, 0..threads
+	uint64_t tasks = 0;
+	uint64_t stolen = 0;
+};
+
+// owns the capture sessions of all devices and the pool their post-processing runs on.
+// sessions are added before Start; Stop stops the sources, lets the pool finish what is queued and stops it.
+// a manager runs once: the sources, syncs and stats are not reset, so Start after Stop fails; capture again with a new one.
+// several sessions may share one source, e.g. a preview which keeps the latest frame and a recording which blocks.
+// such a source delivers into a CFramePublisher, which gives each session a thread of its own to queue the frames
+// on, so a session which blocks for room only delays itself.
+class CCaptureManager {
+public:
+	explicit CCaptureManager(const CaptureManagerOptions &options = CaptureManagerOptions());
+	~CCaptureManager();
+
+	CCaptureSession *AddSession(const char *name, std::shared_ptr<IFrameSource> source, const char *dumpPath = nullptr);
+	// video and audio of one device, put on one timeline by a CAVSync
+	bool AddSessionPair(const char *name, std::shared_ptr<IFrameSource> video, std::shared_ptr<IFrameSource> audio, const char *videoPath = nullptr,
+			    const char *audioPath = nullptr);
+
+	// returns the number of sessions whose source started, 0 when called a second time
+	uint32_t Start();
+	void Stop();
+
+	uint32_t GetSessionCount() const { return (uint32_t)m_sessions.size(); }
+	CCaptureSession *GetSession(uint32_t index) const { return m_sessions[index].get(); }
+	// one per AddSessionPair
+	uint32_t GetSyncCount() const { return (uint32_t)m_syncs.size(); }
+	const CAVSync *GetSync(uint32_t index) const { return m_syncs[index].get(); }
+
+	// polled from any thread
+	CaptureManagerStats GetStats() const;
+
+private:
+	// false when an earlier session has the same source
+	bool IsFirstOfSource(size_t index) const;
+
+private:
+	const CaptureManagerOptions m_options;
+	CWorkStealingPool m_pool;
+	uint32_t m_threads = 0;
+	std::vector<std::unique_ptr<CCaptureSession>> m_sessions;
+	std::vector<std::unique_ptr<CAVSync>> m_syncs;
+	std::vector<std::unique_ptr<CFramePublisher>> m_publishers; // of the shared sources
+	int64_t m_startTime = 0;
+	int64_t m_stopTime = 0;
+	CWakeEvent m_idle; // Stop waits here for the sessions to drain
+};
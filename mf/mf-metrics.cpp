@@ -0,0 +1,151 @@
+#include "mf-metrics.h"
+#include <algorithm>
+#include <cmath>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static uint32_t GetHighestBit(uint64_t value)
+{
+#ifdef _MSC_VER
+	unsigned long index = 0;
+	_BitScanReverse64(&index, value);
+	return index;
+#else
+	return 63 - (uint32_t)__builtin_clzll(value);
+#endif
+}
+
+uint32_t CHistogram::GetBucket(uint64_t value)
+{
+	if (value < 2 * HISTOGRAM_SUB_BUCKETS)
+		return (uint32_t)value;
+
+	value = (std::min)(value, (uint64_t(1) << HISTOGRAM_MAX_BITS) - 1);
+	const uint32_t shift = GetHighestBit(value) - HISTOGRAM_SUB_BITS;
+	return shift * HISTOGRAM_SUB_BUCKETS + (uint32_t)(value >> shift);
+}
+
+uint64_t CHistogram::GetBucketMin(uint32_t bucket)
+{
+	if (bucket < 2 * HISTOGRAM_SUB_BUCKETS)
+		return bucket;
+
+	const uint32_t shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+	return uint64_t(bucket - shift * HISTOGRAM_SUB_BUCKETS) << shift;
+}
+
+uint64_t CHistogram::GetBucketMax(uint32_t bucket)
+{
+	if (bucket < 2 * HISTOGRAM_SUB_BUCKETS)
+		return bucket;
+
+	const uint32_t shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+	return GetBucketMin(bucket) + (uint64_t(1) << shift) - 1;
+}
+
+void CHistogram::Reset()
+{
+	for (auto &bucket : m_buckets)
+		bucket.store(0, std::memory_order_relaxed);
+	m_count.store(0, std::memory_order_relaxed);
+	m_sum.store(0, std::memory_order_relaxed);
+	m_min.store(UINT64_MAX, std::memory_order_relaxed);
+	m_max.store(0, std::memory_order_relaxed);
+}
+
+void CHistogram::Record(uint64_t value)
+{
+	Increment(m_buckets[GetBucket(value)], 1);
+	Increment(m_sum, value);
+	if (value < m_min.load(std::memory_order_relaxed))
+		m_min.store(value, std::memory_order_relaxed);
+	if (value > m_max.load(std::memory_order_relaxed))
+		m_max.store(value, std::memory_order_relaxed);
+	// last, so that a reader which sees the count also sees the bucket
+	m_count.store(m_count.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void CHistogram::GetSnapshot(HistogramSnapshot &snapshot) const
+{
+	snapshot = HistogramSnapshot();
+	if (!m_count.load(std::memory_order_acquire))
+		return;
+
+	// the count is taken from the buckets, so that the percentiles are consistent with it
+	snapshot.buckets.resize(HISTOGRAM_BUCKETS);
+	for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+		snapshot.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+		snapshot.count += snapshot.buckets[i];
+	}
+
+	snapshot.sum = m_sum.load(std::memory_order_relaxed);
+	snapshot.min = m_min.load(std::memory_order_relaxed);
+	snapshot.max = m_max.load(std::memory_order_relaxed);
+	if (snapshot.min > snapshot.max)
+		snapshot.min = snapshot.max;
+}
+
+uint64_t HistogramSnapshot::GetPercentile(double percentile) const
+{
+	if (!count)
+		return 0;
+
+	const double clamped = (std::min)((std::max)(percentile, 0.0), 100.0);
+	const uint64_t target = (std::max)((uint64_t)std::ceil(clamped / 100.0 * double(count)), (uint64_t)1);
+
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < (uint32_t)buckets.size(); ++i) {
+		total += buckets[i];
+		if (total >= target)
+			return (std::min)(CHistogram::GetBucketMax(i), max);
+	}
+	return max;
+}
+
+//---------------------------------------------------------------------------------------------
+void CCaptureMetrics::RecordSample(int64_t time)
+{
+	if (m_lastSample) {
+		const int64_t interval = time - m_lastSample;
+		m_interval.Record(interval > 0 ? (uint64_t)interval : 0);
+
+		// more than 1.5 intervals: the frames in between never arrived
+		if (m_nominalInterval > 0 && interval > m_nominalInterval * 3 / 2) {
+			const uint64_t missing = (uint64_t)((interval + m_nominalInterval / 2) / m_nominalInterval - 1);
+			m_gapFrames.store(m_gapFrames.load(std::memory_order_relaxed) + missing, std::memory_order_relaxed);
+		}
+	}
+	m_lastSample = time;
+	Increment(m_samples);
+}
+
+void CCaptureMetrics::GetSnapshot(CaptureMetricsSnapshot &snapshot) const
+{
+	m_callback.GetSnapshot(snapshot.callback);
+	m_interval.GetSnapshot(snapshot.interval);
+	m_lock.GetSnapshot(snapshot.lock);
+	m_outage.GetSnapshot(snapshot.outage);
+	snapshot.samples = m_samples.load(std::memory_order_relaxed);
+	snapshot.dropped = m_dropped.load(std::memory_order_relaxed);
+	snapshot.gapFrames = m_gapFrames.load(std::memory_order_relaxed);
+	snapshot.streamTicks = m_streamTicks.load(std::memory_order_relaxed);
+	snapshot.readErrors = m_readErrors.load(std::memory_order_relaxed);
+	snapshot.deviceLosses = m_deviceLosses.load(std::memory_order_relaxed);
+}
+
+void CCaptureMetrics::Reset()
+{
+	m_callback.Reset();
+	m_interval.Reset();
+	m_lock.Reset();
+	m_outage.Reset();
+	m_lastSample = 0;
+	m_samples = 0;
+	m_dropped = 0;
+	m_gapFrames = 0;
+	m_streamTicks = 0;
+	m_readErrors = 0;
+	m_deviceLosses = 0;
+}
@@ -0,0 +1,110 @@
+﻿#pragma once
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// log-linear buckets like HdrHistogram: values below 2 * HISTOGRAM_SUB_BUCKETS are exact, above that every power of two
+// is split into HISTOGRAM_SUB_BUCKETS buckets, i.e. at most 1/64 = 1.6% relative error. values are clamped to 2^40 (18 minutes in ns).
+#define HISTOGRAM_SUB_BITS 6
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAX_BITS 40
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+struct HistogramSnapshot {
+	uint64_t count = 0;
+	uint64_t min = 0;
+	uint64_t max = 0;
+	uint64_t sum = 0;
+	std::vector<uint64_t> buckets; // HISTOGRAM_BUCKETS, empty if nothing was recorded
+
+	double GetMean() const { return count ? double(sum) / double(count) : 0.0; }
+	// percentile: 0..100, the upper bound of the bucket it falls into (never above max)
+	uint64_t GetPercentile(double percentile) const;
+};
+
+// lock-free histogram for one writer thread (the capture thread) and any number of readers.
+// Record is a handful of relaxed loads and stores without locked instructions; GetSnapshot never blocks the writer,
+// a snapshot taken while recording may miss the values of the Record calls running at the same time.
+class CHistogram {
+public:
+	CHistogram() { Reset(); }
+
+	void Record(uint64_t value);
+	void GetSnapshot(HistogramSnapshot &snapshot) const;
+	// not while recording
+	void Reset();
+
+	static uint32_t GetBucket(uint64_t value);
+	// lowest and highest value of a bucket
+	static uint64_t GetBucketMin(uint32_t bucket);
+	static uint64_t GetBucketMax(uint32_t bucket);
+
+private:
+	static void Increment(std::atomic<uint64_t> &counter, uint64_t value)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<uint64_t> m_buckets[HISTOGRAM_BUCKETS];
+	std::atomic<uint64_t> m_count;
+	std::atomic<uint64_t> m_sum;
+	std::atomic<uint64_t> m_min;
+	std::atomic<uint64_t> m_max;
+};
+
+struct CaptureMetricsSnapshot {
+	HistogramSnapshot callback; // sample callback, from entering to handing the sample on, ns
+	HistogramSnapshot interval; // between the arrival of two samples with data, ns
+	HistogramSnapshot lock;     // locking the device buffer, ns
+	HistogramSnapshot outage;   // from a device loss to the first sample after the recovery, ns
+	uint64_t samples = 0;
+	uint64_t dropped = 0;     // the pool or the sink could not take the sample
+	uint64_t gapFrames = 0;   // frames missing according to the arrival interval
+	uint64_t streamTicks = 0; // gaps the device reported
+	uint64_t readErrors = 0;  // failed ReadSample calls and error callbacks
+	uint64_t deviceLosses = 0;
+};
+
+// per-stream instrumentation of the capture callback, polled from anywhere.
+// written by one thread at a time: the capture thread, or source reader callbacks serialized by a lock
+class CCaptureMetrics {
+public:
+	// nominal time between two samples (1/fps for video), enables the gap counting. 0: off
+	void SetNominalInterval(int64_t ns) { m_nominalInterval = ns; }
+
+	void RecordCallback(int64_t ns) { m_callback.Record(ns > 0 ? (uint64_t)ns : 0); }
+	void RecordLock(int64_t ns) { m_lock.Record(ns > 0 ? (uint64_t)ns : 0); }
+	void RecordOutage(int64_t ns) { m_outage.Record(ns > 0 ? (uint64_t)ns : 0); }
+	// a sample with data arrived at `time` (GetMonotonicTimeNs)
+	void RecordSample(int64_t time);
+
+	void AddDropped() { Increment(m_dropped); }
+	void AddStreamTick() { Increment(m_streamTicks); }
+	void AddReadError() { Increment(m_readErrors); }
+	void AddDeviceLost() { Increment(m_deviceLosses); }
+
+	uint64_t GetDroppedCount() const { return m_dropped.load(std::memory_order_relaxed); }
+	void GetSnapshot(CaptureMetricsSnapshot &snapshot) const;
+	// not while capturing
+	void Reset();
+
+private:
+	static void Increment(std::atomic<uint64_t> &counter) { counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+
+private:
+	CHistogram m_callback;
+	CHistogram m_interval;
+	CHistogram m_lock;
+	CHistogram m_outage;
+
+	int64_t m_nominalInterval = 0;
+	int64_t m_lastSample = 0;
+
+	std::atomic<uint64_t> m_samples{0};
+	std::atomic<uint64_t> m_dropped{0};
+	std::atomic<uint64_t> m_gapFrames{0};
+	std::atomic<uint64_t> m_streamTicks{0};
+	std::atomic<uint64_t> m_readErrors{0};
+	std::atomic<uint64_t> m_deviceLosses{0};
+};
@@ -0,0 +1,211 @@
+#include "mf-negotiate.h"
+#include "mf-convert.h"
+#include <algorithm>
+#include <cmath>
+
+static double GetRate(uint32_t num, uint32_t den)
+{
+	return den ? double(num) / double(den) : 0.0;
+}
+
+int CMediaNegotiator::GetConversionCost(uint32_t subtype, uint32_t target)
+{
+	if (subtype == target)
+		return 0;
+
+	// 10 bit pipeline
+	if (target == MEDIA_SUBTYPE_P010) {
+		switch (subtype) {
+		case MEDIA_SUBTYPE_P016:
+			return 1; // copy
+		case MEDIA_SUBTYPE_Y210:
+			return 2; // deinterleave and average the chroma rows
+		case MEDIA_SUBTYPE_V210:
+			return 3; // unpack the 10 bit words
+		default:
+			return -1;
+		}
+	}
+
+	// decoded on several threads, see CJpegDecoder
+	if (subtype == MEDIA_SUBTYPE_MJPG)
+		return target == MEDIA_SUBTYPE_NV12 ? 8 : -1;
+
+	if (target != MEDIA_SUBTYPE_NV12 || !IsConvertibleToNV12(subtype))
+		return -1;
+
+	switch (subtype) {
+	case MEDIA_SUBTYPE_I420:
+	case MEDIA_SUBTYPE_IYUV:
+	case MEDIA_SUBTYPE_YV12:
+		return 1; // interleave the chroma planes
+	case MEDIA_SUBTYPE_YUY2:
+	case MEDIA_SUBTYPE_UYVY:
+		return 2; // deinterleave and average the chroma rows
+	case MEDIA_SUBTYPE_RGB32:
+	case MEDIA_SUBTYPE_ARGB32:
+		return 4; // matrix
+	case MEDIA_SUBTYPE_RGB24:
+		return 5; // matrix on 3 byte pixels
+	case MEDIA_SUBTYPE_P010:
+	case MEDIA_SUBTYPE_P016:
+		return 2; // dither
+	case MEDIA_SUBTYPE_Y210:
+		return 3; // deinterleave, average and dither
+	case MEDIA_SUBTYPE_V210:
+		return 4; // unpack, average and dither
+	default:
+		return -1;
+	}
+}
+
+uint64_t CMediaNegotiator::GetBandwidth(const MediaFormat &format)
+{
+	if (!format.video)
+		return uint64_t(format.sampleRate) * format.channels * (format.bitsPerSample / 8);
+
+	uint64_t frameBytes = GetVideoFrameSize(format);
+	if (!frameBytes) {
+		// compressed, mjpeg of a webcam is about a fifth of yuy2
+		frameBytes = uint64_t(format.width) * format.height * 2 / 5;
+	}
+	return uint64_t(frameBytes * GetRate(format.fpsNum, format.fpsDen));
+}
+
+void CMediaNegotiator::SetCapabilities(const std::vector<DeviceCapability> &caps)
+{
+	m_table.clear();
+	m_table.reserve(caps.size());
+
+	for (const auto &cap : caps) {
+		Entry entry;
+		entry.cap = cap;
+		entry.pixels = double(cap.format.width) * double(cap.format.height);
+		entry.aspect = cap.format.height ? double(cap.format.width) / double(cap.format.height) : 0.0;
+		entry.fps = GetRate(cap.format.fpsNum, cap.format.fpsDen);
+		entry.fpsMin = GetRate(cap.fpsMinNum, cap.fpsMinDen);
+		entry.fpsMax = GetRate(cap.fpsMaxNum, cap.fpsMaxDen);
+		if (entry.fpsMin > entry.fpsMax || entry.fpsMax <= 0.0)
+			entry.fpsMin = entry.fpsMax = 0.0;
+
+		MediaFormat format = cap.format;
+		format.fpsNum = 1;
+		format.fpsDen = 1;
+		entry.frameBytes = (uint32_t)GetBandwidth(format);
+		m_table.push_back(entry);
+	}
+}
+
+bool CMediaNegotiator::Negotiate(const MediaRequest &request, NegotiationResult &result) const
+{
+	bool found = false;
+	for (uint32_t i = 0; i < m_table.size(); ++i) {
+		const Entry &entry = m_table[i];
+		if (entry.cap.format.video != request.video)
+			continue;
+
+		NegotiationResult candidate;
+		if (!(request.video ? Score(entry, request, candidate) : ScoreAudio(entry, request, candidate)))
+			continue;
+
+		// ties keep the earlier type, which is the order the driver prefers
+		if (!found || candidate.cost < result.cost) {
+			candidate.entry = i;
+			result = candidate;
+			found = true;
+		}
+	}
+	return found;
+}
+
+bool CMediaNegotiator::Score(const Entry &entry, const MediaRequest &request, NegotiationResult &result) const
+{
+	const MediaFormat &format = entry.cap.format;
+	const int conversion = GetConversionCost(format.subtype, request.targetSubtype);
+	if (conversion < 0 || !entry.pixels)
+		return false;
+
+	result.cap = entry.cap;
+	result.needsConversion = conversion > 0;
+	double cost = conversion * m_weights.conversion;
+
+	// resolution
+	if (request.width && request.height) {
+		const double pixels = double(request.width) * double(request.height);
+		if (entry.pixels < pixels)
+			cost += (1.0 - entry.pixels / pixels) * m_weights.upscale;
+		else
+			cost += (entry.pixels / pixels - 1.0) * m_weights.downscale;
+
+		const double aspect = double(request.width) / double(request.height);
+		cost += std::fabs(entry.aspect - aspect) / aspect * m_weights.aspect;
+	}
+
+	// frame rate, a range can hit the request exactly
+	double fps = entry.fps;
+	if (entry.fpsMax > 0.0 && request.fps > 0.0) {
+		double clamped = (std::min)((std::max)(request.fps, entry.fpsMin), entry.fpsMax);
+		if (std::fabs(clamped - entry.fps) > 0.01) {
+			fps = clamped;
+			result.fpsFromRange = true;
+			uint32_t num = (uint32_t)std::lround(fps * 1000.0);
+			uint32_t den = 1000;
+			while (num % 10 == 0 && den % 10 == 0) {
+				num /= 10;
+				den /= 10;
+			}
+			result.cap.format.fpsNum = num;
+			result.cap.format.fpsDen = den;
+		}
+	}
+
+	if (request.fps > 0.0) {
+		if (fps < request.fps)
+			cost += (1.0 - fps / request.fps) * m_weights.fpsBelow;
+		else
+			cost += (fps / request.fps - 1.0) * m_weights.fpsAbove;
+	}
+
+	// bandwidth
+	result.bandwidth = uint64_t(entry.frameBytes * fps);
+	if (request.maxBandwidth && result.bandwidth > request.maxBandwidth)
+		return false;
+
+	if (request.width && request.height && request.fps > 0.0) {
+		MediaFormat target;
+		target.subtype = request.targetSubtype;
+		target.width = request.width;
+		target.height = request.height;
+		const double reference = double(GetVideoFrameSize(target)) * request.fps;
+		if (reference > 0.0)
+			cost += double(result.bandwidth) / reference * m_weights.bandwidth;
+	}
+
+	result.cost = cost;
+	return true;
+}
+
+bool CMediaNegotiator::ScoreAudio(const Entry &entry, const MediaRequest &request, NegotiationResult &result) const
+{
+	const MediaFormat &format = entry.cap.format;
+	if (format.subtype != MEDIA_SUBTYPE_PCM && format.subtype != MEDIA_SUBTYPE_FLOAT)
+		return false;
+	if (!format.channels || !format.sampleRate || !format.bitsPerSample)
+		return false;
+
+	double cost = 0.0;
+	if (request.channels && format.channels != request.channels)
+		cost += m_weights.audioChannels * (format.channels < request.channels ? 2.0 : 1.0);
+	if (request.sampleRate && format.sampleRate != request.sampleRate)
+		cost += m_weights.audioResample;
+	if (request.bitsPerSample && format.bitsPerSample != request.bitsPerSample)
+		cost += m_weights.audioBits;
+
+	result.cap = entry.cap;
+	result.bandwidth = GetBandwidth(format);
+	if (request.maxBandwidth && result.bandwidth > request.maxBandwidth)
+		return false;
+
+	result.cost = cost;
+	return true;
+}
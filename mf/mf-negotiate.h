@@ -0,0 +1,80 @@
+﻿#pragma once
+#include "mf-capcache.h"
+#include <vector>
+
+// what the pipeline would like to receive. zero fields mean "don't care".
+struct MediaRequest {
+	bool video = true;
+
+	// video
+	uint32_t targetSubtype = MEDIA_SUBTYPE_NV12; // what the pipeline works on, other types are converted to it. P010 for 10 bit
+	uint32_t width = 0;
+	uint32_t height = 0;
+	double fps = 0.0;
+	uint64_t maxBandwidth = 0; // bytes per second the bus can still carry, e.g. when several cameras share a usb controller
+
+	// audio
+	uint32_t channels = 0;
+	uint32_t sampleRate = 0;
+	uint32_t bitsPerSample = 0;
+};
+
+// how much each mismatch costs, the defaults prefer: right resolution > right frame rate > no conversion > less bandwidth
+struct NegotiationWeights {
+	double upscale = 400.0;     // per missing fraction of the requested pixels
+	double downscale = 40.0;    // per extra fraction of the requested pixels
+	double aspect = 100.0;      // per relative aspect ratio difference
+	double fpsBelow = 200.0;    // per missing fraction of the requested rate
+	double fpsAbove = 20.0;     // per extra fraction of the requested rate
+	double conversion = 10.0;   // per unit of GetConversionCost
+	double bandwidth = 5.0;     // per byte/s relative to the raw target format at the requested size and rate
+	double audioChannels = 50.0;
+	double audioResample = 30.0;
+	double audioBits = 5.0;
+};
+
+struct NegotiationResult {
+	uint32_t entry = 0;   // index into the capability table
+	DeviceCapability cap; // with fpsNum/fpsDen set to the chosen rate inside a range
+	double cost = 0.0;
+	uint64_t bandwidth = 0; // bytes per second
+	bool needsConversion = false;
+	bool fpsFromRange = false; // MF_MT_FRAME_RATE must be set before SetCurrentMediaType
+};
+
+// picks the best media type of a device by cost instead of taking the first exact match.
+// pure: works on capability records (from EnumCapability, the capability cache or a test), no media foundation.
+class CMediaNegotiator {
+public:
+	explicit CMediaNegotiator(const NegotiationWeights &weights = NegotiationWeights()) : m_weights(weights) {}
+
+	// builds the table once, Negotiate can then be called for any number of requests
+	void SetCapabilities(const std::vector<DeviceCapability> &caps);
+	uint32_t GetCount() const { return (uint32_t)m_table.size(); }
+
+	// false if no capability can satisfy the request at all (unsupported subtype or over the bandwidth limit)
+	bool Negotiate(const MediaRequest &request, NegotiationResult &result) const;
+
+	// relative cpu cost per pixel of converting `subtype` into `target`, 0 if they are the same, -1 if there is no converter
+	static int GetConversionCost(uint32_t subtype, uint32_t target);
+	// bytes per second on the bus, estimated for compressed types
+	static uint64_t GetBandwidth(const MediaFormat &format);
+
+private:
+	struct Entry {
+		DeviceCapability cap;
+		double pixels;
+		double aspect;
+		double fps;    // fixed rate
+		double fpsMin; // range, 0 if there is none
+		double fpsMax;
+		uint32_t frameBytes; // per frame on the bus
+	};
+
+	bool Score(const Entry &entry, const MediaRequest &request, NegotiationResult &result) const;
+	bool ScoreAudio(const Entry &entry, const MediaRequest &request, NegotiationResult &result) const;
+
+private:
+	NegotiationWeights m_weights;
+	std::vector<Entry> m_table;
+};
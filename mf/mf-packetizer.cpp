@@ -0,0 +1,201 @@
+#include "mf-packetizer.h"
+#include <algorithm>
+#include <assert.h>
+#include <cstring>
+
+// timelines the producer may start before the consumer catches up
+#define PACKETIZER_ANCHORS 64
+
+static void Increment(std::atomic<uint64_t> &counter, uint64_t value = 1)
+{
+	// one writer per counter
+	counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+bool CAudioPacketizer::Init(const MediaFormat &format, const AudioPacketizerOptions &options)
+{
+	const bool pcm = format.subtype == MEDIA_SUBTYPE_PCM && (format.bitsPerSample == 8 || format.bitsPerSample == 16 || format.bitsPerSample == 24 || format.bitsPerSample == 32);
+	const bool flt = format.subtype == MEDIA_SUBTYPE_FLOAT && format.bitsPerSample == 32;
+	const uint32_t packetFrames = options.frames ? options.frames : format.sampleRate * options.durationMs / 1000;
+	if (format.video || (!pcm && !flt) || !format.channels || !format.sampleRate || !packetFrames) {
+		assert(false);
+		return false;
+	}
+
+	m_format = format;
+	m_options = options;
+	m_frameBytes = format.channels * format.bitsPerSample / 8;
+	m_packetFrames = packetFrames;
+	m_silence = format.bitsPerSample == 8 ? 0x80 : 0; // 8 bit pcm is unsigned
+
+	m_ringFrames = (std::max)((uint32_t)((uint64_t)format.sampleRate * options.ringMs / 1000), packetFrames * 2);
+	m_ring.reset(new uint8_t[(size_t)m_ringFrames * m_frameBytes]);
+	m_anchors.reset(new CSpscQueue<Anchor>(PACKETIZER_ANCHORS));
+
+	m_readPosition = 0;
+	m_readAnchor = Anchor();
+	m_bHasNextAnchor = false;
+	m_skipFrames = 0;
+	m_writePosition = 0;
+	m_writeAnchor = Anchor();
+	m_bStarted = false;
+	m_bPendingAnchor = false;
+	m_bPendingDiscontinuity = false;
+
+	m_packets = 0;
+	m_underruns = 0;
+	m_underrunFrames = 0;
+	m_overruns = 0;
+	m_overrunFrames = 0;
+	m_resyncs = 0;
+	return true;
+}
+
+int64_t CAudioPacketizer::GetTimestamp(const Anchor &anchor, uint64_t position) const
+{
+	// from the anchor each time, so the rounding does not add up
+	return anchor.timestamp + (int64_t)(position - anchor.position) * 10000000 / m_format.sampleRate;
+}
+
+uint32_t CAudioPacketizer::Write(const uint8_t *data, uint32_t size, int64_t timestamp, uint32_t flags)
+{
+	if (!m_frameBytes) {
+		assert(false);
+		return 0;
+	}
+
+	const uint32_t frames = size / m_frameBytes;
+	if (!frames)
+		return 0;
+
+	const uint64_t position = m_writePosition.load(std::memory_order_relaxed);
+	int64_t offset = timestamp - GetTimestamp(m_writeAnchor, position);
+	if (offset < 0)
+		offset = -offset;
+	// jitter only moves the timeline, a jump this far means input is missing or repeated
+	const bool discontinuity = m_bStarted && ((flags & MEDIA_SAMPLE_FLAG_DISCONTINUITY) || m_bPendingDiscontinuity || offset > m_options.gapThreshold);
+
+	if (!m_bStarted || discontinuity || m_bPendingAnchor || offset > m_options.resyncThreshold) {
+		if (m_bStarted)
+			Increment(m_resyncs);
+		m_bStarted = true;
+
+		m_writeAnchor.position = position;
+		m_writeAnchor.timestamp = timestamp;
+		m_writeAnchor.discontinuity = discontinuity;
+		// when the queue is full the next write tries again, until then the consumer stays on the old timeline
+		m_bPendingAnchor = !m_anchors->TryPush(m_writeAnchor);
+		m_bPendingDiscontinuity = m_bPendingAnchor && discontinuity;
+	}
+
+	const uint64_t used = position - m_readPosition.load(std::memory_order_acquire);
+	const uint32_t count = (uint32_t)(std::min)((uint64_t)frames, m_ringFrames - used);
+	if (count < frames) {
+		// the consumer is behind, the gap starts a new timeline
+		Increment(m_overruns);
+		Increment(m_overrunFrames, frames - count);
+		m_bPendingDiscontinuity = true;
+	}
+
+	const uint32_t start = (uint32_t)(position % m_ringFrames);
+	const uint32_t first = (std::min)(count, m_ringFrames - start);
+	memcpy(m_ring.get() + (size_t)start * m_frameBytes, data, (size_t)first * m_frameBytes);
+	memcpy(m_ring.get(), data + (size_t)first * m_frameBytes, (size_t)(count - first) * m_frameBytes);
+
+	m_writePosition.store(position + count, std::memory_order_release);
+	return count;
+}
+
+uint64_t CAudioPacketizer::GetAvailableFrames() const
+{
+	const uint64_t available = m_writePosition.load(std::memory_order_acquire) - m_readPosition.load(std::memory_order_relaxed);
+	return available > m_skipFrames ? available - m_skipFrames : 0;
+}
+
+void CAudioPacketizer::Copy(uint64_t position, uint8_t *dst, uint32_t frames) const
+{
+	const uint32_t start = (uint32_t)(position % m_ringFrames);
+	const uint32_t first = (std::min)(frames, m_ringFrames - start);
+	memcpy(dst, m_ring.get() + (size_t)start * m_frameBytes, (size_t)first * m_frameBytes);
+	memcpy(dst + (size_t)first * m_frameBytes, m_ring.get(), (size_t)(frames - first) * m_frameBytes);
+}
+
+bool CAudioPacketizer::Read(uint8_t *dst, AudioPacket &packet, bool pad)
+{
+	return ReadPacket(dst, packet, pad, true);
+}
+
+bool CAudioPacketizer::Flush(uint8_t *dst, AudioPacket &packet)
+{
+	return GetAvailableFrames() && ReadPacket(dst, packet, true, false);
+}
+
+bool CAudioPacketizer::ReadPacket(uint8_t *dst, AudioPacket &packet, bool pad, bool underrun)
+{
+	if (!m_frameBytes) {
+		assert(false);
+		return false;
+	}
+
+	uint64_t position = m_readPosition.load(std::memory_order_relaxed);
+	uint64_t available = m_writePosition.load(std::memory_order_acquire) - position;
+
+	// late input which silence already stood for
+	const uint64_t skip = (std::min)(m_skipFrames, available);
+	position += skip;
+	available -= skip;
+	m_skipFrames -= skip;
+
+	if (available < m_packetFrames && !pad) {
+		m_readPosition.store(position, std::memory_order_release);
+		return false;
+	}
+
+	const uint32_t frames = (uint32_t)(std::min)(available, (uint64_t)m_packetFrames);
+	packet.flags = 0;
+
+	// the last anchor up to the start of the packet gives its timeline. a packet across a new timeline stays on the old
+	// one, the next packet is the first whose timestamp jumps
+	for (;;) {
+		if (!m_bHasNextAnchor)
+			m_bHasNextAnchor = m_anchors->TryPop(m_nextAnchor);
+		if (!m_bHasNextAnchor || m_nextAnchor.position > position)
+			break;
+
+		if (m_nextAnchor.discontinuity)
+			packet.flags |= MEDIA_SAMPLE_FLAG_DISCONTINUITY;
+		m_readAnchor = m_nextAnchor;
+		m_bHasNextAnchor = false;
+	}
+
+	Copy(position, dst, frames);
+	if (frames < m_packetFrames) {
+		const uint32_t silence = m_packetFrames - frames;
+		memset(dst + (size_t)frames * m_frameBytes, m_silence, (size_t)silence * m_frameBytes);
+		if (underrun) {
+			Increment(m_underruns);
+			Increment(m_underrunFrames, silence);
+			m_skipFrames += silence;
+		}
+	}
+
+	packet.timestamp = GetTimestamp(m_readAnchor, position);
+	packet.frames = m_packetFrames;
+	packet.size = m_packetFrames * m_frameBytes;
+
+	m_readPosition.store(position + frames, std::memory_order_release);
+	Increment(m_packets);
+	return true;
+}
+
+AudioPacketizerStats CAudioPacketizer::GetStats() const
+{
+	AudioPacketizerStats stats;
+	stats.packets = m_packets;
+	stats.underruns = m_underruns;
+	stats.underrunFrames = m_underrunFrames;
+	stats.overruns = m_overruns;
+	stats.overrunFrames = m_overrunFrames;
+	stats.resyncs = m_resyncs;
+	return stats;
+}
@@ -0,0 +1,103 @@
+﻿#pragma once
+#include "mf-sample.h"
+#include "mf-spsc-queue.hpp"
+#include <atomic>
+#include <memory>
+
+struct AudioPacketizerOptions {
+	uint32_t durationMs = 20; // of a packet, e.g. 10 or 20
+	uint32_t frames = 0;      // frames of a packet instead of durationMs, e.g. 1024 for aac
+	uint32_t ringMs = 500;    // audio the ring holds before it overruns
+	int64_t resyncThreshold = 20000; // 100ns. input timestamps further off the sample clock start a new timeline
+	int64_t gapThreshold = 500000;   // 100ns. a new timeline this far off is a gap in the input and flagged as a discontinuity
+};
+
+struct AudioPacketizerStats {
+	uint64_t packets = 0;
+	uint64_t underruns = 0;      // packets completed with silence because the input was late
+	uint64_t underrunFrames = 0; // of silence
+	uint64_t overruns = 0;       // writes which did not fit into the ring
+	uint64_t overrunFrames = 0;  // dropped
+	uint64_t resyncs = 0;        // new timelines, including discontinuities
+};
+
+struct AudioPacket {
+	int64_t timestamp = 0;
+	uint32_t flags = 0; // MEDIA_SAMPLE_FLAG_DISCONTINUITY for the first packet after a gap, an overrun or a discontinuous input
+	uint32_t frames = 0;
+	uint32_t size = 0;  // bytes
+};
+
+// re-blocks interleaved pcm of any chunk size into packets of a fixed number of frames, as encoders want them.
+// one producer writes the device chunks, one consumer reads packets, on the same or on two threads; the ring is
+// lock-free and allocated by Init only. timestamps of the packets follow the sample clock from the last input
+// timestamp which did not fit it, so the packets are exactly one packet duration apart within a timeline.
+class CAudioPacketizer {
+public:
+	// PCM 8/16/24/32 bit or FLOAT 32 bit, interleaved. neither side may run during Init
+	bool Init(const MediaFormat &format, const AudioPacketizerOptions &options = AudioPacketizerOptions());
+	bool IsInitialized() const { return m_frameBytes != 0; }
+	const MediaFormat &GetFormat() const { return m_format; }
+	uint32_t GetPacketFrames() const { return m_packetFrames; }
+	uint32_t GetPacketSize() const { return m_packetFrames * m_frameBytes; }
+
+	// producer only. whole frames of `size` bytes, `timestamp` of the first one. returns the frames written,
+	// what does not fit is dropped and counted as an overrun
+	uint32_t Write(const uint8_t *data, uint32_t size, int64_t timestamp, uint32_t flags = 0);
+
+	// consumer only. a whole packet is waiting
+	bool IsPacketReady() const { return GetAvailableFrames() >= m_packetFrames; }
+	// consumer only. writes GetPacketSize() bytes to `dst`. without a whole packet waiting it returns false, or with
+	// `pad` completes the packet with silence and counts an underrun; the late input which the silence stood for is skipped
+	bool Read(uint8_t *dst, AudioPacket &packet, bool pad = false);
+	// consumer only. the rest, padded with silence to a whole packet, e.g. at the end of the stream. false when empty
+	bool Flush(uint8_t *dst, AudioPacket &packet);
+
+	AudioPacketizerStats GetStats() const;
+
+private:
+	struct Anchor {
+		uint64_t position = 0; // frame of the stream
+		int64_t timestamp = 0;
+		bool discontinuity = false;
+	};
+
+	uint64_t GetAvailableFrames() const;
+	int64_t GetTimestamp(const Anchor &anchor, uint64_t position) const;
+	void Copy(uint64_t position, uint8_t *dst, uint32_t frames) const;
+	bool ReadPacket(uint8_t *dst, AudioPacket &packet, bool pad, bool underrun);
+
+private:
+	MediaFormat m_format;
+	AudioPacketizerOptions m_options;
+	uint32_t m_frameBytes = 0;
+	uint32_t m_packetFrames = 0;
+	uint8_t m_silence = 0;
+	std::unique_ptr<uint8_t[]> m_ring;
+	uint32_t m_ringFrames = 0;
+
+	// new timelines, from the producer to the consumer. pushed before the frames they start
+	std::unique_ptr<CSpscQueue<Anchor>> m_anchors;
+
+	char m_pad0[MF_CACHE_LINE];
+	std::atomic<uint64_t> m_readPosition{0}; // written by the consumer
+	Anchor m_readAnchor;
+	Anchor m_nextAnchor;
+	bool m_bHasNextAnchor = false;
+	uint64_t m_skipFrames = 0; // stood in for by silence
+	std::atomic<uint64_t> m_packets{0};
+	std::atomic<uint64_t> m_underruns{0};
+	std::atomic<uint64_t> m_underrunFrames{0};
+
+	char m_pad1[MF_CACHE_LINE];
+	std::atomic<uint64_t> m_writePosition{0}; // written by the producer
+	Anchor m_writeAnchor;
+	bool m_bStarted = false;
+	bool m_bPendingAnchor = false; // the anchor queue was full
+	bool m_bPendingDiscontinuity = false;
+	std::atomic<uint64_t> m_overruns{0};
+	std::atomic<uint64_t> m_overrunFrames{0};
+	std::atomic<uint64_t> m_resyncs{0};
+
+	char m_pad2[MF_CACHE_LINE];
+};
@@ -0,0 +1,328 @@
+#include "mf-pipeline.h"
+#include <algorithm>
+#include <assert.h>
+#include <thread>
+
+// frames queued for the writer plus the one being processed
+#define PIPELINE_WRITER_QUEUE 16
+// a 4k mjpeg frame decodes within a frame interval on this many threads, more only add contention between sessions
+#define PIPELINE_CODEC_THREADS 4
+
+// threads of CJpegDecoder and CLosslessCodec, including the one of the pipeline
+static uint32_t GetCodecThreads()
+{
+	return (std::min)(std::thread::hardware_concurrency(), (uint32_t)PIPELINE_CODEC_THREADS);
+}
+
+CMediaPipeline::CMediaPipeline(bool dump) : m_bDump(dump), m_pool(CFramePool::Create(PIPELINE_WRITER_QUEUE + 2)) {}
+
+CMediaPipeline::~CMediaPipeline()
+{
+	// the last packet, padded with silence
+	if (m_packetizer.IsInitialized()) {
+		FramePtr packet = m_pool->Acquire(m_packetizer.GetPacketSize());
+		AudioPacket info;
+		if (packet && m_packetizer.Flush(packet->GetBuffer(), info)) {
+			packet->SetSample(m_packetizer.GetFormat(), info.timestamp, info.flags, info.size);
+			Dump(packet.Get(), "audio.mfc");
+		}
+	}
+
+	// writes what is still queued
+	m_writer.Close();
+}
+
+void CMediaPipeline::OnMediaSample(const MediaSample &sample)
+{
+	if (!sample.planeCount) // stream tick
+		return;
+
+	// borrowed memory: the writer works after this returns, so keep a copy
+	CTileExecutor *tiles = GetTiles(*sample.format);
+	FramePtr frame = tiles ? tiles->CopySample(m_pool.Get(), sample) : m_pool->CopySample(sample);
+	if (frame)
+		OnMediaFrame(frame.Get());
+}
+
+void CMediaPipeline::OnMediaFrame(CMediaFrame *frame)
+{
+	if (!frame->GetSample().planeCount) // stream tick
+		return;
+
+	if (frame->GetFormat().video)
+		OnVideoData(frame);
+	else
+		OnAudioData(frame);
+}
+
+FramePtr CMediaPipeline::ConvertVideo(const MediaSample &sample, uint32_t target)
+{
+	const MediaFormat &format = *sample.format;
+	if (format.subtype == MEDIA_SUBTYPE_MJPG) {
+		if (!m_jpegDecoder.IsStarted()) {
+			if (!m_jpegDecoder.Start(GetCodecThreads())) {
+				assert(false);
+				return FramePtr();
+			}
+			if (format.fpsNum)
+				m_jpegDecoder.SetFrameInterval((int64_t)format.fpsDen * 1000000000 / format.fpsNum);
+		}
+	} else if (format.subtype == MEDIA_SUBTYPE_MFLZ) {
+		if (target != MEDIA_SUBTYPE_NV12 || (!m_lossless.IsStarted() && !m_lossless.Start(GetCodecThreads()))) {
+			assert(false);
+			return FramePtr();
+		}
+	} else if (target == MEDIA_SUBTYPE_P010) {
+		if (m_depthConverter.GetSubtype() != format.subtype && !m_depthConverter.Init(format.subtype, target)) {
+			assert(false);
+			return FramePtr();
+		}
+	} else if (m_converter.GetSubtype() != format.subtype && !m_converter.Init(format.subtype)) {
+		assert(false);
+		return FramePtr();
+	}
+
+	MediaFormat outputFormat = format;
+	outputFormat.subtype = target;
+
+	FramePtr frame = m_pool->Acquire(GetVideoFrameSize(outputFormat));
+	if (!frame)
+		return frame; // the writer is behind
+
+	const int32_t stride = GetVideoDefaultStride(outputFormat);
+	uint8_t *dstY = frame->GetBuffer();
+	uint8_t *dstUV = dstY + stride * format.height;
+	CTileExecutor *tiles = GetTiles(format);
+	bool converted = false;
+	if (format.subtype == MEDIA_SUBTYPE_MJPG)
+		converted = m_jpegDecoder.Decode(sample.planes[0].data, sample.planes[0].size, format.width, format.height, dstY, stride, dstUV, stride);
+	else if (format.subtype == MEDIA_SUBTYPE_MFLZ)
+		converted = m_lossless.Decode(sample.planes[0].data, sample.planes[0].size, format.width, format.height, dstY, stride, dstUV, stride);
+	else if (target == MEDIA_SUBTYPE_P010 && tiles)
+		converted = tiles->Convert(m_depthConverter, sample.planes, format, dstY, stride, dstUV, stride);
+	else if (target == MEDIA_SUBTYPE_P010)
+		converted = m_depthConverter.Convert(sample.planes, format.width, format.height, dstY, stride, dstUV, stride);
+	else if (tiles)
+		converted = tiles->Convert(m_converter, sample.planes, format, dstY, stride, dstUV, stride);
+	else
+		converted = m_converter.Convert(sample.planes, format.width, format.height, dstY, stride, dstUV, stride);
+	if (!converted)
+		return FramePtr();
+
+	frame->SetSample(outputFormat, sample.timestamp, sample.flags);
+	return frame;
+}
+
+FramePtr CMediaPipeline::EncodeLossless(CMediaFrame *frame)
+{
+	if (!m_lossless.IsStarted() && !m_lossless.Start(GetCodecThreads())) {
+		assert(false);
+		return FramePtr();
+	}
+
+	const MediaFormat &format = frame->GetFormat();
+	const uint32_t capacity = CLosslessCodec::GetMaxEncodedSize(format.width, format.height);
+	FramePtr encoded = m_pool->Acquire(capacity);
+	if (!encoded)
+		return encoded; // the writer is behind
+
+	const uint32_t size = m_lossless.Encode(frame->GetSample().planes, format.width, format.height, encoded->GetBuffer(), capacity);
+	if (!size)
+		return FramePtr();
+
+	MediaFormat outputFormat = format;
+	outputFormat.subtype = MEDIA_SUBTYPE_MFLZ;
+	encoded->SetSample(outputFormat, frame->GetTimestamp(), frame->GetFlags(), size);
+	return encoded;
+}
+
+void CMediaPipeline::SetAudioFormat(const MediaFormat &format)
+{
+	m_audioFormat = format;
+	m_audioFormat.video = false;
+	m_bConvertAudio = true;
+}
+
+void CMediaPipeline::SetRenditions(const ScaleRendition *renditions, uint32_t count, IMediaSink *sink)
+{
+	m_renditions.assign(renditions, renditions + count);
+	m_pRenditionSink = count ? sink : nullptr;
+}
+
+void CMediaPipeline::ScaleRenditions(CMediaFrame *frame)
+{
+	// the renditions are 8 bit
+	FramePtr nv12;
+	if (frame->GetFormat().subtype != MEDIA_SUBTYPE_NV12) {
+		nv12 = ConvertVideo(frame->GetSample(), MEDIA_SUBTYPE_NV12);
+		if (!nv12)
+			return;
+		frame = nv12.Get();
+	}
+
+	const MediaFormat &format = frame->GetFormat();
+	if (m_scaler.GetWidth() != format.width || m_scaler.GetHeight() != format.height) {
+		if (!m_scaler.Init(format.width, format.height, m_renditions.data(), (uint32_t)m_renditions.size())) {
+			m_pRenditionSink = nullptr; // e.g. a rendition larger than the device
+			return;
+		}
+	}
+
+	FramePtr frames[SCALE_MAX_RENDITIONS];
+	m_scaler.SetExecutor(GetTiles(format));
+	m_scaler.Scale(frame, m_pool.Get(), frames);
+	for (uint32_t i = 0; i < m_scaler.GetRenditionCount(); ++i) {
+		if (frames[i])
+			m_pRenditionSink->OnMediaFrame(frames[i].Get());
+	}
+}
+
+CTileExecutor *CMediaPipeline::GetTiles(const MediaFormat &format)
+{
+	if (!CTileExecutor::IsWorthTiling(format))
+		return nullptr;
+
+	if (!m_tiles.IsStarted()) {
+		TileExecutorOptions options;
+		options.threads = GetCodecThreads();
+		if (!m_tiles.Start(options)) {
+			assert(false);
+			return nullptr;
+		}
+	}
+	return &m_tiles;
+}
+
+static bool IsSameAudioFormat(const MediaFormat &a, const MediaFormat &b)
+{
+	return a.subtype == b.subtype && a.bitsPerSample == b.bitsPerSample && a.channels == b.channels && a.sampleRate == b.sampleRate;
+}
+
+FramePtr CMediaPipeline::ConvertAudio(const MediaSample &sample)
+{
+	const MediaFormat &format = *sample.format;
+	if (!IsSameAudioFormat(m_audioConverter.GetInputFormat(), format) && !m_audioConverter.Init(format, m_audioFormat)) {
+		assert(false);
+		return FramePtr();
+	}
+
+	// a gap in the stream, don't filter across it
+	if (sample.flags & MEDIA_SAMPLE_FLAG_DISCONTINUITY)
+		m_audioConverter.Reset();
+
+	const uint32_t size = sample.planes[0].size;
+	FramePtr frame = m_pool->Acquire(m_audioConverter.GetMaxOutputSize(size));
+	if (!frame)
+		return frame; // the writer is behind
+
+	uint32_t bytes = m_audioConverter.Convert(sample.planes[0].data, size, frame->GetBuffer(), m_audioConverter.GetMaxOutputSize(size));
+	if (!bytes)
+		return FramePtr(); // still filling the resampler
+
+	frame->SetSample(m_audioConverter.GetOutputFormat(), sample.timestamp + m_audioConverter.GetTimestampOffset(), sample.flags, bytes);
+	return frame;
+}
+
+void CMediaPipeline::Dump(CMediaFrame *frame, const char *path)
+{
+	if (!m_writer.IsOpen()) {
+		AsyncWriterOptions options;
+		options.queueCapacity = PIPELINE_WRITER_QUEUE;
+		if (!m_writer.Open(m_dumpPath.empty() ? path : m_dumpPath.c_str(), frame->GetFormat(), options))
+			return;
+	}
+
+	m_writer.Write(frame);
+}
+
+void CMediaPipeline::OnVideoData(CMediaFrame *input)
+{
+	const uint32_t subtype = input->GetFormat().subtype;
+	const uint32_t target = m_bKeepHighBitDepth && IsHighBitDepth(subtype) ? MEDIA_SUBTYPE_P010 : MEDIA_SUBTYPE_NV12;
+
+	FramePtr converted;
+	if (subtype != target) {
+		converted = ConvertVideo(input->GetSample(), target);
+		if (!converted)
+			return;
+	}
+
+	// everything below works on NV12 or P010
+	CMediaFrame *frame = converted ? converted.Get() : input;
+	++m_videoFrames;
+
+	FramePtr tagged;
+	if (m_changeDetector.IsInitialized() && !m_changeDetector.IsChanged(frame->GetSample())) {
+		if (m_changeDetector.GetOptions().drop)
+			return;
+
+		// the input may be shared with other sinks, so the flag goes on a frame of its own over the same memory
+		MediaSample sample = frame->GetSample();
+		sample.flags |= MEDIA_SAMPLE_FLAG_UNCHANGED;
+		frame->AddRef();
+		tagged = CMediaFrame::Wrap(sample, [frame]() { frame->Release(); });
+		if (!tagged)
+			return;
+		frame = tagged.Get();
+	}
+
+	if (m_pRenditionSink)
+		ScaleRenditions(frame);
+
+	if (!m_bDump)
+		return;
+
+	FramePtr encoded;
+	if (m_bLosslessDump && frame->GetFormat().subtype == MEDIA_SUBTYPE_NV12) {
+		encoded = EncodeLossless(frame);
+		if (!encoded)
+			return;
+		frame = encoded.Get();
+	}
+
+	Dump(frame, "video.mfc");
+}
+
+void CMediaPipeline::OnAudioData(CMediaFrame *input)
+{
+	m_audioBytes += input->GetSample().planes[0].size;
+
+	FramePtr converted;
+	if (m_bConvertAudio && !IsSameAudioFormat(input->GetFormat(), m_audioFormat)) {
+		converted = ConvertAudio(input->GetSample());
+		if (!converted)
+			return;
+	}
+
+	CMediaFrame *frame = converted ? converted.Get() : input;
+
+	if (!m_bDump)
+		return;
+
+	if (m_bPacketize)
+		DumpAudioPackets(frame);
+	else
+		Dump(frame, "audio.mfc");
+}
+
+void CMediaPipeline::DumpAudioPackets(CMediaFrame *frame)
+{
+	if (!IsSameAudioFormat(m_packetizer.GetFormat(), frame->GetFormat()) && !m_packetizer.Init(frame->GetFormat(), m_packetizerOptions)) {
+		assert(false);
+		return;
+	}
+
+	const MediaSample &sample = frame->GetSample();
+	m_packetizer.Write(sample.planes[0].data, sample.planes[0].size, sample.timestamp, sample.flags);
+
+	while (m_packetizer.IsPacketReady()) {
+		FramePtr packet = m_pool->Acquire(m_packetizer.GetPacketSize());
+		if (!packet)
+			break; // the writer is behind, the rest waits in the ring
+
+		AudioPacket info;
+		m_packetizer.Read(packet->GetBuffer(), info);
+		packet->SetSample(m_packetizer.GetFormat(), info.timestamp, info.flags, info.size);
+		Dump(packet.Get(), "audio.mfc");
+	}
+}
@@ -0,0 +1,118 @@
+﻿#pragma once
+#include "mf-sample.h"
+#include "mf-convert.h"
+#include "mf-audio.h"
+#include "mf-packetizer.h"
+#include "mf-frame.h"
+#include "mf-container.h"
+#include "mf-scale.h"
+#include "mf-jpeg.h"
+#include "mf-change.h"
+#include "mf-lossless.h"
+#include "mf-tiling.h"
+#include <string>
+
+// post-callback processing of one stream, shared by CMFCapture and the stand-in sources
+class CMediaPipeline : public IMediaSink {
+public:
+	explicit CMediaPipeline(bool dump = true);
+	virtual ~CMediaPipeline();
+
+	void OnMediaSample(const MediaSample &sample) override;
+	bool WantsFrames() const override { return true; }
+	void OnMediaFrame(CMediaFrame *frame) override;
+
+	uint64_t GetVideoFrames() const { return m_videoFrames; }
+	uint64_t GetAudioBytes() const { return m_audioBytes; }
+	AsyncWriterStats GetWriterStats() const { return m_writer.GetStats(); }
+	JpegDecoderStats GetJpegStats() const { return m_jpegDecoder.GetStats(); }
+	ChangeDetectorStats GetChangeStats() const { return m_changeDetector.GetStats(); }
+	LosslessCodecStats GetLosslessStats() const { return m_lossless.GetStats(); }
+	AudioPacketizerStats GetPacketizerStats() const { return m_packetizer.GetStats(); }
+
+	// file of the dump, the default is video.mfc / audio.mfc. call before the first sample
+	void SetDumpPath(const char *path) { m_dumpPath = path ? path : ""; }
+
+	// audio is converted to `format` (subtype, bitsPerSample, channels, sampleRate) before it is dumped.
+	// call before the first sample; without it the device format is kept
+	void SetAudioFormat(const MediaFormat &format);
+
+	// audio is dumped in packets of a fixed duration, as encoders want them, instead of the chunks of the device.
+	// see CAudioPacketizer. call before the first sample
+	void SetAudioPackets(const AudioPacketizerOptions &options)
+	{
+		m_packetizerOptions = options;
+		m_bPacketize = true;
+	}
+
+	// 10 and 16 bit devices are kept at 10 bit as P010 (the default), or dithered down to NV12 like the 8 bit types.
+	// call before the first sample
+	void SetHighBitDepth(bool keep) { m_bKeepHighBitDepth = keep; }
+
+	// every video frame is also scaled to `renditions` in one pass (see CVideoScaler), the renditions are handed to
+	// `sink` in the order given, on the thread of the pipeline. call before the first sample
+	void SetRenditions(const ScaleRendition *renditions, uint32_t count, IMediaSink *sink);
+
+	// NV12 frames whose luma did not change are dropped or tagged with MEDIA_SAMPLE_FLAG_UNCHANGED before the renditions
+	// and the dump, see CChangeDetector. call before the first sample
+	bool SetChangeDetection(const ChangeDetectorOptions &options) { return m_changeDetector.Init(options); }
+
+	// NV12 frames are dumped compressed as MEDIA_SUBTYPE_MFLZ (see CLosslessCodec), replay decodes them again.
+	// call before the first sample
+	void SetLosslessDump(bool compress) { m_bLosslessDump = compress; }
+
+private:
+	void OnVideoData(CMediaFrame *frame);
+	void OnAudioData(CMediaFrame *frame);
+	FramePtr ConvertVideo(const MediaSample &sample, uint32_t target);
+	FramePtr EncodeLossless(CMediaFrame *frame);
+	FramePtr ConvertAudio(const MediaSample &sample);
+	void ScaleRenditions(CMediaFrame *frame);
+	CTileExecutor *GetTiles(const MediaFormat &format);
+	void DumpAudioPackets(CMediaFrame *frame);
+	void Dump(CMediaFrame *frame, const char *path);
+
+private:
+	const bool m_bDump;
+	std::string m_dumpPath;
+	CContainerWriter m_writer; // one pipeline handles one stream, so one dump file
+
+	// copies of borrowed samples and conversion outputs, kept alive until the writer is done with them
+	CRefPtr<CFramePool> m_pool;
+
+	// conversion stage for devices which do not deliver NV12, or P010 for the high bit depth types
+	CVideoConverter m_converter;
+	CDepthConverter m_depthConverter;
+	bool m_bKeepHighBitDepth = true;
+
+	// MJPG devices, started with the first frame
+	CJpegDecoder m_jpegDecoder;
+
+	// copy, conversion and scaling of 4k frames in bands, started with the first such frame
+	CTileExecutor m_tiles;
+
+	// simulcast renditions of the NV12 frames
+	std::vector<ScaleRendition> m_renditions;
+	IMediaSink *m_pRenditionSink = nullptr;
+	CVideoScaler m_scaler;
+
+	// off unless SetChangeDetection was called
+	CChangeDetector m_changeDetector;
+
+	// MFLZ dumps and replays, started with the first frame
+	CLosslessCodec m_lossless;
+	bool m_bLosslessDump = false;
+
+	// and for devices which do not deliver m_audioFormat
+	bool m_bConvertAudio = false;
+	MediaFormat m_audioFormat;
+	CAudioConverter m_audioConverter;
+
+	// off unless SetAudioPackets was called, started with the first frame
+	bool m_bPacketize = false;
+	AudioPacketizerOptions m_packetizerOptions;
+	CAudioPacketizer m_packetizer;
+
+	uint64_t m_videoFrames = 0;
+	uint64_t m_audioBytes = 0;
+};
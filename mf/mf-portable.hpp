@@ -0,0 +1,102 @@
+﻿#pragma once
+// platform-neutral helpers shared by the capture pipeline, so that everything after the
+// IMFSourceReader callback can also be built and profiled on linux.
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <utility>
+
+static inline FILE *OpenFile(const char *path, const char *mode)
+{
+	FILE *fp = nullptr;
+#ifdef _MSC_VER
+	if (fopen_s(&fp, path, mode) != 0)
+		return nullptr;
+#else
+	fp = fopen(path, mode);
+#endif
+	return fp;
+}
+
+// monotonic clock in 100ns units, the same unit as the timestamps of IMFSample
+static inline int64_t GetMonotonicTime100ns()
+{
+	auto now = std::chrono::steady_clock::now().time_since_epoch();
+	return (int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now).count() / 100;
+}
+
+// same clock in ns, for durations well below 100ns resolution
+static inline int64_t GetMonotonicTimeNs()
+{
+	auto now = std::chrono::steady_clock::now().time_since_epoch();
+	return (int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+static inline void SleepUntil100ns(int64_t deadline)
+{
+	int64_t now = GetMonotonicTime100ns();
+	if (deadline > now)
+		std::this_thread::sleep_for(std::chrono::nanoseconds((deadline - now) * 100));
+}
+
+// intrusive smart pointer for objects with AddRef/Release, like ComPtr but usable without WRL.
+// constructing from a raw pointer adds a reference, Attach takes over the reference of the caller.
+template<class T> class CRefPtr {
+public:
+	CRefPtr() {}
+	CRefPtr(T *p) : m_p(p)
+	{
+		if (m_p)
+			m_p->AddRef();
+	}
+	CRefPtr(const CRefPtr &other) : CRefPtr(other.m_p) {}
+	CRefPtr(CRefPtr &&other) : m_p(other.m_p) { other.m_p = nullptr; }
+	~CRefPtr()
+	{
+		if (m_p)
+			m_p->Release();
+	}
+
+	CRefPtr &operator=(const CRefPtr &other)
+	{
+		CRefPtr tmp(other);
+		Swap(tmp);
+		return *this;
+	}
+	CRefPtr &operator=(CRefPtr &&other)
+	{
+		CRefPtr tmp(std::move(other));
+		Swap(tmp);
+		return *this;
+	}
+
+	T *Get() const { return m_p; }
+	T *operator->() const { return m_p; }
+	T &operator*() const { return *m_p; }
+	explicit operator bool() const { return m_p != nullptr; }
+
+	void Attach(T *p)
+	{
+		if (m_p)
+			m_p->Release();
+		m_p = p;
+	}
+
+	T *Detach()
+	{
+		T *p = m_p;
+		m_p = nullptr;
+		return p;
+	}
+
+	void Swap(CRefPtr &other)
+	{
+		T *p = m_p;
+		m_p = other.m_p;
+		other.m_p = p;
+	}
+
+private:
+	T *m_p = nullptr;
+};
@@ -0,0 +1,188 @@
+#include "mf-publish.h"
+#include "mf-portable.hpp"
+#include <assert.h>
+
+#define PUBLISHER_WAIT_MS 20
+
+CFramePublisher::~CFramePublisher()
+{
+	Stop();
+}
+
+int CFramePublisher::Subscribe(const char *name, IFrameSubscriber *subscriber, const BackpressureOptions &options)
+{
+	if (!subscriber || m_bStarted) {
+		assert(false);
+		return -1;
+	}
+
+	std::unique_ptr<Subscriber> entry(new Subscriber());
+	if (!entry->queue.Init(options))
+		return -1;
+
+	// the source must not wait for one subscriber, the others would wait with it
+	entry->bBlocking = options.blockTimeoutMs && (options.policy == BACKPRESSURE_BLOCK || options.policy == BACKPRESSURE_RATE_LIMIT);
+	if (entry->bBlocking) {
+		BackpressureOptions inbox;
+		inbox.policy = BACKPRESSURE_BLOCK;
+		inbox.capacity = options.capacity;
+		if (!entry->inbox.Init(inbox))
+			return -1;
+	}
+
+	entry->name = name ? name : "";
+	entry->subscriber = subscriber;
+	m_subscribers.push_back(std::move(entry));
+	return (int)m_subscribers.size() - 1;
+}
+
+bool CFramePublisher::Start()
+{
+	if (m_bStarted || m_subscribers.empty()) {
+		assert(false);
+		return false;
+	}
+
+	for (auto &subscriber : m_subscribers) {
+		subscriber->bRunning = true;
+		subscriber->thread = std::thread(&CFramePublisher::ThreadFunc, subscriber.get());
+		if (subscriber->bBlocking) {
+			subscriber->bFeeding = true;
+			subscriber->feeder = std::thread(&CFramePublisher::FeederFunc, subscriber.get());
+		}
+	}
+	m_bStarted = true;
+	return true;
+}
+
+void CFramePublisher::Stop()
+{
+	if (!m_bStarted)
+		return;
+
+	// the feeders hand on what is in the inboxes while the subscribers still take it
+	for (auto &subscriber : m_subscribers) {
+		subscriber->bFeeding = false;
+		subscriber->inboxWake.NotifyAll();
+	}
+	for (auto &subscriber : m_subscribers) {
+		if (subscriber->feeder.joinable())
+			subscriber->feeder.join();
+	}
+
+	for (auto &subscriber : m_subscribers) {
+		subscriber->bRunning = false;
+		subscriber->wake.NotifyAll();
+	}
+
+	for (auto &subscriber : m_subscribers) {
+		subscriber->thread.join();
+
+		// frames which arrived after the threads have drained the queues
+		CMediaFrame *frame = nullptr;
+		while (subscriber->inbox.TryPop(frame))
+			frame->Release();
+		while (subscriber->queue.TryPop(frame))
+			frame->Release();
+	}
+	m_bStarted = false;
+}
+
+void CFramePublisher::OnMediaSample(const MediaSample & /*sample*/)
+{
+	// WantsFrames() is true, sources must use OnMediaFrame
+	assert(false);
+}
+
+void CFramePublisher::OnMediaFrame(CMediaFrame *frame)
+{
+	if (!m_bStarted)
+		return;
+
+	// every queue takes its own reference of the same frame, a full one only drops for its subscriber
+	for (auto &subscriber : m_subscribers)
+		(subscriber->bBlocking ? subscriber->inbox : subscriber->queue).Push(frame);
+	++m_published;
+
+	for (auto &subscriber : m_subscribers)
+		(subscriber->bBlocking ? subscriber->inboxWake : subscriber->wake).Notify();
+}
+
+void CFramePublisher::Deliver(Subscriber *subscriber, CMediaFrame *frame)
+{
+	const int64_t begin = GetMonotonicTimeNs();
+	subscriber->subscriber->OnFrame(frame);
+	frame->Release();
+
+	const int64_t ns = GetMonotonicTimeNs() - begin;
+	subscriber->totalNs += ns;
+	int64_t maxNs = subscriber->maxNs.load(std::memory_order_relaxed);
+	while (ns > maxNs && !subscriber->maxNs.compare_exchange_weak(maxNs, ns))
+		;
+	++subscriber->delivered;
+}
+
+void CFramePublisher::ThreadFunc(Subscriber *subscriber)
+{
+	for (;;) {
+		CMediaFrame *frame = nullptr;
+		if (subscriber->queue.TryPop(frame)) {
+			Deliver(subscriber, frame);
+			continue;
+		}
+
+		if (!subscriber->bRunning)
+			break;
+
+		subscriber->wake.WaitFor([subscriber]() { return subscriber->queue.GetSize() != 0 || !subscriber->bRunning; }, PUBLISHER_WAIT_MS);
+	}
+}
+
+void CFramePublisher::FeederFunc(Subscriber *subscriber)
+{
+	for (;;) {
+		CMediaFrame *frame = nullptr;
+		if (subscriber->inbox.TryPop(frame)) {
+			// waits up to blockTimeoutMs, on this thread instead of the source's
+			if (subscriber->queue.Push(frame))
+				subscriber->wake.Notify();
+			frame->Release();
+			continue;
+		}
+
+		if (!subscriber->bFeeding)
+			break;
+
+		subscriber->inboxWake.WaitFor([subscriber]() { return subscriber->inbox.GetSize() != 0 || !subscriber->bFeeding; }, PUBLISHER_WAIT_MS);
+	}
+}
+
+SubscriberStats CFramePublisher::GetSubscriberStats(uint32_t index) const
+{
+	const Subscriber &subscriber = *m_subscribers[index];
+	SubscriberStats stats;
+	stats.delivered = subscriber.delivered;
+	stats.totalNs = subscriber.totalNs;
+	stats.maxNs = subscriber.maxNs;
+	stats.queue = subscriber.queue.GetStats();
+	if (subscriber.bBlocking) {
+		// the inbox only drops when the feeder is still waiting for room for the frames before
+		const BackpressureStats inbox = subscriber.inbox.GetStats();
+		stats.queue.dropped[FRAME_DROP_FULL] += inbox.dropped[FRAME_DROP_FULL];
+		stats.queue.depth += inbox.depth;
+	}
+	return stats;
+}
+
+uint32_t CFramePublisher::GetFramesInFlight() const
+{
+	// the queue of each subscriber plus the frame it is working on, and the inbox and the frame of a feeder
+	uint32_t count = 0;
+	for (const auto &subscriber : m_subscribers) {
+		const BackpressureOptions &options = subscriber->queue.GetOptions();
+		count += (options.policy == BACKPRESSURE_KEEP_LATEST ? 1 : options.capacity) + 1;
+		if (subscriber->bBlocking)
+			count += options.capacity + 1;
+	}
+	return count;
+}
@@ -0,0 +1,92 @@
+﻿#pragma once
+#include "mf-backpressure.h"
+#include "mf-frame.h"
+#include "mf-wake.hpp"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct SubscriberStats {
+	uint64_t delivered = 0; // handed to the subscriber
+	int64_t totalNs = 0;    // spent in the subscriber
+	int64_t maxNs = 0;
+	BackpressureStats queue; // what the policy of this subscriber queued, dropped and waited for
+};
+
+// what CFramePublisher hands out: the frame all subscribers share, read-only. the pixels, the format and the timing
+// stay as the source delivered them; a subscriber which wants to change them converts into a frame of its own (as
+// CMediaPipeline does), or wraps the shared memory in one (as CCaptureSession does for a CAVSync behind it).
+class IFrameSubscriber {
+public:
+	virtual ~IFrameSubscriber() {}
+
+	// on the thread of the subscriber. the frame is valid during the call, AddRef keeps it
+	virtual void OnFrame(const CMediaFrame *frame) = 0;
+};
+
+// hands every frame of one source to several independent subscribers at once, e.g. a recorder, a preview, analytics
+// and an encoder. each of them gets a reference of the same frame, nothing is copied.
+// every subscriber has its own queue, policy and thread, so one which falls behind only drops its own frames. the
+// source never waits: a subscriber which blocks for room (BLOCK or RATE_LIMIT with a blockTimeoutMs) gets a second
+// thread which does the waiting, the source only fills its inbox of the same capacity and drops when that is full too.
+// the queued frames still come out of the pool of the source, which should hold GetFramesInFlight frames per size.
+class CFramePublisher : public IMediaSink {
+public:
+	CFramePublisher() {}
+	virtual ~CFramePublisher();
+
+	// before Start, returns the index for GetSubscriberStats, -1 on error
+	int Subscribe(const char *name, IFrameSubscriber *subscriber, const BackpressureOptions &options = BackpressureOptions());
+
+	bool Start();
+	// delivers what is still queued, then stops the threads of the subscribers. the source must be stopped first
+	void Stop();
+	bool IsStarted() const { return m_bStarted; }
+
+	// IMediaSink, called by the source
+	void OnMediaSample(const MediaSample &sample) override;
+	bool WantsFrames() const override { return true; }
+	void OnMediaFrame(CMediaFrame *frame) override;
+
+	uint32_t GetSubscriberCount() const { return (uint32_t)m_subscribers.size(); }
+	const std::string &GetSubscriberName(uint32_t index) const { return m_subscribers[index]->name; }
+	// polled from any thread
+	SubscriberStats GetSubscriberStats(uint32_t index) const;
+	uint64_t GetPublished() const { return m_published; }
+
+	// frames the queues and the subscribers may hold at once, on top of the one the source is filling
+	uint32_t GetFramesInFlight() const;
+
+private:
+	struct Subscriber {
+		std::string name;
+		IFrameSubscriber *subscriber = nullptr;
+		CBackpressureQueue queue;
+
+		std::thread thread;
+		std::atomic<bool> bRunning{false};
+		CWakeEvent wake; // the thread sleeps here when the queue is empty
+
+		// subscribers which block: the source pushes here, the feeder waits for room in `queue`
+		bool bBlocking = false;
+		CBackpressureQueue inbox;
+		std::thread feeder;
+		std::atomic<bool> bFeeding{false};
+		CWakeEvent inboxWake;
+
+		std::atomic<uint64_t> delivered{0};
+		std::atomic<int64_t> totalNs{0};
+		std::atomic<int64_t> maxNs{0};
+	};
+
+	static void ThreadFunc(Subscriber *subscriber);
+	static void FeederFunc(Subscriber *subscriber);
+	static void Deliver(Subscriber *subscriber, CMediaFrame *frame);
+
+private:
+	std::vector<std::unique_ptr<Subscriber>> m_subscribers;
+	bool m_bStarted = false;
+	std::atomic<uint64_t> m_published{0};
+};
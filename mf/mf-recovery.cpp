@@ -0,0 +1,108 @@
+#include "mf-recovery.h"
+#include "mf-portable.hpp"
+#include "mf-sample.h"
+#include <algorithm>
+#include <assert.h>
+
+void CDeviceRecovery::Enable()
+{
+	// a recovery cancelled by the last stop may still be around
+	Disable();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_bEnabled = true;
+	m_bReopened = false;
+}
+
+void CDeviceRecovery::Disable()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_bEnabled = false;
+	}
+	m_cv.notify_all();
+
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+bool CDeviceRecovery::OnDeviceLost()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!m_bEnabled)
+		return false;
+
+	// the reopened device may run before the recovery thread is done with it, which then goes round again
+	if (m_bRecovering) {
+		if (!m_bReopened) {
+			m_pMetrics->AddDeviceLost();
+			m_lostTime = GetMonotonicTimeNs();
+		}
+		m_bLostAgain = true;
+		return true;
+	}
+
+	// the last recovery is over, its thread only has to return
+	if (m_thread.joinable())
+		m_thread.join();
+
+	m_pMetrics->AddDeviceLost();
+	m_lostTime = GetMonotonicTimeNs();
+	m_bRecovering = true;
+	m_thread = std::thread(&CDeviceRecovery::ThreadFunc, this);
+	return true;
+}
+
+uint32_t CDeviceRecovery::EndOutage()
+{
+	if (!m_bReopened.exchange(false))
+		return 0;
+
+	m_pMetrics->RecordOutage(GetMonotonicTimeNs() - m_lostTime);
+	return MEDIA_SAMPLE_FLAG_DISCONTINUITY;
+}
+
+void CDeviceRecovery::ThreadFunc()
+{
+	for (;;) {
+		m_pDevice->CloseDevice();
+		const bool reopened = Reopen();
+
+		// decided under the lock, so a loss reported from now on starts a new recovery instead
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!reopened || !m_bLostAgain || !m_bEnabled) {
+			m_bLostAgain = false;
+			m_bRecovering = false;
+			return;
+		}
+		m_bLostAgain = false;
+	}
+}
+
+bool CDeviceRecovery::Reopen()
+{
+	// a usb glitch is often over by the first attempt, a replugged device takes a few hundred ms to come back
+	uint32_t wait = m_options.retryMs;
+	for (uint32_t attempt = 1;; ++attempt) {
+		{
+			// what the closed device reported does not concern the one being opened
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_bLostAgain = false;
+		}
+
+		// set before the device runs again, its first sample may come before ReopenDevice returns
+		m_bReopened = true;
+		if (m_pDevice->ReopenDevice())
+			return true;
+		m_bReopened = false;
+		m_failedAttempts.store(m_failedAttempts.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+		if (m_options.maxAttempts && attempt >= m_options.maxAttempts)
+			return false;
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (m_cv.wait_for(lock, std::chrono::milliseconds(wait), [this]() { return !m_bEnabled; }))
+			return false; // stopped
+		wait = (std::min)(wait * 2, m_options.maxRetryMs);
+	}
+}
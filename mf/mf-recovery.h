@@ -0,0 +1,76 @@
+﻿#pragma once
+#include "mf-metrics.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+struct DeviceRecoveryOptions {
+	uint32_t retryMs = 50;     // between two reopen attempts after the first failed, doubles up to maxRetryMs
+	uint32_t maxRetryMs = 1000;
+	uint32_t maxAttempts = 0;  // 0: until the source is stopped
+};
+
+// what CDeviceRecovery calls on its own thread
+class IRecoverableDevice {
+public:
+	virtual ~IRecoverableDevice() {}
+
+	// stops the lost device and releases it, the callback which reported the loss has returned or returns soon
+	virtual void CloseDevice() = 0;
+	// opens the device again in the format it had and starts it, false to try again later
+	virtual bool ReopenDevice() = 0;
+};
+
+// brings a lost device back without stopping the session: the capture callback reports the loss and returns, a
+// thread of its own closes the device and reopens it with a backoff until it is back or the source is stopped.
+// the first sample after that carries MEDIA_SAMPLE_FLAG_DISCONTINUITY and ends the outage, which the metrics record.
+class CDeviceRecovery {
+public:
+	CDeviceRecovery(IRecoverableDevice *device, CCaptureMetrics *metrics) : m_pDevice(device), m_pMetrics(metrics) {}
+	~CDeviceRecovery() { Disable(); }
+
+	void SetOptions(const DeviceRecoveryOptions &options) { m_options = options; }
+
+	// with StartCapture, losses are recovered from then on
+	void Enable();
+	// with StopCapture, before the device is stopped: cancels a recovery in progress and waits for it
+	void Disable();
+
+	// from the capture callback, returns at once. false when disabled. a loss of the reopened device while the recovery
+	// is still finishing is recovered right after it, one before its first sample extends the outage
+	bool OnDeviceLost();
+	bool IsRecovering() const { return m_bRecovering; }
+
+	// for every sample delivered: MEDIA_SAMPLE_FLAG_DISCONTINUITY for the first one after a recovery, else 0
+	uint32_t OnSample()
+	{
+		if (!m_bReopened.load(std::memory_order_relaxed))
+			return 0;
+		return EndOutage();
+	}
+
+	uint64_t GetFailedAttempts() const { return m_failedAttempts; }
+
+private:
+	uint32_t EndOutage();
+	void ThreadFunc();
+	// with backoff, false when it gave up or was stopped
+	bool Reopen();
+
+private:
+	IRecoverableDevice *const m_pDevice;
+	CCaptureMetrics *const m_pMetrics;
+	DeviceRecoveryOptions m_options;
+
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	bool m_bEnabled = false;
+	std::atomic<bool> m_bRecovering{false}; // cleared under m_mutex
+	bool m_bLostAgain = false;              // reported while recovering, by the device which was reopened
+	std::thread m_thread;
+
+	int64_t m_lostTime = 0;
+	std::atomic<bool> m_bReopened{false}; // the next sample ends the outage
+	std::atomic<uint64_t> m_failedAttempts{0};
+};
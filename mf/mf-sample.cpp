@@ -0,0 +1,42 @@
+#include "mf-sample.h"
+#include "mf-format.h"
+
+// formats outside of the table behave like an unknown layout
+static const MediaFormatTraits &GetTraits(uint32_t subtype)
+{
+	static const MediaFormatTraits unknown = {};
+	const MediaFormatTraits *traits = FindFormatTraits(subtype);
+	return traits ? *traits : unknown;
+}
+
+bool IsCompressedVideo(uint32_t subtype)
+{
+	return GetTraits(subtype).layout == FORMAT_LAYOUT_BITSTREAM;
+}
+
+uint32_t GetVideoBitDepth(uint32_t subtype)
+{
+	const MediaFormatTraits &traits = GetTraits(subtype);
+	return IsRawVideoFormat(traits) ? traits.bitsPerComponent : 0;
+}
+
+int32_t GetVideoDefaultStride(const MediaFormat &format)
+{
+	return (int32_t)GetFormatStride(GetTraits(format.subtype), format.width);
+}
+
+uint32_t GetVideoFrameSize(const MediaFormat &format)
+{
+	const MediaFormatTraits &traits = GetTraits(format.subtype);
+	return GetFormatFrameSize(traits, GetFormatStride(traits, format.width), format.height);
+}
+
+uint32_t GetVideoPlaneRows(const MediaFormat &format, uint32_t rowBytes[MEDIA_MAX_PLANES], uint32_t rows[MEDIA_MAX_PLANES])
+{
+	return GetFormatPlaneRows(GetTraits(format.subtype), format.width, format.height, rowBytes, rows);
+}
+
+uint32_t DescribeVideoPlanes(const MediaFormat &format, const uint8_t *data, int32_t stride, MediaPlane *planes)
+{
+	return DescribeFormatPlanes(GetTraits(format.subtype), format.height, data, stride, planes);
+}
@@ -0,0 +1,127 @@
+﻿#pragma once
+// platform-neutral description of the samples delivered by a capture source.
+// CMFCapture converts IMFSample into MediaSample, and the stand-in sources in mf-source.h produce
+// the same thing, so the whole post-callback pipeline can run without media foundation.
+#include <cstdint>
+
+// same value as the Data1 member of the media foundation subtype GUID
+#define MEDIA_FOURCC(a, b, c, d) ((uint32_t)(uint8_t)(a) | ((uint32_t)(uint8_t)(b) << 8) | ((uint32_t)(uint8_t)(c) << 16) | ((uint32_t)(uint8_t)(d) << 24))
+
+enum MediaSubtype : uint32_t {
+	// video: FourCC, or D3DFORMAT for the rgb types
+	MEDIA_SUBTYPE_RGB24 = 20,
+	MEDIA_SUBTYPE_ARGB32 = 21,
+	MEDIA_SUBTYPE_RGB32 = 22,
+	MEDIA_SUBTYPE_NV12 = MEDIA_FOURCC('N', 'V', '1', '2'),
+	MEDIA_SUBTYPE_I420 = MEDIA_FOURCC('I', '4', '2', '0'),
+	MEDIA_SUBTYPE_IYUV = MEDIA_FOURCC('I', 'Y', 'U', 'V'),
+	MEDIA_SUBTYPE_YV12 = MEDIA_FOURCC('Y', 'V', '1', '2'),
+	MEDIA_SUBTYPE_YUY2 = MEDIA_FOURCC('Y', 'U', 'Y', '2'),
+	MEDIA_SUBTYPE_UYVY = MEDIA_FOURCC('U', 'Y', 'V', 'Y'),
+
+	// high bit depth: 16 bit samples with the value in the high bits, except v210
+	MEDIA_SUBTYPE_P010 = MEDIA_FOURCC('P', '0', '1', '0'), // NV12 layout, 10 bit
+	MEDIA_SUBTYPE_P016 = MEDIA_FOURCC('P', '0', '1', '6'), // NV12 layout, 16 bit
+	MEDIA_SUBTYPE_Y210 = MEDIA_FOURCC('Y', '2', '1', '0'), // YUY2 layout, 10 bit
+	MEDIA_SUBTYPE_V210 = MEDIA_FOURCC('v', '2', '1', '0'), // 4:2:2, 6 pixels in 4 words of three 10 bit values, rows aligned to 128 bytes
+
+	// compressed: one plane holding the bitstream of a frame, like audio
+	MEDIA_SUBTYPE_MJPG = MEDIA_FOURCC('M', 'J', 'P', 'G'),
+	MEDIA_SUBTYPE_MFLZ = MEDIA_FOURCC('M', 'F', 'L', 'Z'), // lossless NV12 of our dumps, see CLosslessCodec
+
+	// audio: WAVE_FORMAT tag
+	MEDIA_SUBTYPE_PCM = 1,
+	MEDIA_SUBTYPE_FLOAT = 3,
+};
+
+enum MediaSampleFlags : uint32_t {
+	MEDIA_SAMPLE_FLAG_ERROR = 0x1,             // MF_SOURCE_READERF_ERROR
+	MEDIA_SAMPLE_FLAG_END_OF_STREAM = 0x2,     // MF_SOURCE_READERF_ENDOFSTREAM
+	MEDIA_SAMPLE_FLAG_TYPE_CHANGED = 0x4,      // MF_SOURCE_READERF_CURRENTMEDIATYPECHANGED
+	MEDIA_SAMPLE_FLAG_STREAM_TICK = 0x8,       // MF_SOURCE_READERF_STREAMTICK: gap in the stream, no data
+	MEDIA_SAMPLE_FLAG_DISCONTINUITY = 0x10,    // timestamp is not continuous with the previous sample
+	MEDIA_SAMPLE_FLAG_UNCHANGED = 0x20,        // the picture is the same as the previous one, see CChangeDetector
+};
+
+struct MediaFormat {
+	bool video = true;
+	uint32_t subtype = 0;
+
+	// video
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t fpsNum = 0;
+	uint32_t fpsDen = 0;
+
+	// audio, always interleaved
+	uint32_t channels = 0;
+	uint32_t sampleRate = 0;
+	uint32_t bitsPerSample = 0;
+};
+
+#define MEDIA_MAX_PLANES 4
+
+struct MediaPlane {
+	const uint8_t *data = nullptr;
+	int32_t stride = 0; // bytes per row, 0 for audio
+	uint32_t size = 0;  // valid bytes of this plane
+};
+
+struct MediaSample {
+	const MediaFormat *format = nullptr;
+	MediaPlane planes[MEDIA_MAX_PLANES];
+	uint32_t planeCount = 0; // 0 if it is a stream tick
+	int64_t timestamp = 0;   // 100ns
+	uint32_t flags = 0;      // MediaSampleFlags
+};
+
+// the helpers below read the format table of mf-format.h
+
+// true for the subtypes whose samples are a bitstream of variable size instead of planes
+bool IsCompressedVideo(uint32_t subtype);
+
+// significant bits of each sample, 8 for the 8 bit types, 0 if the subtype is unknown
+uint32_t GetVideoBitDepth(uint32_t subtype);
+
+// bytes of a video frame stored contiguously with the minimum stride, 0 if the subtype is not a raw format we handle
+uint32_t GetVideoFrameSize(const MediaFormat &format);
+int32_t GetVideoDefaultStride(const MediaFormat &format);
+
+// bytes per row and row count of each plane of a frame with the default stride, returns the plane count
+uint32_t GetVideoPlaneRows(const MediaFormat &format, uint32_t rowBytes[MEDIA_MAX_PLANES], uint32_t rows[MEDIA_MAX_PLANES]);
+
+// splits a contiguous video frame (scan line 0 at `data`) into planes: Y,UV for NV12/P010/P016, Y,U,V for I420/YV12, one plane for packed formats.
+// returns the plane count, 0 if the subtype is unknown.
+uint32_t DescribeVideoPlanes(const MediaFormat &format, const uint8_t *data, int32_t stride, MediaPlane *planes);
+
+class CMediaFrame;
+
+class IMediaSink {
+public:
+	virtual ~IMediaSink() {}
+
+	// called on the thread of the source, sample data is only valid during the call
+	virtual void OnMediaSample(const MediaSample &sample) = 0;
+
+	// sinks which keep samples beyond the call return true, the source then delivers refcounted frames (copied
+	// once into a CFramePool, or wrapping the device buffer) through OnMediaFrame instead of OnMediaSample.
+	// the sink calls AddRef on the frame if it keeps it.
+	virtual bool WantsFrames() const { return false; }
+	virtual void OnMediaFrame(CMediaFrame * /*frame*/) {}
+};
+
+class CCaptureMetrics;
+
+class IFrameSource {
+public:
+	virtual ~IFrameSource() {}
+
+	virtual bool StartCapture(IMediaSink *sink) = 0;
+	virtual void StopCapture() = 0;
+
+	// valid after StartCapture succeeded
+	virtual const MediaFormat &GetFormat() const = 0;
+
+	// null if the source is not instrumented
+	virtual const CCaptureMetrics *GetCaptureMetrics() const { return nullptr; }
+};
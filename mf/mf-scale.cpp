@@ -0,0 +1,541 @@
+#include "mf-scale.h"
+#include <algorithm>
+#include <assert.h>
+#include <cstddef>
+#include <cstring>
+#include <numeric>
+
+// row pairs of the source per band, a band of 1080p nv12 is ~32KB
+#define SCALE_BAND_PAIRS 8
+
+static inline uint8_t Blend(uint32_t a, uint32_t b, uint32_t fraction)
+{
+	return uint8_t((a * (256 - fraction) + b * fraction + 128) >> 8);
+}
+
+static void BoxRowTail_C(const uint8_t *src0, const uint8_t *src1, uint8_t *dst, uint32_t x, uint32_t count)
+{
+	for (; x < count; ++x)
+		dst[x] = uint8_t((src0[x * 2] + src0[x * 2 + 1] + src1[x * 2] + src1[x * 2 + 1] + 2) >> 2);
+}
+
+// count: output UV pairs
+static void BoxUVRowTail_C(const uint8_t *src0, const uint8_t *src1, uint8_t *dst, uint32_t i, uint32_t count)
+{
+	for (; i < count; ++i) {
+		dst[i * 2] = uint8_t((src0[i * 4] + src0[i * 4 + 2] + src1[i * 4] + src1[i * 4 + 2] + 2) >> 2);
+		dst[i * 2 + 1] = uint8_t((src0[i * 4 + 1] + src0[i * 4 + 3] + src1[i * 4 + 1] + src1[i * 4 + 3] + 2) >> 2);
+	}
+}
+
+static void BlendRowTail_C(const uint8_t *src0, const uint8_t *src1, uint8_t *dst, uint32_t i, uint32_t count, uint32_t fraction)
+{
+	for (; i < count; ++i)
+		dst[i] = Blend(src0[i], src1[i], fraction);
+}
+
+static void BoxRow_C(const uint8_t *src0, const uint8_t *src1, uint8_t *dst, uint32_t count)
+{
+	BoxRowTail_C(src0, src1, dst, 0, count);
+}
+
+static void BoxUVRow_C(const uint8_t *src0, const uint8_t *src1, uint8_t *dst, uint32_t count)
+{
+	BoxUVRowTail_C(src0, src1, dst, 0, count);
+}
+
+static void BlendRow_C(const uint8_t *src0, const uint8_t *src1, uint8_t *dst, uint32_t count, uint32_t fraction)
+{
+	BlendRowTail_C(src0, src1, dst, 0, count, fraction);
+}
+
+// horizontal part of the bilinear filter, the taps make a gather which simd does not help with
+static void FilterColumns(const uint8_t *src, uint8_t *dst, const ScaleTap *taps, uint32_t count)
+{
+	for (uint32_t x = 0; x < count; ++x)
+		dst[x] = Blend(src[taps[x].index], src[taps[x].index + 1], taps[x].fraction);
+}
+
+static void FilterUVColumns(const uint8_t *src, uint8_t *dst, const ScaleTap *taps, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; ++i) {
+		const uint8_t *p = src + taps[i].index * 2;
+		dst[i * 2] = Blend(p[0], p[2], taps[i].fraction);
+		dst[i * 2 + 1] = Blend(p[1], p[3], taps[i].fraction);
+	}
+}
+
+// centers of the output pixels mapped onto the input, 8 bit fraction
+static void MakeTaps(uint32_t srcSize, uint32_t dstSize, std::vector<ScaleTap> &taps)
+{
+	taps.resize(dstSize);
+	for (uint32_t i = 0; i < dstSize; ++i) {
+		int64_t pos = int64_t(2 * i + 1) * srcSize * 256 / (2 * int64_t(dstSize)) - 128;
+		if (pos < 0)
+			pos = 0;
+
+		ScaleTap tap;
+		tap.index = uint32_t(pos >> 8);
+		tap.fraction = uint32_t(pos & 255);
+		if (tap.index + 1 >= srcSize) {
+			tap.index = srcSize >= 2 ? srcSize - 2 : 0;
+			tap.fraction = srcSize >= 2 ? 256 : 0;
+		}
+		taps[i] = tap;
+	}
+}
+
+// last input row the tap reads
+static uint32_t GetLastRow(const ScaleTap &tap)
+{
+	return tap.index + (tap.fraction ? 1 : 0);
+}
+
+#if MF_ARCH_X86
+//---------------------------------------------------------------------------------------------
+// sse2
+
+MF_TARGET_SSE2 static void BoxRow_SSE2(const uint8_t *src0, const uint8_t *src1, uint8_t *dst, uint32_t count)
+{
+	const __m128i mask = _mm_set1_epi16(0x00ff);
+	const __m128i two = _mm_set1_epi16(2);
+	uint32_t x = 0;
+	for (; x + 16 <= count; x += 16) {
+		__m128i a0 = _mm_loadu_si128((const __m128i *)(src0 + x * 2));
+		__m128i a1 = _mm_loadu_si128((const __m128i *)(src0 + x * 2 + 16));
+		__m128i b0 = _mm_loadu_si128((const __m128i *)(src1 + x * 2));
+		__m128i b1 = _mm_loadu_si128((const __m128i *)(src1 + x * 2 + 16));
+
+		// even + odd pixels of both rows
+		__m128i s0 = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a0, mask), _mm_srli_epi16(a0, 8)), _mm_add_epi16(_mm_and_si128(b0, mask), _mm_srli_epi16(b0, 8)));
+		__m128i s1 = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a1, mask), _mm_srli_epi16(a1, 8)), _mm_add_epi16(_mm_and_si128(b1, mask), _mm_srli_epi16(b1, 8)));
+		s0 = _mm_srli_epi16(_mm_add_epi16(s0, two), 2);
+		s1 = _mm_srli_epi16(_mm_add_epi16(s1, two), 2);
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(s0, s1));
+	}
+
+	BoxRowTail_C(src0, src1, dst, x, count);
+}
+
+// [u0 v0 u1 v1 ... u7 v7] of two rows -> sums of [u0+u1 v0+v1 ... u6+u7 v6+v7] as 16 bit
+MF_TARGET_SSE2 static inline __m128i SumUVBlocks_SSE2(__m128i a, __m128i b)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+	__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+	lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 4));
+	hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 4));
+	lo = _mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 2, 0));
+	hi = _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 2, 0));
+	return _mm_unpacklo_epi64(lo, hi);
+}
+
+MF_TARGET_SSE2 static void BoxUVRow_SSE2(const uint8_t *src0, const uint8_t *src1, uint8_t *dst, uint32_t count)
+{
+	const __m128i two = _mm_set1_epi16(2);
+	uint32_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m128i a0 = _mm_loadu_si128((const __m128i *)(src0 + i * 4));
+		__m128i a1 = _mm_loadu_si128((const __m128i *)(src0 + i * 4 + 16));
+		__m128i b0 = _mm_loadu_si128((const __m128i *)(src1 + i * 4));
+		__m128i b1 = _mm_loadu_si128((const __m128i *)(src1 + i * 4 + 16));
+
+		__m128i s0 = _mm_srli_epi16(_mm_add_epi16(SumUVBlocks_SSE2(a0, b0), two), 2);
+		__m128i s1 = _mm_srli_epi16(_mm_add_epi16(SumUVBlocks_SSE2(a1, b1), two), 2);
+		_mm_storeu_si128((__m128i *)(dst + i * 2), _mm_packus_epi16(s0, s1));
+	}
+
+	BoxUVRowTail_C(src0, src1, dst, i, count);
+}
+
+MF_TARGET_SSE2 static void BlendRow_SSE2(const uint8_t *src0, const uint8_t *src1, uint8_t *dst, uint32_t count, uint32_t fraction)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i w0 = _mm_set1_epi16(short(256 - fraction));
+	const __m128i w1 = _mm_set1_epi16(short(fraction));
+	const __m128i round = _mm_set1_epi16(128);
+	uint32_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(src0 + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(src1 + i));
+
+		// a * (256 - f) + b * f + 128 stays below 65536
+		__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), w0), _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), w1));
+		__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), w0), _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), w1));
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 8);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+	}
+
+	BlendRowTail_C(src0, src1, dst, i, count, fraction);
+}
+
+//---------------------------------------------------------------------------------------------
+// avx2, packus works per 128 bit lane, the qwords are put back in order with a permute
+
+MF_TARGET_AVX2 static void BoxRow_AVX2(const uint8_t *src0, const uint8_t *src1, uint8_t *dst, uint32_t count)
+{
+	const __m256i mask = _mm256_set1_epi16(0x00ff);
+	const __m256i two = _mm256_set1_epi16(2);
+	uint32_t x = 0;
+	for (; x + 32 <= count; x += 32) {
+		__m256i a0 = _mm256_loadu_si256((const __m256i *)(src0 + x * 2));
+		__m256i a1 = _mm256_loadu_si256((const __m256i *)(src0 + x * 2 + 32));
+		__m256i b0 = _mm256_loadu_si256((const __m256i *)(src1 + x * 2));
+		__m256i b1 = _mm256_loadu_si256((const __m256i *)(src1 + x * 2 + 32));
+
+		__m256i s0 = _mm256_add_epi16(_mm256_add_epi16(_mm256_and_si256(a0, mask), _mm256_srli_epi16(a0, 8)),
+					      _mm256_add_epi16(_mm256_and_si256(b0, mask), _mm256_srli_epi16(b0, 8)));
+		__m256i s1 = _mm256_add_epi16(_mm256_add_epi16(_mm256_and_si256(a1, mask), _mm256_srli_epi16(a1, 8)),
+					      _mm256_add_epi16(_mm256_and_si256(b1, mask), _mm256_srli_epi16(b1, 8)));
+		s0 = _mm256_srli_epi16(_mm256_add_epi16(s0, two), 2);
+		s1 = _mm256_srli_epi16(_mm256_add_epi16(s1, two), 2);
+		_mm256_storeu_si256((__m256i *)(dst + x), _mm256_permute4x64_epi64(_mm256_packus_epi16(s0, s1), _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+
+	BoxRowTail_C(src0, src1, dst, x, count);
+}
+
+MF_TARGET_AVX2 static inline __m256i SumUVBlocks_AVX2(__m256i a, __m256i b)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+	__m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+	lo = _mm256_add_epi16(lo, _mm256_srli_si256(lo, 4));
+	hi = _mm256_add_epi16(hi, _mm256_srli_si256(hi, 4));
+	lo = _mm256_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 2, 0));
+	hi = _mm256_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 2, 0));
+	return _mm256_unpacklo_epi64(lo, hi);
+}
+
+MF_TARGET_AVX2 static void BoxUVRow_AVX2(const uint8_t *src0, const uint8_t *src1, uint8_t *dst, uint32_t count)
+{
+	const __m256i two = _mm256_set1_epi16(2);
+	uint32_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m256i a0 = _mm256_loadu_si256((const __m256i *)(src0 + i * 4));
+		__m256i a1 = _mm256_loadu_si256((const __m256i *)(src0 + i * 4 + 32));
+		__m256i b0 = _mm256_loadu_si256((const __m256i *)(src1 + i * 4));
+		__m256i b1 = _mm256_loadu_si256((const __m256i *)(src1 + i * 4 + 32));
+
+		__m256i s0 = _mm256_srli_epi16(_mm256_add_epi16(SumUVBlocks_AVX2(a0, b0), two), 2);
+		__m256i s1 = _mm256_srli_epi16(_mm256_add_epi16(SumUVBlocks_AVX2(a1, b1), two), 2);
+		_mm256_storeu_si256((__m256i *)(dst + i * 2), _mm256_permute4x64_epi64(_mm256_packus_epi16(s0, s1), _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+
+	BoxUVRowTail_C(src0, src1, dst, i, count);
+}
+
+MF_TARGET_AVX2 static void BlendRow_AVX2(const uint8_t *src0, const uint8_t *src1, uint8_t *dst, uint32_t count, uint32_t fraction)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i w0 = _mm256_set1_epi16(short(256 - fraction));
+	const __m256i w1 = _mm256_set1_epi16(short(fraction));
+	const __m256i round = _mm256_set1_epi16(128);
+	uint32_t i = 0;
+	for (; i + 32 <= count; i += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)(src0 + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(src1 + i));
+
+		// unpack and packus are both per lane, so the order is kept
+		__m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(a, zero), w0), _mm256_mullo_epi16(_mm256_unpacklo_epi8(b, zero), w1));
+		__m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(a, zero), w0), _mm256_mullo_epi16(_mm256_unpackhi_epi8(b, zero), w1));
+		lo = _mm256_srli_epi16(_mm256_add_epi16(lo, round), 8);
+		hi = _mm256_srli_epi16(_mm256_add_epi16(hi, round), 8);
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_packus_epi16(lo, hi));
+	}
+
+	BlendRowTail_C(src0, src1, dst, i, count, fraction);
+}
+#endif
+
+//---------------------------------------------------------------------------------------------
+bool CVideoScaler::Init(uint32_t width, uint32_t height, const ScaleRendition *renditions, uint32_t count, SimdLevel level)
+{
+	m_nodes.clear();
+	m_width = 0;
+	m_height = 0;
+
+	if (!width || !height || (width & 1) || (height & 1) || !count || count > SCALE_MAX_RENDITIONS) {
+		assert(false);
+		return false;
+	}
+
+	for (uint32_t i = 0; i < count; ++i) {
+		const ScaleRendition &r = renditions[i];
+		if (!r.width || !r.height || (r.width & 1) || (r.height & 1) || r.width > width || r.height > height) {
+			assert(false);
+			return false;
+		}
+	}
+
+	if (level > GetCpuSimdLevel())
+		level = GetCpuSimdLevel();
+
+	m_width = width;
+	m_height = height;
+	m_level = level;
+
+	// largest first, so that every parent comes before its children
+	std::vector<uint32_t> order(count);
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [renditions](uint32_t a, uint32_t b) {
+		return (uint64_t)renditions[a].width * renditions[a].height > (uint64_t)renditions[b].width * renditions[b].height;
+	});
+
+	m_nodes.resize(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		ScaleNode &node = m_nodes[i];
+		node.rendition = order[i];
+		node.width = renditions[order[i]].width;
+		node.height = renditions[order[i]].height;
+
+		// an image of twice the size for the box filter, else the smallest image which is at least as large.
+		// copies are never parents
+		uint32_t parentWidth = width;
+		uint32_t parentHeight = height;
+		node.parent = -1;
+		for (uint32_t j = 0; j < i && !(parentWidth == node.width * 2 && parentHeight == node.height * 2); ++j) {
+			const ScaleNode &other = m_nodes[j];
+			if (other.kind == SCALE_COPY || other.width < node.width || other.height < node.height)
+				continue;
+
+			if ((other.width == node.width * 2 && other.height == node.height * 2) || (uint64_t)other.width * other.height < (uint64_t)parentWidth * parentHeight) {
+				node.parent = (int)j;
+				parentWidth = other.width;
+				parentHeight = other.height;
+			}
+		}
+		node.parentWidth = parentWidth;
+
+		const uint32_t pairs = node.height / 2;
+		node.needed.resize(pairs);
+		if (parentWidth == node.width && parentHeight == node.height) {
+			node.kind = SCALE_COPY;
+			for (uint32_t k = 0; k < pairs; ++k)
+				node.needed[k] = k + 1;
+		} else if (parentWidth == node.width * 2 && parentHeight == node.height * 2) {
+			node.kind = SCALE_BOX;
+			for (uint32_t k = 0; k < pairs; ++k)
+				node.needed[k] = k * 2 + 2;
+		} else {
+			node.kind = SCALE_BILINEAR;
+			MakeTaps(parentWidth, node.width, node.columns);
+			MakeTaps(parentWidth / 2, node.width / 2, node.uvColumns);
+			MakeTaps(parentHeight, node.height, node.rows);
+			MakeTaps(parentHeight / 2, node.height / 2, node.uvRows);
+			node.blended.resize(parentWidth);
+
+			for (uint32_t k = 0; k < pairs; ++k) {
+				uint32_t last = (std::max)(GetLastRow(node.rows[k * 2]), GetLastRow(node.rows[k * 2 + 1])) / 2;
+				last = (std::max)(last, GetLastRow(node.uvRows[k]));
+				node.needed[k] = (std::min)(last + 1, parentHeight / 2);
+			}
+		}
+	}
+
+#if MF_ARCH_X86
+	const bool avx2 = level >= SIMD_AVX2;
+	const bool sse2 = level >= SIMD_SSE2;
+#else
+	const bool avx2 = false;
+	const bool sse2 = false;
+#endif
+
+	m_boxRow = BoxRow_C;
+	m_boxUVRow = BoxUVRow_C;
+	m_blendRow = BlendRow_C;
+#if MF_ARCH_X86
+	if (sse2) {
+		m_boxRow = avx2 ? BoxRow_AVX2 : BoxRow_SSE2;
+		m_boxUVRow = avx2 ? BoxUVRow_AVX2 : BoxUVRow_SSE2;
+		m_blendRow = avx2 ? BlendRow_AVX2 : BlendRow_SSE2;
+	}
+#endif
+
+	(void)avx2;
+	(void)sse2;
+	return true;
+}
+
+ScaleRendition CVideoScaler::GetRendition(uint32_t index) const
+{
+	ScaleRendition rendition;
+	for (const ScaleNode &node : m_nodes) {
+		if (node.rendition == index) {
+			rendition.width = node.width;
+			rendition.height = node.height;
+		}
+	}
+	return rendition;
+}
+
+uint32_t CVideoScaler::Scale(CMediaFrame *frame, CFramePool *pool, FramePtr *frames)
+{
+	const MediaSample &sample = frame->GetSample();
+	const MediaFormat &format = frame->GetFormat();
+	if (m_nodes.empty() || !format.video || format.subtype != MEDIA_SUBTYPE_NV12 || format.width != m_width || format.height != m_height || sample.planeCount < 2) {
+		assert(false);
+		return 0;
+	}
+
+	uint8_t *dst[SCALE_MAX_RENDITIONS] = {};
+	for (const ScaleNode &node : m_nodes) {
+		FramePtr &output = frames[node.rendition];
+		output = FramePtr();
+
+		const FramePtr *parent = node.parent >= 0 ? &frames[m_nodes[node.parent].rendition] : nullptr;
+		if (parent && !*parent)
+			continue;
+
+		// same size as the parent, no need to copy
+		if (node.kind == SCALE_COPY) {
+			output = parent ? *parent : FramePtr(frame);
+			continue;
+		}
+
+		MediaFormat outputFormat = format;
+		outputFormat.width = node.width;
+		outputFormat.height = node.height;
+		output = pool->Acquire(GetVideoFrameSize(outputFormat));
+		if (!output)
+			continue;
+
+		output->SetSample(outputFormat, sample.timestamp, sample.flags);
+		dst[node.rendition] = output->GetBuffer();
+	}
+
+	if (!Scale(sample.planes, dst))
+		return 0;
+
+	uint32_t produced = 0;
+	for (uint32_t i = 0; i < m_nodes.size(); ++i) {
+		if (frames[i])
+			++produced;
+	}
+	return produced;
+}
+
+bool CVideoScaler::Scale(const MediaPlane *src, uint8_t *const *dst)
+{
+	if (m_nodes.empty()) {
+		assert(false);
+		return false;
+	}
+
+	// [0] is the source, [i + 1] node i
+	ScalePlanes planes[SCALE_MAX_RENDITIONS + 1];
+	planes[0].y = src[0].data;
+	planes[0].strideY = src[0].stride;
+	planes[0].uv = src[1].data;
+	planes[0].strideUV = src[1].stride;
+
+	uint8_t *outputs[SCALE_MAX_RENDITIONS];
+	for (uint32_t i = 0; i < m_nodes.size(); ++i) {
+		const ScaleNode &node = m_nodes[i];
+		outputs[i] = dst[node.rendition];
+		if (node.parent >= 0 && !outputs[node.parent])
+			outputs[i] = nullptr;
+
+		planes[i + 1].y = outputs[i];
+		planes[i + 1].strideY = node.width;
+		planes[i + 1].uv = outputs[i] ? outputs[i] + (size_t)node.width * node.height : nullptr;
+		planes[i + 1].strideUV = node.width;
+	}
+
+	if (m_pTiles && m_pTiles->GetThreadCount() > 1) {
+		// parents come first, so every node reads a complete parent
+		for (uint32_t i = 0; i < m_nodes.size(); ++i) {
+			ScaleNode &node = m_nodes[i];
+			if (!outputs[i])
+				continue;
+
+			if (node.kind == SCALE_BILINEAR)
+				node.blended.resize((size_t)node.parentWidth * m_pTiles->GetThreadCount());
+
+			MediaFormat format;
+			format.subtype = MEDIA_SUBTYPE_NV12;
+			format.width = node.width;
+			format.height = node.height;
+
+			m_pNode = &node;
+			m_pParent = &planes[node.parent + 1];
+			m_pOutput = outputs[i];
+			m_pTiles->Run(this, format, 2);
+			m_pNode = nullptr;
+		}
+		return true;
+	}
+
+	// every node goes as far as the rows of its parent allow, then the next band of the source is taken
+	uint32_t done[SCALE_MAX_RENDITIONS] = {};
+	const uint32_t pairs = m_height / 2;
+	for (uint32_t band = 0; band < pairs; band += SCALE_BAND_PAIRS) {
+		const uint32_t ready = (std::min)(band + SCALE_BAND_PAIRS, pairs);
+		for (uint32_t i = 0; i < m_nodes.size(); ++i) {
+			ScaleNode &node = m_nodes[i];
+			if (!outputs[i])
+				continue;
+
+			const uint32_t parentReady = node.parent >= 0 ? done[node.parent] : ready;
+			while (done[i] < node.height / 2 && node.needed[done[i]] <= parentReady)
+				ScaleRowPair(node, done[i]++, planes[node.parent + 1], outputs[i]);
+		}
+	}
+	return true;
+}
+
+void CVideoScaler::ScaleRowPair(ScaleNode &node, uint32_t pair, const ScalePlanes &src, uint8_t *dst, uint32_t worker)
+{
+	const uint32_t width = node.width;
+	uint8_t *dstY = dst + (size_t)pair * 2 * width;
+	uint8_t *dstUV = dst + (size_t)width * node.height + (size_t)pair * width;
+
+	switch (node.kind) {
+	case SCALE_COPY:
+		memcpy(dstY, src.y + (ptrdiff_t)pair * 2 * src.strideY, width);
+		memcpy(dstY + width, src.y + (ptrdiff_t)(pair * 2 + 1) * src.strideY, width);
+		memcpy(dstUV, src.uv + (ptrdiff_t)pair * src.strideUV, width);
+		break;
+
+	case SCALE_BOX:
+		for (uint32_t r = 0; r < 2; ++r) {
+			const uint8_t *row = src.y + (ptrdiff_t)(pair * 4 + r * 2) * src.strideY;
+			m_boxRow(row, row + src.strideY, dstY + r * width, width);
+		}
+		m_boxUVRow(src.uv + (ptrdiff_t)pair * 2 * src.strideUV, src.uv + (ptrdiff_t)(pair * 2 + 1) * src.strideUV, dstUV, width / 2);
+		break;
+
+	default: {
+		// vertical into one row, unless the tap hits a row exactly, then horizontal
+		const uint32_t parentWidth = node.parentWidth;
+		for (uint32_t r = 0; r < 3; ++r) {
+			const bool uv = r == 2;
+			const ScaleTap &tap = uv ? node.uvRows[pair] : node.rows[pair * 2 + r];
+			const uint8_t *plane = uv ? src.uv : src.y;
+			const ptrdiff_t stride = uv ? src.strideUV : src.strideY;
+
+			const uint8_t *row = plane + (ptrdiff_t)tap.index * stride;
+			if (tap.fraction == 256) {
+				row += stride;
+			} else if (tap.fraction) {
+				uint8_t *blended = node.blended.data() + (size_t)worker * parentWidth;
+				m_blendRow(row, row + stride, blended, parentWidth, tap.fraction);
+				row = blended;
+			}
+
+			if (uv)
+				FilterUVColumns(row, dstUV, node.uvColumns.data(), width / 2);
+			else
+				FilterColumns(row, dstY + r * width, node.columns.data(), width);
+		}
+		break;
+	}
+	}
+}
+
+void CVideoScaler::RunRows(uint32_t rowBegin, uint32_t rowEnd, uint32_t worker)
+{
+	for (uint32_t pair = rowBegin / 2; pair < rowEnd / 2; ++pair)
+		ScaleRowPair(*m_pNode, pair, *m_pParent, m_pOutput, worker);
+}
@@ -0,0 +1,102 @@
+﻿#pragma once
+#include "mf-cpu.h"
+#include "mf-frame.h"
+#include "mf-tiling.h"
+#include <vector>
+
+#define SCALE_MAX_RENDITIONS 8
+
+struct ScaleRendition {
+	uint32_t width = 0;  // even
+	uint32_t height = 0; // even
+};
+
+// one output pixel / row of the bilinear filter
+struct ScaleTap {
+	uint32_t index;    // first of the two input pixels / rows
+	uint32_t fraction; // weight of the second, 0..256
+};
+
+typedef void (*BoxRowFunc)(const uint8_t *src0, const uint8_t *src1, uint8_t *dst, uint32_t count);
+typedef void (*BlendRowFunc)(const uint8_t *src0, const uint8_t *src1, uint8_t *dst, uint32_t count, uint32_t fraction);
+
+// NV12 -> several smaller NV12 renditions of the same frame, e.g. 720p + 360p + 180p for simulcast.
+// the renditions form a pyramid: each one is scaled from the smallest larger image, which is the source or another
+// rendition. an exact half is a 2x2 box filter, any other ratio is bilinear. all renditions are produced in one pass
+// over the source in bands of rows, so a rendition reads its parent's rows while they are still in the cache.
+// every simd kernel produces exactly the same bytes as the scalar one.
+class CVideoScaler : private ITileStage {
+public:
+	// renditions must not be larger than the source, their order is kept in Scale
+	bool Init(uint32_t width, uint32_t height, const ScaleRendition *renditions, uint32_t count, SimdLevel level = GetSimdLevel());
+
+	uint32_t GetWidth() const { return m_width; }
+	uint32_t GetHeight() const { return m_height; }
+	uint32_t GetRenditionCount() const { return (uint32_t)m_nodes.size(); }
+	ScaleRendition GetRendition(uint32_t index) const;
+	SimdLevel GetLevel() const { return m_level; }
+
+	// frames[i] receives rendition i in a frame of `pool` with the timing of `frame`, or null if the pool is exhausted.
+	// a rendition of the source size is `frame` itself. returns the number of renditions produced
+	uint32_t Scale(CMediaFrame *frame, CFramePool *pool, FramePtr *frames);
+
+	// src planes as produced by DescribeVideoPlanes, dst[i] is a tight NV12 buffer for rendition i.
+	// a null dst skips the rendition, and then also the renditions scaled from it
+	bool Scale(const MediaPlane *src, uint8_t *const *dst);
+
+	// with an executor, each rendition is scaled in bands on its threads once its parent is complete, instead of all
+	// renditions in one pass on the calling thread. null goes back to one pass
+	void SetExecutor(CTileExecutor *tiles) { m_pTiles = tiles; }
+
+private:
+	enum {
+		SCALE_COPY,
+		SCALE_BOX,
+		SCALE_BILINEAR,
+	};
+
+	struct ScaleNode {
+		uint32_t rendition = 0; // index given to Init
+		uint32_t width = 0;
+		uint32_t height = 0;
+		int parent = -1; // node, -1 is the source
+		uint32_t parentWidth = 0;
+		int kind = SCALE_COPY;
+
+		// row pairs (two luma rows and one chroma row) of the parent needed before each row pair of this node
+		std::vector<uint32_t> needed;
+
+		// bilinear
+		std::vector<ScaleTap> columns;   // per luma column
+		std::vector<ScaleTap> uvColumns; // per chroma pair
+		std::vector<ScaleTap> rows;      // per luma row
+		std::vector<ScaleTap> uvRows;    // per chroma row
+		std::vector<uint8_t> blended;    // one parent row per worker, blended vertically
+	};
+
+	struct ScalePlanes {
+		const uint8_t *y;
+		ptrdiff_t strideY;
+		const uint8_t *uv;
+		ptrdiff_t strideUV;
+	};
+
+	void ScaleRowPair(ScaleNode &node, uint32_t pair, const ScalePlanes &src, uint8_t *dst, uint32_t worker = 0);
+	void RunRows(uint32_t rowBegin, uint32_t rowEnd, uint32_t worker) override;
+
+private:
+	uint32_t m_width = 0;
+	uint32_t m_height = 0;
+	SimdLevel m_level = SIMD_SCALAR;
+	std::vector<ScaleNode> m_nodes; // parents first
+
+	BoxRowFunc m_boxRow = nullptr;
+	BoxRowFunc m_boxUVRow = nullptr;
+	BlendRowFunc m_blendRow = nullptr;
+
+	CTileExecutor *m_pTiles = nullptr;
+	// node being scaled in bands
+	ScaleNode *m_pNode = nullptr;
+	const ScalePlanes *m_pParent = nullptr;
+	uint8_t *m_pOutput = nullptr;
+};
@@ -0,0 +1,349 @@
+#include "mf-source.h"
+#include "mf-portable.hpp"
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+CStandInSource::CStandInSource(const MediaFormat &format, bool realtime) : m_format(format), m_bRealtime(realtime) {}
+
+CStandInSource::~CStandInSource()
+{
+	assert(!m_thread.joinable());
+}
+
+uint32_t CStandInSource::GetSampleSize() const
+{
+	if (m_format.video)
+		return GetVideoFrameSize(m_format);
+
+	// 10ms per chunk
+	return m_format.sampleRate / 100 * m_format.channels * (m_format.bitsPerSample / 8);
+}
+
+int64_t CStandInSource::GetSampleTime(uint64_t index) const
+{
+	if (m_format.video)
+		return int64_t(index * 10000000ULL * m_format.fpsDen / m_format.fpsNum);
+
+	return int64_t(index * 100000ULL); // 10ms
+}
+
+bool CStandInSource::StartCapture(IMediaSink *sink)
+{
+	if (m_bRunning || !sink) {
+		assert(false);
+		return false;
+	}
+
+	const bool sized = IsCompressedVideo(m_format.subtype) ? ReadsRecords() : GetVideoFrameSize(m_format) != 0;
+	if (m_format.video ? (!sized || !m_format.fpsNum || !m_format.fpsDen) : (!m_format.channels || !m_format.sampleRate || !m_format.bitsPerSample)) {
+		assert(false);
+		return false;
+	}
+
+	if (!OnStart())
+		return false;
+
+	m_pSink = sink;
+	if (sink->WantsFrames() && !m_pool)
+		m_pool = CFramePool::Create();
+	m_buffer.resize(GetSampleSize());
+	m_sampleCount = 0;
+	m_metrics.Reset();
+	if (m_format.video && m_bRealtime)
+		m_metrics.SetNominalInterval((int64_t)m_format.fpsDen * 1000000000 / m_format.fpsNum);
+	m_bFinished = false;
+	m_bRunning = true;
+	m_thread = std::thread(&CStandInSource::ThreadFunc, this);
+	return true;
+}
+
+void CStandInSource::StopCapture()
+{
+	m_bRunning = false;
+	if (m_thread.joinable()) {
+		m_thread.join();
+		OnStop();
+	}
+}
+
+bool CStandInSource::ReadSample(uint64_t index, uint8_t *buffer, uint32_t size, MediaSample &sample)
+{
+	sample.timestamp = GetSampleTime(index);
+	if (!FillSample(index, buffer, size))
+		return false;
+
+	if (m_format.video) {
+		sample.planeCount = DescribeVideoPlanes(m_format, buffer, GetVideoDefaultStride(m_format), sample.planes);
+	} else {
+		sample.planes[0].data = buffer;
+		sample.planes[0].size = size;
+		sample.planeCount = 1;
+	}
+	return true;
+}
+
+void CStandInSource::ThreadFunc()
+{
+	const int64_t startTime = GetMonotonicTime100ns();
+	const uint32_t size = (uint32_t)m_buffer.size();
+
+	uint64_t index = 0;
+	int64_t firstTimestamp = 0; // paced relative to the first sample, recorded timestamps start anywhere
+	while (m_bRunning) {
+		MediaSample sample;
+		sample.format = &m_format;
+		if (!ReadSample(index, m_buffer.data(), size, sample)) {
+			sample = MediaSample();
+			sample.format = &m_format;
+			sample.timestamp = GetSampleTime(index);
+			sample.flags = MEDIA_SAMPLE_FLAG_END_OF_STREAM;
+			if (!DeliverSample(m_pSink, m_pool.Get(), sample))
+				m_metrics.AddDropped();
+			m_bFinished = true;
+			break;
+		}
+
+		if (!index)
+			firstTimestamp = sample.timestamp;
+		if (m_bRealtime)
+			SleepUntil100ns(startTime + sample.timestamp - firstTimestamp);
+
+		const int64_t begin = GetMonotonicTimeNs();
+		m_metrics.RecordSample(begin);
+		if (!DeliverSample(m_pSink, m_pool.Get(), sample))
+			m_metrics.AddDropped();
+		m_metrics.RecordCallback(GetMonotonicTimeNs() - begin);
+		m_sampleCount = ++index;
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+CSyntheticSource::CSyntheticSource(const MediaFormat &format, bool realtime, uint64_t maxSamples) : CStandInSource(format, realtime), m_maxSamples(maxSamples) {}
+
+bool CSyntheticSource::FillSample(uint64_t index, uint8_t *buffer, uint32_t size)
+{
+	if (m_maxSamples && index >= m_maxSamples)
+		return false;
+
+	if (m_format.video && m_format.subtype != MEDIA_SUBTYPE_NV12) {
+		// any other raw format: just moving bytes
+		for (uint32_t i = 0; i < size; ++i)
+			buffer[i] = uint8_t(i + index * 4);
+		return true;
+	}
+
+	if (m_format.video) {
+		// diagonal gradient moving by 4 pixels per frame
+		const uint32_t width = m_format.width;
+		const uint32_t height = m_format.height;
+		const uint32_t offset = uint32_t(index * 4);
+		for (uint32_t y = 0; y < height; ++y) {
+			uint8_t *row = buffer + y * width;
+			for (uint32_t x = 0; x < width; ++x)
+				row[x] = uint8_t(x + y + offset);
+		}
+
+		uint8_t *uv = buffer + width * height;
+		for (uint32_t y = 0; y < height / 2; ++y) {
+			for (uint32_t x = 0; x < width; x += 2) {
+				uv[x] = uint8_t(128 + (x >> 3));
+				uv[x + 1] = uint8_t(128 - (y >> 2));
+			}
+			uv += width;
+		}
+		return true;
+	}
+
+	const uint32_t bytesPerSample = m_format.bitsPerSample / 8;
+	const uint32_t frames = size / (bytesPerSample * m_format.channels);
+	const uint64_t first = index * frames;
+	for (uint32_t i = 0; i < frames; ++i) {
+		double value = 0.5 * sin(2.0 * 3.14159265358979 * 440.0 * double(first + i) / double(m_format.sampleRate));
+		for (uint32_t c = 0; c < m_format.channels; ++c) {
+			uint8_t *dst = buffer + (i * m_format.channels + c) * bytesPerSample;
+			if (m_format.subtype == MEDIA_SUBTYPE_FLOAT && bytesPerSample == 4) {
+				float f = float(value);
+				memcpy(dst, &f, 4);
+			} else {
+				// little endian signed pcm of any width, 8bit pcm is unsigned
+				int32_t s = int32_t(value * 2147483647.0);
+				for (uint32_t b = 0; b < bytesPerSample; ++b)
+					dst[b] = uint8_t(s >> (32 - 8 * (bytesPerSample - b)));
+				if (bytesPerSample == 1)
+					dst[0] ^= 0x80;
+			}
+		}
+	}
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+CFileReplaySource::CFileReplaySource(const MediaFormat &format, const char *path, bool realtime, bool loop)
+	: CStandInSource(format, realtime), m_path(path ? path : ""), m_bLoop(loop)
+{
+}
+
+bool CFileReplaySource::OnStart()
+{
+	assert(!m_file);
+	m_file = OpenFile(m_path.c_str(), "rb");
+	return !!m_file;
+}
+
+void CFileReplaySource::OnStop()
+{
+	if (m_file) {
+		fclose(m_file);
+		m_file = nullptr;
+	}
+}
+
+bool CFileReplaySource::FillSample(uint64_t /*index*/, uint8_t *buffer, uint32_t size)
+{
+	size_t read = fread(buffer, 1, size, m_file);
+	if (read == size)
+		return true;
+
+	if (!m_bLoop)
+		return false;
+
+	// the dump is shorter than one sample, or we reached the end: rewind
+	fseek(m_file, 0, SEEK_SET);
+	if (fread(buffer, 1, size, m_file) != size)
+		return false;
+
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+CContainerReplaySource::CContainerReplaySource(const char *path, bool realtime, bool loop) : CStandInSource(MediaFormat(), realtime), m_bLoop(loop)
+{
+	if (path && m_reader.Open(path))
+		m_format = m_reader.GetFormat();
+}
+
+bool CContainerReplaySource::OnStart()
+{
+	m_frame = 0;
+	m_loopOffset = 0;
+	return IsValid();
+}
+
+bool CContainerReplaySource::ReadSample(uint64_t /*index*/, uint8_t * /*buffer*/, uint32_t /*size*/, MediaSample &sample)
+{
+	const uint64_t count = m_reader.GetFrameCount();
+	if (m_frame == count) {
+		if (!m_bLoop)
+			return false;
+
+		// a single record has no interval of its own, it repeats at the nominal rate
+		const int64_t span = m_reader.GetIndexEntry(count - 1)->timestamp - m_reader.GetIndexEntry(0)->timestamp;
+		m_loopOffset += span + (count > 1 ? span / int64_t(count - 1) : GetSampleTime(1));
+		m_frame = 0;
+	}
+
+	if (!m_reader.GetFrame(m_frame, sample))
+		return false;
+
+	sample.format = &m_format;
+	sample.timestamp += m_loopOffset;
+	++m_frame;
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+CFaultInjectionSource::CFaultInjectionSource(std::shared_ptr<IFrameSource> inner, const FaultInjectionOptions &options)
+    : m_inner(std::move(inner)), m_options(options), m_recovery(this, &m_metrics)
+{
+}
+
+bool CFaultInjectionSource::StartCapture(IMediaSink *sink)
+{
+	if (m_bOpen || !sink) {
+		assert(false);
+		return false;
+	}
+
+	m_pSink = sink;
+	m_samples = 0;
+	m_bLost = false;
+	m_failedReopens = 0;
+	m_recovery.Enable();
+	bool started = false;
+	{
+		// the first sample may already be a loss, the recovery closes the inner source once it is started
+		std::lock_guard<std::mutex> lock(m_deviceMutex);
+		m_bOpen = started = m_inner->StartCapture(this);
+	}
+	if (!started)
+		m_recovery.Disable();
+	return started;
+}
+
+void CFaultInjectionSource::StopCapture()
+{
+	// first, so that the inner source is not reopened behind our back
+	m_recovery.Disable();
+	CloseDevice();
+}
+
+bool CFaultInjectionSource::OnDeviceSample()
+{
+	if (m_bLost)
+		return false; // until CloseDevice stops the inner source
+
+	if (m_options.lossEvery && ++m_samples % m_options.lossEvery == 0) {
+		m_bLost = true;
+		m_recovery.OnDeviceLost();
+		return false;
+	}
+
+	m_metrics.RecordSample(GetMonotonicTimeNs());
+	return true;
+}
+
+void CFaultInjectionSource::OnMediaSample(const MediaSample &sample)
+{
+	if (!OnDeviceSample())
+		return;
+
+	MediaSample copy = sample;
+	copy.flags |= m_recovery.OnSample();
+	m_pSink->OnMediaSample(copy);
+}
+
+void CFaultInjectionSource::OnMediaFrame(CMediaFrame *frame)
+{
+	if (!OnDeviceSample())
+		return;
+
+	// nobody else holds the frame yet
+	const uint32_t flags = m_recovery.OnSample();
+	if (flags)
+		frame->SetTiming(frame->GetTimestamp(), frame->GetFlags() | flags);
+	m_pSink->OnMediaFrame(frame);
+}
+
+void CFaultInjectionSource::CloseDevice()
+{
+	std::lock_guard<std::mutex> lock(m_deviceMutex);
+	if (m_bOpen)
+		m_inner->StopCapture();
+	m_bOpen = false;
+}
+
+bool CFaultInjectionSource::ReopenDevice()
+{
+	if (m_failedReopens < m_options.failedReopens) {
+		++m_failedReopens;
+		return false;
+	}
+
+	m_failedReopens = 0;
+	m_bLost = false;
+	std::lock_guard<std::mutex> lock(m_deviceMutex);
+	m_bOpen = m_inner->StartCapture(this);
+	return m_bOpen;
+}
@@ -0,0 +1,164 @@
+﻿#pragma once
+#include "mf-container.h"
+#include "mf-frame.h"
+#include "mf-metrics.h"
+#include "mf-recovery.h"
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// stand-in for a capture device: a worker thread produces samples of a fixed format and pushes
+// them to the sink, either paced like a real device (by the sample timestamps) or as fast as possible for profiling.
+// derived classes must call StopCapture in their destructor, the thread calls their ReadSample or FillSample.
+class CStandInSource : public IFrameSource {
+public:
+	CStandInSource(const MediaFormat &format, bool realtime);
+	virtual ~CStandInSource();
+
+	bool StartCapture(IMediaSink *sink) override;
+	void StopCapture() override;
+	const MediaFormat &GetFormat() const override { return m_format; }
+
+	uint64_t GetSampleCount() const { return m_sampleCount; }
+	uint64_t GetDroppedCount() const { return m_metrics.GetDroppedCount(); }
+	// the same metrics as CMFCapture, the callback is the delivery to the sink
+	const CCaptureMetrics &GetMetrics() const { return m_metrics; }
+	const CCaptureMetrics *GetCaptureMetrics() const override { return &m_metrics; }
+	bool IsFinished() const { return m_bFinished; }
+
+	// bytes of one video frame or of one 10ms audio chunk
+	uint32_t GetSampleSize() const;
+	int64_t GetSampleTime(uint64_t index) const;
+
+protected:
+	virtual bool OnStart() { return true; }
+	virtual void OnStop() {}
+	// the sample `index` with its timestamp and flags, the planes may point anywhere valid until the next call.
+	// by default FillSample writes GetSampleSize bytes into `buffer`, stamped with GetSampleTime. returns false at the end of stream
+	virtual bool ReadSample(uint64_t index, uint8_t *buffer, uint32_t size, MediaSample &sample);
+	virtual bool FillSample(uint64_t /*index*/, uint8_t * /*buffer*/, uint32_t /*size*/) { return false; }
+	// compressed video has no fixed frame size, only a ReadSample which hands out whole records can deliver it
+	virtual bool ReadsRecords() const { return false; }
+
+	MediaFormat m_format;
+
+private:
+	void ThreadFunc();
+
+private:
+	const bool m_bRealtime;
+	IMediaSink *m_pSink = nullptr;
+	CRefPtr<CFramePool> m_pool; // for sinks which want frames
+	std::vector<uint8_t> m_buffer;
+
+	std::thread m_thread;
+	std::atomic<bool> m_bRunning{false};
+	std::atomic<bool> m_bFinished{false};
+	std::atomic<uint64_t> m_sampleCount{0};
+	CCaptureMetrics m_metrics;
+};
+
+// moving test pattern for video (a real gradient for NV12), 440Hz sine for pcm/float audio
+class CSyntheticSource : public CStandInSource {
+public:
+	CSyntheticSource(const MediaFormat &format, bool realtime, uint64_t maxSamples = 0);
+	~CSyntheticSource() { StopCapture(); }
+
+protected:
+	bool FillSample(uint64_t index, uint8_t *buffer, uint32_t size) override;
+
+private:
+	const uint64_t m_maxSamples; // 0: endless
+};
+
+// replays a headerless raw dump (back to back NV12 frames, or pcm), the format must be the one used while recording.
+// the dumps of older builds (input.nv12 / input.pcm) are in this form.
+class CFileReplaySource : public CStandInSource {
+public:
+	CFileReplaySource(const MediaFormat &format, const char *path, bool realtime, bool loop);
+	~CFileReplaySource() { StopCapture(); }
+
+protected:
+	bool OnStart() override;
+	void OnStop() override;
+	bool FillSample(uint64_t index, uint8_t *buffer, uint32_t size) override;
+
+private:
+	const std::string m_path;
+	const bool m_bLoop;
+	FILE *m_file = nullptr;
+};
+
+// replays a container written by CMediaPipeline (video.mfc / audio.mfc) in the format stored in the file.
+// every record is one sample with the timestamp and flags it was recorded with, straight out of the mapping, so
+// compressed dumps (MFLZ, MJPG) come out frame by frame as the device or the pipeline wrote them.
+// a loop goes on one mean record interval after the last timestamp, so the time keeps increasing.
+class CContainerReplaySource : public CStandInSource {
+public:
+	CContainerReplaySource(const char *path, bool realtime, bool loop);
+	~CContainerReplaySource() { StopCapture(); }
+
+	bool IsValid() const { return m_reader.GetFrameCount() != 0; }
+
+protected:
+	bool OnStart() override;
+	bool ReadSample(uint64_t index, uint8_t *buffer, uint32_t size, MediaSample &sample) override;
+	bool ReadsRecords() const override { return true; }
+
+private:
+	const bool m_bLoop;
+	CContainerReader m_reader;
+	uint64_t m_frame = 0;     // next record to read
+	int64_t m_loopOffset = 0; // added to the timestamps of the current round
+};
+
+struct FaultInjectionOptions {
+	uint64_t lossEvery = 0;     // samples between two device losses, 0: never
+	uint32_t failedReopens = 2; // reopen attempts which fail before the device is back
+};
+
+// runs a stand-in through the device loss recovery of CMFCapture: every lossEvery samples the device is lost, the
+// callback reports it as the source reader would, and CDeviceRecovery closes and reopens the inner source, which
+// fails the first failedReopens times. the inner source starts its timestamps over, as a new device would.
+class CFaultInjectionSource : public IFrameSource, private IMediaSink, private IRecoverableDevice {
+public:
+	CFaultInjectionSource(std::shared_ptr<IFrameSource> inner, const FaultInjectionOptions &options);
+	~CFaultInjectionSource() { StopCapture(); }
+
+	bool StartCapture(IMediaSink *sink) override;
+	void StopCapture() override;
+	const MediaFormat &GetFormat() const override { return m_inner->GetFormat(); }
+
+	// losses and outages, the rest comes from the inner source
+	const CCaptureMetrics *GetCaptureMetrics() const override { return &m_metrics; }
+	CDeviceRecovery &GetRecovery() { return m_recovery; }
+
+private:
+	// IMediaSink, called by the inner source
+	void OnMediaSample(const MediaSample &sample) override;
+	bool WantsFrames() const override { return m_pSink->WantsFrames(); }
+	void OnMediaFrame(CMediaFrame *frame) override;
+	// false once the device is lost
+	bool OnDeviceSample();
+
+	// IRecoverableDevice
+	void CloseDevice() override;
+	bool ReopenDevice() override;
+
+private:
+	std::shared_ptr<IFrameSource> m_inner;
+	const FaultInjectionOptions m_options;
+	IMediaSink *m_pSink = nullptr;
+	CCaptureMetrics m_metrics;
+	CDeviceRecovery m_recovery;
+
+	uint64_t m_samples = 0;
+	std::atomic<bool> m_bLost{false};
+	std::mutex m_deviceMutex; // StartCapture against the recovery thread
+	bool m_bOpen = false;
+	uint32_t m_failedReopens = 0;
+};
@@ -0,0 +1,71 @@
+﻿#pragma once
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#define MF_CACHE_LINE 64
+
+// bounded lock-free queue for exactly one producer thread and one consumer thread.
+// head and tail live on their own cache lines, each side keeps a cached copy of the other index so that
+// the shared line is only read when the queue looks full/empty.
+template<class T> class CSpscQueue {
+public:
+	// capacity is rounded up to a power of two
+	explicit CSpscQueue(uint32_t capacity)
+	{
+		uint32_t size = 2;
+		while (size < capacity)
+			size *= 2;
+		m_items.resize(size);
+		m_mask = size - 1;
+	}
+
+	uint32_t GetCapacity() const { return m_mask + 1; }
+
+	// approximate when called from a third thread
+	uint32_t GetSize() const { return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire); }
+
+	// producer only
+	bool TryPush(const T &item)
+	{
+		const uint32_t tail = m_tail.load(std::memory_order_relaxed);
+		if (tail - m_cachedHead > m_mask) {
+			m_cachedHead = m_head.load(std::memory_order_acquire);
+			if (tail - m_cachedHead > m_mask)
+				return false;
+		}
+
+		m_items[tail & m_mask] = item;
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// consumer only
+	bool TryPop(T &item)
+	{
+		const uint32_t head = m_head.load(std::memory_order_relaxed);
+		if (head == m_cachedTail) {
+			m_cachedTail = m_tail.load(std::memory_order_acquire);
+			if (head == m_cachedTail)
+				return false;
+		}
+
+		item = m_items[head & m_mask];
+		m_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	std::vector<T> m_items;
+	uint32_t m_mask = 0;
+
+	char m_pad0[MF_CACHE_LINE];
+	std::atomic<uint32_t> m_head{0}; // written by the consumer
+	uint32_t m_cachedTail = 0;
+
+	char m_pad1[MF_CACHE_LINE];
+	std::atomic<uint32_t> m_tail{0}; // written by the producer
+	uint32_t m_cachedHead = 0;
+
+	char m_pad2[MF_CACHE_LINE];
+};
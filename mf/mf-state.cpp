@@ -0,0 +1,108 @@
+#include "mf-state.h"
+#include "mf-portable.hpp"
+#include <assert.h>
+#include <thread>
+
+const char *GetCaptureStateString(CaptureState state)
+{
+	switch (state) {
+	case CAPTURE_IDLE:
+		return "idle";
+	case CAPTURE_STARTING:
+		return "starting";
+	case CAPTURE_RUNNING:
+		return "running";
+	case CAPTURE_DRAINING:
+		return "draining";
+	case CAPTURE_STOPPED:
+		return "stopped";
+	}
+	return "unknown";
+}
+
+bool CCaptureStateMachine::BeginStart()
+{
+	int state = m_state.load();
+	while (state == CAPTURE_IDLE || state == CAPTURE_STOPPED) {
+		if (m_state.compare_exchange_weak(state, CAPTURE_STARTING))
+			return true;
+	}
+	return false;
+}
+
+void CCaptureStateMachine::EndStart(bool started)
+{
+	assert(m_state.load() == CAPTURE_STARTING);
+	if (started)
+		m_starts.store(m_starts.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	m_state = started ? CAPTURE_RUNNING : CAPTURE_STOPPED;
+}
+
+bool CCaptureStateMachine::BeginStop()
+{
+	int state = m_state.load();
+	for (;;) {
+		if (state == CAPTURE_STARTING) {
+			// takes as long as opening the reader, not worth a wait object
+			std::this_thread::yield();
+			state = m_state.load();
+			continue;
+		}
+		if (state != CAPTURE_RUNNING)
+			return false;
+		if (m_state.compare_exchange_weak(state, CAPTURE_DRAINING))
+			break;
+	}
+
+	m_stopBegin = GetMonotonicTimeNs();
+	return true;
+}
+
+void CCaptureStateMachine::WaitDrained()
+{
+	assert(m_state.load() == CAPTURE_DRAINING);
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_cv.wait(lock, [this]() { return m_inside.load() == 0; });
+}
+
+void CCaptureStateMachine::EndStop()
+{
+	assert(m_state.load() == CAPTURE_DRAINING);
+	const int64_t ns = GetMonotonicTimeNs() - m_stopBegin;
+	m_lastStopNs = ns;
+	if (ns > m_maxStopNs)
+		m_maxStopNs = ns;
+	m_stops.store(m_stops.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	m_state = CAPTURE_STOPPED;
+}
+
+bool CCaptureStateMachine::Enter()
+{
+	// counted in first: BeginStop either sees this callback inside, or this callback sees DRAINING
+	m_inside.fetch_add(1);
+	if (m_state.load() == CAPTURE_RUNNING)
+		return true;
+
+	m_ignored.fetch_add(1, std::memory_order_relaxed);
+	Leave();
+	return false;
+}
+
+void CCaptureStateMachine::Leave()
+{
+	if (m_inside.fetch_sub(1) == 1 && m_state.load() == CAPTURE_DRAINING) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_cv.notify_all();
+	}
+}
+
+CaptureStateStats CCaptureStateMachine::GetStats() const
+{
+	CaptureStateStats stats;
+	stats.starts = m_starts;
+	stats.stops = m_stops;
+	stats.ignored = m_ignored;
+	stats.lastStopNs = m_lastStopNs;
+	stats.maxStopNs = m_maxStopNs;
+	return stats;
+}
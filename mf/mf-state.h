@@ -0,0 +1,83 @@
+﻿#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+enum CaptureState {
+	CAPTURE_IDLE,     // never started
+	CAPTURE_STARTING, // StartCapture is setting up, callbacks are ignored
+	CAPTURE_RUNNING,
+	CAPTURE_DRAINING, // StopCapture waits for the callbacks already inside, new ones are ignored
+	CAPTURE_STOPPED,  // may start again
+};
+
+const char *GetCaptureStateString(CaptureState state);
+
+struct CaptureStateStats {
+	uint64_t starts = 0;
+	uint64_t stops = 0;
+	uint64_t ignored = 0;  // callbacks which came while not running
+	int64_t lastStopNs = 0; // from BeginStop to EndStop
+	int64_t maxStopNs = 0;
+};
+
+// lifecycle of a capture source, lock-free for the callbacks: a callback only counts itself in and checks the state,
+// so that stopping never waits behind a lock which a callback holds while it processes a frame. StopCapture moves to
+// DRAINING, waits only for the callbacks already counted in and tears down after that; nothing else can get in.
+//
+//   IDLE/STOPPED -BeginStart-> STARTING -EndStart-> RUNNING or STOPPED
+//   RUNNING -BeginStop-> DRAINING -WaitDrained, EndStop-> STOPPED
+class CCaptureStateMachine {
+public:
+	CaptureState GetState() const { return (CaptureState)m_state.load(); }
+	bool IsRunning() const { return m_state.load() == CAPTURE_RUNNING; }
+
+	// false while starting, running or draining
+	bool BeginStart();
+	void EndStart(bool started);
+
+	// waits for a start in progress. false when not running, then there is nothing to stop
+	bool BeginStop();
+	// until the callbacks which got in before BeginStop have left
+	void WaitDrained();
+	void EndStop();
+
+	// callbacks: false unless running, Leave only after a successful Enter
+	bool Enter();
+	void Leave();
+
+	CaptureStateStats GetStats() const;
+
+private:
+	std::atomic<int> m_state{CAPTURE_IDLE};
+	std::atomic<uint32_t> m_inside{0};
+
+	// only the callbacks which leave while draining take the lock
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+
+	int64_t m_stopBegin = 0;
+	std::atomic<uint64_t> m_starts{0};
+	std::atomic<uint64_t> m_stops{0};
+	std::atomic<uint64_t> m_ignored{0};
+	std::atomic<int64_t> m_lastStopNs{0};
+	std::atomic<int64_t> m_maxStopNs{0};
+};
+
+// counts a callback in for its scope
+class CCaptureCallbackScope {
+public:
+	explicit CCaptureCallbackScope(CCaptureStateMachine &state) : m_state(state), m_bEntered(state.Enter()) {}
+	~CCaptureCallbackScope()
+	{
+		if (m_bEntered)
+			m_state.Leave();
+	}
+
+	bool IsEntered() const { return m_bEntered; }
+
+private:
+	CCaptureStateMachine &m_state;
+	const bool m_bEntered;
+};
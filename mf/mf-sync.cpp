@@ -0,0 +1,228 @@
+#include "mf-sync.h"
+#include "mf-frame.h"
+#include "mf-portable.hpp"
+#include <algorithm>
+#include <assert.h>
+#include <cmath>
+
+void CStreamClock::Reset()
+{
+	m_head = 0;
+	m_count = 0;
+	m_bStarted = false;
+	m_rate = 1.0;
+	m_offset = 0.0;
+}
+
+int64_t CStreamClock::Update(int64_t mediaTime, int64_t hostTime)
+{
+	if (!m_bStarted) {
+		m_bStarted = true;
+		m_origin.media = mediaTime;
+		m_origin.host = hostTime;
+		m_bucket = m_origin;
+		m_bucketEnd = hostTime + SYNC_BUCKET_TIME;
+		m_offset = 0.0;
+	}
+
+	const double x = double(mediaTime - m_origin.media);
+	const double y = double(hostTime - m_origin.host);
+
+	// less delay than anything seen so far: the envelope was too high
+	if (y - m_rate * x < m_offset)
+		m_offset = y - m_rate * x;
+
+	if (hostTime - mediaTime < m_bucket.host - m_bucket.media) {
+		m_bucket.media = mediaTime;
+		m_bucket.host = hostTime;
+	}
+
+	if (hostTime >= m_bucketEnd) {
+		m_points[m_head] = m_bucket;
+		m_head = (m_head + 1) % SYNC_WINDOW_BUCKETS;
+		m_count = (std::min)(m_count + 1, (uint32_t)SYNC_WINDOW_BUCKETS);
+		Fit();
+
+		m_bucket.media = mediaTime;
+		m_bucket.host = hostTime;
+		m_bucketEnd = hostTime + SYNC_BUCKET_TIME;
+	}
+
+	return Map(mediaTime);
+}
+
+int64_t CStreamClock::Map(int64_t mediaTime) const
+{
+	return m_origin.host + (int64_t)std::llround(m_offset + m_rate * double(mediaTime - m_origin.media));
+}
+
+void CStreamClock::Fit()
+{
+	const uint32_t first = (m_head + SYNC_WINDOW_BUCKETS - m_count) % SYNC_WINDOW_BUCKETS;
+	const ClockPoint &oldest = m_points[first];
+	const ClockPoint &newest = m_points[(m_head + SYNC_WINDOW_BUCKETS - 1) % SYNC_WINDOW_BUCKETS];
+
+	double rate = 1.0;
+	if (m_count >= 2 && newest.media - oldest.media >= SYNC_MIN_FIT_SPAN) {
+		// relative to the oldest point, keeps the sums small
+		double sumX = 0.0, sumY = 0.0, sumXX = 0.0, sumXY = 0.0;
+		for (uint32_t i = 0; i < m_count; ++i) {
+			const ClockPoint &point = m_points[(first + i) % SYNC_WINDOW_BUCKETS];
+			const double x = double(point.media - oldest.media);
+			const double y = double(point.host - oldest.host);
+			sumX += x;
+			sumY += y;
+			sumXX += x * x;
+			sumXY += x * y;
+		}
+
+		const double n = double(m_count);
+		const double denominator = n * sumXX - sumX * sumX;
+		if (denominator > 0.0)
+			rate = (n * sumXY - sumX * sumY) / denominator;
+		rate = (std::min)((std::max)(rate, 1.0 - SYNC_MAX_DRIFT), 1.0 + SYNC_MAX_DRIFT);
+	}
+
+	// the envelope under the new line
+	double offset = 0.0;
+	for (uint32_t i = 0; i < m_count; ++i) {
+		const ClockPoint &point = m_points[(first + i) % SYNC_WINDOW_BUCKETS];
+		const double d = double(point.host - m_origin.host) - rate * double(point.media - m_origin.media);
+		if (i == 0 || d < offset)
+			offset = d;
+	}
+
+	m_rate = rate;
+	m_offset = offset;
+}
+
+//---------------------------------------------------------------------------------------------
+CAVSync::CAVSync(IMediaSink *video, IMediaSink *audio) : m_video(this, video), m_audio(this, audio) {}
+
+void CAVSync::Reset()
+{
+	m_origin = INT64_MIN;
+	m_video.Reset();
+	m_audio.Reset();
+}
+
+int64_t CAVSync::GetOrigin(int64_t timestamp)
+{
+	// the first sample of either stream is 0
+	int64_t origin = INT64_MIN;
+	if (m_origin.compare_exchange_strong(origin, timestamp))
+		return timestamp;
+	return origin;
+}
+
+AVSyncStats CAVSync::GetStats() const
+{
+	AVSyncStats stats;
+	stats.video = m_video.GetStats();
+	stats.audio = m_audio.GetStats();
+	stats.driftPpm = (m_audio.GetRate() / m_video.GetRate() - 1.0) * 1e6;
+	return stats;
+}
+
+void CAVSync::CInput::Reset()
+{
+	m_clock.Reset();
+	m_bGap = true;
+	m_anchor = 0;
+	m_anchorFrames = 0;
+	m_lastTimestamp = 0;
+	m_samples = 0;
+	m_gaps = 0;
+	m_rate = 1.0;
+	m_correction = 0;
+	m_latency = 0;
+}
+
+StreamSyncStats CAVSync::CInput::GetStats() const
+{
+	StreamSyncStats stats;
+	stats.samples = m_samples;
+	stats.gaps = m_gaps;
+	stats.driftPpm = (m_rate - 1.0) * 1e6;
+	stats.correction = m_correction;
+	stats.latency = m_latency;
+	return stats;
+}
+
+bool CAVSync::CInput::Retime(const MediaSample &sample, int64_t &timestamp, uint32_t &flags)
+{
+	const int64_t now = GetMonotonicTime100ns();
+	const MediaFormat &format = *sample.format;
+	flags = sample.flags;
+
+	if (!sample.planeCount) {
+		// stream tick: nothing arrives for a while, the next sample starts a new anchor
+		++m_gaps;
+		m_bGap = true;
+		if (!m_samples)
+			return false; // the clock is not set up before the first sample
+
+		const int64_t host = m_clock.Map(sample.timestamp);
+		timestamp = host - m_pOwner->GetOrigin(host);
+		return true;
+	}
+
+	int64_t mediaTime = sample.timestamp;
+	if (!format.video) {
+		const uint32_t frameBytes = format.channels * format.bitsPerSample / 8;
+		if (!frameBytes || !format.sampleRate) {
+			assert(false);
+			return false;
+		}
+
+		// the sample clock: where this packet should be after the frames delivered so far
+		const int64_t expected = m_anchor + (int64_t)(m_anchorFrames * 10000000 / format.sampleRate);
+		const bool jump = !m_bGap && std::llabs(sample.timestamp - expected) > SYNC_GAP_THRESHOLD;
+		if (jump)
+			++m_gaps;
+		if (m_bGap || jump || (flags & MEDIA_SAMPLE_FLAG_DISCONTINUITY)) {
+			if (m_samples)
+				flags |= MEDIA_SAMPLE_FLAG_DISCONTINUITY;
+			m_anchor = sample.timestamp;
+			m_anchorFrames = 0;
+		}
+
+		mediaTime = m_anchor + (int64_t)(m_anchorFrames * 10000000 / format.sampleRate);
+		m_anchorFrames += sample.planes[0].size / frameBytes;
+	} else if (m_bGap && m_samples) {
+		flags |= MEDIA_SAMPLE_FLAG_DISCONTINUITY;
+	}
+	m_bGap = false;
+
+	const int64_t host = m_clock.Update(mediaTime, now);
+	timestamp = host - m_pOwner->GetOrigin(host);
+
+	// the envelope may move back a little when the fit changes, the output never does
+	if (m_samples && timestamp <= m_lastTimestamp)
+		timestamp = m_lastTimestamp + 1;
+	m_lastTimestamp = timestamp;
+
+	++m_samples;
+	m_rate = m_clock.GetRate();
+	m_correction = timestamp - sample.timestamp;
+	m_latency = now - host;
+	return true;
+}
+
+void CAVSync::CInput::OnMediaSample(const MediaSample &sample)
+{
+	MediaSample retimed = sample;
+	if (Retime(sample, retimed.timestamp, retimed.flags))
+		m_pDownstream->OnMediaSample(retimed);
+}
+
+void CAVSync::CInput::OnMediaFrame(CMediaFrame *frame)
+{
+	int64_t timestamp = 0;
+	uint32_t flags = 0;
+	if (Retime(frame->GetSample(), timestamp, flags)) {
+		// the source hands the frame to us first, nobody else has seen it yet
+		frame->SetTiming(timestamp, flags);
+		m_pDownstream->OnMediaFrame(frame);
+	}
+}
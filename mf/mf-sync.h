@@ -0,0 +1,123 @@
+﻿#pragma once
+#include "mf-sample.h"
+#include <atomic>
+
+#define SYNC_BUCKET_TIME 1000000  // 100ms: one clock point per bucket, the one with the least arrival delay
+#define SYNC_WINDOW_BUCKETS 600   // 60s of clock points for the drift fit
+#define SYNC_MIN_FIT_SPAN 10000000 // 1s, below that the stream clock is assumed to run at the host rate
+#define SYNC_MAX_DRIFT 0.001      // 1000ppm, anything beyond is a broken timestamp, not drift
+#define SYNC_GAP_THRESHOLD 500000 // 50ms between the audio sample clock and the device timestamp is a gap
+
+// maps one stream clock onto the host monotonic clock.
+// arrival delays are always positive, so the points with the least delay per bucket form the lower envelope
+// of (media, host); a least squares fit over them gives the rate of the stream clock (1 + drift), the envelope the offset.
+// single thread.
+class CStreamClock {
+public:
+	void Reset();
+
+	// mediaTime: stream clock, hostTime: GetMonotonicTime100ns() at arrival. returns mediaTime on the host clock
+	int64_t Update(int64_t mediaTime, int64_t hostTime);
+	int64_t Map(int64_t mediaTime) const;
+
+	// host time per media time
+	double GetRate() const { return m_rate; }
+
+private:
+	struct ClockPoint {
+		int64_t media;
+		int64_t host;
+	};
+
+	void Fit();
+
+private:
+	ClockPoint m_points[SYNC_WINDOW_BUCKETS];
+	uint32_t m_head = 0;
+	uint32_t m_count = 0;
+
+	// best point of the bucket being collected
+	ClockPoint m_bucket = {};
+	int64_t m_bucketEnd = 0;
+	bool m_bStarted = false;
+
+	// the fit is relative to the first point, in double
+	ClockPoint m_origin = {};
+	double m_rate = 1.0;
+	double m_offset = 0.0;
+};
+
+struct StreamSyncStats {
+	uint64_t samples = 0;
+	uint64_t gaps = 0;       // stream ticks, discontinuities and audio timestamp jumps
+	double driftPpm = 0.0;   // stream clock against the host clock
+	int64_t correction = 0;  // last output timestamp - device timestamp, 100ns
+	int64_t latency = 0;     // last arrival - output timestamp, 100ns
+};
+
+struct AVSyncStats {
+	StreamSyncStats video;
+	StreamSyncStats audio;
+	double driftPpm = 0.0; // audio sample clock against the video clock
+};
+
+// puts video and audio on one timeline: the sources deliver into GetVideoInput/GetAudioInput on their own threads,
+// the samples go on with their timestamps corrected to the host clock, relative to the first sample of either stream.
+// video keeps its device timestamps (drift removed); audio is timed by its sample count, so the drift of the audio
+// sample clock does not accumulate, and is re-anchored to the device timestamps after every gap.
+// sits in front of the session queues: the arrival time has to be taken on the capture thread.
+class CAVSync {
+public:
+	CAVSync(IMediaSink *video, IMediaSink *audio);
+
+	IMediaSink *GetVideoInput() { return &m_video; }
+	IMediaSink *GetAudioInput() { return &m_audio; }
+
+	// polled from any thread
+	AVSyncStats GetStats() const;
+
+	// before the sources start again
+	void Reset();
+
+private:
+	class CInput : public IMediaSink {
+	public:
+		CInput(CAVSync *owner, IMediaSink *downstream) : m_pOwner(owner), m_pDownstream(downstream) {}
+
+		void OnMediaSample(const MediaSample &sample) override;
+		bool WantsFrames() const override { return m_pDownstream->WantsFrames(); }
+		void OnMediaFrame(CMediaFrame *frame) override;
+
+		void Reset();
+		StreamSyncStats GetStats() const;
+		double GetRate() const { return m_rate; }
+
+	private:
+		// returns false if the sample has to be dropped
+		bool Retime(const MediaSample &sample, int64_t &timestamp, uint32_t &flags);
+
+	private:
+		CAVSync *const m_pOwner;
+		IMediaSink *const m_pDownstream;
+
+		// source thread only
+		CStreamClock m_clock;
+		bool m_bGap = true;
+		int64_t m_anchor = 0;       // audio: device timestamp of the first frame after the last gap
+		uint64_t m_anchorFrames = 0; // and the frames since
+		int64_t m_lastTimestamp = 0;
+
+		std::atomic<uint64_t> m_samples{0};
+		std::atomic<uint64_t> m_gaps{0};
+		std::atomic<double> m_rate{1.0};
+		std::atomic<int64_t> m_correction{0};
+		std::atomic<int64_t> m_latency{0};
+	};
+
+	int64_t GetOrigin(int64_t timestamp);
+
+private:
+	std::atomic<int64_t> m_origin{INT64_MIN}; // INT64_MIN until the first sample
+	CInput m_video;
+	CInput m_audio;
+};
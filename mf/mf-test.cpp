@@ -0,0 +1,2179 @@
+#include "mf-test.h"
+#include "mf-audio.h"
+#include "mf-backpressure.h"
+#include "mf-capcache.h"
+#include "mf-change.h"
+#include "mf-container.h"
+#include "mf-convert.h"
+#include "mf-depth.h"
+#include "mf-format.h"
+#include "mf-jpeg.h"
+#include "mf-lossless.h"
+#include "mf-manager.h"
+#include "mf-metrics.h"
+#include "mf-negotiate.h"
+#include "mf-packetizer.h"
+#include "mf-pipeline.h"
+#include "mf-portable.hpp"
+#include "mf-publish.h"
+#include "mf-scale.h"
+#include "mf-source.h"
+#include "mf-spsc-queue.hpp"
+#include "mf-state.h"
+#include "mf-sync.h"
+#include "mf-tiling.h"
+#include "mf-writer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <cwchar>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#define TEST_GUARD 0xcd // bytes of the output the kernels must not touch
+#define TEST_PI 3.14159265358979323846
+
+static int g_failures = 0;
+
+static void Fail(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	printf("\tfailed: ");
+	vprintf(format, args);
+	printf(" \n");
+	va_end(args);
+	++g_failures;
+}
+
+// deterministic, so a failure can be repeated
+static uint32_t g_random = 1;
+
+static uint32_t Random()
+{
+	g_random = g_random * 1664525 + 1013904223;
+	return g_random >> 8;
+}
+
+static void FillRandom(std::vector<uint8_t> &buffer)
+{
+	for (uint8_t &value : buffer)
+		value = uint8_t(Random());
+}
+
+// the levels the cpu supports, the first one is the reference
+static std::vector<SimdLevel> GetLevels()
+{
+	std::vector<SimdLevel> levels;
+	for (int level = SIMD_SCALAR; level <= GetCpuSimdLevel(); ++level)
+		levels.push_back((SimdLevel)level);
+	return levels;
+}
+
+// widths around the 16 and 32 byte vectors, which leave tails of every length
+static const uint32_t g_widths[] = {2, 6, 14, 18, 34, 62, 66, 130, 322, 1282};
+
+// a source row is padded by `padding` bytes: odd for the 8 bit packed types, which have no alignment, else a whole sample
+static uint32_t GetPadding(uint32_t subtype)
+{
+	switch (subtype) {
+	case MEDIA_SUBTYPE_YUY2:
+	case MEDIA_SUBTYPE_UYVY:
+	case MEDIA_SUBTYPE_RGB32:
+	case MEDIA_SUBTYPE_ARGB32:
+	case MEDIA_SUBTYPE_RGB24:
+		return 7;
+	case MEDIA_SUBTYPE_V210:
+		return 12;
+	default:
+		return 6;
+	}
+}
+
+// the guard bytes right of each row of `width` bytes
+static bool IsGuardIntact(const std::vector<uint8_t> &buffer, uint32_t width, int32_t stride, uint32_t rows)
+{
+	for (uint32_t y = 0; y < rows; ++y) {
+		for (uint32_t x = width; x < (uint32_t)stride; ++x) {
+			if (buffer[(size_t)y * stride + x] != TEST_GUARD)
+				return false;
+		}
+	}
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+// keeps a copy of every sample a stand-in delivers, read it once the source is stopped
+struct CollectingSink : IMediaSink {
+	std::vector<std::vector<uint8_t>> payloads;
+	std::vector<int64_t> timestamps;
+	std::vector<uint32_t> flags;
+	std::atomic<uint64_t> samples{0};
+
+	void OnMediaSample(const MediaSample &sample) override
+	{
+		std::vector<uint8_t> payload;
+		if (sample.planeCount) {
+			const bool raw = sample.format->video && !IsCompressedVideo(sample.format->subtype);
+			const uint32_t size = raw ? GetVideoFrameSize(*sample.format) : sample.planes[0].size;
+			payload.assign(sample.planes[0].data, sample.planes[0].data + size);
+		}
+		payloads.push_back(std::move(payload));
+		timestamps.push_back(sample.timestamp);
+		flags.push_back(sample.flags);
+		++samples;
+	}
+};
+
+// until the stand-in reached the end of its stream or has delivered `count` samples
+static bool WaitForSamples(const CStandInSource &source, const CollectingSink &sink, uint64_t count)
+{
+	for (uint32_t i = 0; i < 2000 && !source.IsFinished() && sink.samples < count; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	return source.IsFinished() || sink.samples >= count;
+}
+
+// the headerless dumps of older builds come back as they were written, audio loops over the end of the file
+static void TestReplay()
+{
+	const char *path = "mf-test-replay.raw";
+	MediaFormat video;
+	video.subtype = MEDIA_SUBTYPE_NV12;
+	video.width = 64;
+	video.height = 32;
+	video.fpsNum = 30;
+	video.fpsDen = 1;
+	std::vector<uint8_t> dump((size_t)GetVideoFrameSize(video) * 3);
+	FillRandom(dump);
+	FILE *fp = OpenFile(path, "wb");
+	if (!fp || fwrite(dump.data(), 1, dump.size(), fp) != dump.size()) {
+		Fail("replay: cannot write %s", path);
+		if (fp)
+			fclose(fp);
+		return;
+	}
+	fclose(fp);
+
+	{
+		CFileReplaySource source(video, path, false, false);
+		CollectingSink sink;
+		if (!source.StartCapture(&sink) || !WaitForSamples(source, sink, 4))
+			Fail("replay: the video dump does not end");
+		source.StopCapture();
+		const size_t frameSize = GetVideoFrameSize(video);
+		if (sink.payloads.size() != 4 || !(sink.flags[3] & MEDIA_SAMPLE_FLAG_END_OF_STREAM))
+			Fail("replay: %zu samples of a 3 frame dump", sink.payloads.size());
+		for (size_t i = 0; i < 3 && i < sink.payloads.size(); ++i) {
+			if (sink.payloads[i].size() != frameSize || memcmp(sink.payloads[i].data(), dump.data() + i * frameSize, frameSize))
+				Fail("replay: frame %zu differs from the dump", i);
+			if (sink.timestamps[i] != source.GetSampleTime(i))
+				Fail("replay: frame %zu at %lld", i, (long long)sink.timestamps[i]);
+		}
+	}
+
+	// 10ms chunks of 48kHz stereo pcm, the dump holds 2.5 of them: the tail is skipped when it loops
+	MediaFormat audio;
+	audio.video = false;
+	audio.subtype = MEDIA_SUBTYPE_PCM;
+	audio.channels = 2;
+	audio.sampleRate = 48000;
+	audio.bitsPerSample = 16;
+	{
+		CFileReplaySource source(audio, path, false, true);
+		const uint32_t chunk = source.GetSampleSize();
+		dump.resize(chunk * 5 / 2);
+		fp = OpenFile(path, "wb");
+		fwrite(dump.data(), 1, dump.size(), fp);
+		fclose(fp);
+
+		CollectingSink sink;
+		if (!source.StartCapture(&sink) || !WaitForSamples(source, sink, 5) || source.IsFinished())
+			Fail("replay: the looped audio dump ends");
+		source.StopCapture();
+		for (size_t i = 0; i < 5 && i < sink.payloads.size(); ++i) {
+			if (sink.payloads[i].size() != chunk || memcmp(sink.payloads[i].data(), dump.data() + i % 2 * chunk, chunk))
+				Fail("replay: audio chunk %zu differs from the dump", i);
+		}
+	}
+	remove(path);
+
+	// no dump at all
+	CFileReplaySource missing(video, "mf-test-missing.raw", false, false);
+	CollectingSink sink;
+	if (missing.StartCapture(&sink))
+		Fail("replay: a missing dump starts");
+}
+
+//---------------------------------------------------------------------------------------------
+// every type -> NV12, each level in two row ranges against the scalar kernels in one
+static void TestConvert()
+{
+	static const uint32_t subtypes[] = {MEDIA_SUBTYPE_YUY2, MEDIA_SUBTYPE_UYVY, MEDIA_SUBTYPE_RGB32, MEDIA_SUBTYPE_ARGB32, MEDIA_SUBTYPE_RGB24, MEDIA_SUBTYPE_I420,
+					    MEDIA_SUBTYPE_YV12, MEDIA_SUBTYPE_NV12, MEDIA_SUBTYPE_P010, MEDIA_SUBTYPE_P016, MEDIA_SUBTYPE_Y210, MEDIA_SUBTYPE_V210};
+	const std::vector<SimdLevel> levels = GetLevels();
+
+	for (uint32_t subtype : subtypes) {
+		for (uint32_t width : g_widths) {
+			for (uint32_t height : {2u, 6u, 34u}) {
+				MediaFormat format;
+				format.subtype = subtype;
+				format.width = width;
+				format.height = height;
+				const int32_t stride = GetVideoDefaultStride(format) + (int32_t)GetPadding(subtype);
+				std::vector<uint8_t> src((size_t)stride * height * 2);
+				FillRandom(src);
+				MediaPlane planes[MEDIA_MAX_PLANES];
+				DescribeVideoPlanes(format, src.data(), stride, planes);
+
+				// odd destination strides
+				const int32_t dstStride = (int32_t)width + 5;
+				std::vector<uint8_t> reference, output;
+				for (SimdLevel level : levels) {
+					std::vector<uint8_t> &dst = level == levels[0] ? reference : output;
+					dst.assign((size_t)dstStride * height * 3 / 2, TEST_GUARD);
+					uint8_t *dstUV = dst.data() + (size_t)dstStride * height;
+
+					CVideoConverter converter;
+					if (!converter.Init(subtype, level)) {
+						Fail("convert %.4s init", (const char *)&subtype);
+						break;
+					}
+
+					const uint32_t middle = height / 4 * 2;
+					if (level == levels[0]) {
+						converter.Convert(planes, width, height, dst.data(), dstStride, dstUV, dstStride);
+						if (!IsGuardIntact(dst, width, dstStride, height * 3 / 2))
+							Fail("convert %.4s %ux%u %s writes past the row", (const char *)&subtype, width, height, GetSimdLevelString(level));
+					} else {
+						converter.Convert(planes, width, height, dst.data(), dstStride, dstUV, dstStride, 0, middle);
+						converter.Convert(planes, width, height, dst.data(), dstStride, dstUV, dstStride, middle, height);
+						if (output != reference)
+							Fail("convert %.4s %ux%u %s differs from %s", (const char *)&subtype, width, height, GetSimdLevelString(level), GetSimdLevelString(levels[0]));
+					}
+				}
+			}
+		}
+	}
+
+	// bottom-up rgb: white -> y 235, chroma 128
+	MediaFormat format;
+	format.subtype = MEDIA_SUBTYPE_RGB32;
+	format.width = 34;
+	format.height = 4;
+	const int32_t stride = 34 * 4;
+	std::vector<uint8_t> src((size_t)stride * 4, 255), dst(34 * 6);
+	MediaPlane planes[MEDIA_MAX_PLANES];
+	DescribeVideoPlanes(format, src.data() + stride * 3, -stride, planes);
+	for (SimdLevel level : levels) {
+		CVideoConverter converter;
+		converter.Init(MEDIA_SUBTYPE_RGB32, level);
+		converter.Convert(planes, 34, 4, dst.data(), 34, dst.data() + 34 * 4, 34);
+		if (dst[0] != 235 || dst[34 * 4 - 1] != 235 || dst[34 * 4] != 128 || dst[34 * 6 - 1] != 128)
+			Fail("convert white rgb32 at %s: y %u uv %u", GetSimdLevelString(level), dst[0], dst[34 * 4]);
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+// size classes, reuse, exhaustion, the copy out of a padded or bottom-up sample, and frames outliving the pool
+static void TestPool()
+{
+	for (uint32_t size : {1u, 4096u, 4097u, 5000u, 3110400u, 12441600u, 0x40000000u}) {
+		const uint32_t sizeClass = CFramePool::GetSizeClass(size);
+		if (sizeClass < size || (size > 4096 && (uint64_t)sizeClass * 4 > (uint64_t)size * 5))
+			Fail("pool: size class %u for %u bytes", sizeClass, size);
+	}
+
+	CRefPtr<CFramePool> pool = CFramePool::Create(2);
+	{
+		FramePtr a = pool->Acquire(100000), b = pool->Acquire(110000); // one size class
+		if (!a || !b || pool->Acquire(100000) || pool->GetStats().exhausted != 1 || pool->GetStats().inFlight != 2)
+			Fail("pool: a bucket of 2 frames is not exhausted by the third");
+		if (!pool->Acquire(10000))
+			Fail("pool: another size class is exhausted too");
+	}
+	FramePoolStats stats = pool->GetStats();
+	FramePtr again = pool->Acquire(100000);
+	if (!again || pool->GetStats().allocated != stats.allocated || stats.inFlight)
+		Fail("pool: a released frame is not reused, %llu allocated", (unsigned long long)pool->GetStats().allocated);
+
+	// padded nv12 and bottom-up rgb are stored tight and top-down
+	MediaFormat format;
+	format.subtype = MEDIA_SUBTYPE_NV12;
+	format.width = 34;
+	format.height = 6;
+	const int32_t stride = 34 + 7;
+	std::vector<uint8_t> src(1024);
+	FillRandom(src);
+	MediaSample sample;
+	sample.format = &format;
+	sample.timestamp = 1234;
+	sample.flags = MEDIA_SAMPLE_FLAG_DISCONTINUITY;
+	sample.planeCount = DescribeVideoPlanes(format, src.data(), stride, sample.planes);
+	FramePtr frame = pool->CopySample(sample);
+	for (uint32_t y = 0; frame && y < 9; ++y) {
+		if (memcmp(frame->GetSample().planes[0].data + y * 34, src.data() + (size_t)y * stride, 34)) {
+			Fail("pool: the copy of a padded frame differs at row %u", y);
+			break;
+		}
+	}
+	if (!frame || frame->GetTimestamp() != 1234 || frame->GetFlags() != MEDIA_SAMPLE_FLAG_DISCONTINUITY)
+		Fail("pool: the copy lost the timing of the sample");
+
+	format.subtype = MEDIA_SUBTYPE_RGB32;
+	format.height = 4;
+	const int32_t rgbStride = 34 * 4 + 8;
+	sample.planeCount = DescribeVideoPlanes(format, src.data() + (size_t)rgbStride * 3, -rgbStride, sample.planes);
+	frame = pool->CopySample(sample);
+	for (uint32_t y = 0; frame && y < 4; ++y) {
+		if (memcmp(frame->GetSample().planes[0].data + y * 34 * 4, src.data() + (size_t)rgbStride * (3 - y), 34 * 4)) {
+			Fail("pool: bottom-up row %u is not flipped", y);
+			break;
+		}
+	}
+
+	// the frames keep the pool alive, and may be released on any thread
+	std::vector<FramePtr> frames;
+	for (uint32_t i = 0; i < 2; ++i)
+		frames.push_back(pool->Acquire(1 << 20));
+	pool = CRefPtr<CFramePool>();
+	std::thread releaser([&frames]() { frames.clear(); });
+	releaser.join();
+	frame = FramePtr();
+	again = FramePtr();
+
+	// wrapped memory goes back to its owner with the last reference
+	uint32_t released = 0;
+	{
+		FramePtr wrapped = CMediaFrame::Wrap(sample, [&released]() { ++released; });
+		FramePtr copy = wrapped;
+		wrapped = FramePtr();
+		if (released)
+			Fail("pool: a wrapped frame is released while referenced");
+	}
+	if (released != 1)
+		Fail("pool: a wrapped frame is released %u times", released);
+}
+
+//---------------------------------------------------------------------------------------------
+// the ring wraps many times at every fill level, then one producer and one consumer thread keep the order
+static void TestSpsc()
+{
+	CSpscQueue<uint32_t> queue(3);
+	if (queue.GetCapacity() != 4)
+		Fail("spsc: capacity %u for 3", queue.GetCapacity());
+
+	uint32_t pushed = 0, popped = 0, item = 0;
+	for (uint32_t round = 0; round < 1000; ++round) {
+		const uint32_t fill = 1 + round % 4;
+		while (queue.GetSize() < fill) {
+			if (!queue.TryPush(pushed++)) {
+				Fail("spsc: push fails at %u of 4", queue.GetSize());
+				return;
+			}
+		}
+		if (fill == 4 && queue.TryPush(pushed))
+			Fail("spsc: a full queue takes one more");
+
+		for (uint32_t i = 0; i < round % 3 + 1 && queue.TryPop(item); ++i) {
+			if (item != popped++) {
+				Fail("spsc: popped %u instead of %u in round %u", item, popped - 1, round);
+				return;
+			}
+		}
+	}
+	while (queue.TryPop(item)) {
+		if (item != popped++)
+			Fail("spsc: popped %u instead of %u", item, popped - 1);
+	}
+	if (popped != pushed || queue.GetSize() || queue.TryPop(item))
+		Fail("spsc: %u pushed, %u popped", pushed, popped);
+
+	const uint32_t count = 200000;
+	CSpscQueue<uint32_t> shared(16);
+	std::thread producer([&shared]() {
+		for (uint32_t i = 0; i < count; ++i) {
+			while (!shared.TryPush(i))
+				std::this_thread::yield();
+		}
+	});
+	// all of them are taken, so the producer never waits forever
+	uint32_t received = 0, misplaced = 0;
+	while (received < count) {
+		if (!shared.TryPop(item)) {
+			std::this_thread::yield();
+			continue;
+		}
+		misplaced += item != received++;
+	}
+	producer.join();
+	if (misplaced)
+		Fail("spsc: the consumer thread got %u of %u items out of order", misplaced, count);
+}
+
+//---------------------------------------------------------------------------------------------
+static std::vector<uint8_t> ReadFile(const char *path)
+{
+	std::vector<uint8_t> data;
+	FILE *fp = OpenFile(path, "rb");
+	if (!fp)
+		return data;
+	uint8_t chunk[16 * 1024];
+	size_t read = 0;
+	while ((read = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+		data.insert(data.end(), chunk, chunk + read);
+	fclose(fp);
+	return data;
+}
+
+// padded I420 frames with a record prefix and odd sized byte blocks through a small staging buffer, with and without direct io:
+// the file holds exactly the tight rows and the bytes in order
+static void TestWriter()
+{
+	const char *path = "mf-test-writer.bin";
+	MediaFormat format;
+	format.subtype = MEDIA_SUBTYPE_I420;
+	format.width = 34;
+	format.height = 10;
+	std::vector<uint8_t> src(2000);
+	FillRandom(src);
+
+	for (bool direct : {false, true}) {
+		CAsyncFileWriter writer;
+		AsyncWriterOptions options;
+		options.bufferSize = 8192;
+		options.queueCapacity = 8;
+		options.directIO = direct;
+		options.preallocate = 1 << 20;
+		if (!writer.Open(path, options)) {
+			Fail("writer: cannot open %s", path);
+			return;
+		}
+
+		std::vector<uint8_t> expected;
+		for (uint32_t n = 0; n < 40; ++n) {
+			const uint8_t *base = src.data() + n;
+			MediaSample sample;
+			sample.format = &format;
+			sample.planes[0] = {base, 50, 500};
+			sample.planes[1] = {base + 500, 25, 125};
+			sample.planes[2] = {base + 700, 25, 125};
+			sample.planeCount = 3;
+			FramePtr frame = CMediaFrame::Wrap(sample, nullptr);
+			const uint8_t prefix[5] = {1, 2, 3, 4, uint8_t(n)};
+			while (!writer.Write(frame.Get(), prefix, sizeof(prefix)))
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+			expected.insert(expected.end(), prefix, prefix + sizeof(prefix));
+			for (uint32_t y = 0; y < 10; ++y)
+				expected.insert(expected.end(), base + y * 50, base + y * 50 + 34);
+			for (uint32_t plane = 1; plane < 3; ++plane) {
+				for (uint32_t y = 0; y < 5; ++y) {
+					const uint8_t *row = sample.planes[plane].data + y * 25;
+					expected.insert(expected.end(), row, row + 17);
+				}
+			}
+
+			const std::vector<uint8_t> bytes(3000 + n, uint8_t(n));
+			writer.WriteBytes(bytes.data(), (uint32_t)bytes.size(), true);
+			expected.insert(expected.end(), bytes.begin(), bytes.end());
+		}
+		if (writer.GetLogicalSize() != expected.size())
+			Fail("writer: logical size %llu of %zu bytes", (unsigned long long)writer.GetLogicalSize(), expected.size());
+		writer.Close();
+
+		const AsyncWriterStats stats = writer.GetStats();
+		if (ReadFile(path) != expected)
+			Fail("writer: the file%s differs from what was written", direct ? " with direct io" : "");
+		if (stats.frames != 80 || stats.writes > expected.size() / 8192 + 2) // WriteBytes counts as a frame
+			Fail("writer: %llu frames in %llu writes", (unsigned long long)stats.frames, (unsigned long long)stats.writes);
+	}
+	remove(path);
+}
+
+//---------------------------------------------------------------------------------------------
+static bool WriteFile(const char *path, const uint8_t *data, size_t size)
+{
+	FILE *fp = OpenFile(path, "wb");
+	if (!fp)
+		return false;
+	const bool written = fwrite(data, 1, size, fp) == size;
+	return fclose(fp) == 0 && written;
+}
+
+// padded frames with their own timestamps and flags: the same planes, timing and flags come back through the index,
+// through the records when the trailer is missing, and through the replay source
+static void TestContainer()
+{
+	const char *path = "mf-test-container.mfc";
+	const char *cut = "mf-test-container-cut.mfc";
+	MediaFormat format;
+	format.subtype = MEDIA_SUBTYPE_NV12;
+	format.width = 34;
+	format.height = 6;
+	format.fpsNum = 30;
+	format.fpsDen = 1;
+	const int32_t stride = 34 + 7;
+	const uint32_t count = 12, frameSize = GetVideoFrameSize(format);
+	std::vector<uint8_t> src((size_t)stride * 9 * count);
+	FillRandom(src);
+
+	// 10ms apart from an arbitrary start, like the device clock
+	std::vector<int64_t> timestamps;
+	std::vector<uint32_t> flags;
+	CContainerWriter writer;
+	if (!writer.Open(path, format)) {
+		Fail("container: cannot open %s", path);
+		return;
+	}
+	for (uint32_t i = 0; i < count; ++i) {
+		MediaSample sample;
+		sample.format = &format;
+		sample.timestamp = 123456789 + i * 100000 + (i > 6 ? 5000000 : 0);
+		sample.flags = i == 7 ? MEDIA_SAMPLE_FLAG_DISCONTINUITY : i % 3 == 0 ? MEDIA_SAMPLE_FLAG_UNCHANGED : 0u;
+		sample.planeCount = DescribeVideoPlanes(format, src.data() + (size_t)stride * 9 * i, stride, sample.planes);
+		FramePtr frame = CMediaFrame::Wrap(sample, nullptr);
+		while (!writer.Write(frame.Get()))
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		timestamps.push_back(sample.timestamp);
+		flags.push_back(sample.flags);
+	}
+	writer.Close();
+
+	// the tight rows of frame i
+	std::vector<std::vector<uint8_t>> frames(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		for (uint32_t y = 0; y < 9; ++y) {
+			const uint8_t *row = src.data() + (size_t)stride * (9 * i + y);
+			frames[i].insert(frames[i].end(), row, row + 34);
+		}
+	}
+
+	const std::vector<uint8_t> file = ReadFile(path);
+	for (uint32_t pass = 0; pass < 2; ++pass) {
+		// without the trailer and the index, and cut off in the middle of the last record
+		if (pass == 1) {
+			CContainerReader reader;
+			reader.Open(path);
+			const ContainerIndexEntry *last = reader.GetIndexEntry(count - 1);
+			if (!last || !WriteFile(cut, file.data(), (size_t)last->offset + last->size / 2)) {
+				Fail("container: cannot write %s", cut);
+				break;
+			}
+		}
+
+		CContainerReader reader;
+		const uint32_t expected = pass ? count - 1 : count;
+		if (!reader.Open(pass ? cut : path) || reader.IsRecovered() != (pass == 1) || reader.GetFrameCount() != expected) {
+			Fail("container pass %u: %llu frames, recovered %d", pass, (unsigned long long)reader.GetFrameCount(), reader.IsRecovered());
+			continue;
+		}
+		const MediaFormat &read = reader.GetFormat();
+		if (read.subtype != format.subtype || read.width != format.width || read.height != format.height || read.fpsNum != format.fpsNum || read.fpsDen != format.fpsDen)
+			Fail("container pass %u: the format differs", pass);
+
+		for (uint32_t i = 0; i < expected; ++i) {
+			MediaSample sample;
+			if (!reader.GetFrame(i, sample) || sample.timestamp != timestamps[i] || sample.flags != flags[i] || sample.planes[0].stride != 34 ||
+			    memcmp(sample.planes[0].data, frames[i].data(), frameSize)) {
+				Fail("container pass %u: frame %u differs", pass, i);
+				break;
+			}
+		}
+		if (reader.FindFrame(timestamps[3] + 1) != 3 || reader.FindFrame(0) != 0 || reader.FindFrame(timestamps[expected - 1] + 100000000) != expected - 1)
+			Fail("container pass %u: FindFrame", pass);
+	}
+
+	// anything but a container is rejected
+	std::vector<uint8_t> garbage(4096);
+	FillRandom(garbage);
+	CContainerReader reader;
+	if (!WriteFile(cut, garbage.data(), garbage.size()) || reader.Open(cut))
+		Fail("container: random bytes open");
+	reader.Close();
+
+	// the replay delivers the records with their timing, a loop goes on after the last one
+	{
+		CContainerReplaySource source(path, false, true);
+		CollectingSink sink;
+		if (!source.IsValid() || !source.StartCapture(&sink) || !WaitForSamples(source, sink, count * 2))
+			Fail("container: the replay does not start");
+		source.StopCapture();
+		const int64_t loop = timestamps[count - 1] - timestamps[0] + (timestamps[count - 1] - timestamps[0]) / (count - 1);
+		for (size_t i = 0; i < count * 2 && i < sink.payloads.size(); ++i) {
+			const size_t record = i % count;
+			if (sink.payloads[i] != frames[record] || sink.flags[i] != flags[record] || sink.timestamps[i] != timestamps[record] + (i < count ? 0 : loop)) {
+				Fail("container: replayed sample %zu at %lld, flags %x", i, (long long)sink.timestamps[i], sink.flags[i]);
+				break;
+			}
+		}
+	}
+
+	// paced by the recorded timestamps: 11 intervals of 10ms and a 500ms gap, whatever the first timestamp is
+	{
+		CContainerReplaySource source(path, true, false);
+		CollectingSink sink;
+		const int64_t begin = GetMonotonicTimeNs();
+		source.StartCapture(&sink);
+		WaitForSamples(source, sink, count + 1);
+		const int64_t elapsed = GetMonotonicTimeNs() - begin;
+		source.StopCapture();
+		if (sink.payloads.size() != count + 1 || elapsed < 600000000 || elapsed > 1500000000)
+			Fail("container: %zu samples replayed in %.1fms", sink.payloads.size(), elapsed / 1e6);
+	}
+	remove(path);
+	remove(cut);
+}
+
+//---------------------------------------------------------------------------------------------
+static DeviceCapabilities MakeDevice(const wchar_t *name, const wchar_t *path, uint32_t caps)
+{
+	DeviceCapabilities device;
+	device.name = name;
+	device.path = path;
+	device.fingerprint = HashBytes(path, wcslen(path) * sizeof(wchar_t));
+	for (uint32_t i = 0; i < caps; ++i) {
+		DeviceCapability cap;
+		cap.format.subtype = i % 2 ? MEDIA_SUBTYPE_MJPG : MEDIA_SUBTYPE_YUY2;
+		cap.format.width = 640 + i * 16;
+		cap.format.height = 480 + i * 8;
+		cap.format.fpsNum = 30;
+		cap.format.fpsDen = 1;
+		cap.index = i;
+		cap.fpsMinNum = i;
+		cap.fpsMaxDen = 1;
+		device.caps.push_back(cap);
+	}
+	return device;
+}
+
+// a saved cache comes back as it was; a cut off file, or one whose counts the file cannot hold, is an empty cache
+static void TestCapCache()
+{
+	const char *path = "mf-test-capabilities.bin";
+	CCapabilityCache cache;
+	cache.Update(MakeDevice(L"camera", L"\\\\?\\usb#vid_046d&pid_085e", 5));
+	cache.Update(MakeDevice(L"microphone", L"\\\\?\\swd#mmdevapi", 0));
+	if (!cache.Save(path) || cache.IsDirty()) {
+		Fail("capcache: cannot save %s", path);
+		return;
+	}
+
+	CCapabilityCache loaded;
+	const DeviceCapabilities expected = MakeDevice(L"camera", L"\\\\?\\usb#vid_046d&pid_085e", 5);
+	const DeviceCapabilities *device = loaded.Load(path) ? loaded.Find(expected.path, expected.fingerprint) : nullptr;
+	if (!device || loaded.GetCount() != 2 || loaded.IsDirty() || device->name != expected.name || device->caps.size() != expected.caps.size()) {
+		Fail("capcache: %zu devices loaded", loaded.GetCount());
+		return;
+	}
+	for (size_t i = 0; i < expected.caps.size(); ++i) {
+		const DeviceCapability &a = device->caps[i], &b = expected.caps[i];
+		if (a.format.subtype != b.format.subtype || a.format.width != b.format.width || a.format.height != b.format.height || a.index != b.index ||
+		    a.fpsMinNum != b.fpsMinNum || a.fpsMaxDen != b.fpsMaxDen)
+			Fail("capcache: capability %zu differs", i);
+	}
+	if (loaded.Find(expected.path, expected.fingerprint + 1))
+		Fail("capcache: a changed fingerprint is found");
+
+	// one device, so that its capability count is at a known offset: magic, version, count, video, fingerprint, name, path
+	CCapabilityCache single;
+	single.Update(expected);
+	single.Save(path);
+	std::vector<uint8_t> file = ReadFile(path);
+	const size_t capCount = 3 * 4 + 4 + 8 + 4 + expected.name.size() * 2 + 4 + expected.path.size() * 2;
+	for (uint32_t count : {0xfffffff0u, 0x10000u, 6u}) {
+		std::vector<uint8_t> broken = file;
+		memcpy(broken.data() + capCount, &count, sizeof(count));
+		if (!WriteFile(path, broken.data(), broken.size()) || loaded.Load(path) || loaded.GetCount())
+			Fail("capcache: a count of %u capabilities in a file of %zu bytes loads", count, broken.size());
+	}
+	for (size_t size = 0; size < file.size(); ++size) {
+		if (!WriteFile(path, file.data(), size) || loaded.Load(path) || loaded.GetCount()) {
+			Fail("capcache: a file cut off after %zu of %zu bytes loads", size, file.size());
+			break;
+		}
+	}
+	remove(path);
+	if (loaded.Load(path) || loaded.GetCount())
+		Fail("capcache: a missing file loads");
+}
+
+//---------------------------------------------------------------------------------------------
+static DeviceCapability MakeCapability(uint32_t subtype, uint32_t width, uint32_t height, uint32_t fps, uint32_t index)
+{
+	DeviceCapability cap;
+	cap.format.subtype = subtype;
+	cap.format.width = width;
+	cap.format.height = height;
+	cap.format.fpsNum = fps;
+	cap.format.fpsDen = 1;
+	cap.index = index;
+	return cap;
+}
+
+static void TestNegotiate()
+{
+	std::vector<DeviceCapability> caps = {
+		MakeCapability(MEDIA_SUBTYPE_YUY2, 1280, 720, 30, 0), MakeCapability(MEDIA_SUBTYPE_MJPG, 1280, 720, 30, 1), MakeCapability(MEDIA_SUBTYPE_NV12, 1280, 720, 30, 2),
+		MakeCapability(MEDIA_SUBTYPE_YUY2, 640, 480, 30, 3),  MakeCapability(MEDIA_SUBTYPE_NV12, 1920, 1080, 30, 4), MakeCapability(MEDIA_SUBTYPE_YUY2, 1280, 720, 10, 5),
+	};
+	CMediaNegotiator negotiator;
+	negotiator.SetCapabilities(caps);
+
+	// the exact match, no conversion
+	MediaRequest request;
+	request.width = 1280;
+	request.height = 720;
+	request.fps = 30.0;
+	NegotiationResult result;
+	if (!negotiator.Negotiate(request, result) || result.cap.index != 2 || result.needsConversion || result.fpsFromRange)
+		Fail("negotiate 720p30 picked %u", result.cap.index);
+
+	// a busy bus: the right size at a lower rate beats the exact match
+	request.maxBandwidth = 30000000;
+	if (!negotiator.Negotiate(request, result) || result.bandwidth > request.maxBandwidth || result.cap.format.width != 1280)
+		Fail("negotiate 720p30 within %llu bytes/s picked %u at %llu", (unsigned long long)request.maxBandwidth, result.cap.index, (unsigned long long)result.bandwidth);
+
+	request.maxBandwidth = 1000;
+	if (negotiator.Negotiate(request, result))
+		Fail("negotiate picked %u over the bandwidth limit", result.cap.index);
+
+	// a rate inside a range is set as requested
+	DeviceCapability range = MakeCapability(MEDIA_SUBTYPE_NV12, 1280, 720, 30, 6);
+	range.fpsMinNum = 5;
+	range.fpsMinDen = 1;
+	range.fpsMaxNum = 60;
+	range.fpsMaxDen = 1;
+	caps.push_back(range);
+	negotiator.SetCapabilities(caps);
+	request.maxBandwidth = 0;
+	request.fps = 25.0;
+	if (!negotiator.Negotiate(request, result) || result.cap.index != 6 || !result.fpsFromRange || result.cap.format.fpsNum != 25 * result.cap.format.fpsDen)
+		Fail("negotiate 720p25 picked %u at %u/%u", result.cap.index, result.cap.format.fpsNum, result.cap.format.fpsDen);
+
+	// nothing the pipeline can convert
+	negotiator.SetCapabilities({MakeCapability(MEDIA_FOURCC('H', '2', '6', '4'), 1280, 720, 30, 0)});
+	if (negotiator.Negotiate(request, result))
+		Fail("negotiate picked H264");
+
+	// audio: the requested rate without resampling
+	std::vector<DeviceCapability> audio(2);
+	for (uint32_t i = 0; i < 2; ++i) {
+		audio[i].format.video = false;
+		audio[i].format.subtype = MEDIA_SUBTYPE_PCM;
+		audio[i].format.channels = 2;
+		audio[i].format.bitsPerSample = 16;
+		audio[i].format.sampleRate = i ? 48000 : 44100;
+		audio[i].index = i;
+	}
+	negotiator.SetCapabilities(audio);
+	MediaRequest audioRequest;
+	audioRequest.video = false;
+	audioRequest.sampleRate = 48000;
+	if (!negotiator.Negotiate(audioRequest, result) || result.cap.index != 1)
+		Fail("negotiate 48kHz picked %u", result.cap.index);
+}
+
+//---------------------------------------------------------------------------------------------
+static MediaFormat MakeAudioFormat(uint32_t subtype, uint32_t channels, uint32_t sampleRate, uint32_t bitsPerSample)
+{
+	MediaFormat format;
+	format.video = false;
+	format.subtype = subtype;
+	format.channels = channels;
+	format.sampleRate = sampleRate;
+	format.bitsPerSample = bitsPerSample;
+	return format;
+}
+
+// a sine through the resampler in uneven chunks: every level within float rounding of the scalar code, a clean sine at the
+// output rate, and the timestamp offset of each chunk is where its first output frame really is
+static void TestAudio()
+{
+	static const uint32_t rates[][2] = {{44100, 48000}, {48000, 44100}, {16000, 48000}, {48000, 32000}};
+	const std::vector<SimdLevel> levels = GetLevels();
+	const double amplitude = 16000.0 / 32768.0;
+
+	for (const auto &rate : rates) {
+		const MediaFormat input = MakeAudioFormat(MEDIA_SUBTYPE_PCM, 2, rate[0], 16);
+		const MediaFormat output = MakeAudioFormat(MEDIA_SUBTYPE_FLOAT, 2, rate[1], 32);
+		for (double frequency : {440.0, 3000.0}) {
+			std::vector<int16_t> src(rate[0] * 2);
+			for (uint32_t i = 0; i < rate[0]; ++i)
+				src[i * 2] = src[i * 2 + 1] = (int16_t)lrint(16000.0 * sin(2.0 * TEST_PI * frequency * i / rate[0]));
+
+			std::vector<float> reference;
+			for (SimdLevel level : levels) {
+				CAudioConverter converter;
+				if (!converter.Init(input, output, level)) {
+					Fail("audio %u -> %u %s init", rate[0], rate[1], GetSimdLevelString(level));
+					break;
+				}
+
+				std::vector<float> result;
+				uint32_t offsetErrors = 0;
+				const uint32_t chunk = 97 + 211 * level; // frames
+				for (uint32_t first = 0; first < rate[0]; first += chunk) {
+					const uint32_t frames = (std::min)(chunk, rate[0] - first);
+					std::vector<uint8_t> dst(converter.GetMaxOutputSize(frames * 4));
+					const uint32_t bytes = converter.Convert((const uint8_t *)(src.data() + first * 2), frames * 4, dst.data(), (uint32_t)dst.size());
+
+					// output frame n is at input time n / output rate
+					const size_t outFirst = result.size() / 2;
+					const double expected = (double(outFirst) / rate[1] - double(first) / rate[0]) * 1e7;
+					if (bytes && std::fabs(double(converter.GetTimestampOffset()) - expected) > 1.0)
+						++offsetErrors;
+
+					result.resize(result.size() + bytes / 4);
+					memcpy(result.data() + result.size() - bytes / 4, dst.data(), bytes);
+				}
+				if (offsetErrors)
+					Fail("audio %u -> %u %s: %u chunks with a wrong timestamp offset", rate[0], rate[1], GetSimdLevelString(level), offsetErrors);
+
+				const size_t outFrames = result.size() / 2;
+				// the filter holds back half of its taps
+				if (outFrames + AUDIO_FILTER_TAPS / 2 * rate[1] / rate[0] + 1 < rate[1] || outFrames > rate[1]) {
+					Fail("audio %u -> %u %s: %zu frames out of one second", rate[0], rate[1], GetSimdLevelString(level), outFrames);
+					continue;
+				}
+
+				double signal = 0.0, noise = 0.0;
+				for (size_t n = AUDIO_FILTER_TAPS; n + AUDIO_FILTER_TAPS < outFrames; ++n) {
+					const double ideal = amplitude * sin(2.0 * TEST_PI * frequency * n / rate[1]);
+					signal += 2.0 * ideal * ideal;
+					noise += (result[n * 2] - ideal) * (result[n * 2] - ideal) + (result[n * 2 + 1] - ideal) * (result[n * 2 + 1] - ideal);
+				}
+				const double snr = 10.0 * log10(signal / (noise + 1e-30));
+				if (snr < 75.0)
+					Fail("audio %u -> %u %.0fHz %s: snr %.1fdB", rate[0], rate[1], frequency, GetSimdLevelString(level), snr);
+
+				if (level == levels[0]) {
+					reference = result;
+					continue;
+				}
+				float maxDiff = reference.size() == result.size() ? 0.0f : 1.0f;
+				for (size_t i = 0; i < reference.size() && i < result.size(); ++i)
+					maxDiff = (std::max)(maxDiff, std::fabs(reference[i] - result[i]));
+				if (maxDiff > 1e-5f)
+					Fail("audio %u -> %u %s differs from %s by %g", rate[0], rate[1], GetSimdLevelString(level), GetSimdLevelString(levels[0]), maxDiff);
+			}
+		}
+	}
+
+	// float out of range is clipped, not wrapped
+	std::vector<float> loud(64);
+	for (uint32_t i = 0; i < 64; ++i)
+		loud[i] = i % 2 ? 2.0f : -2.0f;
+	for (SimdLevel level : levels) {
+		CAudioConverter converter;
+		converter.Init(MakeAudioFormat(MEDIA_SUBTYPE_FLOAT, 1, 48000, 32), MakeAudioFormat(MEDIA_SUBTYPE_PCM, 1, 48000, 16), level);
+		int16_t dst[64];
+		converter.Convert((const uint8_t *)loud.data(), 256, (uint8_t *)dst, sizeof(dst));
+		if (dst[0] != -32768 || dst[1] != 32767 || dst[62] != -32768 || dst[63] != 32767)
+			Fail("audio %s: clipped to %d %d", GetSimdLevelString(level), dst[62], dst[63]);
+	}
+
+	CAudioConverter converter;
+	if (converter.Init(MakeAudioFormat(MEDIA_SUBTYPE_PCM, 1, 44100, 16), MakeAudioFormat(MEDIA_SUBTYPE_PCM, 1, 48001, 16)))
+		Fail("audio: 44100 -> 48001 needs more than %u phases", AUDIO_MAX_PHASES);
+}
+
+//---------------------------------------------------------------------------------------------
+struct RetimedSink : IMediaSink {
+	std::vector<int64_t> timestamps;
+	std::vector<uint32_t> flags;
+
+	void OnMediaSample(const MediaSample &sample) override
+	{
+		timestamps.push_back(sample.timestamp);
+		flags.push_back(sample.flags);
+	}
+};
+
+// the drift fit of a stream clock against simulated arrivals, then the audio of CAVSync timed by its sample count and
+// re-anchored to the device timestamps after a jump or a stream tick
+static void TestSync()
+{
+	// ten minutes of packets every 10ms, delayed by 0.2 to 5ms, one in 20 by up to 20ms
+	for (double ppm : {100.0, -250.0, 0.0, 5000.0}) {
+		CStreamClock clock;
+		const int64_t base = 123456789;
+		double maxError = 0.0;
+		for (int64_t i = 0; i < 60000; ++i) {
+			const int64_t media = i * 100000;
+			const double host = base + media * (1.0 + ppm * 1e-6);
+			const int64_t delay = 2000 + (Random() % 20 ? Random() % 48000 : Random() % 200000);
+			const int64_t mapped = clock.Update(media, (int64_t)host + delay);
+			if (i > 6000)
+				maxError = (std::max)(maxError, std::fabs(double(mapped) - host));
+		}
+
+		// beyond SYNC_MAX_DRIFT the timestamps are broken, the rate stays at the limit
+		const double expected = (std::min)(ppm, SYNC_MAX_DRIFT * 1e6);
+		const double estimated = (clock.GetRate() - 1.0) * 1e6;
+		if (std::fabs(estimated - expected) > 2.0 || (ppm == expected && maxError > 10000.0))
+			Fail("sync: %.0fppm estimated as %.2fppm, off by up to %.2fms", ppm, estimated, maxError / 1e4);
+	}
+
+	// 10ms packets paced in real time: 10 packets, one of them 30ms late by its device timestamp, a device jump of 200ms, 5 packets,
+	// a stream tick, 5 packets. only the least delay of the arrivals moves the output, so it is checked to 5ms
+	RetimedSink video, audio;
+	CAVSync sync(&video, &audio);
+	MediaFormat format = MakeAudioFormat(MEDIA_SUBTYPE_PCM, 2, 48000, 16);
+	std::vector<uint8_t> packet(480 * 4);
+	const int64_t start = GetMonotonicTime100ns();
+	int64_t device = 5000000;
+	for (uint32_t i = 0; i < 21; ++i) {
+		device += i == 10 ? 2100000 : 100000;
+		MediaSample sample;
+		sample.format = &format;
+		sample.timestamp = device + (i == 4 ? 300000 : 0);
+		if (i != 15) {
+			sample.planes[0].data = packet.data();
+			sample.planes[0].size = (uint32_t)packet.size();
+			sample.planeCount = 1;
+		}
+		SleepUntil100ns(start + device - 5000000);
+		sync.GetAudioInput()->OnMediaSample(sample);
+	}
+
+	const AVSyncStats stats = sync.GetStats();
+	if (audio.timestamps.size() != 21 || stats.audio.gaps != 2 || audio.timestamps[0] != 0) {
+		Fail("sync: %zu audio samples, %llu gaps", audio.timestamps.size(), (unsigned long long)stats.audio.gaps);
+		return;
+	}
+	for (uint32_t i = 1; i < 21; ++i) {
+		// the sample count, not the device timestamp; the jump and the tick are new anchors
+		const int64_t step = audio.timestamps[i] - audio.timestamps[i - 1];
+		const bool anchor = i == 10 || i == 16;
+		const int64_t expected = i == 10 ? 2100000 : i == 15 || i == 16 ? step : 100000;
+		if (!!(audio.flags[i] & MEDIA_SAMPLE_FLAG_DISCONTINUITY) != anchor || std::llabs(step - expected) > 50000) {
+			Fail("sync: audio sample %u %.1fms after the previous one, flags %x", i, step / 1e4, audio.flags[i]);
+			break;
+		}
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+// the buckets tile the value range without holes at 1/64 relative width, the percentiles are bucket upper bounds,
+// and a reader may take snapshots while the writer records
+static void TestHistogram()
+{
+	for (uint32_t bucket = 0; bucket < HISTOGRAM_BUCKETS; ++bucket) {
+		const uint64_t low = CHistogram::GetBucketMin(bucket), high = CHistogram::GetBucketMax(bucket);
+		const bool next = bucket + 1 == HISTOGRAM_BUCKETS || CHistogram::GetBucketMin(bucket + 1) == high + 1;
+		if (CHistogram::GetBucket(low) != bucket || CHistogram::GetBucket(high) != bucket || !next || (high - low) * HISTOGRAM_SUB_BUCKETS > low ||
+		    (low < 2 * HISTOGRAM_SUB_BUCKETS && low != high)) {
+			Fail("histogram: bucket %u holds %llu..%llu", bucket, (unsigned long long)low, (unsigned long long)high);
+			break;
+		}
+	}
+	const uint64_t limit = uint64_t(1) << HISTOGRAM_MAX_BITS;
+	if (CHistogram::GetBucketMax(HISTOGRAM_BUCKETS - 1) != limit - 1 || CHistogram::GetBucket(limit) != HISTOGRAM_BUCKETS - 1 ||
+	    CHistogram::GetBucket(UINT64_MAX) != HISTOGRAM_BUCKETS - 1)
+		Fail("histogram: values from 2^%u on are not clamped to the last bucket", HISTOGRAM_MAX_BITS);
+
+	CHistogram histogram;
+	HistogramSnapshot snapshot;
+	histogram.GetSnapshot(snapshot);
+	if (snapshot.count || snapshot.GetPercentile(50))
+		Fail("histogram: an empty histogram has %llu values", (unsigned long long)snapshot.count);
+
+	// 1..10000 once each
+	for (uint64_t value = 1; value <= 10000; ++value)
+		histogram.Record(value);
+	histogram.GetSnapshot(snapshot);
+	if (snapshot.count != 10000 || snapshot.min != 1 || snapshot.max != 10000 || snapshot.sum != 50005000)
+		Fail("histogram: count %llu, min %llu, max %llu", (unsigned long long)snapshot.count, (unsigned long long)snapshot.min, (unsigned long long)snapshot.max);
+	for (double percentile : {0.0, 1.0, 50.0, 90.0, 99.0, 99.9, 100.0}) {
+		const uint64_t exact = (std::max)((uint64_t)std::ceil(percentile * 100.0), (uint64_t)1);
+		const uint64_t value = snapshot.GetPercentile(percentile);
+		if (value < exact || value > exact + exact / HISTOGRAM_SUB_BUCKETS)
+			Fail("histogram: p%g is %llu instead of %llu", percentile, (unsigned long long)value, (unsigned long long)exact);
+	}
+	if (snapshot.GetPercentile(100.0) != 10000 || snapshot.GetPercentile(200.0) != 10000)
+		Fail("histogram: p100 is above the max");
+
+	// one writer, one reader: the count never goes back and always matches the buckets
+	histogram.Reset();
+	std::atomic<bool> done{false};
+	std::thread writer([&histogram, &done]() {
+		for (uint64_t i = 0; i < 200000; ++i)
+			histogram.Record(i % 5000 * 1000);
+		done = true;
+	});
+	uint64_t last = 0;
+	while (!done) {
+		histogram.GetSnapshot(snapshot);
+		if (snapshot.count < last)
+			Fail("histogram: the count went back from %llu to %llu", (unsigned long long)last, (unsigned long long)snapshot.count);
+		last = snapshot.count;
+	}
+	writer.join();
+	histogram.GetSnapshot(snapshot);
+	if (snapshot.count != 200000 || snapshot.max != 4999000)
+		Fail("histogram: %llu values recorded by the writer thread", (unsigned long long)snapshot.count);
+
+	// 33ms frames: an interval of 2 or 3 frames is 1 or 2 missing ones
+	CCaptureMetrics metrics;
+	metrics.SetNominalInterval(33333333);
+	int64_t time = 1000;
+	for (int64_t frames : {1, 1, 2, 1, 3, 1}) {
+		time += frames * 33333333;
+		metrics.RecordSample(time);
+	}
+	CaptureMetricsSnapshot captured;
+	metrics.GetSnapshot(captured);
+	if (captured.samples != 6 || captured.gapFrames != 3 || captured.interval.count != 5)
+		Fail("histogram: %llu gap frames in %llu samples", (unsigned long long)captured.gapFrames, (unsigned long long)captured.samples);
+}
+
+//---------------------------------------------------------------------------------------------
+// sessions which block for room lose nothing, Stop waits for the workers to drain them. a shared source never waits
+// for its subscribers, what they miss shows up as dropped
+static void TestManager()
+{
+	MediaFormat format;
+	format.subtype = MEDIA_SUBTYPE_NV12;
+	format.width = 64;
+	format.height = 32;
+	format.fpsNum = 30;
+	format.fpsDen = 1;
+	const uint64_t count = 200;
+
+	CaptureManagerOptions options;
+	options.threads = 3;
+	options.backpressure.capacity = 4;
+	options.backpressure.blockTimeoutMs = 1000;
+	CCaptureManager manager(options);
+	std::vector<std::shared_ptr<CSyntheticSource>> sources;
+	for (uint32_t i = 0; i < 5; ++i) {
+		sources.push_back(std::make_shared<CSyntheticSource>(format, false, count));
+		manager.AddSession("camera", sources.back());
+	}
+	manager.AddSession("preview", sources[0]);
+	if (manager.Start() != 6)
+		Fail("manager: %u sessions failed to start", manager.GetStats().failed);
+
+	for (uint32_t i = 0; i < 2000; ++i) {
+		bool finished = true;
+		for (const auto &source : sources)
+			finished = finished && source->IsFinished();
+		if (finished)
+			break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	const int64_t begin = GetMonotonicTimeNs();
+	manager.Stop();
+	const int64_t stopNs = GetMonotonicTimeNs() - begin;
+
+	for (uint32_t i = 0; i < manager.GetSessionCount(); ++i) {
+		const CaptureSessionStats stats = manager.GetSession(i)->GetStats();
+		const bool shared = i == 0 || i == 5;
+		if ((shared ? stats.frames == 0 : stats.frames != count + 1 || stats.dropped) || !manager.GetSession(i)->IsIdle())
+			Fail("manager: session %u processed %llu and dropped %llu of %llu frames", i, (unsigned long long)stats.frames, (unsigned long long)stats.dropped,
+			     (unsigned long long)count + 1);
+	}
+	// what the shared source could not get a frame for is dropped once, but missed by both of its sessions
+	const CaptureManagerStats stats = manager.GetStats();
+	if (stats.sessions != 6 || stats.threads != 3 || stats.frames + stats.dropped + sources[0]->GetDroppedCount() != 6 * (count + 1) || stats.tasks < 6)
+		Fail("manager: %u sessions, %llu frames and %llu dropped in %llu tasks", stats.sessions, (unsigned long long)stats.frames, (unsigned long long)stats.dropped,
+		     (unsigned long long)stats.tasks);
+	if (stopNs > 500000000)
+		Fail("manager: Stop took %.1fms", stopNs / 1e6);
+}
+
+//---------------------------------------------------------------------------------------------
+// a pyramid of box and bilinear renditions from a padded source
+static void TestScale()
+{
+	static const uint32_t sizes[][2] = {{1922, 1082}, {1280, 720}, {102, 62}, {34, 18}, {6, 4}};
+	const std::vector<SimdLevel> levels = GetLevels();
+
+	for (const auto &size : sizes) {
+		const uint32_t width = size[0], height = size[1];
+		const int32_t stride = (int32_t)width + 7;
+		std::vector<uint8_t> src((size_t)stride * height * 3 / 2);
+		FillRandom(src);
+		MediaPlane planes[2];
+		planes[0].data = src.data();
+		planes[0].stride = stride;
+		planes[1].data = src.data() + (size_t)stride * height;
+		planes[1].stride = stride;
+
+		ScaleRendition renditions[4];
+		renditions[0].width = width / 2 & ~1u;
+		renditions[0].height = height / 2 & ~1u;
+		renditions[1].width = width;
+		renditions[1].height = height;
+		renditions[2].width = (std::max)(width / 4 & ~1u, 2u);
+		renditions[2].height = (std::max)(height / 4 & ~1u, 2u);
+		renditions[3].width = (std::max)(width * 2 / 3 & ~1u, 2u);
+		renditions[3].height = (std::max)(height * 2 / 3 & ~1u, 2u);
+
+		std::vector<uint8_t> reference[4], output[4];
+		for (SimdLevel level : levels) {
+			std::vector<uint8_t> *dst = level == levels[0] ? reference : output;
+			uint8_t *pointers[4];
+			for (uint32_t i = 0; i < 4; ++i) {
+				dst[i].assign(renditions[i].width * renditions[i].height * 3 / 2, TEST_GUARD);
+				pointers[i] = dst[i].data();
+			}
+
+			CVideoScaler scaler;
+			if (!scaler.Init(width, height, renditions, 4, level) || !scaler.Scale(planes, pointers)) {
+				Fail("scale %ux%u %s", width, height, GetSimdLevelString(level));
+				break;
+			}
+			for (uint32_t i = 0; level != levels[0] && i < 4; ++i) {
+				if (output[i] != reference[i])
+					Fail("scale %ux%u -> %ux%u %s differs from %s", width, height, renditions[i].width, renditions[i].height, GetSimdLevelString(level),
+					     GetSimdLevelString(levels[0]));
+			}
+		}
+
+		// the source size is a copy, the half a 2x2 box
+		for (uint32_t y = 0; y < height; ++y) {
+			if (memcmp(reference[1].data() + (size_t)y * width, src.data() + (size_t)y * stride, width)) {
+				Fail("scale %ux%u copy differs at row %u", width, height, y);
+				break;
+			}
+		}
+		const ScaleRendition &half = renditions[0];
+		for (uint32_t y = 0; half.width * 2 == width && half.height * 2 == height && y < half.height; ++y) {
+			for (uint32_t x = 0; x < half.width; ++x) {
+				const uint8_t *box = src.data() + (size_t)y * 2 * stride + x * 2;
+				if (reference[0][(size_t)y * half.width + x] != ((box[0] + box[1] + box[stride] + box[stride + 1] + 2) >> 2)) {
+					Fail("scale %ux%u box differs at %u,%u", width, height, x, y);
+					x = half.width;
+					y = half.height;
+				}
+			}
+		}
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+// high bit depth -> P010 and NV12, P010 keeps the low 6 bits clear
+static void TestDepth()
+{
+	static const uint32_t subtypes[] = {MEDIA_SUBTYPE_V210, MEDIA_SUBTYPE_Y210, MEDIA_SUBTYPE_P010, MEDIA_SUBTYPE_P016};
+	const std::vector<SimdLevel> levels = GetLevels();
+
+	for (uint32_t subtype : subtypes) {
+		for (uint32_t target : {MEDIA_SUBTYPE_P010, MEDIA_SUBTYPE_NV12}) {
+			for (uint32_t width : g_widths) {
+				const uint32_t height = 6;
+				MediaFormat format;
+				format.subtype = subtype;
+				format.width = width;
+				format.height = height;
+				const int32_t stride = GetVideoDefaultStride(format) + (int32_t)GetPadding(subtype);
+				std::vector<uint8_t> src((size_t)stride * height * 2);
+				FillRandom(src);
+				MediaPlane planes[MEDIA_MAX_PLANES];
+				DescribeVideoPlanes(format, src.data(), stride, planes);
+
+				const uint32_t bytes = target == MEDIA_SUBTYPE_P010 ? 2 : 1;
+				const int32_t dstStride = (int32_t)(width * bytes) + 6;
+				std::vector<uint8_t> reference, output;
+				for (SimdLevel level : levels) {
+					std::vector<uint8_t> &dst = level == levels[0] ? reference : output;
+					dst.assign((size_t)dstStride * height * 3 / 2, TEST_GUARD);
+
+					CDepthConverter converter;
+					if (!converter.Init(subtype, target, level)) {
+						Fail("depth %.4s -> %.4s init", (const char *)&subtype, (const char *)&target);
+						break;
+					}
+					converter.Convert(planes, width, height, dst.data(), dstStride, dst.data() + (size_t)dstStride * height, dstStride);
+					if (level != levels[0] && output != reference)
+						Fail("depth %.4s -> %.4s width %u %s differs from %s", (const char *)&subtype, (const char *)&target, width, GetSimdLevelString(level),
+						     GetSimdLevelString(levels[0]));
+				}
+
+				if (!IsGuardIntact(reference, width * bytes, dstStride, height * 3 / 2))
+					Fail("depth %.4s -> %.4s width %u writes past the row", (const char *)&subtype, (const char *)&target, width);
+
+				if (target == MEDIA_SUBTYPE_P010) {
+					for (uint32_t y = 0; y < height * 3 / 2; ++y) {
+						const uint16_t *row = (const uint16_t *)(reference.data() + (size_t)y * dstStride);
+						for (uint32_t x = 0; x < width; ++x) {
+							if (row[x] & 0x3f) {
+								Fail("depth %.4s -> P010 width %u leaves low bits at row %u", (const char *)&subtype, width, y);
+								x = width;
+								y = height * 3 / 2;
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+// frames of EncodeJpeg as a camera would send them: close to the source, the same bytes with every level and thread count
+static void TestMjpeg()
+{
+	static const uint32_t sizes[][2] = {{1280, 720}, {642, 362}, {37, 17}, {16, 8}};
+	const std::vector<SimdLevel> levels = GetLevels();
+
+	for (const auto &size : sizes) {
+		const uint32_t width = size[0], height = size[1];
+		for (uint32_t variant = 0; variant < 4; ++variant) {
+			JpegEncodeOptions options;
+			options.quality = 90;
+			options.chroma420 = variant & 1;
+			options.restartInterval = variant & 2 ? 3 : 0;
+			options.huffmanTables = variant == 3;
+
+			const uint32_t chromaWidth = (width + 1) / 2;
+			const uint32_t chromaHeight = options.chroma420 ? (height + 1) / 2 : height;
+			std::vector<uint8_t> y(width * height), u(chromaWidth * chromaHeight), v(chromaWidth * chromaHeight);
+			for (uint32_t row = 0; row < height; ++row) {
+				for (uint32_t col = 0; col < width; ++col)
+					y[row * width + col] = uint8_t(col * 2 + row + Random() % 4);
+			}
+			for (uint32_t row = 0; row < chromaHeight; ++row) {
+				for (uint32_t col = 0; col < chromaWidth; ++col) {
+					u[row * chromaWidth + col] = uint8_t(96 + col % 64);
+					v[row * chromaWidth + col] = uint8_t(160 - row % 64);
+				}
+			}
+			const MediaPlane planes[3] = {{y.data(), (int32_t)width, 0}, {u.data(), (int32_t)chromaWidth, 0}, {v.data(), (int32_t)chromaWidth, 0}};
+			std::vector<uint8_t> frame;
+			if (!EncodeJpeg(planes, width, height, options, frame)) {
+				Fail("mjpeg %ux%u does not encode", width, height);
+				continue;
+			}
+
+			const int32_t stride = (int32_t)((width + 1) & ~1u) + 6;
+			const uint32_t rows = (height + 1) & ~1u;
+			std::vector<uint8_t> reference, output;
+			for (SimdLevel level : levels) {
+				for (uint32_t threads : {1u, 2u, 4u}) {
+					const bool first = level == levels[0] && threads == 1;
+					std::vector<uint8_t> &dst = first ? reference : output;
+					dst.assign((size_t)stride * rows * 3 / 2, TEST_GUARD);
+					CJpegDecoder decoder;
+					decoder.Start(threads, level);
+					if (!decoder.Decode(frame.data(), (uint32_t)frame.size(), width, height, dst.data(), stride, dst.data() + (size_t)stride * rows, stride)) {
+						Fail("mjpeg %ux%u variant %u %s on %u threads does not decode", width, height, variant, GetSimdLevelString(level), threads);
+						continue;
+					}
+					if (!first && output != reference)
+						Fail("mjpeg %ux%u variant %u %s on %u threads differs", width, height, variant, GetSimdLevelString(level), threads);
+				}
+			}
+
+			// luma and the u samples of the nv12 chroma
+			double lumaError = 0.0, chromaError = 0.0;
+			for (uint32_t row = 0; row < height; ++row) {
+				for (uint32_t col = 0; col < width; ++col) {
+					const double error = double(reference[(size_t)row * stride + col]) - y[row * width + col];
+					lumaError += error * error;
+				}
+			}
+			for (uint32_t row = 0; row < height / 2; ++row) {
+				for (uint32_t col = 0; col < width / 2; ++col) {
+					const double error = double(reference[(size_t)stride * rows + (size_t)row * stride + col * 2]) - u[(options.chroma420 ? row : row * 2) * chromaWidth + col];
+					chromaError += error * error;
+				}
+			}
+			const double lumaPsnr = 10.0 * log10(255.0 * 255.0 * width * height / (lumaError + 1e-9));
+			const double chromaPsnr = 10.0 * log10(255.0 * 255.0 * (std::max)(width / 2 * (height / 2), 1u) / (chromaError + 1e-9));
+			if (lumaPsnr < 35.0 || chromaPsnr < 35.0)
+				Fail("mjpeg %ux%u variant %u: psnr y %.1f u %.1f", width, height, variant, lumaPsnr, chromaPsnr);
+
+			// cut off frames are rejected
+			CJpegDecoder decoder;
+			decoder.Start(2);
+			output.assign(reference.size(), 0);
+			if (decoder.Decode(frame.data(), (uint32_t)frame.size() / 2, width, height, output.data(), stride, output.data() + (size_t)stride * rows, stride) &&
+			    output == reference)
+				Fail("mjpeg %ux%u variant %u: half a frame decodes as the whole", width, height, variant);
+		}
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+// the sums must be exact: a difference of `threshold` per pixel is unchanged, one more anywhere changes the frame
+static void TestChange()
+{
+	const std::vector<SimdLevel> levels = GetLevels();
+
+	for (uint32_t width : g_widths) {
+		for (uint32_t height : {2u, 18u, 66u}) {
+			for (uint32_t blockSize : {16u, 32u, 48u}) {
+				MediaFormat format;
+				format.subtype = MEDIA_SUBTYPE_NV12;
+				format.width = width;
+				format.height = height;
+				const int32_t stride = (int32_t)width + 7;
+				std::vector<uint8_t> a((size_t)stride * height * 3 / 2), b;
+				for (uint8_t &value : a)
+					value = uint8_t(Random() % 200);
+
+				ChangeDetectorOptions options;
+				options.blockSize = blockSize;
+				options.threshold = 1 + Random() % 3;
+				b = a;
+				for (uint32_t y = 0; y < height; ++y) {
+					for (uint32_t x = 0; x < width; ++x)
+						b[(size_t)y * stride + x] += uint8_t(options.threshold);
+				}
+
+				for (SimdLevel level : levels) {
+					CChangeDetector detector;
+					detector.Init(options, level);
+					MediaSample sample;
+					sample.format = &format;
+					sample.planeCount = DescribeVideoPlanes(format, a.data(), stride, sample.planes);
+					if (!detector.IsChanged(sample) || detector.IsChanged(sample))
+						Fail("change %ux%u %s: the first frame changed, the same one again did not", width, height, GetSimdLevelString(level));
+
+					sample.planeCount = DescribeVideoPlanes(format, b.data(), stride, sample.planes);
+					if (detector.IsChanged(sample))
+						Fail("change %ux%u block %u %s: a difference of the threshold changed", width, height, blockSize, GetSimdLevelString(level));
+
+					const size_t pixel = (size_t)(Random() % height) * stride + Random() % width;
+					++b[pixel];
+					if (!detector.IsChanged(sample))
+						Fail("change %ux%u block %u %s: one more at %zu did not change", width, height, blockSize, GetSimdLevelString(level), pixel);
+					--b[pixel];
+				}
+			}
+		}
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+// the encoded bytes of every level are the same, every level decodes them. a lossless dump of the pipeline replays
+// one record per sample and the pipeline decodes the replay back to the frames which went in
+static void TestLossless()
+{
+	const std::vector<SimdLevel> levels = GetLevels();
+
+	for (uint32_t width : g_widths) {
+		for (uint32_t height : {2u, 18u, 34u}) {
+			for (uint32_t kind = 0; kind < 3; ++kind) {
+				const int32_t stride = (int32_t)width + 7;
+				std::vector<uint8_t> src((size_t)stride * height * 3 / 2);
+				// noise, flat, smooth with camera noise
+				for (uint32_t y = 0; y < height * 3 / 2; ++y) {
+					for (uint32_t x = 0; x < width; ++x) {
+						uint8_t &value = src[(size_t)y * stride + x];
+						if (kind == 0)
+							value = uint8_t(Random());
+						else if (kind == 1)
+							value = 128;
+						else
+							value = uint8_t(128 + 60 * sin(x * 0.02) * cos(y * 0.03) + (int)(Random() % 5) - 2);
+					}
+				}
+				MediaFormat format;
+				format.subtype = MEDIA_SUBTYPE_NV12;
+				format.width = width;
+				format.height = height;
+				MediaPlane planes[MEDIA_MAX_PLANES];
+				DescribeVideoPlanes(format, src.data(), stride, planes);
+
+				std::vector<uint8_t> reference, encoded;
+				for (SimdLevel level : levels) {
+					std::vector<uint8_t> &dst = level == levels[0] ? reference : encoded;
+					CLosslessCodec codec;
+					codec.Start(1 + Random() % 3, level);
+					dst.resize(CLosslessCodec::GetMaxEncodedSize(width, height));
+					dst.resize(codec.Encode(planes, width, height, dst.data(), (uint32_t)dst.size()));
+					if (dst.empty()) {
+						Fail("lossless %ux%u %s does not encode", width, height, GetSimdLevelString(level));
+						return;
+					}
+					if (level != levels[0] && encoded != reference)
+						Fail("lossless %ux%u kind %u %s encodes differently from %s", width, height, kind, GetSimdLevelString(level), GetSimdLevelString(levels[0]));
+
+					const int32_t dstStride = (int32_t)width + 5;
+					std::vector<uint8_t> output((size_t)dstStride * height * 3 / 2, TEST_GUARD);
+					if (!codec.Decode(reference.data(), (uint32_t)reference.size(), width, height, output.data(), dstStride, output.data() + (size_t)dstStride * height,
+							  dstStride)) {
+						Fail("lossless %ux%u %s does not decode", width, height, GetSimdLevelString(level));
+						continue;
+					}
+					for (uint32_t y = 0; y < height * 3 / 2; ++y) {
+						if (memcmp(output.data() + (size_t)y * dstStride, src.data() + (size_t)y * stride, width)) {
+							Fail("lossless %ux%u kind %u %s differs at row %u", width, height, kind, GetSimdLevelString(level), y);
+							break;
+						}
+					}
+					if (!IsGuardIntact(output, width, dstStride, height * 3 / 2))
+						Fail("lossless %ux%u %s writes past the row", width, height, GetSimdLevelString(level));
+				}
+			}
+		}
+	}
+
+	const char *path = "mf-test-lossless.mfc";
+	const char *decodedPath = "mf-test-lossless-nv12.mfc";
+	MediaFormat format;
+	format.subtype = MEDIA_SUBTYPE_NV12;
+	format.width = 96;
+	format.height = 64;
+	format.fpsNum = 30;
+	format.fpsDen = 1;
+	const uint64_t count = 12;
+
+	CollectingSink original;
+	{
+		CSyntheticSource source(format, false, count);
+		if (!source.StartCapture(&original) || !WaitForSamples(source, original, count + 1))
+			Fail("lossless: the synthetic source does not end");
+		source.StopCapture();
+	}
+
+	// the pipeline of a stand-in, once compressing into `path` and once replaying it into `decodedPath`
+	const auto runPipeline = [](CStandInSource &source, const char *dumpPath, bool compress) {
+		CMediaPipeline pipeline;
+		pipeline.SetDumpPath(dumpPath);
+		pipeline.SetLosslessDump(compress);
+		if (!source.StartCapture(&pipeline))
+			return false;
+		for (uint32_t i = 0; i < 2000 && !source.IsFinished(); ++i)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		source.StopCapture();
+		return source.IsFinished() && pipeline.GetLosslessStats().errors == 0;
+	};
+	{
+		CSyntheticSource source(format, false, count);
+		if (!runPipeline(source, path, true))
+			Fail("lossless: the dump of %llu frames fails", (unsigned long long)count);
+	}
+
+	{
+		CContainerReader reader;
+		CContainerReplaySource replay(path, false, false);
+		CollectingSink sink;
+		if (!reader.Open(path) || reader.GetFormat().subtype != MEDIA_SUBTYPE_MFLZ || reader.GetFrameCount() != count || !replay.StartCapture(&sink) ||
+		    !WaitForSamples(replay, sink, count + 1))
+			Fail("lossless: %llu records in %s, the replay does not start", (unsigned long long)reader.GetFrameCount(), path);
+		replay.StopCapture();
+		for (uint32_t i = 0; i < count && i < reader.GetFrameCount() && i < sink.payloads.size(); ++i) {
+			if (sink.payloads[i].size() != reader.GetIndexEntry(i)->size || sink.timestamps[i] != original.timestamps[i])
+				Fail("lossless: replayed record %u has %zu bytes at %lld", i, sink.payloads[i].size(), (long long)sink.timestamps[i]);
+		}
+	}
+
+	{
+		CContainerReplaySource replay(path, false, false);
+		if (!replay.IsValid() || !runPipeline(replay, decodedPath, false))
+			Fail("lossless: the replay of %s does not decode", path);
+	}
+	{
+		CContainerReader reader;
+		if (!reader.Open(decodedPath) || reader.GetFormat().subtype != MEDIA_SUBTYPE_NV12 || reader.GetFrameCount() != count)
+			Fail("lossless: %llu frames decoded from %llu", (unsigned long long)reader.GetFrameCount(), (unsigned long long)count);
+		const size_t frameSize = GetVideoFrameSize(format);
+		for (uint32_t i = 0; i < reader.GetFrameCount() && i < original.payloads.size(); ++i) {
+			MediaSample sample;
+			if (!reader.GetFrame(i, sample) || sample.timestamp != original.timestamps[i] || memcmp(sample.planes[0].data, original.payloads[i].data(), frameSize)) {
+				Fail("lossless: decoded frame %u differs", i);
+				break;
+			}
+		}
+	}
+	remove(path);
+	remove(decodedPath);
+}
+
+//---------------------------------------------------------------------------------------------
+// a frame over a static byte which counts itself in `live` until its last reference is gone
+static FramePtr MakeCountedFrame(const MediaFormat &format, int64_t timestamp, std::atomic<int> &live)
+{
+	static uint8_t byte;
+	MediaSample sample;
+	sample.format = &format;
+	sample.timestamp = timestamp;
+	sample.planes[0].data = &byte;
+	sample.planes[0].size = 1;
+	sample.planeCount = 1;
+	++live;
+	return CMediaFrame::Wrap(sample, [&live]() { --live; });
+}
+
+// the queue with every policy full, once without and once with a consumer on another thread: what comes out is in
+// order, and what does not is counted under the right reason
+static void TestBackpressure()
+{
+	MediaFormat format;
+	format.video = false;
+	std::atomic<int> live{0};
+
+	static const struct {
+		BackpressurePolicy policy;
+		uint32_t blockTimeoutMs;
+		int64_t first;          // timestamp of the first frame popped out of 5 pushed into 3 slots
+		uint32_t popped;        // of those
+		FrameDropReason reason; // of the others
+	} fullCases[] = {
+		{BACKPRESSURE_BLOCK, 0, 0, 3, FRAME_DROP_FULL},
+		{BACKPRESSURE_BLOCK, 20, 0, 3, FRAME_DROP_FULL},
+		{BACKPRESSURE_DROP_OLDEST, 0, 2, 3, FRAME_DROP_REPLACED},
+		{BACKPRESSURE_KEEP_LATEST, 0, 4, 1, FRAME_DROP_REPLACED},
+	};
+	for (const auto &test : fullCases) {
+		const char *name = GetBackpressurePolicyString(test.policy);
+		CBackpressureQueue queue;
+		BackpressureOptions options;
+		options.policy = test.policy;
+		options.capacity = 3;
+		options.blockTimeoutMs = test.blockTimeoutMs;
+		queue.Init(options);
+
+		uint32_t accepted = 0;
+		for (int64_t i = 0; i < 5; ++i)
+			accepted += queue.Push(MakeCountedFrame(format, i, live).Get());
+		BackpressureStats stats = queue.GetStats();
+		const uint32_t expected = test.reason == FRAME_DROP_FULL ? 3 : 5;
+		if (accepted != expected || stats.pushed != expected || stats.dropped[test.reason] != 5 - test.popped || stats.GetDropped() != 5 - test.popped ||
+		    stats.maxDepth != test.popped || queue.GetSize() != test.popped)
+			Fail("backpressure %s: %u of 5 frames queued, %llu dropped as %s", name, accepted, (unsigned long long)stats.dropped[test.reason],
+			     GetFrameDropReasonString(test.reason));
+		if (stats.blocked != (test.blockTimeoutMs ? 2u : 0u) || stats.blockedNs < int64_t(test.blockTimeoutMs) * 2 * 900000)
+			Fail("backpressure %s: waited %.1fms for room %llu times", name, stats.blockedNs / 1e6, (unsigned long long)stats.blocked);
+
+		CMediaFrame *frame = nullptr;
+		for (uint32_t i = 0; i < test.popped; ++i) {
+			if (!queue.TryPop(frame) || frame->GetTimestamp() != test.first + i) {
+				Fail("backpressure %s: frame %u is not %lld", name, i, (long long)(test.first + i));
+				break;
+			}
+			frame->Release();
+		}
+		if (queue.TryPop(frame) || queue.GetStats().popped != test.popped)
+			Fail("backpressure %s: more than %u frames come out", name, test.popped);
+	}
+
+	// 30 fps limited to 20 passes two of three frames, a source which starts over starts the limit over
+	{
+		CBackpressureQueue queue;
+		BackpressureOptions options;
+		options.policy = BACKPRESSURE_RATE_LIMIT;
+		options.capacity = 256;
+		options.maxFramesPerSecond = 20.0;
+		queue.Init(options);
+		uint32_t accepted = 0;
+		for (int64_t i = 0; i < 150; ++i)
+			accepted += queue.Push(MakeCountedFrame(format, i * 10000000 / 30, live).Get());
+		const bool restarted = queue.Push(MakeCountedFrame(format, 0, live).Get());
+		const BackpressureStats stats = queue.GetStats();
+		if (accepted != 100 || !restarted || stats.dropped[FRAME_DROP_RATE] != 50 || stats.GetDropped() != 50)
+			Fail("backpressure rate limit: %u of 150 frames at 30 fps pass 20 fps", accepted);
+	}
+
+	// the producer runs far ahead: BLOCK loses nothing, DROP_OLDEST keeps the order and accounts for every frame
+	for (BackpressurePolicy policy : {BACKPRESSURE_BLOCK, BACKPRESSURE_DROP_OLDEST}) {
+		const char *name = GetBackpressurePolicyString(policy);
+		CBackpressureQueue queue;
+		BackpressureOptions options;
+		options.policy = policy;
+		options.capacity = 5;
+		options.blockTimeoutMs = 1000;
+		queue.Init(options);
+
+		const uint32_t count = 100000;
+		std::atomic<bool> done{false};
+		uint64_t popped = 0;
+		bool ordered = true;
+		std::thread consumer([&]() {
+			int64_t last = -1;
+			for (;;) {
+				const bool finished = done;
+				CMediaFrame *frame = nullptr;
+				if (!queue.TryPop(frame)) {
+					if (finished)
+						break;
+					std::this_thread::yield();
+					continue;
+				}
+				ordered = ordered && frame->GetTimestamp() > last;
+				last = frame->GetTimestamp();
+				frame->Release();
+				++popped;
+			}
+		});
+		for (uint32_t i = 0; i < count; ++i)
+			queue.Push(MakeCountedFrame(format, i, live).Get());
+		done = true;
+		consumer.join();
+
+		const BackpressureStats stats = queue.GetStats();
+		if (!ordered || popped + stats.GetDropped() != count || (policy == BACKPRESSURE_BLOCK && popped != count))
+			Fail("backpressure %s: %llu popped, %llu dropped of %u, in order %d", name, (unsigned long long)popped, (unsigned long long)stats.GetDropped(), count, ordered);
+	}
+
+	if (live)
+		Fail("backpressure: %d frames are still referenced", live.load());
+}
+
+//---------------------------------------------------------------------------------------------
+// 48kHz stereo pcm into 20ms packets, every frame holds its index in both channels so that the packets show which
+// frames they carry
+struct PacketizerInput {
+	std::vector<int16_t> samples;
+	int16_t next = 0;
+
+	const uint8_t *Make(uint32_t frames)
+	{
+		samples.resize(frames * 2);
+		for (uint32_t i = 0; i < frames; ++i)
+			samples[i * 2] = samples[i * 2 + 1] = next++;
+		return (const uint8_t *)samples.data();
+	}
+};
+
+static int16_t GetFirstFrame(const std::vector<uint8_t> &packet)
+{
+	return *(const int16_t *)packet.data();
+}
+
+static bool IsContinuous(const std::vector<uint8_t> &packet, uint32_t frames, int16_t first)
+{
+	const int16_t *samples = (const int16_t *)packet.data();
+	for (uint32_t i = 0; i < frames; ++i) {
+		if (samples[i * 2] != int16_t(first + i) || samples[i * 2 + 1] != int16_t(first + i))
+			return false;
+	}
+	return true;
+}
+
+// packets exactly 20ms apart under jitter, a gap flagged on the first packet after it, silence for late input which
+// is skipped when it arrives, overruns counted, and a timeline the full anchor queue held back taken up later
+static void TestPacketizer()
+{
+	MediaFormat format = MakeAudioFormat(MEDIA_SUBTYPE_PCM, 2, 48000, 16);
+	const int64_t step = 200000;
+	CAudioPacketizer packetizer;
+	AudioPacket packet;
+
+	// chunks of 100..999 frames with +-0.5ms of jitter, a 5ms jump which only moves the timeline and a 1s gap
+	{
+		packetizer.Init(format);
+		const uint32_t frames = packetizer.GetPacketFrames();
+		std::vector<uint8_t> output(packetizer.GetPacketSize());
+		PacketizerInput input;
+		int64_t position = 0, offset = 0, last = 0;
+		uint32_t packets = 0, flagged = 0;
+		for (uint32_t i = 0; i < 1000; ++i) {
+			if (i == 400)
+				offset += 50000;
+			if (i == 700)
+				offset += 10000000;
+			const uint32_t count = 100 + Random() % 900;
+			const int64_t timestamp = position * 10000000 / 48000 + offset + (int64_t)(Random() % 10000) - 5000;
+			packetizer.Write(input.Make(count), count * 4, timestamp);
+			position += count;
+
+			while (packetizer.Read(output.data(), packet)) {
+				const int64_t delta = packet.timestamp - last;
+				const bool gap = packet.flags == MEDIA_SAMPLE_FLAG_DISCONTINUITY;
+				if (packet.frames != frames || !IsContinuous(output, frames, int16_t(packets * frames)) ||
+				    (packets && (gap ? std::llabs(delta - step - 10000000) > 10000 : delta != step && std::llabs(delta - step - 50000) > 10000)))
+					Fail("packetizer: packet %u at %lld after %lld, flags %x", packets, (long long)packet.timestamp, (long long)last, packet.flags);
+				flagged += gap;
+				last = packet.timestamp;
+				++packets;
+			}
+		}
+		const AudioPacketizerStats stats = packetizer.GetStats();
+		if (flagged != 1 || stats.resyncs != 2 || stats.packets != packets || packets != position / frames || stats.overruns || stats.underruns)
+			Fail("packetizer: %u of %u packets flagged after %llu resyncs", flagged, packets, (unsigned long long)stats.resyncs);
+	}
+
+	// a second at once into a 500ms ring: the rest is dropped and the input after it starts a new timeline
+	{
+		packetizer.Init(format);
+		const uint32_t frames = packetizer.GetPacketFrames();
+		std::vector<uint8_t> output(packetizer.GetPacketSize());
+		PacketizerInput input;
+		const uint32_t written = packetizer.Write(input.Make(48000), 48000 * 4, 0);
+		AudioPacketizerStats stats = packetizer.GetStats();
+		if (written != 24000 || stats.overruns != 1 || stats.overrunFrames != 24000)
+			Fail("packetizer: %u of 48000 frames fit into the ring, %llu overrun", written, (unsigned long long)stats.overrunFrames);
+		uint32_t packets = 0;
+		while (packetizer.Read(output.data(), packet))
+			++packets;
+		packetizer.Write(input.Make(frames), frames * 4, 10000000);
+		if (packets != 24000 / frames || !packetizer.Read(output.data(), packet) || packet.flags != MEDIA_SAMPLE_FLAG_DISCONTINUITY || packet.timestamp != 10000000 ||
+		    !IsContinuous(output, frames, int16_t(48000)))
+			Fail("packetizer: %u packets before the overrun, the next at %lld with flags %x", packets, (long long)packet.timestamp, packet.flags);
+	}
+
+	// 100 frames, then nothing: the packet is padded and the 860 frames of silence are skipped when they arrive late
+	{
+		packetizer.Init(format);
+		const uint32_t frames = packetizer.GetPacketFrames();
+		std::vector<uint8_t> output(packetizer.GetPacketSize());
+		PacketizerInput input;
+		packetizer.Write(input.Make(100), 100 * 4, 0);
+		const bool padded = packetizer.Read(output.data(), packet, true);
+		const int16_t *samples = (const int16_t *)output.data();
+		const AudioPacketizerStats stats = packetizer.GetStats();
+		if (!padded || !IsContinuous(output, 100, 0) || samples[100 * 2] || samples[frames * 2 - 1] || stats.underruns != 1 || stats.underrunFrames != frames - 100)
+			Fail("packetizer: padded %d, %llu underruns of %llu frames", padded, (unsigned long long)stats.underruns, (unsigned long long)stats.underrunFrames);
+
+		packetizer.Write(input.Make(1000), 1000 * 4, 100 * 10000000 / 48000);
+		if (packetizer.Read(output.data(), packet))
+			Fail("packetizer: the late frames are read instead of skipped");
+		packetizer.Write(input.Make(frames), frames * 4, int64_t(1100) * 10000000 / 48000);
+		if (!packetizer.Read(output.data(), packet) || packet.timestamp != step || GetFirstFrame(output) != int16_t(frames) || packet.flags)
+			Fail("packetizer: after the underrun a packet at %lld starts with frame %d", (long long)packet.timestamp, GetFirstFrame(output));
+	}
+
+	// 70 packets a second apart before the consumer reads: the anchor queue holds 64 timelines, the packets after them
+	// stay on the last one it holds until the next write gets its timeline in
+	{
+		AudioPacketizerOptions options;
+		options.ringMs = 2000;
+		packetizer.Init(format, options);
+		const uint32_t frames = packetizer.GetPacketFrames();
+		std::vector<uint8_t> output(packetizer.GetPacketSize());
+		PacketizerInput input;
+		for (int64_t i = 0; i < 70; ++i)
+			packetizer.Write(input.Make(frames), frames * 4, i * 10000000);
+		for (int64_t i = 0; i < 71; ++i) {
+			if (i == 70)
+				packetizer.Write(input.Make(frames), frames * 4, i * 10000000);
+			const bool held = i >= 64 && i < 70;
+			const int64_t timestamp = held ? 63 * 10000000 + (i - 63) * step : i * 10000000;
+			if (!packetizer.Read(output.data(), packet) || packet.timestamp != timestamp || packet.flags != (i && !held ? MEDIA_SAMPLE_FLAG_DISCONTINUITY : 0u) ||
+			    !IsContinuous(output, frames, int16_t(i * frames))) {
+				Fail("packetizer: packet %lld at %lld instead of %lld, flags %x", (long long)i, (long long)packet.timestamp, (long long)timestamp, packet.flags);
+				break;
+			}
+		}
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+// callbacks only get in while running, and a stop waits for the ones inside before anything is torn down
+static void TestState()
+{
+	CCaptureStateMachine state;
+	if (state.Enter() || state.BeginStop() || !state.BeginStart() || state.BeginStart() || state.Enter())
+		Fail("state: a callback or a second start gets in before the first start ends");
+	state.EndStart(false);
+	if (state.GetState() != CAPTURE_STOPPED || !state.BeginStart())
+		Fail("state: a failed start leaves %s", GetCaptureStateString(state.GetState()));
+	state.EndStart(true);
+	if (!state.IsRunning() || !state.Enter())
+		Fail("state: no callback gets in while %s", GetCaptureStateString(state.GetState()));
+	state.Leave();
+
+	// stop while a callback is inside: it finishes first, the ones after the stop are turned away
+	{
+		std::atomic<bool> entered{false}, finished{false};
+		std::thread callback([&]() {
+			CCaptureCallbackScope scope(state);
+			entered = scope.IsEntered();
+			std::this_thread::sleep_for(std::chrono::milliseconds(30));
+			finished = true;
+		});
+		for (uint32_t i = 0; i < 2000 && !entered; ++i)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		if (!entered || !state.BeginStop() || state.GetState() != CAPTURE_DRAINING || CCaptureCallbackScope(state).IsEntered())
+			Fail("state: a callback gets in while %s", GetCaptureStateString(state.GetState()));
+		state.WaitDrained();
+		if (!finished)
+			Fail("state: the stop did not wait for the callback inside");
+		state.EndStop();
+		callback.join();
+	}
+	CaptureStateStats stats = state.GetStats();
+	if (state.GetState() != CAPTURE_STOPPED || stats.starts != 1 || stats.stops != 1 || stats.ignored != 3 || stats.lastStopNs < 10000000)
+		Fail("state: %llu starts, %llu stops, %llu ignored, the stop took %.1fms", (unsigned long long)stats.starts, (unsigned long long)stats.stops,
+		     (unsigned long long)stats.ignored, stats.lastStopNs / 1e6);
+
+	// callbacks on four threads while the source starts and stops: none of them ever sees what the stop tore down
+	std::atomic<bool> running{true}, torn{true};
+	std::atomic<uint64_t> inside{0}, violations{0};
+	std::vector<std::thread> callbacks;
+	for (uint32_t i = 0; i < 4; ++i) {
+		callbacks.emplace_back([&]() {
+			while (running) {
+				CCaptureCallbackScope scope(state);
+				if (!scope.IsEntered())
+					continue;
+				++inside;
+				if (torn)
+					++violations;
+			}
+		});
+	}
+	for (uint32_t i = 0; i < 200; ++i) {
+		if (!state.BeginStart()) {
+			Fail("state: cycle %u does not start from %s", i, GetCaptureStateString(state.GetState()));
+			break;
+		}
+		torn = false;
+		state.EndStart(true);
+		std::this_thread::yield();
+		state.BeginStop();
+		state.WaitDrained();
+		torn = true;
+		state.EndStop();
+	}
+	running = false;
+	for (auto &thread : callbacks)
+		thread.join();
+	stats = state.GetStats();
+	if (violations || stats.starts != 201 || stats.stops != 201)
+		Fail("state: %llu of %llu callbacks ran after the stop", (unsigned long long)violations.load(), (unsigned long long)inside.load());
+}
+
+//---------------------------------------------------------------------------------------------
+struct CountingSink : IMediaSink {
+	std::atomic<uint64_t> samples{0};
+	std::atomic<uint64_t> discontinuities{0};
+
+	void OnMediaSample(const MediaSample &sample) override
+	{
+		++samples;
+		if (sample.flags & MEDIA_SAMPLE_FLAG_DISCONTINUITY)
+			++discontinuities;
+	}
+};
+
+// a device lost again and again is always brought back, each outage ends with one discontinuity
+static void TestRecovery()
+{
+	MediaFormat format;
+	format.subtype = MEDIA_SUBTYPE_NV12;
+	format.width = 64;
+	format.height = 32;
+	format.fpsNum = 30;
+	format.fpsDen = 1;
+
+	for (uint32_t run = 0; run < 6; ++run) {
+		FaultInjectionOptions options;
+		options.lossEvery = 1 + run % 3;
+		options.failedReopens = run / 3 * 2;
+		DeviceRecoveryOptions recoveryOptions;
+		recoveryOptions.retryMs = 1;
+		recoveryOptions.maxRetryMs = 4;
+
+		CFaultInjectionSource source(std::make_shared<CSyntheticSource>(format, false), options);
+		source.GetRecovery().SetOptions(recoveryOptions);
+		CountingSink sink;
+		if (!source.StartCapture(&sink)) {
+			Fail("recovery run %u does not start", run);
+			continue;
+		}
+
+		// every loss is followed by a reopen, with lossEvery 1 no sample gets through but the losses go on
+		CaptureMetricsSnapshot before, after;
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		source.GetCaptureMetrics()->GetSnapshot(before);
+		const uint64_t samples = sink.samples;
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		source.GetCaptureMetrics()->GetSnapshot(after);
+		if (after.deviceLosses == before.deviceLosses || (options.lossEvery > 1 && sink.samples == samples))
+			Fail("recovery run %u: the device stays lost after %llu losses", run, (unsigned long long)after.deviceLosses);
+
+		source.StopCapture();
+		source.GetCaptureMetrics()->GetSnapshot(after);
+		if (sink.discontinuities != after.outage.count)
+			Fail("recovery run %u: %llu discontinuities for %llu outages", run, (unsigned long long)sink.discontinuities.load(), (unsigned long long)after.outage.count);
+		if (after.outage.count > after.deviceLosses || source.GetRecovery().GetFailedAttempts() < after.outage.count * options.failedReopens)
+			Fail("recovery run %u: %llu outages, %llu losses, %llu failed reopens", run, (unsigned long long)after.outage.count, (unsigned long long)after.deviceLosses,
+			     (unsigned long long)source.GetRecovery().GetFailedAttempts());
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+// every subtype of the table is found at its own index, anything else is not, also when it lands in an occupied slot.
+// the per-format plane layouts agree with the generic one
+static void TestFormats()
+{
+	static_assert(TFormatTraits<MEDIA_SUBTYPE_NV12>::GetFrameSize(64, 32) == 64 * 32 * 3 / 2, "NV12 is folded at compile time");
+
+	for (uint32_t i = 0; i < CFormatRegistry::s_count; ++i) {
+		const MediaFormatTraits &entry = CFormatRegistry::s_formats[i];
+		if (FindFormatIndex(entry.subtype) != i || FindFormatTraits(entry.subtype) != &entry || !entry.name)
+			Fail("formats: %s is not found at %u", entry.name, i);
+	}
+
+	std::vector<uint32_t> misses = {0, 0xffffffffu, MEDIA_FOURCC('X', 'X', 'X', 'X')};
+	// strangers in the slots of NV12 and PCM, which only the compare of the subtype turns away
+	for (uint32_t subtype : {(uint32_t)MEDIA_SUBTYPE_NV12, (uint32_t)MEDIA_SUBTYPE_PCM}) {
+		uint32_t value = Random();
+		while (GetFormatHash(value) != GetFormatHash(subtype) || value == subtype)
+			value = Random();
+		misses.push_back(value);
+	}
+	for (uint32_t subtype : misses) {
+		bool known = false;
+		for (const auto &entry : CFormatRegistry::s_formats)
+			known = known || entry.subtype == subtype;
+		if (!known && (FindFormatIndex(subtype) != FORMAT_NOT_FOUND || FindFormatTraits(subtype)))
+			Fail("formats: %08x is found", subtype);
+	}
+
+	// odd sizes, so that the rounding of v210 and of the chroma shows
+	MediaFormat format;
+	format.width = 98;
+	format.height = 34;
+	std::vector<uint8_t> buffer(1 << 16);
+	for (const auto &entry : CFormatRegistry::s_formats) {
+		if (!IsRawVideoFormat(entry))
+			continue;
+
+		format.subtype = entry.subtype;
+		const int32_t stride = GetVideoDefaultStride(format);
+		MediaPlane generic[MEDIA_MAX_PLANES], folded[MEDIA_MAX_PLANES];
+		const uint32_t count = DescribeVideoPlanes(format, buffer.data(), stride, generic);
+		const uint32_t foldedCount = GetDescribePlanesFunc(entry.subtype)(format, buffer.data(), stride, folded);
+		uint32_t size = 0;
+		for (uint32_t i = 0; i < count; ++i)
+			size += generic[i].size;
+		bool same = count == entry.planes && foldedCount == count && size == GetVideoFrameSize(format) && size <= buffer.size();
+		for (uint32_t i = 0; i < count && i < foldedCount; ++i)
+			same = same && generic[i].data == folded[i].data && generic[i].stride == folded[i].stride && generic[i].size == folded[i].size;
+		if (!same)
+			Fail("formats: the %u planes of %s make %u of %u bytes", count, entry.name, size, GetVideoFrameSize(format));
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+// marks the rows of every band it is run on, a row marked twice or never is a gap or an overlap of the bands
+class CRowMarkStage : public ITileStage {
+public:
+	explicit CRowMarkStage(uint32_t height) : m_marks(height, 0) {}
+
+	void RunRows(uint32_t rowBegin, uint32_t rowEnd, uint32_t /*worker*/) override
+	{
+		for (uint32_t y = rowBegin; y < rowEnd; ++y)
+			++m_marks[y];
+	}
+
+	bool IsCovered() const
+	{
+		return std::all_of(m_marks.begin(), m_marks.end(), [](uint8_t mark) { return mark == 1; });
+	}
+
+private:
+	std::vector<uint8_t> m_marks; // one writer per row
+};
+
+// the bands of a frame cover every row once, and the banded copy and conversions write the same bytes as one thread
+static void TestTiling()
+{
+	CTileExecutor tiles;
+	TileExecutorOptions options;
+	options.threads = 4;
+	options.bandBytes = 16 * 1024; // many bands also on the small frames
+	if (!tiles.Start(options)) {
+		Fail("tiling: the executor does not start");
+		return;
+	}
+
+	static const uint32_t subtypes[] = {MEDIA_SUBTYPE_YUY2, MEDIA_SUBTYPE_RGB32, MEDIA_SUBTYPE_I420, MEDIA_SUBTYPE_NV12, MEDIA_SUBTYPE_P016, MEDIA_SUBTYPE_V210};
+	static const uint32_t sizes[][2] = {{1920, 1080}, {642, 362}};
+	for (uint32_t subtype : subtypes) {
+		for (const auto &size : sizes) {
+			MediaFormat format;
+			format.subtype = subtype;
+			format.width = size[0];
+			format.height = size[1];
+			const uint32_t bandRows = tiles.GetBandRows(format, 2);
+			CRowMarkStage marks(format.height);
+			const TileExecutorStats before = tiles.GetStats();
+			tiles.Run(&marks, format.height, bandRows);
+			const uint64_t bands = tiles.GetStats().bands - before.bands;
+			if (!marks.IsCovered() || bandRows % 2 || bands != (format.height + bandRows - 1) / bandRows || bands < options.threads)
+				Fail("tiling %.4s %ux%u: %llu bands of %u rows", (const char *)&subtype, format.width, format.height, (unsigned long long)bands, bandRows);
+
+			const int32_t stride = GetVideoDefaultStride(format) + (int32_t)GetPadding(subtype);
+			std::vector<uint8_t> src((size_t)stride * format.height * 2);
+			FillRandom(src);
+			MediaPlane planes[MEDIA_MAX_PLANES];
+			DescribeVideoPlanes(format, src.data(), stride, planes);
+
+			// the high bit depth types go to P010, two bytes a sample
+			const bool deep = GetVideoBitDepth(subtype) > 8;
+			const int32_t dstStride = (int32_t)format.width * (deep ? 2 : 1) + 6;
+			std::vector<uint8_t> reference((size_t)dstStride * format.height * 3 / 2, TEST_GUARD), output(reference);
+			uint8_t *referenceUV = reference.data() + (size_t)dstStride * format.height;
+			uint8_t *outputUV = output.data() + (size_t)dstStride * format.height;
+			bool converted = false;
+			if (deep) {
+				CDepthConverter converter;
+				converted = converter.Init(subtype, MEDIA_SUBTYPE_P010) &&
+					    converter.Convert(planes, format.width, format.height, reference.data(), dstStride, referenceUV, dstStride) &&
+					    tiles.Convert(converter, planes, format, output.data(), dstStride, outputUV, dstStride);
+			} else {
+				CVideoConverter converter;
+				converted = converter.Init(subtype) && converter.Convert(planes, format.width, format.height, reference.data(), dstStride, referenceUV, dstStride) &&
+					    tiles.Convert(converter, planes, format, output.data(), dstStride, outputUV, dstStride);
+			}
+			if (!converted || output != reference)
+				Fail("tiling %.4s %ux%u: the banded conversion differs from one thread", (const char *)&subtype, format.width, format.height);
+
+			// the copy of a padded device buffer into a frame of the pool
+			CRefPtr<CFramePool> pool = CFramePool::Create(2);
+			MediaSample sample;
+			sample.format = &format;
+			sample.timestamp = 1234;
+			sample.planeCount = DescribeVideoPlanes(format, src.data(), stride, sample.planes);
+			FramePtr single = pool->CopySample(sample);
+			FramePtr banded = tiles.CopySample(pool.Get(), sample);
+			const uint32_t frameSize = GetVideoFrameSize(format);
+			if (!single || !banded || banded->GetTimestamp() != 1234 || memcmp(single->GetBuffer(), banded->GetBuffer(), frameSize))
+				Fail("tiling %.4s %ux%u: the banded copy differs from one thread", (const char *)&subtype, format.width, format.height);
+		}
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+class CSlowSubscriber : public IFrameSubscriber {
+public:
+	explicit CSlowSubscriber(uint32_t sleepMs) : m_sleepMs(sleepMs) {}
+
+	void OnFrame(const CMediaFrame *frame) override
+	{
+		if (frame->GetSample().planes[0].data[0] != uint8_t(frame->GetTimestamp()))
+			++corrupt;
+		if (m_sleepMs)
+			std::this_thread::sleep_for(std::chrono::milliseconds(m_sleepMs));
+	}
+
+	std::atomic<uint64_t> corrupt{0};
+
+private:
+	const uint32_t m_sleepMs;
+};
+
+// a subscriber which blocks waits on its own threads: the source and the others go on
+static void TestPublish()
+{
+	MediaFormat format;
+	format.subtype = MEDIA_SUBTYPE_NV12;
+	format.width = 64;
+	format.height = 32;
+	std::vector<uint8_t> memory(GetVideoFrameSize(format));
+	MediaSample sample;
+	sample.format = &format;
+	sample.planeCount = DescribeVideoPlanes(format, memory.data(), GetVideoDefaultStride(format), sample.planes);
+
+	CSlowSubscriber fast(0), recorder(5);
+	BackpressureOptions all;
+	all.policy = BACKPRESSURE_DROP_OLDEST;
+	all.capacity = 64;
+	BackpressureOptions blocking;
+	blocking.capacity = 2;
+	blocking.blockTimeoutMs = 1000;
+
+	CFramePublisher publisher;
+	publisher.Subscribe("fast", &fast, all);
+	publisher.Subscribe("recorder", &recorder, blocking);
+	CRefPtr<CFramePool> pool = CFramePool::Create(publisher.GetFramesInFlight() + 1);
+	publisher.Start();
+
+	// the recorder needs 5ms per frame and gets one every 1ms, it would hold up the source for seconds
+	const uint32_t count = 40;
+	int64_t maxNs = 0;
+	for (uint32_t i = 0; i < count; ++i) {
+		memory[0] = uint8_t(i);
+		sample.timestamp = i;
+		FramePtr frame = pool->CopySample(sample);
+		if (!frame) {
+			Fail("publish: the pool of %u frames is exhausted", publisher.GetFramesInFlight() + 1);
+			break;
+		}
+		const int64_t begin = GetMonotonicTimeNs();
+		publisher.OnMediaFrame(frame.Get());
+		maxNs = (std::max)(maxNs, GetMonotonicTimeNs() - begin);
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	publisher.Stop();
+
+	const SubscriberStats fastStats = publisher.GetSubscriberStats(0);
+	const SubscriberStats recorderStats = publisher.GetSubscriberStats(1);
+	if (maxNs > 20000000)
+		Fail("publish: the source waited %.1fms", maxNs / 1e6);
+	if (fastStats.delivered != count)
+		Fail("publish: the fast subscriber got %llu of %u frames", (unsigned long long)fastStats.delivered, count);
+	if (!recorderStats.queue.blocked || recorderStats.delivered + recorderStats.queue.GetDropped() != count)
+		Fail("publish: the recorder got %llu, dropped %llu, waited for %llu of %u frames", (unsigned long long)recorderStats.delivered,
+		     (unsigned long long)recorderStats.queue.GetDropped(), (unsigned long long)recorderStats.queue.blocked, count);
+	if (fast.corrupt || recorder.corrupt)
+		Fail("publish: frames changed while they were shared");
+	if (pool->GetStats().inFlight)
+		Fail("publish: %u frames are still referenced after Stop", pool->GetStats().inFlight);
+}
+
+//---------------------------------------------------------------------------------------------
+int RunTests(int argc, char **argv)
+{
+	static const struct {
+		const char *name;
+		void (*func)();
+	} tests[] = {
+		{"replay", TestReplay},
+		{"convert", TestConvert},
+		{"pool", TestPool},
+		{"spsc", TestSpsc},
+		{"writer", TestWriter},
+		{"container", TestContainer},
+		{"capcache", TestCapCache},
+		{"negotiate", TestNegotiate},
+		{"audio", TestAudio},
+		{"sync", TestSync},
+		{"histogram", TestHistogram},
+		{"manager", TestManager},
+		{"scale", TestScale},
+		{"depth", TestDepth},
+		{"mjpeg", TestMjpeg},
+		{"change", TestChange},
+		{"lossless", TestLossless},
+		{"backpressure", TestBackpressure},
+		{"packetizer", TestPacketizer},
+		{"state", TestState},
+		{"recovery", TestRecovery},
+		{"formats", TestFormats},
+		{"tiling", TestTiling},
+		{"publish", TestPublish},
+	};
+
+	printf("simd levels up to %s \n", GetSimdLevelString(GetCpuSimdLevel()));
+	int count = 0;
+	for (const auto &test : tests) {
+		bool selected = argc <= 0;
+		for (int i = 0; i < argc && !selected; ++i)
+			selected = strcmp(argv[i], test.name) == 0;
+
+		if (selected) {
+			const int failures = g_failures;
+			test.func();
+			printf("%-10s %s \n", test.name, g_failures == failures ? "ok" : "FAILED");
+			++count;
+		}
+	}
+
+	if (!count) {
+		printf("unknown test, available:");
+		for (const auto &test : tests)
+			printf(" %s", test.name);
+		printf("\n");
+		return 1;
+	}
+	return g_failures;
+}
+
+#ifdef MF_TEST_STANDALONE
+int main(int argc, char **argv)
+{
+	return RunTests(argc - 1, argv + 1) ? 1 : 0;
+}
+#endif
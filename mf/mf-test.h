@@ -0,0 +1,7 @@
+﻿#pragma once
+// tests of the portable parts of the capture pipeline, the simd kernels are checked against the scalar ones at every level the cpu has.
+// windows: "mf.exe test [name...]". linux, everything but main.cpp, mf-capture.cpp and mf-enum.cpp:
+//   g++ -std=c++14 -O2 -DMF_TEST_STANDALONE $(ls mf-*.cpp | grep -v -e mf-capture -e mf-enum) -o mf-test -pthread
+// without names every test runs. returns the number of failed checks.
+
+int RunTests(int argc, char **argv);
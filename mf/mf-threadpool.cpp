@@ -0,0 +1,249 @@
+#include "mf-threadpool.h"
+#include "mf-portable.hpp"
+#include <algorithm>
+#include <assert.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#define POOL_WAIT_MS 10
+
+static void SetCurrentThreadCpu(uint32_t cpu)
+{
+#ifdef _WIN32
+	if (cpu < sizeof(DWORD_PTR) * 8)
+		SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu);
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+	(void)cpu;
+#endif
+}
+
+bool CWorkStealingPool::Start(uint32_t threads, bool pinThreads)
+{
+	if (m_bRunning) {
+		assert(false);
+		return false;
+	}
+
+	if (!threads)
+		threads = (std::max)(std::thread::hardware_concurrency(), 1u);
+
+	m_bRunning = true;
+	m_workers.clear();
+	for (uint32_t i = 0; i < threads; ++i)
+		m_workers.emplace_back(new Worker());
+	for (uint32_t i = 0; i < threads; ++i)
+		m_workers[i]->thread = std::thread(&CWorkStealingPool::ThreadFunc, this, i, pinThreads);
+	return true;
+}
+
+void CWorkStealingPool::Stop()
+{
+	if (!m_bRunning)
+		return;
+
+	m_bRunning = false;
+	m_wake.NotifyAll();
+
+	for (auto &worker : m_workers)
+		worker->thread.join();
+}
+
+void CWorkStealingPool::Submit(IPoolTask *task, uint32_t hint)
+{
+	if (m_workers.empty()) {
+		assert(false);
+		return;
+	}
+
+	// counted first, so that a worker which takes the task right away never sees the count drop below zero
+	m_pending.fetch_add(1);
+	Worker &worker = *m_workers[hint % m_workers.size()];
+	{
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		worker.tasks.push_back(task);
+	}
+
+	m_wake.Notify();
+}
+
+IPoolTask *CWorkStealingPool::Pop(uint32_t index, bool &stolen)
+{
+	// own queue first, in order
+	{
+		Worker &own = *m_workers[index];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.tasks.empty()) {
+			IPoolTask *task = own.tasks.front();
+			own.tasks.pop_front();
+			stolen = false;
+			return task;
+		}
+	}
+
+	// then the oldest task of the others, starting with the next worker so that the victims are spread
+	const uint32_t count = (uint32_t)m_workers.size();
+	for (uint32_t i = 1; i < count; ++i) {
+		Worker &victim = *m_workers[(index + i) % count];
+		std::unique_lock<std::mutex> lock(victim.mutex, std::try_to_lock);
+		if (!lock.owns_lock() || victim.tasks.empty())
+			continue;
+
+		IPoolTask *task = victim.tasks.front();
+		victim.tasks.pop_front();
+		stolen = true;
+		return task;
+	}
+	return nullptr;
+}
+
+void CWorkStealingPool::ThreadFunc(uint32_t index, bool pin)
+{
+	if (pin)
+		SetCurrentThreadCpu(index % (std::max)(std::thread::hardware_concurrency(), 1u));
+
+	Worker &worker = *m_workers[index];
+	for (;;) {
+		bool stolen = false;
+		IPoolTask *task = m_pending.load(std::memory_order_acquire) ? Pop(index, stolen) : nullptr;
+		if (task) {
+			m_pending.fetch_sub(1);
+
+			const int64_t begin = GetMonotonicTimeNs();
+			task->Run();
+			worker.busyNs.store(worker.busyNs.load(std::memory_order_relaxed) + GetMonotonicTimeNs() - begin, std::memory_order_relaxed);
+			worker.executed.store(worker.executed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			if (stolen)
+				worker.stolen.store(worker.stolen.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			continue;
+		}
+
+		// a steal can fail on a contended lock, only sleep if there is really nothing
+		if (m_pending.load(std::memory_order_acquire)) {
+			std::this_thread::yield();
+			continue;
+		}
+		if (!m_bRunning)
+			break;
+
+		m_wake.WaitFor([this]() { return m_pending.load(std::memory_order_relaxed) != 0 || !m_bRunning; }, POOL_WAIT_MS);
+	}
+}
+
+WorkPoolStats CWorkStealingPool::GetStats() const
+{
+	WorkPoolStats stats;
+	stats.threads = (uint32_t)m_workers.size();
+	for (const auto &worker : m_workers) {
+		stats.executed += worker->executed;
+		stats.stolen += worker->stolen;
+		stats.busyNs += worker->busyNs;
+	}
+	return stats;
+}
+
+//---------------------------------------------------------------------------------------------
+bool CParallelFor::Start(uint32_t threads)
+{
+	if (m_threadCount) {
+		assert(false);
+		return false;
+	}
+
+	if (!threads)
+		threads = (std::max)(std::thread::hardware_concurrency(), 1u);
+
+	m_bRunning = true;
+	m_threadCount = threads;
+	for (uint32_t i = 1; i < threads; ++i)
+		m_threads.emplace_back(&CParallelFor::ThreadFunc, this, i);
+	return true;
+}
+
+void CParallelFor::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_bRunning = false;
+	}
+	m_start.notify_all();
+
+	for (auto &thread : m_threads)
+		thread.join();
+	m_threads.clear();
+	m_threadCount = 0;
+}
+
+void CParallelFor::Run(IParallelJob *job, uint32_t parts)
+{
+	if (parts <= 1 || m_threads.empty()) {
+		for (uint32_t i = 0; i < parts; ++i)
+			job->RunPart(i, 0);
+		return;
+	}
+
+	{
+		// a helper still leaving the previous job must not take a part of this one
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_done.wait(lock, [this]() { return m_busy == 0; });
+
+		m_pJob = job;
+		m_parts = parts;
+		m_next = 0;
+		m_remaining = parts;
+		++m_generation;
+	}
+	m_start.notify_all();
+
+	RunParts(job, 0);
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done.wait(lock, [this]() { return m_remaining.load() == 0 && m_busy == 0; });
+	m_pJob = nullptr;
+}
+
+void CParallelFor::RunParts(IParallelJob *job, uint32_t worker)
+{
+	for (;;) {
+		const uint32_t part = m_next.fetch_add(1);
+		if (part >= m_parts)
+			break;
+
+		job->RunPart(part, worker);
+		if (m_remaining.fetch_sub(1) == 1) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_done.notify_all();
+		}
+	}
+}
+
+void CParallelFor::ThreadFunc(uint32_t worker)
+{
+	uint64_t generation = 0;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;) {
+		m_start.wait(lock, [&]() { return !m_bRunning || (m_generation != generation && m_pJob); });
+		if (!m_bRunning)
+			break;
+
+		generation = m_generation;
+		IParallelJob *job = m_pJob;
+		++m_busy;
+		lock.unlock();
+
+		RunParts(job, worker);
+
+		lock.lock();
+		if (--m_busy == 0)
+			m_done.notify_all();
+	}
+}
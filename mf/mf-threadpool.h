@@ -0,0 +1,111 @@
+﻿#pragma once
+#include "mf-wake.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class IPoolTask {
+public:
+	virtual ~IPoolTask() {}
+	virtual void Run() = 0;
+};
+
+struct WorkPoolStats {
+	uint32_t threads = 0;
+	uint64_t executed = 0; // tasks run
+	uint64_t stolen = 0;   // of those, taken from another worker's queue
+	int64_t busyNs = 0;    // summed over the workers, time spent in IPoolTask::Run
+};
+
+// fixed set of worker threads, each with its own task queue. a worker runs its own tasks in order and steals the oldest
+// task of another worker when it runs dry, so a busy session does not hold up the others on the same worker.
+// tasks are not owned: a task must stay alive until it ran, and must not be submitted again before it started,
+// otherwise two workers may run it at once (CCaptureSession guards this with a flag).
+class CWorkStealingPool {
+public:
+	CWorkStealingPool() {}
+	~CWorkStealingPool() { Stop(); }
+
+	// threads: 0 means one per cpu. pinThreads: worker i only runs on cpu i % cpus
+	bool Start(uint32_t threads = 0, bool pinThreads = false);
+	// runs what is still queued, then joins the workers
+	void Stop();
+
+	uint32_t GetThreadCount() const { return (uint32_t)m_workers.size(); }
+
+	// queues the task on worker `hint % threads`, from any thread
+	void Submit(IPoolTask *task, uint32_t hint);
+
+	WorkPoolStats GetStats() const;
+
+private:
+	struct Worker {
+		std::mutex mutex;
+		std::deque<IPoolTask *> tasks;
+		std::thread thread;
+		std::atomic<uint64_t> executed{0};
+		std::atomic<uint64_t> stolen{0};
+		std::atomic<int64_t> busyNs{0};
+	};
+
+	void ThreadFunc(uint32_t index, bool pin);
+	IPoolTask *Pop(uint32_t index, bool &stolen);
+
+private:
+	std::vector<std::unique_ptr<Worker>> m_workers;
+	std::atomic<bool> m_bRunning{false};
+	std::atomic<uint32_t> m_pending{0};
+
+	CWakeEvent m_wake; // idle workers sleep here
+};
+
+// one job split into parts which run on a few threads at once, e.g. the restart segments of a jpeg frame.
+// unlike CWorkStealingPool the caller takes part and Run returns when every part is done, so it can be used
+// from a pool task without waiting on the pool itself.
+class IParallelJob {
+public:
+	virtual ~IParallelJob() {}
+	// worker is 0 for the calling thread and 1..threads-1 for the helpers, e.g. to pick a scratch buffer
+	virtual void RunPart(uint32_t part, uint32_t worker) = 0;
+};
+
+class CParallelFor {
+public:
+	CParallelFor() {}
+	~CParallelFor() { Stop(); }
+
+	// threads including the caller: 0 means one per cpu, 1 runs everything on the caller
+	bool Start(uint32_t threads = 0);
+	void Stop();
+
+	bool IsStarted() const { return m_threadCount != 0; }
+	uint32_t GetThreadCount() const { return m_threadCount; }
+
+	// calls job->RunPart for every part in [0, parts), not in order. one Run at a time
+	void Run(IParallelJob *job, uint32_t parts);
+
+private:
+	void ThreadFunc(uint32_t worker);
+	void RunParts(IParallelJob *job, uint32_t worker);
+
+private:
+	std::vector<std::thread> m_threads;
+	uint32_t m_threadCount = 0;
+	bool m_bRunning = false;
+
+	// guarded by m_mutex, except for the part counters
+	std::mutex m_mutex;
+	std::condition_variable m_start;
+	std::condition_variable m_done;
+	uint64_t m_generation = 0;
+	IParallelJob *m_pJob = nullptr;
+	uint32_t m_parts = 0;
+	uint32_t m_busy = 0; // helpers inside RunParts
+	std::atomic<uint32_t> m_next{0};
+	std::atomic<uint32_t> m_remaining{0};
+};
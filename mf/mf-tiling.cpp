@@ -0,0 +1,134 @@
+#include "mf-tiling.h"
+#include "mf-format.h"
+#include "mf-portable.hpp"
+#include <algorithm>
+#include <assert.h>
+#include <cstring>
+
+// raw video of `src` into the planes of a frame of the same format with the default stride
+class CCopyStage : public ITileStage {
+public:
+	CCopyStage(const MediaSample &src, CMediaFrame *dst) : m_src(src), m_pDst(dst)
+	{
+		const MediaFormatTraits *traits = FindFormatTraits(src.format->subtype);
+		m_chromaShift = traits ? traits->chromaShiftY : 0;
+	}
+
+	void RunRows(uint32_t rowBegin, uint32_t rowEnd, uint32_t /*worker*/) override
+	{
+		const MediaSample &dst = m_pDst->GetSample();
+		const bool last = rowEnd == m_src.format->height;
+
+		for (uint32_t i = 0; i < dst.planeCount && i < m_src.planeCount; ++i) {
+			const MediaPlane &from = m_src.planes[i];
+			uint8_t *to = m_pDst->GetBuffer() + (dst.planes[i].data - m_pDst->GetBuffer());
+			const uint32_t rowBytes = (uint32_t)dst.planes[i].stride;
+
+			// the last band also takes the chroma row of an odd height
+			const uint32_t shift = i ? m_chromaShift : 0;
+			const uint32_t begin = rowBegin >> shift;
+			const uint32_t end = last ? dst.planes[i].size / rowBytes : rowEnd >> shift;
+			if (begin >= end)
+				continue;
+
+			if (from.stride == dst.planes[i].stride) {
+				memcpy(to + (size_t)begin * rowBytes, from.data + (ptrdiff_t)begin * from.stride, (size_t)(end - begin) * rowBytes);
+				continue;
+			}
+
+			// padded or bottom-up source
+			for (uint32_t y = begin; y < end; ++y)
+				memcpy(to + (size_t)y * rowBytes, from.data + (ptrdiff_t)y * from.stride, rowBytes);
+		}
+	}
+
+private:
+	const MediaSample &m_src;
+	CMediaFrame *m_pDst;
+	uint32_t m_chromaShift = 0;
+};
+
+//---------------------------------------------------------------------------------------------
+bool CTileExecutor::Start(const TileExecutorOptions &options)
+{
+	m_options = options;
+	m_options.bandBytes = (std::max)(options.bandBytes, 1u);
+	m_stats = TileExecutorStats();
+	return m_threads.Start(options.threads);
+}
+
+bool CTileExecutor::IsWorthTiling(const MediaFormat &format)
+{
+	return format.video && !IsCompressedVideo(format.subtype) && (uint64_t)format.width * format.height >= TILING_MIN_PIXELS;
+}
+
+uint32_t CTileExecutor::GetBandRows(const MediaFormat &format, uint32_t rowAlign) const
+{
+	const MediaFormatTraits *traits = FindFormatTraits(format.subtype);
+	if (!traits || !IsRawVideoFormat(*traits))
+		return (std::max)(format.height, 1u);
+
+	// bytes of `align` rows of every plane
+	const uint32_t align = (std::max)(rowAlign, 1u << traits->chromaShiftY);
+	const uint32_t alignBytes = (std::max)(GetFormatFrameSize(*traits, GetFormatStride(*traits, format.width), align), 1u);
+	uint32_t rows = (std::max)(m_options.bandBytes / alignBytes, 1u) * align;
+
+	// small frames: smaller bands, so that every thread gets some
+	const uint32_t minBands = GetThreadCount() * m_options.bandsPerThread;
+	if (minBands > 1 && format.height / rows < minBands)
+		rows = (std::max)(format.height / minBands / align * align, align);
+	return rows;
+}
+
+void CTileExecutor::Run(ITileStage *stage, uint32_t height, uint32_t bandRows)
+{
+	if (!bandRows) {
+		assert(false);
+		return;
+	}
+
+	const int64_t begin = GetMonotonicTimeNs();
+	const uint32_t bands = (height + bandRows - 1) / bandRows;
+
+	m_pStage = stage;
+	m_height = height;
+	m_bandRows = bandRows;
+	m_threads.Run(this, bands);
+	m_pStage = nullptr;
+
+	const int64_t ns = GetMonotonicTimeNs() - begin;
+	++m_stats.frames;
+	m_stats.bands += bands;
+	m_stats.totalNs += ns;
+	m_stats.maxNs = (std::max)(m_stats.maxNs, ns);
+}
+
+void CTileExecutor::RunPart(uint32_t part, uint32_t worker)
+{
+	const uint32_t rowBegin = part * m_bandRows;
+	m_pStage->RunRows(rowBegin, (std::min)(rowBegin + m_bandRows, m_height), worker);
+}
+
+FramePtr CTileExecutor::CopySample(CFramePool *pool, const MediaSample &sample)
+{
+	const MediaFormat &format = *sample.format;
+	if (!IsStarted() || !sample.planeCount || !format.video || IsCompressedVideo(format.subtype))
+		return pool->CopySample(sample);
+
+	const uint32_t size = GetVideoFrameSize(format);
+	if (!size) {
+		assert(false);
+		return FramePtr();
+	}
+
+	FramePtr frame = pool->Acquire(size);
+	if (!frame)
+		return frame;
+
+	frame->SetSample(format, sample.timestamp, sample.flags, size);
+	assert(frame->GetSample().planeCount == sample.planeCount);
+
+	CCopyStage stage(sample, frame.Get());
+	Run(&stage, format);
+	return frame;
+}
@@ -0,0 +1,111 @@
+﻿#pragma once
+#include "mf-frame.h"
+#include "mf-sample.h"
+#include "mf-threadpool.h"
+#include <atomic>
+
+// frames from this size on are split, below it the fork/join costs about what it saves
+#define TILING_MIN_PIXELS (2560 * 1440)
+// a 4k copy or conversion is bound by memory bandwidth, more threads only add contention between sessions
+#define TILING_MAX_THREADS 4
+
+// a per-pixel stage of a frame which can be split into bands of rows, e.g. conversion or the copy of a device buffer
+class ITileStage {
+public:
+	virtual ~ITileStage() {}
+	// luma rows [rowBegin, rowEnd), rowBegin is a multiple of the band alignment. worker: see IParallelJob
+	virtual void RunRows(uint32_t rowBegin, uint32_t rowEnd, uint32_t worker) = 0;
+};
+
+struct TileExecutorOptions {
+	uint32_t threads = 0;            // including the caller, 0 means one per cpu
+	uint32_t bandBytes = 256 * 1024; // of all planes of one band, about the l2 cache of a core
+	uint32_t bandsPerThread = 2;     // at least, so that a thread which was preempted does not hold up the frame
+};
+
+struct TileExecutorStats {
+	uint64_t frames = 0;
+	uint64_t bands = 0;
+	int64_t totalNs = 0;
+	int64_t maxNs = 0;
+};
+
+// runs the stages of a large frame (4k at 60 fps does not fit a frame interval on one thread) on a persistent set of
+// threads. the frame is cut into bands of rows sized for the cache, aligned to the chroma rows of the format, so a
+// band of NV12/I420 covers whole chroma rows. the threads share one atomic band counter (see CParallelFor), so a
+// frame costs one wake up and one join no matter how many bands it has, and Run returns when every band is done.
+class CTileExecutor : private IParallelJob {
+public:
+	bool Start(const TileExecutorOptions &options = TileExecutorOptions());
+	void Stop() { m_threads.Stop(); }
+	bool IsStarted() const { return m_threads.IsStarted(); }
+	uint32_t GetThreadCount() const { return m_threads.GetThreadCount(); }
+
+	// raw video of at least TILING_MIN_PIXELS
+	static bool IsWorthTiling(const MediaFormat &format);
+
+	// rows of a band for frames of `format`, a multiple of `rowAlign` and of the chroma subsampling
+	uint32_t GetBandRows(const MediaFormat &format, uint32_t rowAlign = 1) const;
+
+	// runs `stage` over the `height` rows of a frame in bands of `bandRows`, from one thread at a time
+	void Run(ITileStage *stage, uint32_t height, uint32_t bandRows);
+	void Run(ITileStage *stage, const MediaFormat &format, uint32_t rowAlign = 1) { Run(stage, format.height, GetBandRows(format, rowAlign)); }
+
+	// CFramePool::CopySample with the rows of raw video copied in bands
+	FramePtr CopySample(CFramePool *pool, const MediaSample &sample);
+
+	// CVideoConverter::Convert or CDepthConverter::Convert of a whole frame, in bands
+	template<class TConverter>
+	bool Convert(const TConverter &converter, const MediaPlane *src, const MediaFormat &format, uint8_t *dstY, int32_t dstStrideY, uint8_t *dstUV, int32_t dstStrideUV);
+
+	// from the thread which calls Run
+	TileExecutorStats GetStats() const { return m_stats; }
+
+private:
+	void RunPart(uint32_t part, uint32_t worker) override;
+
+private:
+	CParallelFor m_threads;
+	TileExecutorOptions m_options;
+	TileExecutorStats m_stats;
+
+	// of the frame being run
+	ITileStage *m_pStage = nullptr;
+	uint32_t m_height = 0;
+	uint32_t m_bandRows = 0;
+};
+
+template<class TConverter> class TConvertStage : public ITileStage {
+public:
+	TConvertStage(const TConverter &converter, const MediaPlane *src, const MediaFormat &format, uint8_t *dstY, int32_t dstStrideY, uint8_t *dstUV, int32_t dstStrideUV)
+		: m_converter(converter), m_src(src), m_format(format), m_dstY(dstY), m_dstStrideY(dstStrideY), m_dstUV(dstUV), m_dstStrideUV(dstStrideUV)
+	{
+	}
+
+	bool IsFailed() const { return m_bFailed; }
+
+	void RunRows(uint32_t rowBegin, uint32_t rowEnd, uint32_t /*worker*/) override
+	{
+		if (!m_converter.Convert(m_src, m_format.width, m_format.height, m_dstY, m_dstStrideY, m_dstUV, m_dstStrideUV, rowBegin, rowEnd))
+			m_bFailed = true; // the same for every band, no need to synchronize
+	}
+
+private:
+	const TConverter &m_converter;
+	const MediaPlane *m_src;
+	const MediaFormat &m_format;
+	uint8_t *m_dstY;
+	int32_t m_dstStrideY;
+	uint8_t *m_dstUV;
+	int32_t m_dstStrideUV;
+	std::atomic<bool> m_bFailed{false};
+};
+
+template<class TConverter>
+bool CTileExecutor::Convert(const TConverter &converter, const MediaPlane *src, const MediaFormat &format, uint8_t *dstY, int32_t dstStrideY, uint8_t *dstUV, int32_t dstStrideUV)
+{
+	// the converters take pairs of rows
+	TConvertStage<TConverter> stage(converter, src, format, dstY, dstStrideY, dstUV, dstStrideUV);
+	Run(&stage, format, 2);
+	return !stage.IsFailed();
+}
@@ -21,6 +21,8 @@
 #include <wrl\client.h>
 #include <assert.h>
 
+#include "mf-format.h"
+
 #pragma comment(lib, "mfplat.lib")
 #pragma comment(lib, "mf.lib")
 #pragma comment(lib, "mfreadwrite.lib")
@@ -164,7 +166,15 @@ static HRESULT GetDefaultStride(IMFMediaType *pType, LONG *plStride)
 			hr = MFGetAttributeSize(pType, MF_MT_FRAME_SIZE, &width, &height);
 		}
 		if (SUCCEEDED(hr)) {
-			hr = MFGetStrideForBitmapInfoHeader(subtype.Data1, width, &lStride);
+			// the format table also knows the 10 bit types, which MFGetStrideForBitmapInfoHeader does not
+			const MediaFormatTraits *traits = FindFormatTraits(subtype.Data1);
+			if (traits && IsRawVideoFormat(*traits)) {
+				lStride = (LONG)GetFormatStride(*traits, width);
+				if (traits->bottomUp)
+					lStride = -lStride;
+			} else {
+				hr = MFGetStrideForBitmapInfoHeader(subtype.Data1, width, &lStride);
+			}
 		}
 
 		// Set the attribute for later reference.
@@ -0,0 +1,56 @@
+﻿#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+// lets the sleeping side of a lock-free queue (the consumer, or a producer waiting for room) sleep without the busy side
+// ever taking a lock, unless somebody actually sleeps. the waiter announces itself and then checks the queue, the
+// notifier changes the queue and then checks for waiters, each with a seq_cst fence in between: either the waiter sees
+// the change before it sleeps, or the notifier sees the waiter. the waiter holds the mutex from its check until it
+// sleeps, so a notification can not slip in between.
+class CWakeEvent {
+public:
+	// after the change was published, e.g. an item pushed or popped. from any thread, cheap when nobody sleeps
+	void Notify()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (m_waiting.load(std::memory_order_relaxed)) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_cv.notify_one();
+		}
+	}
+
+	// wakes every waiter, e.g. after clearing a running flag
+	void NotifyAll()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_cv.notify_all();
+	}
+
+	// sleeps until `ready` returns true or the deadline passed, returns the last result of `ready`
+	template<class Pred> bool WaitUntil(Pred ready, std::chrono::steady_clock::time_point deadline)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_waiting.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		bool result = ready();
+		while (!result && m_cv.wait_until(lock, deadline) != std::cv_status::timeout)
+			result = ready();
+		if (!result)
+			result = ready();
+		m_waiting.fetch_sub(1, std::memory_order_relaxed);
+		return result;
+	}
+
+	// the consumers wait with a timeout, so that a thread never hangs on a bug in the caller
+	template<class Pred> bool WaitFor(Pred ready, uint32_t timeoutMs)
+	{
+		return WaitUntil(ready, std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs));
+	}
+
+private:
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::atomic<uint32_t> m_waiting{0};
+};
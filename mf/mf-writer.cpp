@@ -0,0 +1,390 @@
+#include "mf-writer.h"
+#include <algorithm>
+#include <assert.h>
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define WRITER_ALIGNMENT 4096
+#define WRITER_WAIT_MS 20
+
+CAsyncFileWriter::CAsyncFileWriter() {}
+
+CAsyncFileWriter::~CAsyncFileWriter()
+{
+	Close();
+}
+
+bool CAsyncFileWriter::Open(const char *path, const AsyncWriterOptions &options)
+{
+	if (IsOpen()) {
+		assert(false);
+		return false;
+	}
+
+	m_options = options;
+	m_options.bufferSize = (std::max)(options.bufferSize, (uint32_t)WRITER_ALIGNMENT);
+	m_options.bufferSize = (m_options.bufferSize + WRITER_ALIGNMENT - 1) / WRITER_ALIGNMENT * WRITER_ALIGNMENT;
+
+	// page aligned, as direct io requires
+	m_pool = CFramePool::Create(1);
+	m_staging = m_pool ? m_pool->Acquire(m_options.bufferSize) : FramePtr();
+	if (!m_staging) {
+		assert(false);
+		m_pool = CRefPtr<CFramePool>();
+		return false;
+	}
+
+	if (!OsOpen(path)) {
+		m_staging = FramePtr();
+		m_pool = CRefPtr<CFramePool>();
+		return false;
+	}
+
+	m_pQueue = new CSpscQueue<WriteItem>(m_options.queueCapacity);
+	m_logicalSize = 0;
+	m_stagingSize = 0;
+	m_fileSize = 0;
+
+	m_bRunning = true;
+	m_thread = std::thread(&CAsyncFileWriter::ThreadFunc, this);
+	return true;
+}
+
+void CAsyncFileWriter::Close()
+{
+	if (!m_thread.joinable())
+		return;
+
+	m_bRunning = false;
+	m_wake.NotifyAll();
+	m_thread.join();
+
+	delete m_pQueue;
+	m_pQueue = nullptr;
+	m_staging = FramePtr();
+	m_pool = CRefPtr<CFramePool>();
+}
+
+uint32_t CAsyncFileWriter::GetFramePayloadSize(const CMediaFrame *frame)
+{
+	const MediaSample &sample = frame->GetSample();
+	if (!sample.planeCount)
+		return 0;
+
+	const MediaFormat &format = frame->GetFormat();
+	if (!format.video || IsCompressedVideo(format.subtype))
+		return sample.planes[0].size;
+
+	uint32_t rowBytes[MEDIA_MAX_PLANES];
+	uint32_t rows[MEDIA_MAX_PLANES];
+	uint32_t planes = GetVideoPlaneRows(format, rowBytes, rows);
+
+	uint32_t size = 0;
+	for (uint32_t i = 0; i < planes && i < sample.planeCount; ++i)
+		size += rowBytes[i] * rows[i];
+	return size;
+}
+
+bool CAsyncFileWriter::Write(CMediaFrame *frame, const void *prefix, uint32_t prefixSize)
+{
+	if (prefixSize > WRITER_MAX_PREFIX) {
+		assert(false);
+		return false;
+	}
+
+	WriteItem item;
+	item.frame = frame;
+	item.prefixSize = prefixSize;
+	if (prefixSize)
+		memcpy(item.prefix, prefix, prefixSize);
+
+	return Push(item, false);
+}
+
+bool CAsyncFileWriter::WriteBytes(const void *data, uint32_t size, bool wait)
+{
+	if (size <= WRITER_MAX_PREFIX) {
+		WriteItem item;
+		item.prefixSize = size;
+		memcpy(item.prefix, data, size);
+		return Push(item, wait);
+	}
+
+	uint8_t *copy = new (std::nothrow) uint8_t[size];
+	if (!copy)
+		return false;
+	memcpy(copy, data, size);
+
+	MediaFormat format;
+	format.video = false; // written as is
+	MediaSample sample;
+	sample.format = &format;
+	sample.planes[0].data = copy;
+	sample.planes[0].size = size;
+	sample.planeCount = 1;
+
+	FramePtr frame = CMediaFrame::Wrap(sample, [copy]() { delete[] copy; });
+	if (!frame)
+		return false;
+
+	WriteItem item;
+	item.frame = frame.Get();
+	return Push(item, wait);
+}
+
+bool CAsyncFileWriter::Push(const WriteItem &item, bool wait)
+{
+	if (!m_pQueue) {
+		assert(false);
+		return false;
+	}
+
+	if (item.frame)
+		item.frame->AddRef();
+	while (!m_pQueue->TryPush(item)) {
+		if (wait) {
+			std::this_thread::yield();
+			continue;
+		}
+		if (item.frame)
+			item.frame->Release();
+		++m_dropped;
+		return false;
+	}
+
+	m_logicalSize += item.prefixSize + (item.frame ? GetFramePayloadSize(item.frame) : 0);
+
+	uint32_t depth = m_pQueue->GetSize();
+	uint32_t maxDepth = m_maxDepth.load(std::memory_order_relaxed);
+	while (depth > maxDepth && !m_maxDepth.compare_exchange_weak(maxDepth, depth))
+		;
+
+	m_wake.Notify();
+	return true;
+}
+
+void CAsyncFileWriter::ThreadFunc()
+{
+	for (;;) {
+		WriteItem item;
+		if (m_pQueue->TryPop(item)) {
+			if (item.prefixSize)
+				Append(item.prefix, item.prefixSize);
+			if (item.frame) {
+				AppendFrame(item.frame);
+				item.frame->Release();
+				++m_frames;
+			}
+			continue;
+		}
+
+		if (!m_bRunning)
+			break;
+
+		// nothing is waiting on the writer, no need to spin
+		m_wake.WaitFor([this]() { return m_pQueue->GetSize() != 0 || !m_bRunning; }, WRITER_WAIT_MS);
+	}
+
+	FlushFinal();
+}
+
+void CAsyncFileWriter::Append(const uint8_t *data, uint32_t size)
+{
+	uint8_t *buffer = m_staging->GetBuffer();
+	m_bytes += size;
+
+	while (size) {
+		uint32_t count = (std::min)(size, m_options.bufferSize - m_stagingSize);
+		memcpy(buffer + m_stagingSize, data, count);
+		m_stagingSize += count;
+		data += count;
+		size -= count;
+
+		// only whole buffers are written while capturing
+		if (m_stagingSize == m_options.bufferSize) {
+			OsWrite(buffer, m_stagingSize);
+			m_fileSize += m_stagingSize;
+			m_stagingSize = 0;
+		}
+	}
+}
+
+void CAsyncFileWriter::AppendFrame(const CMediaFrame *frame)
+{
+	const MediaSample &sample = frame->GetSample();
+	if (!sample.planeCount)
+		return;
+
+	const MediaFormat &format = frame->GetFormat();
+	if (!format.video || IsCompressedVideo(format.subtype)) {
+		Append(sample.planes[0].data, sample.planes[0].size);
+		return;
+	}
+
+	// rows without padding, top-down
+	uint32_t rowBytes[MEDIA_MAX_PLANES];
+	uint32_t rows[MEDIA_MAX_PLANES];
+	uint32_t planes = GetVideoPlaneRows(format, rowBytes, rows);
+
+	for (uint32_t i = 0; i < planes && i < sample.planeCount; ++i) {
+		const MediaPlane &plane = sample.planes[i];
+		if (plane.stride == (int32_t)rowBytes[i]) {
+			Append(plane.data, rowBytes[i] * rows[i]);
+			continue;
+		}
+
+		for (uint32_t y = 0; y < rows[i]; ++y)
+			Append(plane.data + (ptrdiff_t)y * plane.stride, rowBytes[i]);
+	}
+}
+
+void CAsyncFileWriter::FlushFinal()
+{
+	const uint64_t logicalSize = m_fileSize + m_stagingSize;
+
+	if (m_stagingSize) {
+		uint32_t size = m_stagingSize;
+		if (m_options.directIO) {
+			// direct io only writes whole sectors, the padding is cut off again below
+			size = (size + WRITER_ALIGNMENT - 1) / WRITER_ALIGNMENT * WRITER_ALIGNMENT;
+			memset(m_staging->GetBuffer() + m_stagingSize, 0, size - m_stagingSize);
+		}
+
+		OsWrite(m_staging->GetBuffer(), size);
+		m_fileSize += size;
+		m_stagingSize = 0;
+	}
+
+	OsClose(logicalSize);
+}
+
+AsyncWriterStats CAsyncFileWriter::GetStats() const
+{
+	AsyncWriterStats stats;
+	stats.frames = m_frames;
+	stats.bytes = m_bytes;
+	stats.writes = m_writes;
+	stats.dropped = m_dropped;
+	stats.maxDepth = m_maxDepth;
+	return stats;
+}
+
+//---------------------------------------------------------------------------------------------
+#ifdef _WIN32
+bool CAsyncFileWriter::OsOpen(const char *path)
+{
+	DWORD flags = FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN;
+	if (m_options.directIO)
+		flags |= FILE_FLAG_NO_BUFFERING;
+
+	HANDLE hFile = CreateFileA(path, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, flags, NULL);
+	if (hFile == INVALID_HANDLE_VALUE) {
+		assert(false);
+		return false;
+	}
+
+	if (m_options.preallocate) {
+		// reserves the clusters without moving the end of file, so the file does not fragment while growing
+		FILE_ALLOCATION_INFO info = {};
+		info.AllocationSize.QuadPart = (LONGLONG)m_options.preallocate;
+		SetFileInformationByHandle(hFile, FileAllocationInfo, &info, sizeof(info));
+	}
+
+	m_hFile = hFile;
+	return true;
+}
+
+bool CAsyncFileWriter::OsWrite(const uint8_t *data, uint32_t size)
+{
+	++m_writes;
+
+	DWORD written = 0;
+	if (!WriteFile((HANDLE)m_hFile, data, size, &written, NULL) || written != size) {
+		assert(false);
+		return false;
+	}
+	return true;
+}
+
+void CAsyncFileWriter::OsClose(uint64_t finalSize)
+{
+	if (!m_hFile)
+		return;
+
+	// drops the direct io padding and whatever was preallocated but not used
+	LARGE_INTEGER pos;
+	pos.QuadPart = (LONGLONG)finalSize;
+	if (SetFilePointerEx((HANDLE)m_hFile, pos, NULL, FILE_BEGIN))
+		SetEndOfFile((HANDLE)m_hFile);
+
+	CloseHandle((HANDLE)m_hFile);
+	m_hFile = nullptr;
+}
+#else
+bool CAsyncFileWriter::OsOpen(const char *path)
+{
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+	int fd = -1;
+#ifdef O_DIRECT
+	if (m_options.directIO)
+		fd = open(path, flags | O_DIRECT, 0644);
+#endif
+	if (fd < 0) {
+		// e.g. tmpfs does not support O_DIRECT
+		m_options.directIO = false;
+		fd = open(path, flags, 0644);
+	}
+	if (fd < 0) {
+		assert(false);
+		return false;
+	}
+
+#ifdef FALLOC_FL_KEEP_SIZE
+	if (m_options.preallocate)
+		fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)m_options.preallocate);
+#endif
+
+	m_fd = fd;
+	return true;
+}
+
+bool CAsyncFileWriter::OsWrite(const uint8_t *data, uint32_t size)
+{
+	++m_writes;
+
+	while (size) {
+		ssize_t written = write(m_fd, data, size);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			assert(false);
+			return false;
+		}
+		data += written;
+		size -= (uint32_t)written;
+	}
+	return true;
+}
+
+void CAsyncFileWriter::OsClose(uint64_t finalSize)
+{
+	if (m_fd < 0)
+		return;
+
+	// drops the direct io padding and whatever was preallocated but not used
+	if (ftruncate(m_fd, (off_t)finalSize) != 0)
+		assert(false);
+
+	close(m_fd);
+	m_fd = -1;
+}
+#endif
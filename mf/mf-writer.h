@@ -0,0 +1,95 @@
+﻿#pragma once
+#include "mf-frame.h"
+#include "mf-spsc-queue.hpp"
+#include "mf-wake.hpp"
+#include <thread>
+
+#define WRITER_MAX_PREFIX 64
+
+struct AsyncWriterOptions {
+	uint32_t bufferSize = 4 * 1024 * 1024; // bytes coalesced into one write, multiple of 4096
+	uint32_t queueCapacity = 64;           // frames waiting for the writer thread
+	bool directIO = false;                 // bypass the os cache: O_DIRECT / FILE_FLAG_NO_BUFFERING
+	uint64_t preallocate = 0;              // bytes of disk space reserved up front, 0: none
+};
+
+struct AsyncWriterStats {
+	uint64_t frames = 0;  // frames written
+	uint64_t bytes = 0;   // payload bytes written
+	uint64_t writes = 0;  // write calls to the os
+	uint64_t dropped = 0; // queue was full
+	uint32_t maxDepth = 0;
+};
+
+// background writer for raw capture dumps. Write only takes a reference of the frame, the writer thread copies
+// the frames into a large aligned buffer and writes it out in big chunks, so the capture thread never touches the disk.
+// Write must always be called from the same thread (single producer queue).
+class CAsyncFileWriter {
+public:
+	CAsyncFileWriter();
+	~CAsyncFileWriter();
+
+	bool Open(const char *path, const AsyncWriterOptions &options = AsyncWriterOptions());
+	// writes everything queued, then closes the file
+	void Close();
+	bool IsOpen() const { return m_thread.joinable(); }
+
+	// never blocks, returns false if the queue is full and the frame was dropped.
+	// up to WRITER_MAX_PREFIX bytes of `prefix` are written right before the frame (e.g. a record header).
+	// video frames are written plane by plane without row padding, audio frames as is.
+	bool Write(CMediaFrame *frame, const void *prefix = nullptr, uint32_t prefixSize = 0);
+	// copies `data`, for headers and trailers. wait: spin until there is room instead of dropping
+	bool WriteBytes(const void *data, uint32_t size, bool wait = false);
+
+	AsyncWriterStats GetStats() const;
+
+	// file offset of the next Write, counts everything queued so far. producer thread only
+	uint64_t GetLogicalSize() const { return m_logicalSize; }
+
+	// bytes Write puts into the file for `frame`, without the prefix
+	static uint32_t GetFramePayloadSize(const CMediaFrame *frame);
+
+private:
+	struct WriteItem {
+		CMediaFrame *frame = nullptr; // holds one reference
+		uint32_t prefixSize = 0;
+		uint8_t prefix[WRITER_MAX_PREFIX];
+	};
+
+	bool Push(const WriteItem &item, bool wait);
+	void ThreadFunc();
+	void Append(const uint8_t *data, uint32_t size);
+	void AppendFrame(const CMediaFrame *frame);
+	void FlushFinal();
+
+	bool OsOpen(const char *path);
+	bool OsWrite(const uint8_t *data, uint32_t size);
+	void OsClose(uint64_t finalSize);
+
+private:
+	AsyncWriterOptions m_options;
+	CSpscQueue<WriteItem> *m_pQueue = nullptr;
+	uint64_t m_logicalSize = 0;
+
+	// writer thread only
+	CRefPtr<CFramePool> m_pool;
+	FramePtr m_staging; // aligned, bufferSize bytes
+	uint32_t m_stagingSize = 0;
+	uint64_t m_fileSize = 0; // bytes handed to the os
+
+#ifdef _WIN32
+	void *m_hFile = nullptr;
+#else
+	int m_fd = -1;
+#endif
+
+	std::thread m_thread;
+	std::atomic<bool> m_bRunning{false};
+	CWakeEvent m_wake; // the writer thread sleeps here when the queue is empty
+
+	std::atomic<uint64_t> m_frames{0};
+	std::atomic<uint64_t> m_bytes{0};
+	std::atomic<uint64_t> m_writes{0};
+	std::atomic<uint64_t> m_dropped{0};
+	std::atomic<uint32_t> m_maxDepth{0};
+};